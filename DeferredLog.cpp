@@ -0,0 +1,143 @@
+/*
+ * DeferredLog.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "DeferredLog.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[DLog]..........";
+#define _EXPR_	(!IS_ISR())
+
+/** Tamaño máximo de una traza formateada */
+static const uint32_t DLogLineSize = 128;
+
+
+DeferredLog DeferredLog::_default;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+DeferredLog::DeferredLog(){
+	memset(_ring, 0, sizeof(_ring));
+	_head = 0;
+	_tail = 0;
+	_lost = 0;
+	_reading = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+bool DeferredLog::read(Record_t& rec){
+	if(!__sync_bool_compare_and_swap(&_reading, 0, 1)){
+		return false;
+	}
+	bool result = _read(rec);
+	_reading = 0;
+	return result;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t DeferredLog::flush(uint32_t max){
+	if(!__sync_bool_compare_and_swap(&_reading, 0, 1)){
+		return 0;
+	}
+	uint32_t count = 0;
+	Record_t rec;
+	char line[DLogLineSize];
+	while((max == 0 || count < max) && _read(rec)){
+		// los argumentos no utilizados por la cadena de formato se ignoran
+		snprintf(line, DLogLineSize, rec.fmt, rec.args[0], rec.args[1], rec.args[2], rec.args[3]);
+		switch(rec.level){
+			case ESP_LOG_ERROR:
+				DEBUG_TRACE_E(_EXPR_, rec.tag, "<%d> %s", rec.ts, line);
+				break;
+			case ESP_LOG_WARN:
+				DEBUG_TRACE_W(_EXPR_, rec.tag, "<%d> %s", rec.ts, line);
+				break;
+			case ESP_LOG_INFO:
+				DEBUG_TRACE_I(_EXPR_, rec.tag, "<%d> %s", rec.ts, line);
+				break;
+			default:
+				DEBUG_TRACE_D(_EXPR_, rec.tag, "<%d> %s", rec.ts, line);
+				break;
+		}
+		count++;
+	}
+	_reading = 0;
+	return count;
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+bool DeferredLog::_read(Record_t& rec){
+	for(;;){
+		uint32_t head = _head;
+		if(_tail == head){
+			return false;
+		}
+		// si los escritores han dado la vuelta al buffer, descarta las trazas sobrescritas
+		if(head - _tail > RingSize){
+			__sync_fetch_and_add(&_lost, head - RingSize - _tail);
+			_tail = head - RingSize;
+		}
+		Record_t& r = _ring[_tail & RingMask];
+		uint32_t seq = r.seq;
+		// escritura en curso
+		if(seq == 0 || (int32_t)(seq - (_tail + 1)) < 0){
+			return false;
+		}
+		rec = r;
+		__sync_synchronize();
+		// si se ha sobrescrito durante la copia o ya era más reciente, se pierde
+		if(r.seq != seq || seq != _tail + 1){
+			__sync_fetch_and_add(&_lost, 1);
+			_tail++;
+			continue;
+		}
+		_tail++;
+		return true;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void DeferredLog::_write(esp_log_level_t level, const char* tag, const char* fmt, const uint32_t* args, uint8_t nargs){
+	// reserva la posición sin bloquear y la marca como en curso hasta completarla
+	uint32_t idx = __sync_fetch_and_add(&_head, 1);
+	Record_t& r = _ring[idx & RingMask];
+	r.seq = 0;
+	__sync_synchronize();
+	r.fmt = fmt;
+	r.tag = tag;
+	r.ts = (uint32_t)Kernel::get_ms_count();
+	r.level = (uint8_t)level;
+	r.nargs = nargs;
+	for(uint8_t i=0;i<MaxArgs;i++){
+		r.args[i] = (i < nargs)? args[i] : 0;
+	}
+	__sync_synchronize();
+	r.seq = idx + 1;
+}
+
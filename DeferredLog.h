@@ -0,0 +1,197 @@
+/*
+ * DeferredLog.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	DeferredLog es un registro de trazas diferido para los caminos críticos. En lugar de formatear el texto en el
+ *	punto de llamada (DEBUG_TRACE_x), cada traza se registra como un identificador (la dirección de la cadena de
+ *	formato) y sus argumentos en bruto, en un buffer circular sin bloqueos:
+ *
+ *		DLOG_E/W/I/D: registran una traza en el registro compartido (getDefault). Los niveles superiores a
+ *		DLOG_LEVEL se eliminan en compilación
+ *
+ *		flush: presenta las trazas pendientes a través de DEBUG_TRACE_x, fuera del camino crítico (ej: cuando el
+ *		módulo no tiene mensajes pendientes). El nivel de traza configurado en cada módulo se sigue aplicando aquí
+ *
+ *		read: extrae las trazas en bruto para su decodificación fuera del dispositivo, a partir de la tabla de
+ *		símbolos del firmware
+ *
+ *	Cada registro admite un único lector a la vez: <read> y <flush> retornan sin extraer nada si otro hilo está
+ *	leyendo el mismo registro.
+ *
+ *	Sólo se admiten argumentos enteros (%d, %u, %x...), ya que se registran por valor y se formatean más tarde.
+ *	Las cadenas de formato y los tags deben ser literales o estáticos.
+ */
+
+#ifndef __DeferredLog__H
+#define __DeferredLog__H
+
+#include "mbed.h"
+#include <type_traits>
+
+/** Nivel máximo de las trazas diferidas que se compilan (0:ninguna, 1:error, 2:warning, 3:info, 4:debug) */
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL		4
+#endif
+
+#if DLOG_LEVEL >= 1
+#define DLOG_E(tag, fmt, ...)	DeferredLog::getDefault()->write(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_E(tag, fmt, ...)	do{}while(0)
+#endif
+
+#if DLOG_LEVEL >= 2
+#define DLOG_W(tag, fmt, ...)	DeferredLog::getDefault()->write(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_W(tag, fmt, ...)	do{}while(0)
+#endif
+
+#if DLOG_LEVEL >= 3
+#define DLOG_I(tag, fmt, ...)	DeferredLog::getDefault()->write(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_I(tag, fmt, ...)	do{}while(0)
+#endif
+
+#if DLOG_LEVEL >= 4
+#define DLOG_D(tag, fmt, ...)	DeferredLog::getDefault()->write(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_D(tag, fmt, ...)	do{}while(0)
+#endif
+
+
+class DeferredLog {
+  public:
+
+	/** Número máximo de argumentos por traza */
+	static const uint8_t MaxArgs = 4;
+
+	/** Número de trazas del buffer circular (potencia de 2) */
+	static const uint32_t RingSize = 64;
+
+	/** Número de trazas presentadas en cada llamada a <flush> desde un módulo */
+	static const uint32_t FlushBurst = 8;
+
+	/** Traza registrada */
+	struct Record_t {
+		volatile uint32_t seq;		//!< Secuencia de escritura + 1 (0: en curso)
+		const char* fmt;			//!< Cadena de formato (identificador de la traza)
+		const char* tag;			//!< Tag del módulo
+		uint32_t ts;				//!< Instante de registro en ms
+		uint8_t level;				//!< Nivel de la traza (esp_log_level_t)
+		uint8_t nargs;				//!< Número de argumentos
+		uint32_t args[MaxArgs];		//!< Argumentos en bruto
+	};
+
+
+	/** Obtiene el registro compartido en el que escriben las macros DLOG_x. Es un objeto estático, por lo que
+	 *  está disponible desde el arranque
+	 *
+	 * @return Registro compartido
+	 */
+	static DeferredLog* getDefault(){
+		return &_default;
+	}
+
+
+	/** Crea un registro vacío (ej: para registrar y extraer trazas sin interferir con el registro compartido)
+	 */
+	DeferredLog();
+
+
+	/** Registra una traza. Puede invocarse desde cualquier hilo sin bloquear
+	 *
+	 * @param level Nivel de la traza
+	 * @param tag Tag del módulo
+	 * @param fmt Cadena de formato
+	 * @param args Argumentos enteros
+	 */
+	template<typename... A>
+	void write(esp_log_level_t level, const char* tag, const char* fmt, A... args){
+		static_assert(sizeof...(A) <= MaxArgs, "DeferredLog: demasiados argumentos");
+		static_assert(_allIntegral<A...>::value, "DeferredLog: sólo se admiten argumentos enteros");
+		const uint32_t values[] = {0, static_cast<uint32_t>(args)...};
+		_write(level, tag, fmt, &values[1], sizeof...(A));
+	}
+
+
+	/** Extrae la siguiente traza pendiente. Si otro hilo está leyendo o presentando trazas, retorna sin extraer
+	 *  nada
+	 *
+	 * @param rec Recibe la traza
+	 * @return True si había alguna traza pendiente y se ha extraído
+	 */
+	bool read(Record_t& rec);
+
+
+	/** Presenta las trazas pendientes a través de DEBUG_TRACE_x. Si otro hilo está leyendo o presentando trazas,
+	 *  retorna sin hacer nada
+	 *
+	 * @param max Número máximo de trazas a presentar (0: todas)
+	 * @return Número de trazas presentadas
+	 */
+	uint32_t flush(uint32_t max = 0);
+
+
+	/** Obtiene el número de trazas perdidas por desbordamiento del buffer
+	 *
+	 * @return Trazas perdidas
+	 */
+	uint32_t getLost(){
+		return _lost;
+	}
+
+  private:
+
+	/** Máscara de posición en el buffer */
+	static const uint32_t RingMask = RingSize - 1;
+
+	/** Registro compartido */
+	static DeferredLog _default;
+
+	/** Buffer circular */
+	Record_t _ring[RingSize];
+
+	/** Secuencia de la siguiente escritura */
+	volatile uint32_t _head;
+
+	/** Secuencia de la siguiente lectura */
+	uint32_t _tail;
+
+	/** Trazas perdidas */
+	volatile uint32_t _lost;
+
+	/** Flag de lector en curso (read o flush) */
+	volatile uint32_t _reading;
+
+
+	/** Comprueba en compilación que todos los argumentos son enteros o enumerados */
+	template<typename... A> struct _allIntegral : std::true_type {};
+	template<typename T, typename... A> struct _allIntegral<T, A...> :
+		std::integral_constant<bool, (std::is_integral<T>::value || std::is_enum<T>::value) && _allIntegral<A...>::value> {};
+
+
+	/** Extrae la siguiente traza pendiente. Debe invocarse con el flag de lector adquirido
+	 *
+	 * @param rec Recibe la traza
+	 * @return True si había alguna traza pendiente
+	 */
+	bool _read(Record_t& rec);
+
+
+	/** Registra una traza con los argumentos ya convertidos
+	 *
+	 * @param level Nivel de la traza
+	 * @param tag Tag del módulo
+	 * @param fmt Cadena de formato
+	 * @param args Argumentos
+	 * @param nargs Número de argumentos
+	 */
+	void _write(esp_log_level_t level, const char* tag, const char* fmt, const uint32_t* args, uint8_t nargs);
+};
+
+#endif /*__DeferredLog__H */
+
+/**** END OF FILE ****/
+
+
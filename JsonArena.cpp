@@ -0,0 +1,122 @@
+/*
+ * JsonArena.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "JsonArena.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[JsonArena].....";
+#define _EXPR_	(!IS_ISR())
+
+
+uint8_t* JsonArena::_buf = NULL;
+uint32_t JsonArena::_offset = 0;
+osThreadId JsonArena::_owner = NULL;
+uint32_t JsonArena::_depth = 0;
+volatile bool JsonArena::_open = false;
+uint32_t JsonArena::_high_water = 0;
+uint32_t JsonArena::_overflows = 0;
+Mutex JsonArena::_mtx;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void JsonArena::begin(){
+	// si ya estaba adquirida por este hilo (un suscriptor que responde durante la publicación de otro
+	// documento de la arena), continúa a partir del documento en curso sin liberarlo
+	if(_owner == osThreadGetId()){
+		_depth++;
+		_open = true;
+		return;
+	}
+	// si está en uso desde otro hilo no espera, las asignaciones de este hilo se sirven desde el heap
+	if(!_mtx.trylock()){
+		return;
+	}
+	// en la primera adquisición reserva la arena
+	if(_buf == NULL){
+		_buf = (uint8_t*)Heap::memAlloc(Size);
+		MBED_ASSERT(_buf);
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Arena JSON reservada, size=%d", Size);
+	}
+	_depth = 1;
+	_offset = 0;
+	_owner = osThreadGetId();
+	cJSON_Hooks hooks = {&JsonArena::_malloc, &JsonArena::_free};
+	cJSON_InitHooks(&hooks);
+	_open = true;
+}
+
+
+//------------------------------------------------------------------------------------
+void JsonArena::close(){
+	if(_owner == osThreadGetId()){
+		_open = false;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void JsonArena::end(){
+	if(_owner != osThreadGetId()){
+		return;
+	}
+	_open = false;
+	if(--_depth == 0){
+		cJSON_InitHooks(NULL);
+		_owner = NULL;
+		_offset = 0;
+		_mtx.unlock();
+	}
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void* JsonArena::_malloc(size_t size){
+	if(_open && _owner == osThreadGetId()){
+		uint32_t aligned = (size + Align - 1) & ~(Align - 1);
+		if(_offset + aligned <= Size){
+			void* ptr = &_buf[_offset];
+			_offset += aligned;
+			if(_offset > _high_water){
+				_high_water = _offset;
+			}
+			return ptr;
+		}
+		_overflows++;
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Arena JSON agotada, asignando %d bytes del heap", (int)size);
+	}
+	return malloc(size);
+}
+
+
+//------------------------------------------------------------------------------------
+void JsonArena::_free(void* ptr){
+	// los bloques de la arena se liberan todos juntos en <end>
+	if(_buf != NULL && (uint8_t*)ptr >= _buf && (uint8_t*)ptr < &_buf[Size]){
+		return;
+	}
+	free(ptr);
+}
+
@@ -0,0 +1,138 @@
+/*
+ * JsonArena.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	JsonArena es un asignador de memoria lineal (bump-pointer) que se instala en cJSON a través de sus hooks de
+ *	asignación, para que los documentos JSON de estado que se generan en cada cambio de la salida no fragmenten
+ *	el heap global:
+ *
+ *		begin: adquiere la arena para el hilo en curso e instala los hooks de cJSON. A partir de ese momento, las
+ *		asignaciones de cJSON realizadas desde ese hilo se sirven desde la arena. Si otro hilo la tiene adquirida
+ *		no espera: las asignaciones del hilo en curso se sirven desde el heap
+ *
+ *		close: deja de servir asignaciones desde la arena (ej: antes de publicar el documento, para que los
+ *		suscriptores que se ejecutan en el mismo hilo no retengan memoria de la arena)
+ *
+ *		end: libera de golpe todo el contenido de la arena, restaura los hooks por defecto de cJSON y deja la
+ *		arena disponible para otro hilo
+ *
+ *	Los hooks sólo están instalados entre begin y end. Para el resto de hilos equivalen a malloc/free, ya que
+ *	las asignaciones de otros hilos, las realizadas fuera de [begin, close] y las que no caben en la arena se
+ *	sirven desde el heap. Las liberaciones de bloques de la arena no tienen efecto, ya que se liberan todos
+ *	juntos en <end>.
+ *
+ *	Cada publicación sigue la secuencia begin, generación del documento, close, publicación, cJSON_Delete y end:
+ *	el documento se genera en la arena y se libera de golpe tras publicarlo. La arena se dimensiona para los
+ *	documentos de estado; los documentos que deben sobrevivir al mensaje (ej: respuestas memorizadas de
+ *	configuración) no deben generarse dentro de la arena.
+ */
+
+#ifndef __JsonArena__H
+#define __JsonArena__H
+
+#include "mbed.h"
+#include "LightManagerBlob.h"
+#include "cJSON.h"
+
+class JsonArena {
+  public:
+
+	/** Nodos del documento más extenso generado en la arena (respuesta o notificación de estado): objeto raíz,
+	 *  idTrans, error (objeto, código y descripción), datos (objeto y uid) y estado (objeto, flags y outValue),
+	 *  con margen para una respuesta anidada
+	 */
+	static const uint32_t MaxNodes = 16;
+
+	/** Tamaño reservado para la clave que cJSON duplica en cada nodo de un objeto */
+	static const uint32_t KeySize = 16;
+
+	/** Tamaño de la arena: nodos con su clave y la descripción del error */
+	static const uint32_t Size = MaxNodes * (sizeof(cJSON) + KeySize) + sizeof(Blob::ErrorData_t);
+
+
+	/** Adquiere la arena para el hilo en curso, instalando los hooks de cJSON y reservando la arena en la
+	 *  primera llamada. No bloquea: si la arena está en uso desde otro hilo, las asignaciones se sirven desde el
+	 *  heap hasta <end>. Puede anidarse desde el mismo hilo (ej: un suscriptor que responde durante una
+	 *  publicación), en cuyo caso el contenido se libera al cerrar el nivel exterior
+	 */
+	static void begin();
+
+
+	/** Deja de servir asignaciones desde la arena, manteniendo su contenido hasta <end>
+	 */
+	static void close();
+
+
+	/** Libera el contenido de la arena, restaura los hooks por defecto de cJSON y deja la arena disponible. No
+	 *  hace nada si el hilo en curso no adquirió la arena en <begin>
+	 */
+	static void end();
+
+
+	/** Obtiene el máximo uso registrado de la arena
+	 *
+	 * @return Bytes
+	 */
+	static uint32_t getHighWater(){
+		return _high_water;
+	}
+
+
+	/** Obtiene el número de asignaciones que no cupieron en la arena y se sirvieron desde el heap
+	 *
+	 * @return Asignaciones desbordadas
+	 */
+	static uint32_t getOverflows(){
+		return _overflows;
+	}
+
+  private:
+
+	/** Alineación de cada bloque */
+	static const uint32_t Align = 8;
+
+	/** Memoria de la arena (se reserva una única vez) */
+	static uint8_t* _buf;
+
+	/** Posición de la siguiente asignación */
+	static uint32_t _offset;
+
+	/** Hilo propietario mientras la arena está abierta */
+	static osThreadId _owner;
+
+	/** Nivel de anidamiento de <begin> en el hilo propietario */
+	static uint32_t _depth;
+
+	/** Flag de arena abierta */
+	static volatile bool _open;
+
+	/** Estadísticas de uso */
+	static uint32_t _high_water;
+	static uint32_t _overflows;
+
+	/** Mutex de acceso a la arena */
+	static Mutex _mtx;
+
+
+	/** Hook de asignación de cJSON
+	 *
+	 * @param size Tamaño solicitado
+	 * @return Bloque asignado o NULL
+	 */
+	static void* _malloc(size_t size);
+
+
+	/** Hook de liberación de cJSON
+	 *
+	 * @param ptr Bloque a liberar
+	 */
+	static void _free(void* ptr);
+};
+
+#endif /*__JsonArena__H */
+
+/**** END OF FILE ****/
+
+
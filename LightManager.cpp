@@ -11,8 +11,8 @@
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[LightM]........";
 #define _EXPR_	(!IS_ISR())
@@ -32,6 +32,12 @@ LightManager::LightManager(PinName pin010, FSManager* fs, bool defdbg) : ActiveM
 	_json_supported = true;
 	#endif
 
+	// Establece el soporte de CBOR
+	_cbor_supported = false;
+	#if LIGHTMANAGER_ENABLE_CBOR_SUPPORT == 1
+	_cbor_supported = true;
+	#endif
+
     if(defdbg){
     	esp_log_level_set(_MODULE_, ESP_LOG_DEBUG);
     }
@@ -39,49 +45,201 @@ LightManager::LightManager(PinName pin010, FSManager* fs, bool defdbg) : ActiveM
     	esp_log_level_set(_MODULE_, ESP_LOG_WARN);
     }
 
+	// registra el driver PWM / 0-10V
+	memset(_out_drivers, 0, sizeof(_out_drivers));
+	_out_driver_count = 0;
+	_out_driver_slots = 0;
 	if(pin010 == NC){
 		_driver010 = NULL;
 	}
 	else{
-		_driver010 = new Driver_Pwm010(pin010, Driver_Pwm010::OnIsLowLevel, 1, defdbg);
+		_driver010 = new LightOutPwm010Driver(pin010, defdbg);
 		MBED_ASSERT(_driver010);
-		_driver010->setScaleFactor(1);
+		_out_driver_slots = 1;
+		_addOutputDriver(_driver010);
 	}
 
 	// crea el scheduler
 	_sched = new Scheduler(Blob::MaxAllowedActionDataInArray, _lightdata.cfg.outData.actions, fs, defdbg);
 	MBED_ASSERT(_sched);
 
-	// Carga callbacks estticas de publicacin/suscripcin
+	// Carga callbacks estáticas de publicación/suscripción
     _publicationCb = callback(this, &LightManager::publicationCb);
 
-    _sim_tmr = new RtosTimer(callback(this, &LightManager::eventSimulatorCb), osTimerPeriodic, "LightSimTmr");
+    // inicializa el simulador de eventos
+    memset(&_sim, 0, sizeof(_sim));
+    _sim.result.firstMismatch = -1;
+    _wheel = TimingWheel::getDefault();
+    _sim_tmr.cb = callback(this, &LightManager::eventSimulatorCb);
+
+    // inicializa el anillo de transiciones de la salida
+    memset(&_out_ring, 0, sizeof(_out_ring));
+    _out_ring_tmr.cb = callback(this, &LightManager::outRingTimerCb);
+
+    // inicializa el integrador de uso
+    memset(&_meter, 0, sizeof(_meter));
+
+    // sin límite de potencia hasta registrarse en el servicio
+    _power.budget = NULL;
+    _power.priority = 0;
+    _power.level = 0;
+    _power.pending = 0;
+
+    // sin carga diferida hasta el arranque de la máquina de estados
+    _boot.step = BootStepDone;
+    _boot.success = true;
+
+    // inicializa las colas de entrada
+    memset(&_queue_stats, 0, sizeof(_queue_stats));
+    memset(_queue_starve, 0, sizeof(_queue_starve));
+
+    // inicializa la instantánea del estado
+    memset(&_lightdata.stat, 0, sizeof(Blob::LightStatData_t));
+    memset(&_snap, 0, sizeof(_snap));
+    _cfg_version = 0;
+
+    // inicializa las respuestas memorizadas
+    memset(_cfg_cache, 0, sizeof(_cfg_cache));
+    memset(_boot_cache, 0, sizeof(_boot_cache));
+
+    // inicializa la etapa de notificación
+    memset(&_notif, 0, sizeof(_notif));
+    _notif.interval = LIGHTMANAGER_NOTIF_MIN_INTERVAL_MS;
+    _notif_tmr.cb = callback(this, &LightManager::notifTimerCb);
 }
 
 
 //------------------------------------------------------------------------------------
-void LightManager::startSimulator() {
-	_sim_counter = 0;
-	_sim_tmr->start(1000);
+void LightManager::startSimulator(const SimEvent_t* trace, uint32_t count, uint32_t speed, const uint8_t* expected, uint32_t exp_count) {
+	stopSimulator();
+	_sim.trace = trace;
+	_sim.count = count;
+	_sim.next = 0;
+	_sim.speed = speed;
+	_sim.vtime = 0;
+	_sim.expected = expected;
+	_sim.exp_count = exp_count;
+	memset(&_sim.result, 0, sizeof(SimResult_t));
+	_sim.result.firstMismatch = -1;
+
+	// las notificaciones no se agrupan para poder comparar la secuencia completa
+	_sim.notif_interval = _notif.interval;
+	_notif.interval = 0;
+	_sim.running = true;
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Iniciando simulador con %d eventos, velocidad=%d", count, speed);
+
+	// si es lo más rápido posible, encadena los eventos a través de la máquina de estados
+	if(_sim.speed == 0){
+		_simPostStep();
+	}
+	else{
+		_wheel->start(_sim_tmr, SimTickMs);
+	}
 }
 
 
 //------------------------------------------------------------------------------------
 void LightManager::stopSimulator() {
-	_sim_tmr->stop();
+	_wheel->cancel(_sim_tmr);
+	if(_sim.running){
+		_sim.running = false;
+		_notif.interval = _sim.notif_interval;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::getStatSnapshot(StatSnapshot_t& snap) {
+	uint32_t seq;
+	// si la secuencia cambia durante la copia, se ha completado una escritura y se repite la lectura
+	do{
+		seq = _snap.seq;
+		__sync_synchronize();
+		snap = _snap.buf[seq & 1];
+		__sync_synchronize();
+	}while(seq != _snap.seq);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::buildTimeTrace(SimEvent_t* trace, Blob::LightLocaltime_t* times, uint32_t count, time_t start, uint32_t step) {
+	for(uint32_t i=0;i<count;i++){
+		times[i] = start + (i * step);
+		trace[i].offset = i * step * 1000;
+		trace[i].type = SimTimeSet;
+		trace[i].data = &times[i];
+		trace[i].size = sizeof(Blob::LightLocaltime_t);
+	}
 }
 
 
 //------------------------------------------------------------------------------------
 osStatus LightManager::putMessage(State::Msg *msg){
-    osStatus ost = _queue.put(msg, ActiveModule::DefaultPutTimeout);
+	MsgClass cls = _getMsgClass(msg->sig);
+	// una lectura recibida con cambios de configuración pendientes se encola tras ellos, para no adelantarlos
+	if(cls == MsgClassRead && _queue_stats.depth[MsgClassConfig] > 0){
+		cls = MsgClassConfig;
+	}
+    osStatus ost = _queue[cls].put(msg, ActiveModule::DefaultPutTimeout);
     if(ost != osOK){
-        DEBUG_TRACE_E(_EXPR_, _MODULE_, "QUEUE_PUT_ERROR %d", ost);
+    	__sync_fetch_and_add(&_queue_stats.dropped[cls], 1);
+        DEBUG_TRACE_E(_EXPR_, _MODULE_, "QUEUE_PUT_ERROR %d, clase=%d", ost, cls);
+        return ost;
+    }
+    uint32_t depth = __sync_add_and_fetch(&_queue_stats.depth[cls], 1);
+    if(depth > _queue_stats.maxDepth[cls]){
+    	_queue_stats.maxDepth[cls] = depth;
     }
+    _queue_sem.release();
     return ost;
 }
 
 
+//------------------------------------------------------------------------------------
+void LightManager::getQueueStats(QueueStats_t& stats){
+	stats = _queue_stats;
+}
+
+
+//------------------------------------------------------------------------------------
+bool LightManager::attachOutputDriver(LightOutputDriver* drv){
+	// reserva el hueco antes de postear, para que el número de drivers nunca supere el máximo
+	if(__sync_add_and_fetch(&_out_driver_slots, 1) > MaxOutputDrivers){
+		__sync_sub_and_fetch(&_out_driver_slots, 1);
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_DRV, no se admiten más drivers de salida");
+		return false;
+	}
+	// la lista de drivers sólo la modifica el hilo de LightManager, que es el que la recorre en _applyOutput
+	LightOutputDriver** data = (LightOutputDriver**)Heap::memAlloc(sizeof(LightOutputDriver*));
+	MBED_ASSERT(data);
+	*data = drv;
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = RecvOutDriverAdd;
+	op->msg = data;
+	if(putMessage(op) != osOK){
+		Heap::memFree(data);
+		Heap::memFree(op);
+		__sync_sub_and_fetch(&_out_driver_slots, 1);
+		return false;
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::attachPowerBudget(LightPowerBudget* budget, uint8_t priority){
+	if(_power.budget){
+		_power.budget->detach(_power.member);
+	}
+	_power.budget = budget;
+	_power.priority = priority;
+	if(budget){
+		budget->attach(_power.member, priority, callback(this, &LightManager::_powerLimitCb));
+	}
+}
+
+
 
 //------------------------------------------------------------------------------------
 //-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
@@ -90,7 +248,57 @@ osStatus LightManager::putMessage(State::Msg *msg){
 
 //------------------------------------------------------------------------------------
 osEvent LightManager:: getOsEvent(){
-	return _queue.get();
+	// durante la carga diferida de la configuración sólo se atienden los mensajes de control, intercalados con
+	// los pasos de carga una vez restaurados el modo y la curva de la salida, para no aplicarlos con una curva
+	// que se va a sustituir. El resto permanecen en sus colas hasta que finalice
+	if(_boot.step < BootStepDone){
+		if(_boot.step > BootStepOutput && _queue_stats.depth[MsgClassControl] > 0 && _queue_sem.wait(0) > 0){
+			__sync_sub_and_fetch(&_queue_stats.depth[MsgClassControl], 1);
+			return _queue[MsgClassControl].get(0);
+		}
+		State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+		MBED_ASSERT(op);
+		op->sig = RecvBootStep;
+		op->msg = NULL;
+		osEvent oe;
+		oe.status = osEventMessage;
+		oe.value.p = op;
+		return oe;
+	}
+
+	// espera a que haya algún mensaje en cualquiera de las colas. Mientras no haya ninguno, aprovecha para
+	// presentar las trazas diferidas
+	while(_queue_sem.wait(0) <= 0){
+		if(DeferredLog::getDefault()->flush(DeferredLog::FlushBurst) == 0){
+			_queue_sem.wait(osWaitForever);
+			break;
+		}
+	}
+
+	// selecciona la clase más prioritaria con mensajes, salvo que una menos prioritaria haya alcanzado el límite
+	// de espera, en cuyo caso se atiende ésta
+	int sel = -1;
+	for(int i=0;i<MsgClassCount;i++){
+		if(_queue_stats.depth[i] == 0){
+			continue;
+		}
+		if(sel < 0){
+			sel = i;
+		}
+		else if(_queue_starve[i] >= MaxClassStarvation){
+			sel = i;
+			break;
+		}
+	}
+	MBED_ASSERT(sel >= 0);
+	for(int i=sel+1;i<MsgClassCount;i++){
+		if(_queue_stats.depth[i] != 0){
+			_queue_starve[i]++;
+		}
+	}
+	_queue_starve[sel] = 0;
+	__sync_sub_and_fetch(&_queue_stats.depth[sel], 1);
+	return _queue[sel].get(0);
 }
 
 
@@ -103,48 +311,182 @@ void LightManager::publicationCb(const char* topic, int32_t result){
 
 //------------------------------------------------------------------------------------
 void LightManager::eventSimulatorCb() {
-	_sim_counter ++;
-	if((_sim_counter % 30) == 0){
-		_lightdata.stat.flags = (uint32_t)Blob::LightOutLevelChangeEvt;
-		_lightdata.stat.outValue = (int8_t)(rand() % 100);
-		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Simulando evento %x, outValue=%d, contador = %d", _lightdata.stat.flags, _lightdata.stat.outValue, _sim_counter);
-		char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-		MBED_ASSERT(pub_topic);
-		sprintf(pub_topic, "stat/value/%s", _pub_topic_base);
-		Blob::NotificationData_t<light_manager> *notif = new Blob::NotificationData_t<light_manager>(_lightdata);
-		MBED_ASSERT(notif);
-
-		if(_json_supported){
-			cJSON* jboot = JsonParser::getJsonFromNotification(*notif, ObjSelectState);
-			MBED_ASSERT(jboot);
-			MQ::MQClient::publish(pub_topic, &jboot, sizeof(cJSON**), &_publicationCb);
-			cJSON_Delete(jboot);
-		}
-		else{
-			MQ::MQClient::publish(pub_topic, notif, sizeof(Blob::NotificationData_t<light_manager>), &_publicationCb);
+	if(!_sim.running){
+		return;
+	}
+	_sim.vtime += SimTickMs * _sim.speed;
+	_wheel->start(_sim_tmr, SimTickMs);
+
+	// inyecta los eventos vencidos, limitando la ráfaga para no desbordar la cola
+	uint32_t burst = 0;
+	while(_sim.next < _sim.count && _sim.trace[_sim.next].offset <= _sim.vtime && burst < MaxClassMessages/2){
+		_simInject();
+		burst++;
+	}
+
+	// al finalizar la traza, la máquina de estados cierra la reproducción tras procesar los eventos pendientes
+	if(_sim.next >= _sim.count){
+		_wheel->cancel(_sim_tmr);
+		_simPostStep();
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_simInject() {
+	static const char* sim_topics[] = {"set/time", "set/lux", "set/value", "set/cfg"};
+	const SimEvent_t& ev = _sim.trace[_sim.next++];
+	char* topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(topic);
+	sprintf(topic, "%s/%s", sim_topics[ev.type], _sub_topic_base);
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Simulando evento en %s, t=%d", topic, ev.offset);
+	// la traza se inyecta siempre en formato blob, sin alterar el formato del tráfico en curso
+	_dispatchMessage(topic, (void*)ev.data, ev.size, false, false);
+	_sim.result.injected++;
+	Heap::memFree(topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_simPostStep() {
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = RecvSimStep;
+	op->msg = NULL;
+	if(putMessage(op) != osOK){
+		Heap::memFree(op);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+LightManager::MsgClass LightManager::_getMsgClass(uint32_t sig) {
+	switch(sig){
+		case RecvTimeSet:
+		case RecvLocaltimeSet:
+			return MsgClassSchedule;
+		case RecvLuxSet:
+			return MsgClassSensor;
+		case RecvCfgGet:
+		case RecvStatGet:
+		case RecvBootGet:
+		case RecvScheduleGet:
+		case RecvMeterGet:
+		case RecvPowerCapGet:
+		case RecvLatencyGet:
+		case RecvNotifFlush:
+			return MsgClassRead;
+		// el paso del simulador va en la clase menos prioritaria para que se procesen antes todos los
+		// eventos inyectados en el paso anterior
+		case RecvCfgSet:
+		case RecvActionSet:
+		case RecvActionClr:
+		case RecvCalendarSet:
+		case RecvMeterSet:
+		case RecvLatencySet:
+		case RecvOutRingSave:
+		case RecvSectionSet:
+		case RecvSimStep:
+			return MsgClassConfig;
+		// el control de la salida y los eventos internos de la máquina de estados son los más prioritarios
+		case RecvStatSet:
+		case RecvLevelSet:
+		case RecvPowerCapSet:
+		case RecvPowerLimit:
+		case RecvOutDriverAdd:
+		default:
+			return MsgClassControl;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::notifTimerCb() {
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = RecvNotifFlush;
+	op->msg = NULL;
+	if(putMessage(op) != osOK){
+		Heap::memFree(op);
+		// si la cola está llena, reintenta en el siguiente intervalo para no perder el último estado
+		_wheel->start(_notif_tmr, (_notif.interval > 0)? _notif.interval : 1);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::outRingTimerCb() {
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = RecvOutRingSave;
+	op->msg = NULL;
+	if(putMessage(op) != osOK){
+		Heap::memFree(op);
+		// si la cola está llena, reintenta tras otro intervalo para no perder el valor estable
+		_wheel->start(_out_ring_tmr, LIGHTMANAGER_OUTRING_SETTLE_MS);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_simCheckOutput(uint8_t value) {
+	if(!_sim.running){
+		return;
+	}
+	uint32_t idx = _sim.result.notified++;
+	if(_sim.expected != NULL && (idx >= _sim.exp_count || _sim.expected[idx] != value)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_SIM. Notificación %d inesperada, outValue=%d", idx, value);
+		if(_sim.result.mismatches++ == 0){
+			_sim.result.firstMismatch = idx;
 		}
-		delete(notif);
-		Heap::memFree(pub_topic);
 	}
 }
 
 
 // ----------------------------------------------------------------------------------
 uint8_t LightManager::_applyCurve(uint8_t value){
+	return _applyCurve(_lightdata.cfg.outData.curve, value);
+}
+
+
+// ----------------------------------------------------------------------------------
+uint8_t LightManager::_applyCurve(const Blob::LightCurve_t& curve, uint8_t value){
 	// si no hay curva, devuelve el mismo valor
-	if(_lightdata.cfg.outData.curve.samples != Blob::LightCurveSampleCount)
+	if(curve.samples != Blob::LightCurveSampleCount)
 		return value;
 
-	// si el ltimo punto de la curva, lo devuelve
+	// si el último punto de la curva, lo devuelve
 	int i = value/10;
 	if(i == Blob::LightCurveSampleCount - 1)
-		return _lightdata.cfg.outData.curve.data[i];
+		return curve.data[i];
 
 	// si es un punto intermedio, aplica la curva
-	uint8_t p1 = _lightdata.cfg.outData.curve.data[i];
-	uint8_t p2 = _lightdata.cfg.outData.curve.data[i+1];
+	uint8_t p1 = curve.data[i];
+	uint8_t p2 = curve.data[i+1];
 	uint16_t pos = value%10;
 	uint8_t result = (pos*(p2-p1))/10 + p1;
 	return result;
 }
 
+
+// ----------------------------------------------------------------------------------
+void LightManager::_addOutputDriver(LightOutputDriver* drv){
+	// el driver parte de un estado desconocido, por lo que se escribirá en la siguiente actualización
+	drv->invalidate();
+	_out_drivers[_out_driver_count++] = drv;
+}
+
+
+// ----------------------------------------------------------------------------------
+void LightManager::_applyOutput(){
+	uint8_t level = _limitPower(_applyCurve(_lightdata.stat.outValue));
+	// el integrador registra el nivel limitado, que es el que realmente se aplica a los drivers
+	_meterUpdate(level);
+	for(uint8_t i=0;i<_out_driver_count;i++){
+		LightOutputDriver* drv = _out_drivers[i];
+		// los drivers de modos no seleccionados permanecen apagados
+		drv->setLevel(drv->isSelected(_lightdata.cfg.outData.mode)? level : 0);
+		drv->flush();
+	}
+}
+
@@ -4,7 +4,7 @@
  *  Created on: Ene 2018
  *      Author: raulMrello
  *
- *	LightManager es el mdulo encargado de gestionar la salida de control de la luminaria
+ *	LightManager es el módulo encargado de gestionar la salida de control de la luminaria
  */
  
 #ifndef __LightManager__H
@@ -14,7 +14,10 @@
 #include "ActiveModule.h"
 #include "LightManagerBlob.h"
 #include "Scheduler.h"
-#include "Driver_Pwm010.h"
+#include "TimingWheel.h"
+#include "LightPowerBudget.h"
+#include "JsonArena.h"
+#include "LightOutputDriver.h"
 #include "JsonParserBlob.h"
 
 /** Flag para habilitar el soporte de objetos JSON en las suscripciones a MQLib
@@ -22,39 +25,124 @@
  */
 #define LIGHTMANAGER_ENABLE_JSON_SUPPORT		0
 
+/** Flag para habilitar el soporte de objetos CBOR en las suscripciones a MQLib. Sólo se utiliza si el soporte
+ *  JSON está desactivado.
+ *  Por defecto DESACTIVADO
+ */
+#define LIGHTMANAGER_ENABLE_CBOR_SUPPORT		0
+
+/** Intervalo mínimo (ms) entre notificaciones no solicitadas en "stat/value". Los cambios producidos dentro del
+ *  intervalo se agrupan y se notifica únicamente el último estado. 0 deshabilita la agrupación.
+ *  Por defecto 1000ms
+ */
+#define LIGHTMANAGER_NOTIF_MIN_INTERVAL_MS		1000
+
+/** Tiempo (ms) que debe permanecer estable la salida para registrar su valor en memoria NV. Una ráfaga de cambios
+ *  (ej: regulación desde un pulsador) genera una única escritura, a costa de perder el último cambio si se corta
+ *  la alimentación dentro de este tiempo.
+ *  Por defecto 3000ms
+ */
+#define LIGHTMANAGER_OUTRING_SETTLE_MS			3000
+
 
    
 class LightManager : public ActiveModule {
   public:
 
-    static const uint32_t MaxNumMessages = 16;		//!< Mximo nmero de mensajes procesables en el Mailbox del componente
+    static const uint32_t MaxNumMessages = 16;		//!< Máximo número de mensajes procesables en el Mailbox del componente
               
     /** Constructor por defecto
      *  @param pin010 Pin del Driver de control 0-10
      * 	@param fs Objeto FSManager para operaciones de backup
-     * 	@param defdbg Flag para habilitar depuracin por defecto
+     * 	@param defdbg Flag para habilitar depuración por defecto
      */
     LightManager(PinName pin010, FSManager* fs, bool defdbg = false);
 
 
     /** Destructor
      */
-    virtual ~LightManager(){}
+    virtual ~LightManager(){
+    	// los temporizadores se registran en la rueda compartida, que sobrevive a la instancia
+    	_wheel->cancel(_sim_tmr);
+    	_wheel->cancel(_notif_tmr);
+    	_wheel->cancel(_out_ring_tmr);
+    	if(_power.budget){
+    		_power.budget->detach(_power.member);
+    	}
+    	delete(_driver010);
+    }
+
+
+    /** Tipos de mensaje reproducibles por el simulador de eventos */
+    enum SimEventType{
+    	SimTimeSet,			//!< Mensaje en "set/time" (Blob::LightTimeData_t o Blob::LightLocaltime_t)
+    	SimLuxSet,			//!< Mensaje en "set/lux" (Blob::LightLuxLevel)
+    	SimValueSet,		//!< Mensaje en "set/value" (Blob::SetRequest_t<light_manager>)
+    	SimCfgSet,			//!< Mensaje en "set/cfg" (Blob::SetRequest_t<light_manager>)
+    };
+
+
+    /** Evento de una traza de simulación */
+    struct SimEvent_t {
+    	uint32_t offset;		//!< Instante virtual del evento (ms desde el inicio de la traza)
+    	SimEventType type;		//!< Tipo de mensaje
+    	const void* data;		//!< Mensaje en formato blob
+    	uint16_t size;			//!< Tamaño del mensaje
+    };
+
+
+    /** Resultado de la reproducción de una traza */
+    struct SimResult_t {
+    	uint32_t injected;		//!< Eventos de la traza inyectados
+    	uint32_t notified;		//!< Notificaciones publicadas en "stat/value"
+    	uint32_t mismatches;	//!< Notificaciones que no coinciden con la secuencia esperada
+    	int32_t firstMismatch;	//!< Índice de la primera notificación no esperada o -1
+    	bool done;				//!< Flag activado al finalizar la reproducción
+    };
 
 
-    /** Arranca el simulador de eventos basndose en un RtosTimer
+    /** Arranca el simulador de eventos, que reproduce una traza de mensajes en orden y bajo tiempo virtual.
+     *  La traza se inyecta siempre en formato blob, con independencia de los soportes JSON y CBOR, que siguen
+     *  aplicándose al resto del tráfico durante la reproducción.
+     *  Opcionalmente verifica los valores de salida notificados en "stat/value" frente a una secuencia esperada.
      *
+     * @param trace Traza de eventos ordenada por <offset>
+     * @param count Número de eventos de la traza
+     * @param speed Factor de velocidad sobre el tiempo virtual (1: tiempo real, N: N veces más rápido,
+     * 	0: lo más rápido posible, un evento tras otro)
+     * @param expected Secuencia esperada de valores notificados en "stat/value" (puede ser NULL)
+     * @param exp_count Número de valores de la secuencia esperada
      */
-    void startSimulator();
+    void startSimulator(const SimEvent_t* trace, uint32_t count, uint32_t speed = 0, const uint8_t* expected = NULL, uint32_t exp_count = 0);
 
 
-    /** Detiene el simulador de eventos basndose en un RtosTimer
+    /** Detiene el simulador de eventos
      *
      */
     void stopSimulator();
 
 
-    /** Interfaz para postear un mensaje de la mquina de estados en el Mailbox de la clase heredera
+    /** Obtiene el resultado de la última reproducción
+     *
+     * @param result Recibe el resultado
+     */
+    void getSimulatorResult(SimResult_t& result){
+    	result = _sim.result;
+    }
+
+
+    /** Genera una traza de actualizaciones compactas de "set/time" a intervalo fijo
+     *
+     * @param trace Recibe los eventos de la traza
+     * @param times Recibe las horas locales referenciadas por cada evento
+     * @param count Número de eventos a generar
+     * @param start Hora local del primer evento
+     * @param step Intervalo entre eventos en segundos
+     */
+    static void buildTimeTrace(SimEvent_t* trace, Blob::LightLocaltime_t* times, uint32_t count, time_t start, uint32_t step);
+
+
+    /** Interfaz para postear un mensaje de la máquina de estados en el Mailbox de la clase heredera
      *  @param msg Mensaje a postear
      *  @return Resultado
      */
@@ -78,10 +166,194 @@ class LightManager : public ActiveModule {
     	return _json_supported;
     }
 
+
+    /**
+     * Activa y/o desactiva el soporte CBOR. Si el soporte JSON está activado, tiene prioridad sobre CBOR
+     * @param flag
+     */
+    void setCBORSupport(bool flag){
+    	_cbor_supported = flag;
+    }
+
+
+    /**
+     * Obtiene el estado del soporte CBOR
+     * @return
+     */
+    bool isCBORSupported(){
+    	return _cbor_supported;
+    }
+
+
+    /**
+     * Indica si la carga diferida de la configuración ha restaurado ya el modo y la curva de la salida. Hasta
+     * entonces los mensajes de control permanecen en su cola
+     * @return True si se han restaurado
+     */
+    bool isOutputRestored(){
+    	return (_boot.step > BootStepOutput);
+    }
+
+
+    /**
+     * Establece el intervalo mínimo entre notificaciones no solicitadas en "stat/value"
+     * @param ms Intervalo en milisegundos (0: notifica cada cambio)
+     */
+    void setNotifInterval(uint32_t ms){
+    	_notif.interval = ms;
+    }
+
+
+    /**
+     * Obtiene el intervalo mínimo entre notificaciones no solicitadas
+     * @return Intervalo en milisegundos
+     */
+    uint32_t getNotifInterval(){
+    	return _notif.interval;
+    }
+
+
+    /** Clases de prioridad de los mensajes recibidos, de mayor a menor prioridad. El orden de llegada se mantiene
+     *  dentro de cada clase, pero no entre clases (ej: un set/value se atiende antes que un set/cfg anterior). Las
+     *  lecturas que llegan con cambios de configuración pendientes se atienden tras ellos, por lo que un get/cfg
+     *  siempre responde con los set/cfg recibidos previamente ya aplicados
+     * 	@enum MsgClassControl Control directo de la salida (set/value, set/level)
+     * 	@enum MsgClassSchedule Eventos temporales del calendario (set/time)
+     * 	@enum MsgClassSensor Medidas del sensor ALS (set/lux)
+     * 	@enum MsgClassRead Lecturas y notificaciones (get/cfg, get/value, get/boot)
+     * 	@enum MsgClassConfig Cambios de configuración con escrituras en memoria NV (set/cfg, set/action...)
+     */
+    enum MsgClass{
+    	MsgClassControl,
+    	MsgClassSchedule,
+    	MsgClassSensor,
+    	MsgClassRead,
+    	MsgClassConfig,
+    	MsgClassCount
+    };
+
+
+    /** Estadísticas de la cola de entrada por clase de prioridad */
+    struct QueueStats_t {
+    	uint32_t depth[MsgClassCount];		//!< Mensajes pendientes
+    	uint32_t maxDepth[MsgClassCount];	//!< Máximo de mensajes pendientes registrado
+    	uint32_t dropped[MsgClassCount];	//!< Mensajes descartados por cola llena
+    };
+
+
+    /** Obtiene las estadísticas de la cola de entrada
+     *
+     * @param stats Recibe las estadísticas
+     */
+    void getQueueStats(QueueStats_t& stats);
+
+
+    /** Número de posiciones del anillo de transiciones de la salida en memoria NV */
+    static const uint8_t OutRingSlots = 8;
+
+    /** Entrada del anillo de transiciones de la salida. Cada valor estable se escribe en la posición
+     *  <seq % OutRingSlots>, de forma que las escrituras se reparten entre todas las posiciones y el anillo nunca
+     *  crece. En el arranque se recupera la entrada válida con mayor <seq>
+     */
+    struct __packed LightOutRingEntry_t {
+    	uint32_t seq;					//!< Número de secuencia de la escritura
+    	uint8_t outValue;				//!< Valor de la salida
+    	uint32_t crc;					//!< Checksum crc32 de los campos anteriores
+    };
+
+
+    /** Selecciona la entrada válida más reciente del anillo de transiciones. Descarta las posiciones no leídas,
+     *  las que no superan el checksum (ej: escritura interrumpida) y las que tienen un valor fuera de rango
+     *
+     * @param slots Posiciones leídas de la memoria NV
+     * @param read Flags de posición leída correctamente
+     * @param count Número de posiciones
+     * @param entry Recibe la entrada seleccionada
+     * @return True si hay alguna entrada válida
+     */
+    static bool selectOutRingEntry(const LightOutRingEntry_t* slots, const bool* read, uint8_t count, LightOutRingEntry_t& entry);
+
+
+    /** Intervalo mínimo (ms) entre dos grabaciones de los contadores de uso. Es la pérdida máxima de medida ante
+     *  un corte de alimentación
+     */
+    static const uint32_t MeterSavePeriodMs = 3600 * 1000;
+
+    /** Integrador de uso de la salida. Se actualiza en cada cambio de la salida, acumulando el tramo anterior */
+    struct LightMeter_t {
+    	Blob::LightMeterData_t data;	//!< Contadores acumulados
+    	Blob::LightMeterCfg_t cfg;		//!< Parámetros de la estimación de energía
+    	uint64_t last_ms;				//!< Instante de la última integración
+    	uint64_t saved_ms;				//!< Instante de la última grabación
+    	uint8_t value;					//!< Valor de la salida en el tramo en curso
+    	uint8_t power;					//!< Potencia (%) en el tramo en curso
+    	bool started;					//!< Flag de integración iniciada
+    };
+
+
+    /** Acumula en el integrador el tramo en curso hasta el instante indicado. La primera llamada sólo inicia la
+     *  integración
+     *
+     * @param m Integrador
+     * @param now_ms Instante actual (ms)
+     * @return True si han transcurrido <MeterSavePeriodMs> desde la última grabación (<m.saved_ms>)
+     */
+    static bool meterAccumulate(LightMeter_t& m, uint64_t now_ms);
+
+
+    /** Registra un cambio de la salida en el integrador, que debe estar acumulado hasta el instante del cambio
+     *
+     * @param m Integrador
+     * @param value Nuevo valor de la salida
+     * @param power Potencia (%) con el nuevo valor
+     */
+    static void meterSetOutput(LightMeter_t& m, uint8_t value, uint8_t power);
+
+
+    /** Instantánea del estado de la salida y de la versión de la configuración */
+    struct StatSnapshot_t {
+    	Blob::LightStatData_t stat;		//!< Estado de la salida
+    	uint32_t cfgVersion;			//!< Versión de la configuración, se incrementa en cada cambio
+    };
+
+
+    /** Obtiene una instantánea coherente del estado de la salida. Puede invocarse desde cualquier hilo, sin
+     *  bloqueos y sin pasar por la cola de la máquina de estados
+     *
+     * @param snap Recibe la instantánea
+     */
+    void getStatSnapshot(StatSnapshot_t& snap);
+
+
+    /** Registra un driver de salida adicional (ej: relé, DALI). Los drivers registrados se actualizan con el nivel
+     *  de la salida tras aplicar la curva, siempre que implementen alguno de los modos de <outData.mode>, y a nivel
+     *  0 en caso contrario. El driver PWM / 0-10V del pin indicado en el constructor se registra automáticamente.
+     *  Puede invocarse desde cualquier hilo: el registro se postea en la cola y lo realiza el hilo de LightManager,
+     *  el mismo que recorre los drivers al actualizar la salida
+     *
+     * @param drv Driver de salida, debe existir mientras exista la instancia
+     * @return True si se ha posteado el registro, False si se ha alcanzado <MaxOutputDrivers> o la cola está llena
+     */
+    bool attachOutputDriver(LightOutputDriver* drv);
+
+
+    /** Registra la instancia en un servicio de límite de potencia compartido (ej: LightPowerBudget::getDefault()).
+     *  La instancia comunica su demanda (potencia nominal por curva de potencia, ver "set/meter") en cada cambio
+     *  de la salida y limita su nivel con el factor asignado a su prioridad. Debe invocarse antes de iniciar la
+     *  máquina de estados
+     *
+     * @param budget Servicio de límite de potencia
+     * @param priority Prioridad de la luminaria (0: máxima)
+     */
+    void attachPowerBudget(LightPowerBudget* budget, uint8_t priority);
+
   private:
 
-    /** Mximo nmero de mensajes alojables en la cola asociada a la mquina de estados */
-    static const uint32_t MaxQueueMessages = 16;
+    /** Máximo número de mensajes alojables en la cola de cada clase de prioridad. Las cinco colas suman 20
+     *  mensajes, similar a la cola única de 16 mensajes a la que sustituyen, ya que la ráfaga de cada clase es
+     *  corta (un pulsador, un set/time por minuto, una medida ALS...) y el emisor espera a que haya hueco
+     */
+    static const uint32_t MaxClassMessages = 4;
 
     /** Flags de operaciones a realizar por la tarea */
     enum MsgEventFlags{
@@ -92,117 +364,333 @@ class LightManager : public ActiveModule {
     	RecvBootGet	  = (State::EV_RESERVED_USER << 4),  /// Flag activado al recibir mensaje en "get/boot"
     	RecvTimeSet	  = (State::EV_RESERVED_USER << 5),  /// Flag activado al recibir mensaje en "set/time"
     	RecvLuxSet	  = (State::EV_RESERVED_USER << 6),  /// Flag activado al recibir mensaje en "set/lux"
+    	RecvLocaltimeSet = (State::EV_RESERVED_USER << 7),  /// Flag activado al recibir una hora local compacta en "set/time"
+    	RecvSimStep	  = (State::EV_RESERVED_USER << 8),  /// Flag activado para avanzar un paso del simulador de eventos
+    	RecvLevelSet  = (State::EV_RESERVED_USER << 9),  /// Flag activado al recibir mensaje en "set/level"
+    	RecvActionSet = (State::EV_RESERVED_USER << 10), /// Flag activado al recibir mensaje en "set/action"
+    	RecvActionClr = (State::EV_RESERVED_USER << 11), /// Flag activado al recibir mensaje en "set/actclr"
+    	RecvSectionSet = (State::EV_RESERVED_USER << 12), /// Flag activado al recibir mensaje en "set/section"
+    	RecvNotifFlush = (State::EV_RESERVED_USER << 13), /// Flag activado al vencer el intervalo mínimo de notificación
+    	RecvBootStep  = (State::EV_RESERVED_USER << 14), /// Flag activado para ejecutar un paso de la carga diferida de la configuración
+    	RecvCalendarSet = (State::EV_RESERVED_USER << 15), /// Flag activado al recibir mensaje en "set/calendar"
+    	RecvScheduleGet = (State::EV_RESERVED_USER << 16), /// Flag activado al recibir mensaje en "get/schedule"
+    	RecvMeterGet  = (State::EV_RESERVED_USER << 17), /// Flag activado al recibir mensaje en "get/meter"
+    	RecvMeterSet  = (State::EV_RESERVED_USER << 18), /// Flag activado al recibir mensaje en "set/meter"
+    	RecvPowerCapSet = (State::EV_RESERVED_USER << 19), /// Flag activado al recibir mensaje en "set/powercap"
+    	RecvPowerCapGet = (State::EV_RESERVED_USER << 20), /// Flag activado al recibir mensaje en "get/powercap"
+    	RecvPowerLimit = (State::EV_RESERVED_USER << 21), /// Flag activado al cambiar el factor de potencia de su prioridad
+    	RecvLatencyGet = (State::EV_RESERVED_USER << 22), /// Flag activado al recibir mensaje en "get/latency"
+    	RecvLatencySet = (State::EV_RESERVED_USER << 23), /// Flag activado al recibir mensaje en "set/latency"
+    	RecvOutRingSave = (State::EV_RESERVED_USER << 24), /// Flag activado al estabilizarse la salida, para registrarla en memoria NV
+    	RecvOutDriverAdd = (State::EV_RESERVED_USER << 25), /// Flag activado al registrar un driver de salida adicional
     };
 
 
-    /** Cola de mensajes de la mquina de estados */
-    Queue<State::Msg, MaxQueueMessages> _queue;
+    /** Número máximo de mensajes consecutivos de clases más prioritarias que puede esperar un mensaje antes de
+     *  ser atendido (protección contra inanición)
+     */
+    static const uint32_t MaxClassStarvation = 8;
+
+    /** Colas de mensajes de la máquina de estados, una por clase de prioridad */
+    Queue<State::Msg, MaxClassMessages> _queue[MsgClassCount];
+
+    /** Número total de mensajes pendientes en las colas */
+    Semaphore _queue_sem;
+
+    /** Estadísticas de las colas */
+    QueueStats_t _queue_stats;
+
+    /** Mensajes atendidos de otras clases mientras la clase tenía mensajes pendientes */
+    uint32_t _queue_starve[MsgClassCount];
 
-    /** Datos de configuracin y estado */
+    /** Datos de configuración y estado */
     Blob::LightBootData_t _lightdata;
 
     /** Scheduler de programas */
     Scheduler* _sched;
 
-    /** Timer de simulacin de eventos */
-    RtosTimer* _sim_tmr;
+    /** Rueda de temporización compartida en la que se registran los temporizadores de la instancia */
+    TimingWheel* _wheel;
+
+    /** Timer de simulación de eventos (periódico, se rearma en cada vencimiento) */
+    TimingWheel::Timer_t _sim_tmr;
+
+    /** Periodo del timer de simulación en ms */
+    static const uint32_t SimTickMs = 10;
+
+    /** Estado del simulador de eventos */
+    struct {
+    	const SimEvent_t* trace;	//!< Traza en reproducción
+    	uint32_t count;				//!< Número de eventos de la traza
+    	uint32_t next;				//!< Siguiente evento a inyectar
+    	uint32_t speed;				//!< Factor de velocidad (0: lo más rápido posible)
+    	uint32_t vtime;				//!< Tiempo virtual transcurrido en ms
+    	const uint8_t* expected;	//!< Secuencia esperada de valores notificados
+    	uint32_t exp_count;			//!< Número de valores esperados
+    	uint32_t notif_interval;	//!< Intervalo de notificación previo a la reproducción
+    	bool running;				//!< Flag de reproducción en curso
+    	SimResult_t result;			//!< Resultado de la reproducción
+    }_sim;
+
+    /** Timer del intervalo mínimo de notificación */
+    TimingWheel::Timer_t _notif_tmr;
+
+    /** Estado de la etapa de notificación de "stat/value" */
+    struct {
+    	uint32_t interval;			//!< Intervalo mínimo entre notificaciones en ms
+    	uint32_t flags;				//!< Eventos acumulados desde la última notificación
+    	bool armed;					//!< Flag de intervalo en curso
+    	bool pending;				//!< Flag de cambios pendientes de notificar al finalizar el intervalo
+    }_notif;
+
+    /** Codecs de las respuestas memorizadas */
+    enum RespCodec{
+    	RespCodecBlob,
+    	RespCodecJson,
+    	RespCodecCbor,
+    	RespCodecCount
+    };
+
+    /** Respuesta serializada y memorizada para un codec */
+    struct RespCache_t {
+    	void* data;						//!< Trama blob, objeto cJSON*, trama cbor o NULL si no es válida
+    	uint16_t size;					//!< Tamaño de la trama
+    	Blob::LightStatData_t stat;		//!< Estado incluido en la trama (sólo get/boot en json y cbor)
+    };
+
+    /** Respuestas memorizadas de "stat/cfg" y "stat/boot" por codec. Se invalidan al modificar la configuración */
+    RespCache_t _cfg_cache[RespCodecCount];
+    RespCache_t _boot_cache[RespCodecCount];
+
+    /** Buffer de codificación de las tramas CBOR de configuración y arranque, generadas siempre desde el hilo de
+     *  LightManager. Admite la cabecera de la respuesta seguida de la configuración memorizada
+     */
+    uint8_t _cbor_buf[CBOR::LightCborHeaderMaxSize + CBOR::LightCborMaxSize];
+
+    /** Registro de arranque en memoria NV con la curva y el modo necesarios para aplicar la salida antes de
+     *  cargar la configuración
+     */
+    struct __packed LightBootRecord_t {
+    	Blob::LightCurve_t curve;		//!< Curva de activación
+    	Blob::LightOutModeFlags mode;	//!< Modo de control de la salida
+    	uint32_t crc;					//!< Checksum de los campos anteriores
+    };
+
+    /** Timer de estabilización de la salida antes de registrarla en el anillo de transiciones */
+    TimingWheel::Timer_t _out_ring_tmr;
+
+    /** Estado del anillo de transiciones */
+    struct {
+    	uint32_t seq;					//!< Secuencia de la siguiente escritura
+    	uint8_t value;					//!< Último valor registrado
+    	bool valid;						//!< Flag de valor registrado
+    }_out_ring;
+
+    /** Registro de los contadores de uso en memoria NV */
+    struct __packed LightMeterRecord_t {
+    	Blob::LightMeterData_t data;	//!< Contadores
+    	uint32_t crc;					//!< Checksum de los campos anteriores
+    };
+
+    /** Integrador de uso de la salida */
+    LightMeter_t _meter;
 
-    /** Contador de segundos del simulador de eventos */
-    uint32_t _sim_counter;
+    /** Mensajes internos de actualización horaria. Incluyen el instante de recepción para medir el tiempo de
+     *  espera en la cola (ver Scheduler::recordApplied)
+     */
+    struct TimeMsg_t {
+    	Blob::LightTimeData_t data;		//!< Datos recibidos
+    	uint64_t recv_ms;				//!< Instante de recepción
+    };
+    struct LocaltimeMsg_t {
+    	Blob::LightLocaltime_t t;		//!< Hora local recibida
+    	uint64_t recv_ms;				//!< Instante de recepción
+    };
+
+    /** Participación en el servicio de límite de potencia */
+    struct {
+    	LightPowerBudget* budget;		//!< Servicio registrado (NULL si no participa)
+    	LightPowerBudget::Member_t member;	//!< Registro en el servicio
+    	uint8_t priority;				//!< Prioridad
+    	uint8_t level;					//!< Último nivel aplicado tras el límite
+    	volatile uint32_t pending;		//!< Aviso de cambio del factor pendiente de procesar (0, 1). Se adquiere por CAS
+    }_power;
+
+    /** Pasos de la carga diferida de la configuración. Las acciones se cargan de una en una */
+    static const uint8_t BootStepFlags = 0;
+    static const uint8_t BootStepOutput = 1;
+    static const uint8_t BootStepActions = 2;
+    static const uint8_t BootStepCalendars = BootStepActions + Blob::MaxAllowedActionDataInArray;
+    static const uint8_t BootStepCheck = BootStepCalendars + 1;
+    static const uint8_t BootStepDone = BootStepCheck + 1;
+
+    /** Revisión de la máscara de eventos por defecto. Las configuraciones grabadas con una revisión anterior
+     *  incorporan los eventos añadidos después (1: LightLateActionEvt) al recuperarlas
+     */
+    static const uint32_t EvtMaskRevision = 1;
+
+    /** Estado de la carga diferida de la configuración */
+    struct {
+    	uint8_t step;					//!< Siguiente paso o BootStepDone si ha finalizado
+    	bool success;					//!< Flag de lectura correcta de todos los parámetros
+    }_boot;
+
+    /** Instantánea del estado publicada con un doble buffer por secuencia (seqlock latch). La escribe
+     *  únicamente el hilo de LightManager y la leen sin bloqueos el resto de hilos
+     */
+    struct {
+    	volatile uint32_t seq;			//!< Secuencia de escritura, su bit 0 indica la copia que deben leer los lectores
+    	StatSnapshot_t buf[2];			//!< Copias de la instantánea
+    }_snap;
+
+    /** Versión de la configuración */
+    uint32_t _cfg_version;
+
+    /** Número máximo de drivers de salida */
+    static const uint8_t MaxOutputDrivers = 4;
 
     /** Driver de control 0-10 */
-    Driver_Pwm010* _driver010;
+    LightOutPwm010Driver* _driver010;
+
+    /** Drivers de salida registrados. Sólo los modifica y recorre el hilo de LightManager */
+    LightOutputDriver* _out_drivers[MaxOutputDrivers];
+    uint8_t _out_driver_count;
+
+    /** Drivers registrados o con el registro pendiente en la cola */
+    volatile uint32_t _out_driver_slots;
 
     /** Flag de control para el soporte de objetos json */
     bool _json_supported;
 
+    /** Flag de control para el soporte de objetos cbor */
+    bool _cbor_supported;
+
     /** Interfaz para obtener un evento osEvent de la clase heredera
      *  @param msg Mensaje a postear
      */
     virtual osEvent getOsEvent();
 
 
- 	/** Interfaz para manejar los eventos en la mquina de estados por defecto
+ 	/** Interfaz para manejar los eventos en la máquina de estados por defecto
       *  @param se Evento a manejar
       *  @return State::StateResult Resultado del manejo del evento
       */
     virtual State::StateResult Init_EventHandler(State::StateEvent* se);
 
 
- 	/** Callback invocada al recibir una actualizacin de un topic local al que est suscrito
+ 	/** Callback invocada al recibir una actualización de un topic local al que está suscrito
       *  @param topic Identificador del topic
       *  @param msg Mensaje recibido
-      *  @param msg_len Tamao del mensaje
+      *  @param msg_len Tamaño del mensaje
       */
     virtual void subscriptionCb(const char* topic, void* msg, uint16_t msg_len);
 
 
- 	/** Callback invocada al finalizar una publicacin local
+ 	/** Callback invocada al finalizar una publicación local
       *  @param topic Identificador del topic
-      *  @param result Resultado de la publicacin
+      *  @param result Resultado de la publicación
       */
     virtual void publicationCb(const char* topic, int32_t result);
 
 
-   	/** Chequea la integridad de los datos de configuracin <_cfg>. En caso de que algo no sea
+   	/** Chequea la integridad de los datos de configuración <_cfg>. En caso de que algo no sea
    	 * 	coherente, restaura a los valores por defecto y graba en memoria NV.
    	 * 	@return True si la integridad es correcta, False si es incorrecta
 	 */
 	virtual bool checkIntegrity();
 
 
-   	/** Establece la configuracin por defecto grabndola en memoria NV
+   	/** Establece la configuración por defecto grabándola en memoria NV
 	 */
 	virtual void setDefaultConfig();
 
 
-   	/** Recupera la configuracin de memoria NV
+   	/** Recupera la configuración de memoria NV
 	 */
 	virtual void restoreConfig();
 
 
-   	/** Graba la configuracin en memoria NV
+   	/** Graba la configuración en memoria NV
 	 */
 	virtual void saveConfig();
 
 
-	/** Graba un parmetro en la memoria NV
-	 * 	@param param_id Identificador del parmetro
+	/** Graba un parámetro en la memoria NV
+	 * 	@param param_id Identificador del parámetro
 	 * 	@param data Datos asociados
-	 * 	@param size Tamao de los datos
+	 * 	@param size Tamaño de los datos
 	 * 	@param type Tipo de los datos
-	 * 	@return True: xito, False: no se pudo recuperar
+	 * 	@return True: éxito, False: no se pudo recuperar
 	 */
 	virtual bool saveParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
 		return ActiveModule::saveParameter(param_id, data, size, type);
 	}
 
 
-	/** Recupera un parmetro de la memoria NV
-	 * 	@param param_id Identificador del parmetro
+	/** Recupera un parámetro de la memoria NV
+	 * 	@param param_id Identificador del parámetro
 	 * 	@param data Receptor de los datos asociados
-	 * 	@param size Tamao de los datos a recibir
+	 * 	@param size Tamaño de los datos a recibir
 	 * 	@param type Tipo de los datos
-	 * 	@return True: xito, False: no se pudo recuperar
+	 * 	@return True: éxito, False: no se pudo recuperar
 	 */
 	virtual bool restoreParameter(const char* param_id, void* data, size_t size, NVSInterface::KeyValueType type){
 		return ActiveModule::restoreParameter(param_id, data, size, type);
 	}
 
 
-	/** Actualiza el estado de activacin de la luminaria. Internamente se actualiza '_stat'
+	/** Actualiza el estado de activación de la luminaria. Internamente se actualiza '_stat'
 	 *
-	 * @param value Nuevo valor de activacin: 0=Off, 1..99=Dim, 100=On
+	 * @param value Nuevo valor de activación: 0=Off, 1..99=Dim, 100=On
 	 */
 	void updateLightValue(uint8_t value);
 
 
-	/** Ejecuta el simulador de eventos
+	/** Avanza el tiempo virtual del simulador e inyecta los eventos vencidos
 	 *
 	 */
 	void eventSimulatorCb();
 
 
+	/** Obtiene la clase de prioridad de un mensaje
+	 *
+	 * @param sig Evento del mensaje
+	 * @return Clase de prioridad
+	 */
+	static MsgClass _getMsgClass(uint32_t sig);
+
+
+	/** Callback del timer de notificación, solicita a la máquina de estados la notificación de los cambios
+	 *  acumulados
+	 */
+	void notifTimerCb();
+
+
+	/** Callback del timer de estabilización de la salida, solicita a la máquina de estados su registro en el
+	 *  anillo de transiciones
+	 */
+	void outRingTimerCb();
+
+
+	/** Inyecta el siguiente evento de la traza como si se hubiera recibido por su topic
+	 *
+	 */
+	void _simInject();
+
+
+	/** Solicita a la máquina de estados un nuevo paso del simulador
+	 *
+	 */
+	void _simPostStep();
+
+
+	/** Verifica un valor notificado en "stat/value" frente a la secuencia esperada
+	 *
+	 * @param value Valor notificado
+	 */
+	void _simCheckOutput(uint8_t value);
+
+
 	/** Actualiza el estado de la salida y notifica
 	 *
 	 * @param value Nuevo estado de la salida
@@ -210,7 +698,23 @@ class LightManager : public ActiveModule {
 	void _updateAndNotify(uint8_t value);
 
 
-	/** Aplica la curva de activacin en la carga
+	/** Registra un cambio de estado en la etapa de notificación. Si no hay un intervalo en curso se notifica
+	 *  inmediatamente, en caso contrario se agrupa y se notifica al finalizar el intervalo
+	 *
+	 * @param flags Eventos asociados al cambio (LightEvtFlags)
+	 */
+	void _notifyStat(uint32_t flags);
+
+
+	/** Publica el estado actual en "stat/value" con los eventos acumulados habilitados en <evtFlagMask>. Si
+	 *  ninguno de los eventos está habilitado, descarta la notificación
+	 *
+	 * @return True si se ha publicado
+	 */
+	bool _publishStat();
+
+
+	/** Aplica la curva de activación en la carga
 	 *
 	 * @param value Valor a aplicar
 	 * @return Valor resultante tras la curva
@@ -218,13 +722,290 @@ class LightManager : public ActiveModule {
 	uint8_t _applyCurve(uint8_t value);
 
 
-	/** Actualiza la configuracin
+	/** Aplica una curva de 11 muestras (0, 10.. 100). Si la curva está incompleta devuelve el mismo valor
+	 *
+	 * @param curve Curva
+	 * @param value Valor a aplicar
+	 * @return Valor resultante tras la curva
+	 */
+	static uint8_t _applyCurve(const Blob::LightCurve_t& curve, uint8_t value);
+
+
+	/** Recupera los contadores de uso y los parámetros de la estimación de energía
+	 *
+	 */
+	void _meterRestore();
+
+
+	/** Registra un cambio de la salida en el integrador de uso
+	 *
+	 * @param level Nivel aplicado tras la curva de activación y la limitación de potencia
+	 */
+	void _meterUpdate(uint8_t level);
+
+
+	/** Acumula el tramo en curso hasta el instante actual y graba los contadores si ha transcurrido
+	 *  <MeterSavePeriodMs> desde la última grabación
+	 *
+	 * @param save True para grabarlos en cualquier caso (ej: antes de cambiar los parámetros en "set/meter")
+	 */
+	void _meterSync(bool save = false);
+
+
+	/** Publica en "stat/meter" los parámetros y los contadores de uso
+	 *
+	 * @param idTrans Identificador de la transacción
+	 * @param code Resultado de la operación
+	 */
+	void _publishMeter(uint32_t idTrans, Blob::ErrorCode code);
+
+
+	/** Comunica la demanda asociada al nivel indicado y aplica el factor asignado por el servicio de límite de
+	 *  potencia, buscando el mayor nivel cuya potencia no supera la asignada
+	 *
+	 * @param level Nivel tras aplicar la curva de activación
+	 * @return Nivel limitado
+	 */
+	uint8_t _limitPower(uint8_t level);
+
+
+	/** Callback invocada por el servicio de límite de potencia al cambiar el factor de su prioridad. Se ejecuta
+	 *  en el hilo que provoca el cambio, por lo que únicamente postea RecvPowerLimit
+	 */
+	void _powerLimitCb();
+
+
+	/** Publica en "stat/powercap" el límite y la demanda de la instalación y el factor de la luminaria
+	 *
+	 * @param idTrans Identificador de la transacción
+	 * @param code Resultado de la operación
+	 */
+	void _publishPowerCap(uint32_t idTrans, Blob::ErrorCode code);
+
+
+	/** Registra el retraso de la última acción programada ejecutada y notifica LightLateActionEvt si supera el
+	 *  umbral de alerta
+	 *
+	 * @param recv_ms Instante de recepción de la hora local que la ha ejecutado
+	 */
+	void _recordLatency(uint64_t recv_ms);
+
+
+	/** Notifica LightLateActionEvt si alguna acción programada ha quedado atrás sin ejecutarse en la última
+	 *  actualización horaria, siempre que la alerta de retraso esté habilitada
+	 */
+	void _notifyMissedActions();
+
+
+	/** Publica en "stat/latency" el umbral de alerta y el histograma de retraso de las acciones programadas
+	 *
+	 * @param idTrans Identificador de la transacción
+	 * @param code Resultado de la operación
+	 */
+	void _publishLatency(uint32_t idTrans, Blob::ErrorCode code);
+
+
+	/** Añade un driver a la lista de drivers de salida. Se invoca desde el constructor o desde el hilo de
+	 *  LightManager, con el hueco ya reservado en <_out_driver_slots>
+	 *
+	 * @param drv Driver de salida
+	 */
+	void _addOutputDriver(LightOutputDriver* drv);
+
+
+	/** Aplica el nivel actual de la salida en los drivers registrados según el modo configurado. Los drivers sólo
+	 *  escriben en el hardware los canales cuyo nivel ha cambiado
+	 *
+	 */
+	void _applyOutput();
+
+
+	/** Actualiza la configuración
 	 *
-	 * @param data Nueva configuracin a aplicar
-	 * @param err Recibe los errores generados durante la actualizacin
+	 * @param data Nueva configuración a aplicar
+	 * @param err Recibe los errores generados durante la actualización
 	 */
 	void _updateConfig(const light_manager& data, Blob::ErrorData_t& err);
 
+
+	/** Actualiza una única sección de la configuración recibida en una solicitud compacta
+	 *
+	 * @param req Solicitud con la sección a actualizar
+	 * @param err Recibe los errores generados durante la actualización
+	 */
+	void _updateConfigSection(const Blob::LightSectionRequest_t& req, Blob::ErrorData_t& err);
+
+
+	/** Obtiene el tamaño de los datos de una sección de la configuración
+	 *
+	 * @param key Sección (LightKeyNames)
+	 * @return Tamaño en bytes o 0 si la sección no admite actualización compacta
+	 */
+	uint16_t _getSectionSize(uint8_t key) const;
+
+
+	/** Visitante de LightManagerSchema que graba o recupera de memoria NV los campos con clave propia */
+	struct NvsVisitor;
+
+
+	/** Aplica un nuevo valor en la salida solicitado de forma remota
+	 *
+	 * @param value Nuevo valor de la salida
+	 * @param err Recibe el error ErrRangeValue si el valor está fuera de rango
+	 */
+	void _setOutValue(uint8_t value, Blob::ErrorData_t& err);
+
+
+	/** Publica la configuración actual en "stat/cfg" en el formato habilitado (json, cbor o blob)
+	 *
+	 * @param idTrans Identificador de la transacción
+	 * @param err Resultado de la operación
+	 */
+	void _publishCfg(uint32_t idTrans, const Blob::ErrorData_t& err);
+
+
+	/** Publica la trama de arranque en "stat/boot" en el formato habilitado (json, cbor o blob)
+	 *
+	 */
+	void _publishBoot();
+
+
+	/** Libera las respuestas memorizadas de "stat/cfg" y "stat/boot". Debe invocarse siempre que se modifique
+	 *  la configuración
+	 *
+	 */
+	void _invalidateRespCache();
+
+
+	/** Registra un cambio de configuración: invalida las respuestas memorizadas, incrementa la versión de la
+	 *  configuración y actualiza la instantánea
+	 *
+	 */
+	void _configChanged();
+
+
+	/** Restaura el registro de arranque (curva) y el último valor de la salida, y aplica la salida
+	 *
+	 */
+	void _restoreBootRecord();
+
+
+	/** Guarda el registro de arranque
+	 *
+	 */
+	void _saveBootRecord();
+
+
+	/** Graba en memoria NV una única acción modificada, junto con el número de acciones y el checksum de la
+	 *  configuración, sin grabar el resto de parámetros
+	 *
+	 * @param pos Posición de la acción
+	 */
+	void _saveAction(uint8_t pos);
+
+
+	/** Recupera el último valor de la salida del anillo de transiciones
+	 *
+	 * @return Último valor registrado o 0 si no hay ninguno válido
+	 */
+	uint8_t _restoreOutRing();
+
+
+	/** Registra un valor de la salida en el anillo, si ha cambiado desde el último registrado
+	 *
+	 * @param value Valor de la salida
+	 */
+	void _appendOutRing(uint8_t value);
+
+
+	/** Notifica un cambio de la salida. Su registro en el anillo se aplaza hasta que permanezca estable durante
+	 *  LIGHTMANAGER_OUTRING_SETTLE_MS
+	 *
+	 */
+	void _settleOutRing();
+
+
+	/** Ejecuta un paso de la recuperación de la configuración desde memoria NV. Al finalizar el último paso
+	 *  valida los datos y, si no son correctos, establece la configuración por defecto
+	 *
+	 * @param step Paso a ejecutar (BootStepFlags .. BootStepCheck)
+	 */
+	void _restoreConfigStep(uint8_t step);
+
+
+	/** Actualiza la instantánea del estado a partir de '_lightdata.stat'. Debe invocarse desde el hilo de
+	 *  LightManager tras cualquier cambio en el estado
+	 *
+	 */
+	void _commitSnapshot();
+
+
+	/** Responde a una solicitud de estado desde la instantánea, en el contexto del hilo que la publica. No adquiere
+	 *  ningún recurso compartido con el hilo de LightManager, por lo que no espera a su procesamiento
+	 *
+	 * @param idTrans Identificador de la transacción
+	 * @param err Errores de la decodificación de la solicitud
+	 * @param slim True para responder con LightSlimResponse_t en "stat/level"
+	 */
+	void _publishStatSnapshot(uint32_t idTrans, const Blob::ErrorData_t& err, bool slim);
+
+
+	/** Publica, en formato JSON o CBOR según el soporte activo, una respuesta con el estado de la instantánea
+	 *
+	 * @param pub_topic Topic de publicación
+	 * @param idTrans Identificador de la transacción
+	 * @param err Resultado de la operación
+	 */
+	void _publishSnapshotResponse(const char* pub_topic, uint32_t idTrans, const Blob::ErrorData_t& err);
+
+
+	/** Rechaza una solicitud recibida en JSON o CBOR en un topic que sólo admite formato blob, respondiendo en
+	 *  "stat/$TOKEN" con ErrRangeValue y el estado de la instantánea (ej: "set/meter" -> "stat/meter")
+	 *
+	 * @param topic Topic de la solicitud
+	 * @param msg Mensaje recibido
+	 * @param msg_len Tamaño del mensaje
+	 * @param json True si el mensaje es un objeto JSON, False si es CBOR
+	 */
+	void _publishFormatError(const char* topic, void* msg, uint16_t msg_len, bool json);
+
+
+	/** Publica la respuesta a una solicitud compacta en "stat/$TOKEN"
+	 *
+	 * @param token Token de la solicitud (ej: "level")
+	 * @param idTrans Identificador de la transacción
+	 * @param code Resultado de la operación
+	 */
+	void _publishSlimResponse(const char* token, uint32_t idTrans, Blob::ErrorCode code);
+
+
+	/** Publica en "stat/schedule" las próximas transiciones de la salida
+	 *
+	 * @param req Solicitud recibida en "get/schedule"
+	 */
+	void _publishSchedule(const Blob::LightScheduleRequest_t& req);
+
+
+	/** Copia una solicitud compacta y la postea en la cola de la máquina de estados
+	 *
+	 * @param sig Evento a postear
+	 * @param msg Solicitud recibida
+	 * @param msg_len Tamaño de la solicitud
+	 */
+	void _postSlimRequest(uint32_t sig, const void* msg, uint16_t msg_len);
+
+
+	/** Decodifica un mensaje recibido en un topic local y lo postea en la máquina de estados. El formato se
+	 *  indica en cada llamada, de forma que el simulador pueda inyectar blobs sin alterar el del tráfico en curso
+	 *
+	 * @param topic Identificador del topic
+	 * @param msg Mensaje recibido
+	 * @param msg_len Tamaño del mensaje
+	 * @param json Flag para decodificar el mensaje en formato JSON
+	 * @param cbor Flag para decodificar el mensaje en formato CBOR
+	 */
+	void _dispatchMessage(const char* topic, void* msg, uint16_t msg_len, bool json, bool cbor);
+
 };
      
 #endif /*__LightManager__H */
@@ -4,9 +4,9 @@
  *  Created on: Ene 2018
  *      Author: raulMrello
  *
- *	LightManagerBlob es el componente del mdulo LightManager en el que se definen los objetos y tipos relativos a
- *	los objetos BLOB de este mdulo.
- *	Todos los tipos definidos en este componente estn asociados al namespace "Blob", de forma que puedan ser
+ *	LightManagerBlob es el componente del módulo LightManager en el que se definen los objetos y tipos relativos a
+ *	los objetos BLOB de este módulo.
+ *	Todos los tipos definidos en este componente están asociados al namespace "Blob", de forma que puedan ser
  *	accesibles mediante el uso de: "Blob::"  e importando este archivo de cabecera.
  */
  
@@ -16,7 +16,7 @@
 #include "Blob.h"
 #include "mbed.h"
 
-/** Incluye referencia a este mdulo para hacer uso de los eventos temporales <CalendarClockEvt...> */
+/** Incluye referencia a este módulo para hacer uso de los eventos temporales <CalendarClockEvt...> */
 #include "calendar_objects.h"
   
 
@@ -24,31 +24,31 @@
 #define VERS_LIGHT_YTL			0
 
 
-/** Seleccin de la versin utilizada 	*/
-/** DEFINIR SEGN APLICACIN 			*/
+/** Selección de la versión utilizada 	*/
+/** DEFINIR SEGÚN APLICACIÓN 			*/
 #define VERS_LIGHT_SELECTED		VERS_LIGHT_YTL /*otras opciones*/
 
-/** Macro de generacin de UIDs*/
+/** Macro de generación de UIDs*/
 #define UID_LIGHT_MANAGER		(uint32_t)(0x00000005 | ((uint32_t)VERS_LIGHT_SELECTED << 20))
 
 namespace Blob {
 
-/** Valor para identificar acciones vacas, cuyo id es invlido y por lo tanto descartables */
+/** Valor para identificar acciones vacías, cuyo id es inválido y por lo tanto descartables */
 static const int8_t LightInvalidActionId = -1;
 
-/** Nmero de puntos de la curva de activacin de la carga */
+/** Número de puntos de la curva de activación de la carga */
 static const uint8_t LightCurveSampleCount = 11;
 
 
-/** Tamao mximo de los parmetros textuales */
+/** Tamaño máximo de los parámetros textuales */
 static const uint16_t LightTextParamLength = 32;
 
 
-/** Flags para la configuracin de notificaciones de un objeto LightManager cuando su configuracin se ha
+/** Flags para la configuración de notificaciones de un objeto LightManager cuando su configuración se ha
  *  modificado.
  */
  enum LightUpdFlags{
-	 EnableLightCfgUpdNotif = (1 << 0),	/// Flag activado para notificar cambios en la configuracin en bloque del objeto
+	 EnableLightCfgUpdNotif = (1 << 0),	/// Flag activado para notificar cambios en la configuración en bloque del objeto
  };
 
 
@@ -58,14 +58,15 @@ static const uint16_t LightTextParamLength = 32;
 	 LightNoEvents          = 0,			//!< No hay eventos
  	 LightOutOnEvt			= (1 << 0),		//!< Evento al activar la salida
 	 LightOutOffEvt			= (1 << 1),		//!< Evento al desactivar la salida
-	 LightOutLevelChangeEvt = (1 << 2),		//!< Evento al cambiar el nivel de activacin de la salida
+	 LightOutLevelChangeEvt = (1 << 2),		//!< Evento al cambiar el nivel de activación de la salida
+	 LightLateActionEvt		= (1 << 3),		//!< Evento al ejecutar una acción programada con un retraso superior al umbral o al perderla
   };
 
 
- /** Estructuras de datos para la configuracin de rangos de funcionamiento min-max del sensor ALS
+ /** Estructuras de datos para la configuración de rangos de funcionamiento min-max del sensor ALS
   * 	Se forma por diferentes estructuras y tips
   * 	@struct LightMinMax_t Estructura para definir un par min-max
-  * 	@struct LightMinMax_t Estructura de configuracin del sensor ALS
+  * 	@struct LightMinMax_t Estructura de configuración del sensor ALS
   */
 typedef uint32_t LightLuxLevel;
 struct __packed LightMinMax_t{
@@ -79,43 +80,45 @@ struct __packed LightAlsData_t{
 
 
 
-/** Estructuras de datos para la configuracin de la salida
- * 	@enum LightOutModeFlags Flags de seleccin del modo de control de luminaria
- * 	@enum LightActionFlags Flags de configuracin de una acccin sobre la luminaria
- * 	@struct LigthAction_t Estructura que define una accin a realizar sobre la luminaria
- * 	@struct LightCurve_t Estructura que define la curva de activacin (lineal, logartmica, etc...)
- * 	@struct LightOutData_t Estructura de configuracin de la salida de control de la luminaria
+/** Estructuras de datos para la configuración de la salida
+ * 	@enum LightOutModeFlags Flags de selección del modo de control de luminaria
+ * 	@enum LightActionFlags Flags de configuración de una accción sobre la luminaria
+ * 	@struct LigthAction_t Estructura que define una acción a realizar sobre la luminaria
+ * 	@struct LightCurve_t Estructura que define la curva de activación (lineal, logarítmica, etc...)
+ * 	@struct LightOutData_t Estructura de configuración de la salida de control de la luminaria
  */
 enum LightOutModeFlags {
-	 LightOutRelayNA = (1 << 0),		//!< Salida de rel normalmente abierto
-	 LightOutRelayNC = (1 << 1),		//!< Salida de rel normalmente cerrado
+	 LightOutRelayNA = (1 << 0),		//!< Salida de relé normalmente abierto
+	 LightOutRelayNC = (1 << 1),		//!< Salida de relé normalmente cerrado
 	 LightOutDali	 = (1 << 2),		//!< Salida de control por comandos DALI
 	 LightOutPwm	 = (1 << 3),		//!< Salida de control por pwm
 	 LightOut010	 = (1 << 4),		//!< Salida de control por voltaje 0-10V
 };
 enum LightActionFlags {
-	LightNoActions 		= 0,			//!< No hay flags de accin
-	LightActionSun 		= (1 << 0),		//!< Accin asociada al domingo
-	LightActionSat 		= (1 << 1),		//!< Accin asociada al sbado
-	LightActionFri 		= (1 << 2),		//!< Accin asociada al viernes
-	LightActionThr 		= (1 << 3),		//!< Accin asociada al jueves
-	LightActionWed 		= (1 << 4),		//!< Accin asociada al mircoles
-	LightActionTue 		= (1 << 5),		//!< Accin asociada al martes
-	LightActionMon 		= (1 << 6),		//!< Accin asociada al lunes
-	LightActionPeriod0 	= (1 << 7),		//!< Accin asociada al periodo 0
-	LightActionPeriod1 	= (1 << 8),		//!< Accin asociada al periodo 1
-	LightActionPeriod2 	= (1 << 9),		//!< Accin asociada al periodo 2
-	LightActionPeriod3 	= (1 << 10),	//!< Accin asociada al periodo 3
-	LightActionPeriod4 	= (1 << 11),	//!< Accin asociada al periodo 4
-	LightActionPeriod5 	= (1 << 12),	//!< Accin asociada al periodo 5
-	LightActionPeriod6 	= (1 << 13),	//!< Accin asociada al periodo 6
-	LightActionPeriod7 	= (1 << 14),	//!< Accin asociada al periodo 7
-	LightActionFixTime 	= (1 << 15),	//!< Accin asociada a una hora prefijada
-	LightActionFixDate 	= (1 << 16),	//!< Accin asociada a una fecha (ddMM) concreta
-	LightActionDawn	 	= (1 << 17),	//!< Accin asociada al orto
-	LightActionDusk	 	= (1 << 18),	//!< Accin asociada al ocaso
-	LightActionAls	 	= (1 << 19),	//!< Accin asociada al sensor
-	LighActionAlsActive = (1 << 20),	//!< Accin asociada al sensor, activa
+	LightNoActions 		= 0,			//!< No hay flags de acción
+	LightActionSun 		= (1 << 0),		//!< Acción asociada al domingo
+	LightActionSat 		= (1 << 1),		//!< Acción asociada al sábado
+	LightActionFri 		= (1 << 2),		//!< Acción asociada al viernes
+	LightActionThr 		= (1 << 3),		//!< Acción asociada al jueves
+	LightActionWed 		= (1 << 4),		//!< Acción asociada al miércoles
+	LightActionTue 		= (1 << 5),		//!< Acción asociada al martes
+	LightActionMon 		= (1 << 6),		//!< Acción asociada al lunes
+	LightActionPeriod0 	= (1 << 7),		//!< Acción asociada al periodo 0
+	LightActionPeriod1 	= (1 << 8),		//!< Acción asociada al periodo 1
+	LightActionPeriod2 	= (1 << 9),		//!< Acción asociada al periodo 2
+	LightActionPeriod3 	= (1 << 10),	//!< Acción asociada al periodo 3
+	LightActionPeriod4 	= (1 << 11),	//!< Acción asociada al periodo 4
+	LightActionPeriod5 	= (1 << 12),	//!< Acción asociada al periodo 5
+	LightActionPeriod6 	= (1 << 13),	//!< Acción asociada al periodo 6
+	LightActionPeriod7 	= (1 << 14),	//!< Acción asociada al periodo 7
+	LightActionFixTime 	= (1 << 15),	//!< Acción asociada a una hora prefijada
+	LightActionFixDate 	= (1 << 16),	//!< Acción asociada a una fecha (ddMM) concreta
+	LightActionDawn	 	= (1 << 17),	//!< Acción asociada al orto
+	LightActionDusk	 	= (1 << 18),	//!< Acción asociada al ocaso
+	LightActionAls	 	= (1 << 19),	//!< Acción asociada al sensor
+	LighActionAlsActive = (1 << 20),	//!< Acción asociada al sensor, activa
+	LightActionCalendar = (1 << 21),	//!< Acción asociada a los días de un calendario (índice en <date>)
+	LightActionCalendarExcl = (1 << 22),//!< Junto con LightActionCalendar, la acción se excluye en los días del calendario
 };
 
 
@@ -136,13 +139,13 @@ enum LightKeyNames{
 
 
 struct __packed LightAction_t {
-	int8_t id;							//!< Identificador de la accin
-	LightActionFlags flags;				//!< Flags de control de la accin a realizar
-	uint16_t date;						//!< Fecha ddMM para activar la accin
-	uint16_t time; 						//!< Hora fija de activacin (min. da)
-	int8_t astCorr;						//!< Correccin sobre el hito astronmico en caso de estar habilitado
-	LightMinMax_t luxLevel;				//!< Nivel de luminosidad a partir de la cual se activar
-	int8_t outValue;					//!< Valor de salida 0:Off, 1..99:Dimm, 100:On, -1:Accin Desactivada
+	int8_t id;							//!< Identificador de la acción
+	LightActionFlags flags;				//!< Flags de control de la acción a realizar
+	uint16_t date;						//!< Fecha ddMM para activar la acción
+	uint16_t time; 						//!< Hora fija de activación (min. día)
+	int8_t astCorr;						//!< Corrección sobre el hito astronómico en caso de estar habilitado
+	LightMinMax_t luxLevel;				//!< Nivel de luminosidad a partir de la cual se activará
+	int8_t outValue;					//!< Valor de salida 0:Off, 1..99:Dimm, 100:On, -1:Acción Desactivada
 };
 enum LightActionValueRanges{
 	LightActionDateMin = 1,
@@ -151,34 +154,57 @@ enum LightActionValueRanges{
 	LightActionAstCorrMax = 1439,
 	LightActionOutMax = 100
 };
+
+/** Calendarios con nombre (festivos, temporadas, etc...) referenciados por las acciones con el flag
+ *  LightActionCalendar. Cada calendario es un mapa de bits de 366 días, en el que el día ddMM ocupa siempre la
+ *  misma posición (la de un año bisiesto), obtenida mediante <getCalendarDay>
+ */
+static const uint8_t MaxCalendars = 8;
+static const uint8_t LightCalendarNameLen = 12;
+static const uint8_t LightCalendarWords = (366 + 31) / 32;
+struct __packed LightCalendar_t {
+	char name[LightCalendarNameLen];			//!< Nombre del calendario
+	uint32_t days[LightCalendarWords];			//!< Mapa de bits de los días incluidos
+};
+
+/** Obtiene la posición de un día en el mapa de bits de un calendario
+ * 	@param mon Mes (0..11)
+ * 	@param mday Día del mes (1..31)
+ * 	@return Posición (0..365)
+ */
+inline uint16_t getCalendarDay(int mon, int mday){
+	static const uint16_t first[12] = {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335};
+	return first[mon] + (mday - 1);
+}
+
 struct __packed LightCurve_t {
-	uint16_t samples;					//!< Nmero de datos de la curva de activacin de la luminaria
-	int8_t data[LightCurveSampleCount];	//!< datos con la curva de activacin (valores +-100) siendo 100 = 1.00f
+	uint16_t samples;					//!< Número de datos de la curva de activación de la luminaria
+	int8_t data[LightCurveSampleCount];	//!< datos con la curva de activación (valores +-100) siendo 100 = 1.00f
 };
 
-/** Mximo nmero de acciones en el array de la estructura LightOutData_t. Para aprovechar el mximo nmero de acciones en la
- *  trama de configuracin LightCfgData_t, hay que calcular el espacio disponible, para ello se calcula la variable
- *  MaxAllowedActionDataInArray en funcin de la trama actual LightOutData_t y la de envo con mayor tamao, en este caso
+/** Máximo número de acciones en el array de la estructura LightOutData_t. Para aprovechar el máximo número de acciones en la
+ *  trama de configuración LightCfgData_t, hay que calcular el espacio disponible, para ello se calcula la variable
+ *  MaxAllowedActionDataInArray en función de la trama actual LightOutData_t y la de envío con mayor tamaño, en este caso
  *  es LightCfgData_t
  */
 //static const uint32_t MaxAllowedActionDataInArray = (Blob::MaxBlobSize - sizeof(LightAlsData_t) - sizeof(uint8_t) - sizeof(LightCurve_t) - (3 * sizeof(uint32_t)))/sizeof(LightAction_t);
 static const uint32_t MaxAllowedActionDataInArray = 20;
 
 struct __packed LightOutData_t{
-	LightOutModeFlags mode;				//!< Flags de seleccin del modo de funcionamiento
-	LightCurve_t curve;					//!< Curva de activacin
-	uint8_t numActions;					//!< Nmero de acciones en el array
+	LightOutModeFlags mode;				//!< Flags de selección del modo de funcionamiento
+	LightCurve_t curve;					//!< Curva de activación
+	uint8_t numActions;					//!< Número de acciones en el array
 	LightAction_t actions[MaxAllowedActionDataInArray];			//!< Array de acciones
 };
 
 
-/** Estructura de datos para la configuracin en bloque del objeto LightManager.
- * 	Se forma por las distintas estructuras de datos de configuracin
- * 	@var updFlags Flags de configuracin de notificacin de cambios de configuracin
- * 	@var evtFlags Flags de configuracin de notificacin de eventos
+/** Estructura de datos para la configuración en bloque del objeto LightManager.
+ * 	Se forma por las distintas estructuras de datos de configuración
+ * 	@var updFlags Flags de configuración de notificación de cambios de configuración
+ * 	@var evtFlags Flags de configuración de notificación de eventos
  * 	@var alsData Datos de ajuste del sensor ALS
  * 	@var outData Datos de ajuste de la salida de control
- * 	@var verbosity Nivel de depuracin
+ * 	@var verbosity Nivel de depuración
  */
 struct __packed LightCfgData_t{
 	LightUpdFlags updFlagMask;
@@ -191,8 +217,8 @@ struct __packed LightCfgData_t{
 
 
 /** Estructura de estado del objeto LightManager notificada tras una medida, una alarma, evento, etc...
- * 	Se forma por las distintas estructuras de datos de configuracin
- * 	@var cfg Configuracin actualizada
+ * 	Se forma por las distintas estructuras de datos de configuración
+ * 	@var cfg Configuración actualizada
  * 	@var flags Flags de estado
  * 	@var outValue Valor de la salida de control
  */
@@ -213,6 +239,161 @@ struct __packed LightBootData_t{
 
 typedef calendar_clock LightTimeData_t;
 
+
+/** Hora local para las actualizaciones compactas en "set/time". El resto de datos del calendario se conservan
+ *  de la última actualización completa y el orto y ocaso se calculan localmente a partir de la geolocalización
+ */
+typedef time_t LightLocaltime_t;
+
+
+/** Solicitudes compactas, alternativas a SetRequest_t<light_manager>, para las operaciones que sólo modifican
+ *  una parte del objeto. Se reciben en su propio topic y únicamente en formato blob.
+ * 	@struct LightLevelRequest_t Solicitud de cambio de la salida en "set/level"
+ * 	@struct LightActionRequest_t Solicitud de alta de una acción en "set/action"
+ * 	@struct LightActionClrRequest_t Solicitud de borrado de una acción en "set/actclr"
+ * 	@struct LightSectionRequest_t Solicitud de actualización de una sección de la configuración en "set/section"
+ * 	@struct LightCalendarRequest_t Solicitud de actualización de un calendario en "set/calendar"
+ * 	@struct LightScheduleRequest_t Solicitud de las próximas transiciones de la salida en "get/schedule"
+ * 	@struct LightSlimResponse_t Respuesta a cualquiera de las solicitudes anteriores en "stat/$TOKEN"
+ */
+struct __packed LightLevelRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t outValue;					//!< Nuevo valor de la salida
+};
+struct __packed LightActionRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t pos;						//!< Posición de la acción (debe coincidir con su identificador)
+	LightAction_t action;				//!< Acción a registrar
+};
+struct __packed LightActionClrRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t pos;						//!< Posición de la acción a borrar
+};
+struct __packed LightSectionRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t _keys;						//!< Sección que se actualiza (una única LightKeyNames salvo LightKeyCfgActs)
+	union __packed {
+		LightUpdFlags updFlagMask;
+		LightEvtFlags evtFlagMask;
+		LightAlsData_t alsData;
+		LightOutModeFlags mode;
+		LightCurve_t curve;
+		esp_log_level_t verbosity;
+	}data;								//!< Datos de la sección, la trama sólo incluye el tamaño de la sección
+};
+struct __packed LightCalendarRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t index;						//!< Índice del calendario
+	LightCalendar_t calendar;			//!< Calendario
+};
+struct __packed LightScheduleRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint8_t count;						//!< Número de transiciones solicitadas
+};
+struct __packed LightSlimResponse_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	ErrorCode code;						//!< Resultado de la operación
+	LightStatData_t stat;				//!< Estado actual de la salida
+};
+
+/** Respuesta a "get/schedule" en "stat/schedule". La trama sólo incluye las <count> primeras transiciones
+ * 	@struct LightTransition_t Cambio previsto de la salida
+ * 	@struct LightScheduleResponse_t Respuesta con las próximas transiciones
+ */
+static const uint8_t MaxScheduleTransitions = 16;
+struct __packed LightTransition_t{
+	uint32_t time;						//!< Instante de ejecución (hora local)
+	int8_t id;							//!< Identificador de la acción
+	uint8_t outValue;					//!< Nuevo valor de la salida
+};
+struct __packed LightScheduleResponse_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	ErrorCode code;						//!< Resultado de la operación
+	uint8_t count;						//!< Número de transiciones
+	LightTransition_t items[MaxScheduleTransitions];	//!< Transiciones ordenadas por instante de ejecución
+};
+
+/** Medida de uso de la salida, consultada en "get/meter" y respondida en "stat/meter"
+ * 	@struct LightMeterData_t Contadores acumulados desde la instalación
+ * 	@struct LightMeterCfg_t Parámetros de la estimación de energía, actualizables en "set/meter"
+ * 	@struct LightMeterCfgRequest_t Solicitud de actualización de los parámetros en "set/meter"
+ * 	@struct LightMeterResponse_t Respuesta con los parámetros y los contadores
+ */
+struct __packed LightMeterData_t{
+	uint64_t onMs;						//!< Tiempo con la salida activa (ms)
+	uint64_t levelMs;					//!< Integral del nivel aplicado (0..100, tras curva y limitación) por el tiempo (ms)
+	uint64_t energyMj;					//!< Energía estimada (mJ)
+	uint32_t switchCount;				//!< Número de encendidos (Off -> On/Dim)
+};
+struct __packed LightMeterCfg_t{
+	uint16_t ratedPower;				//!< Potencia nominal de la luminaria (W)
+	LightCurve_t powerCurve;			//!< Potencia (%) en función del nivel tras la curva de activación. Lineal si está incompleta
+};
+struct __packed LightMeterCfgRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	LightMeterCfg_t cfg;				//!< Nuevos parámetros
+};
+struct __packed LightMeterResponse_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	ErrorCode code;						//!< Resultado de la operación
+	LightMeterCfg_t cfg;				//!< Parámetros de la estimación
+	LightMeterData_t data;				//!< Contadores
+};
+
+/** Límite de potencia de la instalación, actualizable en "set/powercap" y consultable en "get/powercap"
+ * 	@struct LightPowerCapRequest_t Solicitud de actualización del límite
+ * 	@struct LightPowerCapResponse_t Respuesta publicada en "stat/powercap"
+ */
+struct __packed LightPowerCapRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint32_t capW;						//!< Límite de potencia en W (0: sin límite)
+};
+struct __packed LightPowerCapResponse_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	ErrorCode code;						//!< Resultado de la operación
+	uint32_t capW;						//!< Límite de potencia en W (0: sin límite)
+	uint32_t demandW;					//!< Demanda total de la instalación sin limitar (W)
+	uint8_t priority;					//!< Prioridad de la luminaria (0: máxima)
+	uint16_t factor;					//!< Factor de potencia asignado a su prioridad (por mil)
+};
+
+/** Retraso de ejecución de las acciones programadas, consultado en "get/latency" y respondido en "stat/latency"
+ * 	@struct LightLatencyStats_t Histograma del retraso entre el instante previsto de cada acción (incluidas las
+ * 	correcciones astronómicas) y la aplicación de la salida. Las acciones cuyo instante queda atrás sin ejecutarse
+ * 	se cuentan como perdidas o, si se aplican tras un salto horario, se miden con su retraso real
+ * 	@struct LightLatencyCfgRequest_t Solicitud de actualización del umbral de alerta en "set/latency"
+ * 	@struct LightLatencyResponse_t Respuesta con el umbral y el histograma
+ */
+static const uint8_t LightLatencyBins = 8;
+struct __packed LightLatencyStats_t{
+	uint32_t bins[LightLatencyBins];	//!< Acciones por tramo de retraso: <1s, <2s, <5s, <10s, <30s, <60s, <120s, >=120s
+	uint32_t count;						//!< Acciones medidas
+	uint32_t late;						//!< Acciones con un retraso superior al umbral de alerta
+	uint32_t maxMs;						//!< Retraso máximo (ms)
+	int8_t maxId;						//!< Acción con el retraso máximo
+	int8_t lastId;						//!< Última acción medida
+	uint32_t lastIntended;				//!< Instante previsto de la última acción medida (hora local)
+	uint32_t lastMs;					//!< Retraso de la última acción medida (ms)
+	uint32_t missed;					//!< Acciones cuyo instante ha pasado sin ejecutarse
+};
+struct __packed LightLatencyCfgRequest_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	uint32_t alertMs;					//!< Umbral de alerta (ms, 0: deshabilitada)
+	uint8_t reset;						//!< 1: borra el histograma
+};
+struct __packed LightLatencyResponse_t{
+	uint32_t idTrans;					//!< Identificador de la transacción
+	ErrorCode code;						//!< Resultado de la operación
+	uint32_t alertMs;					//!< Umbral de alerta (ms, 0: deshabilitada)
+	LightLatencyStats_t stats;			//!< Histograma
+};
+
+/** Tamaño de la cabecera de LightScheduleResponse_t, previa a las transiciones */
+static const uint16_t LightScheduleHeaderSize = sizeof(uint32_t) + sizeof(ErrorCode) + sizeof(uint8_t);
+
+/** Tamaño de la cabecera de LightSectionRequest_t, previa a los datos de la sección */
+static const uint16_t LightSectionHeaderSize = sizeof(uint32_t) + sizeof(uint8_t);
+
 }	// end namespace Blob
 
 typedef Blob::LightBootData_t light_manager;
@@ -229,8 +410,8 @@ namespace JSON {
 cJSON* getJsonFromLightManager(const Blob::LightBootData_t& obj, ObjDataSelection type);
 
 /**
- * Codifica la configuracin actual en un objeto JSON
- * @param cfg Configuracin
+ * Codifica la configuración actual en un objeto JSON
+ * @param cfg Configuración
  * @return Objeto JSON o NULL en caso de error
  */
 cJSON* getJsonFromLightCfg(const Blob::LightCfgData_t& cfg);
@@ -243,8 +424,8 @@ cJSON* getJsonFromLightCfg(const Blob::LightCfgData_t& cfg);
 cJSON* getJsonFromLightStat(const Blob::LightStatData_t& stat);
 
 /**
- * Codifica la configuracin de la clula ALS en un objeto JSON
- * @param lux Configuracin ALS
+ * Codifica la configuración de la célula ALS en un objeto JSON
+ * @param lux Configuración ALS
  * @return Objeto JSON o NULL en caso de error
  */
 cJSON* getJsonFromLightLux(const Blob::LightLuxLevel& lux);
@@ -288,15 +469,15 @@ cJSON* getJsonFromLight(const T& obj, ObjDataSelection type){
  * Decodifica el mensaje JSON en un objeto
  * @param obj Recibe el objeto decodificado
  * @param json Objeto JSON a decodificar
- * @return keys Parmetros decodificados o 0 en caso de error
+ * @return keys Parámetros decodificados o 0 en caso de error
  */
 uint32_t getLightManagerFromJson(Blob::LightBootData_t &obj, cJSON* json);
 
 /**
- * Decodifica el mensaje JSON en un objeto de configuracin
+ * Decodifica el mensaje JSON en un objeto de configuración
  * @param obj Recibe el objeto decodificado
  * @param json Objeto JSON a decodificar
- * @return keys Parmetros decodificados o 0 en caso de error
+ * @return keys Parámetros decodificados o 0 en caso de error
  */
 uint32_t getLightCfgFromJson(Blob::LightCfgData_t &obj, cJSON* json);
 
@@ -304,15 +485,15 @@ uint32_t getLightCfgFromJson(Blob::LightCfgData_t &obj, cJSON* json);
  * Decodifica el mensaje JSON en un objeto de estado
  * @param obj Recibe el objeto decodificado
  * @param json Objeto JSON a decodificar
- * @return keys Parmetros decodificados o 0 en caso de error
+ * @return keys Parámetros decodificados o 0 en caso de error
  */
 uint32_t getLightStatFromJson(Blob::LightStatData_t &obj, cJSON* json);
 
 /**
- * Decodifica el mensaje JSON en un objeto de configuracin ALS
+ * Decodifica el mensaje JSON en un objeto de configuración ALS
  * @param obj Recibe el objeto decodificado
  * @param json Objeto JSON a decodificar
- * @return keys Parmetros decodificados o 0 en caso de error
+ * @return keys Parámetros decodificados o 0 en caso de error
  */
 uint32_t getLightLuxFromJson(Blob::LightLuxLevel &obj, cJSON* json);
 
@@ -320,7 +501,7 @@ uint32_t getLightLuxFromJson(Blob::LightLuxLevel &obj, cJSON* json);
  * Decodifica el mensaje JSON en un evento temporal
  * @param obj Recibe el objeto decodificado
  * @param json Objeto JSON a decodificar
- * @return keys Parmetros decodificados o 0 en caso de error
+ * @return keys Parámetros decodificados o 0 en caso de error
  */
 uint32_t getLightTimeFromJson(Blob::LightTimeData_t &obj, cJSON* json);
 
@@ -336,7 +517,7 @@ uint32_t getLightObjFromJson(T& obj, cJSON* json_obj){
 	if (std::is_same<T, Blob::LightStatData_t>::value){
 		return JSON::getLightStatFromJson((Blob::LightStatData_t&)obj, json_obj);
 	}
-	// decodifica objeto de configuraci�n ALS
+	// decodifica objeto de configuraciï¿½n ALS
 	if (std::is_same<T, Blob::LightLuxLevel>::value){
 		return JSON::getLightLuxFromJson((Blob::LightLuxLevel&)obj, json_obj);
 	}
@@ -351,5 +532,150 @@ uint32_t getLightObjFromJson(T& obj, cJSON* json_obj){
 }	// end namespace JSON
 
 
+namespace CBOR {
+
+/** Tamaño máximo de un objeto LightManager codificado en CBOR */
+static const uint32_t LightCborMaxSize = 1536;
+
+/** Tamaño máximo de la cabecera CBOR de una respuesta (mapa, idTrans, error y clave de datos) */
+static const uint32_t LightCborHeaderMaxSize = 16;
+
+/** Tamaño máximo de una respuesta de estado (ObjSelectState) codificada en CBOR */
+static const uint32_t LightCborStatMaxSize = 64;
+
+/** Claves numéricas de los mapas CBOR */
+enum LightCborKeys{
+	CborKeyIdTrans = 0,
+	CborKeyError,
+	CborKeyData,
+	CborKeyOutValue,
+	CborKeyFlags,
+	CborKeyLuxLevel,
+	CborKeyLocaltime,
+	CborKeyUid,
+	CborKeyCfg,
+	CborKeyStat,
+	CborKeyUpdFlags,
+	CborKeyEvtFlags,
+	CborKeyVerbosity,
+	CborKeyAlsData,
+	CborKeyMin,
+	CborKeyMax,
+	CborKeyThres,
+	CborKeyOutData,
+	CborKeyMode,
+	CborKeyCurve,
+	CborKeyActions,
+	CborKeyId,
+	CborKeyDate,
+	CborKeyTime,
+	CborKeyAstCorr,
+	CborKeyPeriod,
+	CborKeyDawn,
+	CborKeyDusk,
+	CborKeyCoords,
+	CborKeyTimezone,
+};
+
+/**
+ * Codifica el objeto en CBOR
+ * @param obj Objeto
+ * @param type Selección de los datos a codificar
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborFromLightManager(const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size);
+
+/**
+ * Codifica el estado actual en CBOR
+ * @param stat Estado
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborFromLightStat(const Blob::LightStatData_t& stat, uint8_t* buf, uint32_t size);
+
+/**
+ * Codifica una respuesta en CBOR
+ * @param idTrans Identificador de la transacción
+ * @param err Resultado de la operación
+ * @param obj Objeto
+ * @param type Selección de los datos a codificar
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborFromLightResponse(uint32_t idTrans, const Blob::ErrorData_t& err, const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size);
+
+/**
+ * Codifica un evento temporal en CBOR
+ * @param t Evento temporal
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborFromLightTime(const Blob::LightTimeData_t& t, uint8_t* buf, uint32_t size);
+
+/**
+ * Codifica la cabecera de una respuesta (idTrans, error y clave de datos). Concatenada con el resultado de
+ * <getCborFromLightData> forma la misma trama que <getCborFromLightResponse>
+ * @param idTrans Identificador de la transacción
+ * @param err Resultado de la operación
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborResponseHeader(uint32_t idTrans, const Blob::ErrorData_t& err, uint8_t* buf, uint32_t size);
+
+/**
+ * Codifica únicamente el objeto de datos de una respuesta
+ * @param obj Objeto a codificar
+ * @param type Selección de los datos a codificar
+ * @param buf Buffer de salida
+ * @param size Tamaño del buffer
+ * @return Número de bytes codificados o <0 en caso de error
+ */
+int32_t getCborFromLightData(const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size);
+
+/**
+ * Decodifica una solicitud SET en CBOR
+ * @param req Recibe la solicitud decodificada
+ * @param buf Mensaje CBOR
+ * @param len Tamaño del mensaje
+ * @return keys Parámetros decodificados o 0 en caso de error
+ */
+uint32_t getLightSetRequestFromCbor(Blob::SetRequest_t<light_manager>& req, const uint8_t* buf, uint32_t len);
+
+/**
+ * Decodifica una solicitud GET en CBOR
+ * @param req Recibe la solicitud decodificada
+ * @param buf Mensaje CBOR
+ * @param len Tamaño del mensaje
+ * @return keys Parámetros decodificados o 0 en caso de error
+ */
+uint32_t getGetRequestFromCbor(Blob::GetRequest_t& req, const uint8_t* buf, uint32_t len);
+
+/**
+ * Decodifica una medida del sensor ALS en CBOR
+ * @param lux Recibe la medida
+ * @param buf Mensaje CBOR
+ * @param len Tamaño del mensaje
+ * @return keys Parámetros decodificados o 0 en caso de error
+ */
+uint32_t getLightLuxFromCbor(Blob::LightLuxLevel& lux, const uint8_t* buf, uint32_t len);
+
+/**
+ * Decodifica un evento temporal en CBOR
+ * @param t Recibe el evento temporal
+ * @param buf Mensaje CBOR
+ * @param len Tamaño del mensaje
+ * @return keys Parámetros decodificados o 0 en caso de error
+ */
+uint32_t getLightTimeFromCbor(Blob::LightTimeData_t& t, const uint8_t* buf, uint32_t len);
+
+}	// end namespace CBOR
+
+
 
 #endif
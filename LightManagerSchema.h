@@ -0,0 +1,285 @@
+/*
+ * LightManagerSchema.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	LightManagerSchema describe en un único lugar los campos de los objetos de LightManager: nombre JSON, sección
+ *	(LightKeyNames) que actualizan, clave en memoria NV y valor máximo admitido. A partir de esta descripción se
+ *	generan los codecs JSON (LightManager_Json.cpp), la persistencia (LightManager_NVStore.cpp) y el tratamiento de
+ *	las secciones de configuración (_keys), de forma que añadir o modificar un campo sólo requiere actualizar su
+ *	descripción.
+ *
+ *	La descripción de cada estructura es una plantilla Desc<T>::visit(v, p) que invoca, en orden y para cada campo:
+ *
+ *		v.field(f, &p->campo): campo escalar (entero o enumerado) o estructura con su propia descripción
+ *
+ *		v.array(f, p->campo, &p->contador): array de <f.max> elementos, de los que se utilizan <*contador>
+ *
+ *	Cada operación es un visitante con esos dos métodos. Al ser plantillas, el compilador expande la descripción en
+ *	código lineal, sin tablas ni búsquedas en tiempo de ejecución. Las estructuras son empaquetadas, por lo que los
+ *	visitantes acceden siempre a los campos mediante memcpy.
+ */
+
+#ifndef __LightManagerSchema__H
+#define __LightManagerSchema__H
+
+#include "LightManagerBlob.h"
+#include "JsonParserBlob.h"
+#include <type_traits>
+
+namespace Schema {
+
+/** Descriptor de un campo */
+struct Field_t {
+	const char* name;					//!< Nombre en JSON
+	uint32_t key;						//!< Sección (LightKeyNames) que actualiza o 0 si no es una sección
+	const char* nvs;					//!< Clave en memoria NV o NULL si no se guarda de forma independiente
+	uint32_t max;						//!< Valor máximo (escalares) o capacidad (arrays). 0: sin límite
+};
+
+
+/** Descripción de una estructura, especializada para cada tipo */
+template<typename T> struct Desc;
+
+
+/** Recorre una estructura anidada, constante o no
+ *
+ * @param v Visitante
+ * @param p Estructura
+ */
+template<typename V, typename T> void visit(V& v, T* p){
+	Desc<typename std::remove_const<T>::type>::visit(v, p);
+}
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightMinMax_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_min, 0, NULL, 0}, &p->min);
+		v.field(Field_t{JsonParser::p_max, 0, NULL, 0}, &p->max);
+		v.field(Field_t{JsonParser::p_thres, 0, NULL, 0}, &p->thres);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightAlsData_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_lux, 0, NULL, 0}, &p->lux);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightCurve_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_samples, 0, NULL, Blob::LightCurveSampleCount}, &p->samples);
+		v.array(Field_t{JsonParser::p_data, 0, NULL, Blob::LightCurveSampleCount}, p->data, &p->samples);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightAction_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_id, 0, NULL, 0}, &p->id);
+		v.field(Field_t{JsonParser::p_flags, 0, NULL, 0}, &p->flags);
+		v.field(Field_t{JsonParser::p_date, 0, NULL, 0}, &p->date);
+		v.field(Field_t{JsonParser::p_time, 0, NULL, 0}, &p->time);
+		v.field(Field_t{JsonParser::p_astCorr, 0, NULL, 0}, &p->astCorr);
+		v.field(Field_t{JsonParser::p_outValue, 0, NULL, 0}, &p->outValue);
+		v.field(Field_t{JsonParser::p_luxLevel, 0, NULL, 0}, &p->luxLevel);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightOutData_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_mode, Blob::LightKeyCfgOutm, "LigOutDatMod", 0}, &p->mode);
+		v.field(Field_t{JsonParser::p_numActions, 0, "LigOutDatNum", Blob::MaxAllowedActionDataInArray}, &p->numActions);
+		v.field(Field_t{JsonParser::p_curve, Blob::LightKeyCfgCurve, "LigOutDatCur", 0}, &p->curve);
+		// las acciones se guardan de una en una desde el scheduler
+		v.array(Field_t{JsonParser::p_actions, Blob::LightKeyCfgActs, NULL, Blob::MaxAllowedActionDataInArray}, p->actions, &p->numActions);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightCfgData_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_updFlags, Blob::LightKeyCfgUpd, "LigUpdFla", 0}, &p->updFlagMask);
+		v.field(Field_t{JsonParser::p_evtFlags, Blob::LightKeyCfgEvt, "LigEvtFla", 0}, &p->evtFlagMask);
+		v.field(Field_t{JsonParser::p_verbosity, Blob::LightKeyCfgVerbosity, "LightVerbosity", 0}, &p->verbosity);
+		v.field(Field_t{JsonParser::p_alsData, Blob::LightKeyCfgAls, "LigAlsDat", 0}, &p->alsData);
+		v.field(Field_t{JsonParser::p_outData, 0, NULL, 0}, &p->outData);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+template<> struct Desc<Blob::LightStatData_t> {
+	template<typename V, typename P> static void visit(V& v, P* p){
+		v.field(Field_t{JsonParser::p_flags, 0, NULL, 0}, &p->flags);
+		v.field(Field_t{JsonParser::p_outValue, 0, NULL, 0}, &p->outValue);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+/** Visitante que obtiene el tamaño de la sección <key>. Los arrays no forman secciones */
+struct SectionSize {
+	uint32_t key;
+	uint16_t size;
+
+	template<typename T> void field(const Field_t& f, T* p){
+		if(f.key != 0 && f.key == key){
+			size = sizeof(T);
+			return;
+		}
+		_nested(p, typename std::is_class<T>::type());
+	}
+	template<typename T, typename C> void array(const Field_t& f, T* items, C* count){}
+
+  private:
+	template<typename T> void _nested(T* p, std::true_type){
+		if(size == 0){
+			visit(*this, p);
+		}
+	}
+	template<typename T> void _nested(T* p, std::false_type){}
+};
+
+
+//------------------------------------------------------------------------------------
+/** Visitante que comprueba los límites de todos los campos */
+struct Validate {
+	bool ok;
+
+	template<typename T> void field(const Field_t& f, T* p){
+		_check(f, p, typename std::is_class<T>::type());
+	}
+	template<typename T, typename C> void array(const Field_t& f, T* items, C* count){
+		C n;
+		memcpy(&n, count, sizeof(C));
+		ok = ok && ((uint32_t)n <= f.max);
+	}
+
+  private:
+	template<typename T> void _check(const Field_t& f, T* p, std::true_type){
+		visit(*this, p);
+	}
+	template<typename T> void _check(const Field_t& f, T* p, std::false_type){
+		T v;
+		memcpy(&v, p, sizeof(T));
+		ok = ok && (f.max == 0 || (int64_t)v <= (int64_t)f.max);
+	}
+};
+
+
+//------------------------------------------------------------------------------------
+/** Visitante que escribe la sección <key> desde <src>, validándola previamente */
+struct SectionWrite {
+	uint32_t key;
+	const void* src;
+	bool done;
+	bool ok;
+
+	template<typename T> void field(const Field_t& f, T* p){
+		if(done){
+			return;
+		}
+		if(f.key != 0 && f.key == key){
+			done = true;
+			T v;
+			memcpy(&v, src, sizeof(T));
+			Validate chk = {true};
+			chk.field(f, &v);
+			if((ok = chk.ok)){
+				memcpy(p, &v, sizeof(T));
+			}
+			return;
+		}
+		_nested(p, typename std::is_class<T>::type());
+	}
+	template<typename T, typename C> void array(const Field_t& f, T* items, C* count){}
+
+  private:
+	template<typename T> void _nested(T* p, std::true_type){
+		visit(*this, p);
+	}
+	template<typename T> void _nested(T* p, std::false_type){}
+};
+
+
+//------------------------------------------------------------------------------------
+/** Visitante que copia de <src> las secciones incluidas en <keys>. Los arrays los trata el llamante */
+struct KeyCopy {
+	uint8_t* dst;
+	const uint8_t* src;
+	uint32_t keys;
+
+	template<typename T> void field(const Field_t& f, T* p){
+		if(f.key != 0 && (f.key & keys) != 0){
+			memcpy(p, src + ((uint8_t*)p - dst), sizeof(T));
+			return;
+		}
+		_nested(p, typename std::is_class<T>::type());
+	}
+	template<typename T, typename C> void array(const Field_t& f, T* items, C* count){}
+
+  private:
+	template<typename T> void _nested(T* p, std::true_type){
+		visit(*this, p);
+	}
+	template<typename T> void _nested(T* p, std::false_type){}
+};
+
+
+//------------------------------------------------------------------------------------
+/** Obtiene el tamaño de una sección de un objeto
+ *
+ * @param obj Objeto (no se accede a sus datos)
+ * @param key Sección (LightKeyNames)
+ * @return Tamaño o 0 si no es una sección
+ */
+template<typename T> uint16_t getSectionSize(const T& obj, uint32_t key){
+	SectionSize v = {key, 0};
+	visit(v, &obj);
+	return v.size;
+}
+
+
+/** Actualiza una sección de un objeto si sus datos están dentro de rango
+ *
+ * @param obj Objeto
+ * @param key Sección (LightKeyNames)
+ * @param src Datos de la sección
+ * @return True si se ha actualizado, False si no es una sección o está fuera de rango
+ */
+template<typename T> bool setSection(T& obj, uint32_t key, const void* src){
+	SectionWrite v = {key, src, false, false};
+	visit(v, &obj);
+	return (v.done && v.ok);
+}
+
+
+/** Copia las secciones indicadas de un objeto a otro, salvo los arrays
+ *
+ * @param dst Objeto destino
+ * @param src Objeto origen
+ * @param keys Secciones (LightKeyNames)
+ */
+template<typename T> void copyKeys(T& dst, const T& src, uint32_t keys){
+	KeyCopy v = {(uint8_t*)&dst, (const uint8_t*)&src, keys};
+	visit(v, &dst);
+}
+
+}	// end namespace Schema
+
+#endif /*__LightManagerSchema__H */
+
+/**** END OF FILE ****/
+
+
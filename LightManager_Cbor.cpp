@@ -0,0 +1,824 @@
+/*
+ * LightManager_Cbor.cpp
+ *
+ * Implementación de los codecs CBOR-OBJ. Los objetos se codifican como mapas CBOR con claves numéricas
+ * (ver CBOR::LightCborKeys) sobre un buffer proporcionado por el llamante, sin reservas de memoria.
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "LightManagerBlob.h"
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[LightM]........";
+#define _EXPR_	(true)
+
+
+/** Tipos mayores CBOR (RFC 7049) */
+enum CborMajorType{
+	CborUint 	= 0,
+	CborNegInt	= 1,
+	CborBytes	= 2,
+	CborText	= 3,
+	CborArray	= 4,
+	CborMap		= 5,
+	CborTag		= 6,
+	CborSimple	= 7,
+};
+
+
+/** Máximo anidamiento de los elementos desconocidos que se descartan al decodificar */
+static const uint8_t CborMaxSkipDepth = 8;
+
+
+/** Codificador sobre un buffer de tamaño fijo */
+struct CborWriter{
+	uint8_t* buf;
+	uint32_t size;
+	uint32_t pos;
+	bool err;
+};
+
+
+/** Decodificador sobre un buffer de tamaño fijo */
+struct CborReader{
+	const uint8_t* buf;
+	uint32_t len;
+	uint32_t pos;
+	bool err;
+};
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE FUNCTIONS ---------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+static void putHead(CborWriter& w, uint8_t major, uint64_t val){
+	uint8_t hdr = major << 5;
+	uint8_t n;
+	if(val < 24){
+		n = 0;
+		hdr |= val;
+	}
+	else if(val <= 0xFF){
+		n = 1;
+		hdr |= 24;
+	}
+	else if(val <= 0xFFFF){
+		n = 2;
+		hdr |= 25;
+	}
+	else if(val <= 0xFFFFFFFF){
+		n = 4;
+		hdr |= 26;
+	}
+	else{
+		n = 8;
+		hdr |= 27;
+	}
+	if(w.err || w.pos + 1 + n > w.size){
+		w.err = true;
+		return;
+	}
+	w.buf[w.pos++] = hdr;
+	while(n > 0){
+		n--;
+		w.buf[w.pos++] = (uint8_t)(val >> (8 * n));
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+static void putInt(CborWriter& w, int64_t val){
+	if(val >= 0){
+		putHead(w, CborUint, (uint64_t)val);
+	}
+	else{
+		putHead(w, CborNegInt, (uint64_t)(-1 - val));
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+static void putKeyInt(CborWriter& w, uint8_t key, int64_t val){
+	putHead(w, CborUint, key);
+	putInt(w, val);
+}
+
+
+//------------------------------------------------------------------------------------
+static void putText(CborWriter& w, const char* str, uint32_t max){
+	uint32_t len = strnlen(str, max);
+	putHead(w, CborText, len);
+	if(w.err || w.pos + len > w.size){
+		w.err = true;
+		return;
+	}
+	memcpy(&w.buf[w.pos], str, len);
+	w.pos += len;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getHead(CborReader& r, uint8_t& major, uint64_t& val){
+	if(r.err || r.pos >= r.len){
+		r.err = true;
+		return false;
+	}
+	uint8_t hdr = r.buf[r.pos++];
+	major = hdr >> 5;
+	uint8_t ai = hdr & 0x1F;
+	if(ai < 24){
+		val = ai;
+		return true;
+	}
+	// no se admiten longitudes indefinidas
+	uint8_t n = (ai == 24)? 1 : (ai == 25)? 2 : (ai == 26)? 4 : (ai == 27)? 8 : 0;
+	if(n == 0 || r.pos + n > r.len){
+		r.err = true;
+		return false;
+	}
+	val = 0;
+	while(n > 0){
+		n--;
+		val = (val << 8) | r.buf[r.pos++];
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getInt(CborReader& r, int64_t& val){
+	uint8_t major;
+	uint64_t v;
+	if(!getHead(r, major, v)){
+		return false;
+	}
+	if(major == CborUint){
+		val = (int64_t)v;
+		return true;
+	}
+	if(major == CborNegInt){
+		val = -1 - (int64_t)v;
+		return true;
+	}
+	r.err = true;
+	return false;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getText(CborReader& r, char* str, uint32_t max){
+	uint8_t major;
+	uint64_t v;
+	// el texto debe caber en el destino junto con su terminador
+	if(!getHead(r, major, v) || major != CborText || v >= max || v > r.len - r.pos){
+		r.err = true;
+		return false;
+	}
+	memcpy(str, &r.buf[r.pos], v);
+	str[v] = 0;
+	r.pos += v;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getContainer(CborReader& r, uint8_t type, uint32_t& count){
+	uint8_t major;
+	uint64_t v;
+	if(!getHead(r, major, v) || major != type){
+		r.err = true;
+		return false;
+	}
+	count = (uint32_t)v;
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool skipItem(CborReader& r, uint8_t depth = 0){
+	uint8_t major;
+	uint64_t v;
+	// limita la recursión ante tramas con anidamientos excesivos
+	if(depth > CborMaxSkipDepth){
+		r.err = true;
+		return false;
+	}
+	if(!getHead(r, major, v)){
+		return false;
+	}
+	switch(major){
+		case CborBytes:
+		case CborText:
+			if(v > r.len - r.pos){
+				r.err = true;
+				return false;
+			}
+			r.pos += v;
+			return true;
+		case CborArray:
+			for(uint64_t i=0;i<v;i++){
+				if(!skipItem(r, depth + 1))
+					return false;
+			}
+			return true;
+		case CborMap:
+			for(uint64_t i=0;i<2*v;i++){
+				if(!skipItem(r, depth + 1))
+					return false;
+			}
+			return true;
+		case CborTag:
+			return skipItem(r, depth + 1);
+		default:
+			return true;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+static void putMinMax(CborWriter& w, uint8_t key, const Blob::LightMinMax_t& lux){
+	putHead(w, CborUint, key);
+	putHead(w, CborMap, 3);
+	putKeyInt(w, CBOR::CborKeyMin, lux.min);
+	putKeyInt(w, CBOR::CborKeyMax, lux.max);
+	putKeyInt(w, CBOR::CborKeyThres, lux.thres);
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getMinMax(CborReader& r, Blob::LightMinMax_t& lux){
+	uint32_t n;
+	if(!getContainer(r, CborMap, n)){
+		return false;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return false;
+		}
+		switch(key){
+			case CBOR::CborKeyMin:
+				if(!getInt(r, val)) return false;
+				lux.min = val;
+				break;
+			case CBOR::CborKeyMax:
+				if(!getInt(r, val)) return false;
+				lux.max = val;
+				break;
+			case CBOR::CborKeyThres:
+				if(!getInt(r, val)) return false;
+				lux.thres = val;
+				break;
+			default:
+				if(!skipItem(r)) return false;
+				break;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+static void putCfg(CborWriter& w, const Blob::LightCfgData_t& cfg){
+	putHead(w, CborMap, 5);
+	putKeyInt(w, CBOR::CborKeyUpdFlags, cfg.updFlagMask);
+	putKeyInt(w, CBOR::CborKeyEvtFlags, cfg.evtFlagMask);
+	putKeyInt(w, CBOR::CborKeyVerbosity, cfg.verbosity);
+	putMinMax(w, CBOR::CborKeyAlsData, cfg.alsData.lux);
+
+	// outData
+	putHead(w, CborUint, CBOR::CborKeyOutData);
+	putHead(w, CborMap, 3);
+	putKeyInt(w, CBOR::CborKeyMode, cfg.outData.mode);
+	uint16_t samples = (cfg.outData.curve.samples > Blob::LightCurveSampleCount)? Blob::LightCurveSampleCount : cfg.outData.curve.samples;
+	putHead(w, CborUint, CBOR::CborKeyCurve);
+	putHead(w, CborArray, samples);
+	for(int i=0;i<samples;i++){
+		putInt(w, cfg.outData.curve.data[i]);
+	}
+	uint8_t num = (cfg.outData.numActions > Blob::MaxAllowedActionDataInArray)? Blob::MaxAllowedActionDataInArray : cfg.outData.numActions;
+	putHead(w, CborUint, CBOR::CborKeyActions);
+	putHead(w, CborArray, num);
+	for(int i=0;i<num;i++){
+		const Blob::LightAction_t& act = cfg.outData.actions[i];
+		putHead(w, CborMap, 7);
+		putKeyInt(w, CBOR::CborKeyId, act.id);
+		putKeyInt(w, CBOR::CborKeyFlags, act.flags);
+		putKeyInt(w, CBOR::CborKeyDate, act.date);
+		putKeyInt(w, CBOR::CborKeyTime, act.time);
+		putKeyInt(w, CBOR::CborKeyAstCorr, act.astCorr);
+		putKeyInt(w, CBOR::CborKeyOutValue, act.outValue);
+		putMinMax(w, CBOR::CborKeyLuxLevel, act.luxLevel);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getAction(CborReader& r, Blob::LightAction_t& act){
+	uint32_t n;
+	if(!getContainer(r, CborMap, n)){
+		return false;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val = 0;
+		if(!getInt(r, key)){
+			return false;
+		}
+		if(key == CBOR::CborKeyLuxLevel){
+			if(!getMinMax(r, act.luxLevel)) return false;
+			continue;
+		}
+		if(key != CBOR::CborKeyId && key != CBOR::CborKeyFlags && key != CBOR::CborKeyDate && key != CBOR::CborKeyTime &&
+		   key != CBOR::CborKeyAstCorr && key != CBOR::CborKeyOutValue){
+			if(!skipItem(r)) return false;
+			continue;
+		}
+		if(!getInt(r, val)){
+			return false;
+		}
+		switch(key){
+			case CBOR::CborKeyId:		act.id = val; break;
+			case CBOR::CborKeyFlags:	act.flags = (Blob::LightActionFlags)val; break;
+			case CBOR::CborKeyDate:		act.date = val; break;
+			case CBOR::CborKeyTime:		act.time = val; break;
+			case CBOR::CborKeyAstCorr:	act.astCorr = val; break;
+			default:					act.outValue = val; break;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+static uint32_t getCfg(CborReader& r, Blob::LightCfgData_t& cfg){
+	uint32_t keys = Blob::LightKeyNone;
+	uint32_t n;
+	cfg._keys = 0;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		switch(key){
+			case CBOR::CborKeyUpdFlags:
+				if(!getInt(r, val)) return 0;
+				cfg.updFlagMask = (Blob::LightUpdFlags)val;
+				keys |= Blob::LightKeyCfgUpd;
+				break;
+			case CBOR::CborKeyEvtFlags:
+				if(!getInt(r, val)) return 0;
+				cfg.evtFlagMask = (Blob::LightEvtFlags)val;
+				keys |= Blob::LightKeyCfgEvt;
+				break;
+			case CBOR::CborKeyVerbosity:
+				if(!getInt(r, val)) return 0;
+				cfg.verbosity = (esp_log_level_t)val;
+				keys |= Blob::LightKeyCfgVerbosity;
+				break;
+			case CBOR::CborKeyAlsData:
+				if(!getMinMax(r, cfg.alsData.lux)) return 0;
+				keys |= Blob::LightKeyCfgAls;
+				break;
+			case CBOR::CborKeyOutData:{
+				uint32_t m;
+				if(!getContainer(r, CborMap, m)) return 0;
+				for(uint32_t j=0;j<m;j++){
+					if(!getInt(r, key)) return 0;
+					if(key == CBOR::CborKeyMode){
+						if(!getInt(r, val)) return 0;
+						cfg.outData.mode = (Blob::LightOutModeFlags)val;
+						keys |= Blob::LightKeyCfgOutm;
+					}
+					else if(key == CBOR::CborKeyCurve){
+						uint32_t samples;
+						if(!getContainer(r, CborArray, samples) || samples > Blob::LightCurveSampleCount){
+							r.err = true;
+							return 0;
+						}
+						cfg.outData.curve.samples = samples;
+						for(uint32_t k=0;k<samples;k++){
+							if(!getInt(r, val)) return 0;
+							cfg.outData.curve.data[k] = val;
+						}
+						keys |= Blob::LightKeyCfgCurve;
+					}
+					else if(key == CBOR::CborKeyActions){
+						uint32_t num;
+						if(!getContainer(r, CborArray, num) || num > Blob::MaxAllowedActionDataInArray){
+							r.err = true;
+							return 0;
+						}
+						cfg.outData.numActions = num;
+						for(uint32_t k=0;k<num;k++){
+							if(!getAction(r, cfg.outData.actions[k])) return 0;
+						}
+						keys |= Blob::LightKeyCfgActs;
+					}
+					else if(!skipItem(r)){
+						return 0;
+					}
+				}
+				break;
+			}
+			default:
+				if(!skipItem(r)) return 0;
+				break;
+		}
+	}
+	cfg._keys = keys;
+	return keys;
+}
+
+
+//------------------------------------------------------------------------------------
+static void putStat(CborWriter& w, const Blob::LightStatData_t& stat){
+	putHead(w, CborMap, 2);
+	putKeyInt(w, CBOR::CborKeyFlags, stat.flags);
+	putKeyInt(w, CBOR::CborKeyOutValue, stat.outValue);
+}
+
+
+//------------------------------------------------------------------------------------
+static uint32_t getStat(CborReader& r, Blob::LightStatData_t& stat){
+	uint32_t n;
+	uint32_t keys = 0;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		if(key == CBOR::CborKeyFlags){
+			if(!getInt(r, val)) return 0;
+			stat.flags = val;
+			keys |= (1 << 0);
+		}
+		else if(key == CBOR::CborKeyOutValue){
+			if(!getInt(r, val)) return 0;
+			stat.outValue = val;
+			keys |= (1 << 1);
+		}
+		else if(!skipItem(r)){
+			return 0;
+		}
+	}
+	return keys;
+}
+
+
+//------------------------------------------------------------------------------------
+static void putBoot(CborWriter& w, const Blob::LightBootData_t& obj, ObjDataSelection type){
+	putHead(w, CborMap, (type == ObjSelectAll)? 3 : 2);
+	putKeyInt(w, CBOR::CborKeyUid, obj.uid);
+	if(type != ObjSelectState){
+		putHead(w, CborUint, CBOR::CborKeyCfg);
+		putCfg(w, obj.cfg);
+	}
+	if(type != ObjSelectCfg){
+		putHead(w, CborUint, CBOR::CborKeyStat);
+		putStat(w, obj.stat);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+static uint32_t getBoot(CborReader& r, Blob::LightBootData_t& obj){
+	uint32_t n;
+	uint32_t keys = 0;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		if(key == CBOR::CborKeyUid){
+			if(!getInt(r, val)) return 0;
+			obj.uid = val;
+			keys |= (1 << 0);
+		}
+		else if(key == CBOR::CborKeyCfg){
+			if(getCfg(r, obj.cfg) == 0 && r.err) return 0;
+			keys |= (1 << 1);
+		}
+		else if(key == CBOR::CborKeyStat){
+			if(getStat(r, obj.stat) == 0 && r.err) return 0;
+			keys |= (1 << 2);
+		}
+		else if(!skipItem(r)){
+			return 0;
+		}
+	}
+	return keys;
+}
+
+
+//------------------------------------------------------------------------------------
+static int32_t finish(CborWriter& w){
+	if(w.err){
+		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_CBOR. Buffer insuficiente (%d bytes)", w.size);
+		return -1;
+	}
+	return (int32_t)w.pos;
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC FUNCTIONS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+namespace CBOR {
+
+//------------------------------------------------------------------------------------
+int32_t getCborFromLightManager(const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size){
+	CborWriter w = {buf, size, 0, false};
+	putHead(w, CborMap, 1);
+	putHead(w, CborUint, CborKeyData);
+	putBoot(w, obj, type);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t getCborFromLightStat(const Blob::LightStatData_t& stat, uint8_t* buf, uint32_t size){
+	CborWriter w = {buf, size, 0, false};
+	putHead(w, CborMap, 1);
+	putHead(w, CborUint, CborKeyData);
+	putStat(w, stat);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t getCborFromLightResponse(uint32_t idTrans, const Blob::ErrorData_t& err, const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size){
+	CborWriter w = {buf, size, 0, false};
+	putHead(w, CborMap, 3);
+	putKeyInt(w, CborKeyIdTrans, idTrans);
+	putKeyInt(w, CborKeyError, err.code);
+	putHead(w, CborUint, CborKeyData);
+	putBoot(w, obj, type);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t getCborResponseHeader(uint32_t idTrans, const Blob::ErrorData_t& err, uint8_t* buf, uint32_t size){
+	CborWriter w = {buf, size, 0, false};
+	putHead(w, CborMap, 3);
+	putKeyInt(w, CborKeyIdTrans, idTrans);
+	putKeyInt(w, CborKeyError, err.code);
+	putHead(w, CborUint, CborKeyData);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t getCborFromLightData(const Blob::LightBootData_t& obj, ObjDataSelection type, uint8_t* buf, uint32_t size){
+	CborWriter w = {buf, size, 0, false};
+	putBoot(w, obj, type);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t getCborFromLightTime(const Blob::LightTimeData_t& t, uint8_t* buf, uint32_t size){
+	const uint32_t periods = sizeof(t.cfg.geoloc.astCorr) / sizeof(t.cfg.geoloc.astCorr[0]);
+	CborWriter w = {buf, size, 0, false};
+	putHead(w, CborMap, 11);
+	putKeyInt(w, CborKeyUid, t.uid);
+	putKeyInt(w, CborKeyUpdFlags, t.cfg.updFlagMask);
+	putKeyInt(w, CborKeyEvtFlags, t.cfg.evtFlagMask);
+	putHead(w, CborUint, CborKeyTimezone);
+	putText(w, t.cfg.geoloc.timezone, sizeof(t.cfg.geoloc.timezone));
+	putHead(w, CborUint, CborKeyCoords);
+	putHead(w, CborArray, 2);
+	putInt(w, (int64_t)(t.cfg.geoloc.coords[0] * 1000000));
+	putInt(w, (int64_t)(t.cfg.geoloc.coords[1] * 1000000));
+	// correcciones de orto y ocaso de cada periodo
+	putHead(w, CborUint, CborKeyAstCorr);
+	putHead(w, CborArray, periods);
+	for(uint32_t i=0;i<periods;i++){
+		putHead(w, CborArray, 2);
+		putInt(w, t.cfg.geoloc.astCorr[i][0]);
+		putInt(w, t.cfg.geoloc.astCorr[i][1]);
+	}
+	putKeyInt(w, CborKeyLocaltime, t.stat.localtime);
+	putKeyInt(w, CborKeyPeriod, t.stat.period);
+	putKeyInt(w, CborKeyDawn, t.stat.dawn);
+	putKeyInt(w, CborKeyDusk, t.stat.dusk);
+	putKeyInt(w, CborKeyFlags, t.stat.flags);
+	return finish(w);
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t getLightSetRequestFromCbor(Blob::SetRequest_t<light_manager>& req, const uint8_t* buf, uint32_t len){
+	CborReader r = {buf, len, 0, false};
+	uint32_t n;
+	uint32_t keys = 0;
+	bool has_data = false;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		if(key == CborKeyIdTrans){
+			if(!getInt(r, val)) return 0;
+			req.idTrans = val;
+		}
+		else if(key == CborKeyData){
+			keys = getBoot(r, req.data);
+			if(r.err) return 0;
+			has_data = true;
+		}
+		else if(!skipItem(r)){
+			return 0;
+		}
+	}
+	if(!has_data){
+		return 0;
+	}
+	req.keys = keys;
+	req._error.code = Blob::ErrOK;
+	strcpy(req._error.descr, Blob::errList[req._error.code]);
+	return (keys == 0)? 1 : keys;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t getGetRequestFromCbor(Blob::GetRequest_t& req, const uint8_t* buf, uint32_t len){
+	CborReader r = {buf, len, 0, false};
+	uint32_t n;
+	uint32_t keys = 0;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		if(key == CborKeyIdTrans){
+			if(!getInt(r, val)) return 0;
+			req.idTrans = val;
+			keys |= (1 << 0);
+		}
+		else if(!skipItem(r)){
+			return 0;
+		}
+	}
+	if(keys == 0){
+		return 0;
+	}
+	req._error.code = Blob::ErrOK;
+	strcpy(req._error.descr, Blob::errList[req._error.code]);
+	return keys;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t getLightLuxFromCbor(Blob::LightLuxLevel& lux, const uint8_t* buf, uint32_t len){
+	CborReader r = {buf, len, 0, false};
+	uint32_t n;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		if(key == CborKeyLuxLevel){
+			if(!getInt(r, val)) return 0;
+			lux = val;
+			return 1;
+		}
+		if(!skipItem(r)){
+			return 0;
+		}
+	}
+	return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t getLightTimeFromCbor(Blob::LightTimeData_t& t, const uint8_t* buf, uint32_t len){
+	const uint32_t periods = sizeof(t.cfg.geoloc.astCorr) / sizeof(t.cfg.geoloc.astCorr[0]);
+	CborReader r = {buf, len, 0, false};
+	uint32_t n;
+	uint32_t keys = 0;
+	if(!getContainer(r, CborMap, n)){
+		return 0;
+	}
+	for(uint32_t i=0;i<n;i++){
+		int64_t key, val;
+		if(!getInt(r, key)){
+			return 0;
+		}
+		switch(key){
+			case CborKeyLocaltime:
+				if(!getInt(r, val)) return 0;
+				t.stat.localtime = val;
+				keys |= (1 << 0);
+				break;
+			case CborKeyPeriod:
+				if(!getInt(r, val)) return 0;
+				t.stat.period = val;
+				keys |= (1 << 1);
+				break;
+			case CborKeyDawn:
+				if(!getInt(r, val)) return 0;
+				t.stat.dawn = val;
+				keys |= (1 << 2);
+				break;
+			case CborKeyDusk:
+				if(!getInt(r, val)) return 0;
+				t.stat.dusk = val;
+				keys |= (1 << 3);
+				break;
+			case CborKeyCoords:{
+				uint32_t m;
+				if(!getContainer(r, CborArray, m) || m != 2){
+					r.err = true;
+					return 0;
+				}
+				for(uint32_t j=0;j<m;j++){
+					if(!getInt(r, val)) return 0;
+					t.cfg.geoloc.coords[j] = (double)val / 1000000;
+				}
+				keys |= (1 << 4);
+				break;
+			}
+			case CborKeyUid:
+				if(!getInt(r, val)) return 0;
+				t.uid = val;
+				keys |= (1 << 5);
+				break;
+			case CborKeyUpdFlags:
+				if(!getInt(r, val)) return 0;
+				t.cfg.updFlagMask = val;
+				keys |= (1 << 6);
+				break;
+			case CborKeyEvtFlags:
+				if(!getInt(r, val)) return 0;
+				t.cfg.evtFlagMask = val;
+				keys |= (1 << 7);
+				break;
+			case CborKeyTimezone:
+				if(!getText(r, t.cfg.geoloc.timezone, sizeof(t.cfg.geoloc.timezone))) return 0;
+				keys |= (1 << 8);
+				break;
+			case CborKeyAstCorr:{
+				uint32_t m, c;
+				if(!getContainer(r, CborArray, m) || m > periods){
+					r.err = true;
+					return 0;
+				}
+				for(uint32_t j=0;j<m;j++){
+					if(!getContainer(r, CborArray, c) || c != 2){
+						r.err = true;
+						return 0;
+					}
+					for(uint32_t k=0;k<c;k++){
+						if(!getInt(r, val)) return 0;
+						t.cfg.geoloc.astCorr[j][k] = val;
+					}
+				}
+				keys |= (1 << 9);
+				break;
+			}
+			case CborKeyFlags:
+				if(!getInt(r, val)) return 0;
+				t.stat.flags = val;
+				keys |= (1 << 10);
+				break;
+			default:
+				if(!skipItem(r)) return 0;
+				break;
+		}
+	}
+	return keys;
+}
+
+}	// end namespace CBOR
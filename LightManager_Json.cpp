@@ -1,25 +1,173 @@
 /*
  * LightManager_Json.cpp
  *
- * Implementacin de los codecs JSON-OBJ
+ * Implementación de los codecs JSON-OBJ
  *
  *  Created on: Feb 2019
  *      Author: raulMrello
  */
 
 #include "JsonParserBlob.h"
+#include "LightManagerSchema.h"
 
 //------------------------------------------------------------------------------------
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[LightM]........";
 #define _EXPR_	(true)
 
- 
+
+/** Visitante de LightManagerSchema que codifica un objeto en JSON. Los objetos hijos se añaden al crearlos, de
+ *  forma que en caso de error basta con liberar el objeto raíz
+ */
+struct JsonWriter {
+	cJSON* json;
+	bool ok;
+
+	template<typename T> void field(const Schema::Field_t& f, T* p){
+		_field(f, p, typename std::is_class<T>::type());
+	}
+
+	template<typename T, typename C> void array(const Schema::Field_t& f, T* items, C* count){
+		typename std::remove_const<C>::type n;
+		memcpy(&n, count, sizeof(C));
+		cJSON* array = NULL;
+		if(!ok || (array = cJSON_CreateArray()) == NULL){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando %s[]", f.name);
+			ok = false;
+			return;
+		}
+		cJSON_AddItemToObject(json, f.name, array);
+		for(uint32_t i = 0; i < n && i < f.max && ok; i++){
+			cJSON* item = _create(&items[i], typename std::is_class<T>::type());
+			if(item == NULL){
+				DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando %s[%d]", f.name, i);
+				ok = false;
+				return;
+			}
+			cJSON_AddItemToArray(array, item);
+		}
+	}
+
+  private:
+	template<typename T> void _field(const Schema::Field_t& f, T* p, std::false_type){
+		typename std::remove_const<T>::type v;
+		memcpy(&v, p, sizeof(T));
+		cJSON_AddNumberToObject(json, f.name, v);
+	}
+
+	template<typename T> void _field(const Schema::Field_t& f, T* p, std::true_type){
+		cJSON* obj = NULL;
+		if(!ok || (obj = _create(p, std::true_type())) == NULL){
+			DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando %s", f.name);
+			ok = false;
+			return;
+		}
+		cJSON_AddItemToObject(json, f.name, obj);
+	}
+
+	template<typename T> cJSON* _create(T* p, std::false_type){
+		typename std::remove_const<T>::type v;
+		memcpy(&v, p, sizeof(T));
+		return cJSON_CreateNumber(v);
+	}
+
+	template<typename T> cJSON* _create(T* p, std::true_type){
+		cJSON* obj = cJSON_CreateObject();
+		if(obj == NULL){
+			return NULL;
+		}
+		JsonWriter w = {obj, true};
+		Schema::visit(w, p);
+		if(!w.ok){
+			cJSON_Delete(obj);
+			return NULL;
+		}
+		return obj;
+	}
+
+  public:
+	/** Codifica un objeto descrito en LightManagerSchema */
+	template<typename T> static cJSON* encode(const T& obj){
+		JsonWriter w = {NULL, true};
+		return w._create(&obj, std::true_type());
+	}
+};
+
+
+/** Visitante de LightManagerSchema que decodifica un objeto JSON. Sólo actualiza los campos presentes y acumula
+ *  las secciones (LightKeyNames) recibidas. Una estructura con arrays sólo se considera recibida si lo están
+ *  todos sus arrays con el número de elementos indicado por su contador (ej: curve exige <samples> datos)
+ */
+struct JsonReader {
+	cJSON* json;
+	uint32_t keys;
+	uint32_t fields;
+	bool complete;
+
+	template<typename T> void field(const Schema::Field_t& f, T* p){
+		cJSON* obj = cJSON_GetObjectItem(json, f.name);
+		if(obj == NULL){
+			return;
+		}
+		if(_read(f, obj, p, typename std::is_class<T>::type())){
+			keys |= f.key;
+			fields++;
+		}
+	}
+
+	template<typename T, typename C> void array(const Schema::Field_t& f, T* items, C* count){
+		C n;
+		memcpy(&n, count, sizeof(C));
+		cJSON* array = cJSON_GetObjectItem(json, f.name);
+		if(array == NULL || cJSON_GetArraySize(array) != (int)n || n > f.max){
+			complete = false;
+			return;
+		}
+		// <f.max> es la capacidad del array, no el límite de sus elementos
+		const Schema::Field_t item = {f.name, 0, NULL, 0};
+		for(int i = 0; i < n; i++){
+			_read(item, cJSON_GetArrayItem(array, i), &items[i], typename std::is_class<T>::type());
+		}
+		keys |= f.key;
+		fields++;
+	}
+
+  private:
+	template<typename T> bool _read(const Schema::Field_t& f, cJSON* obj, T* p, std::false_type){
+		T v = (T)obj->valueint;
+		if(f.max != 0 && obj->valueint > (int)f.max){
+			v = (T)f.max;
+		}
+		memcpy(p, &v, sizeof(T));
+		return true;
+	}
+
+	template<typename T> bool _read(const Schema::Field_t& f, cJSON* obj, T* p, std::true_type){
+		JsonReader r = {obj, 0, 0, true};
+		Schema::visit(r, p);
+		keys |= r.keys;
+		return (r.fields > 0 && r.complete);
+	}
+
+  public:
+	/** Decodifica un objeto descrito en LightManagerSchema
+	 *  @return Secciones recibidas
+	 */
+	template<typename T> static uint32_t decode(T& obj, cJSON* json, uint32_t* fields = NULL){
+		JsonReader r = {json, 0, 0, true};
+		Schema::visit(r, &obj);
+		if(fields){
+			*fields = r.fields;
+		}
+		return r.keys;
+	}
+};
+
 
 
 namespace JSON {
@@ -58,141 +206,17 @@ cJSON* getJsonFromLightManager(const Blob::LightBootData_t& obj, ObjDataSelectio
 
 //------------------------------------------------------------------------------------
 cJSON* getJsonFromLightCfg(const Blob::LightCfgData_t& cfg){
-	cJSON *alsData = NULL;
-	cJSON *outData = NULL;
-	cJSON *curve = NULL;
-	cJSON *array = NULL;
-	cJSON *value = NULL;
-	cJSON *luxLevel = NULL;
-	cJSON *light = NULL;
-
-	if((light=cJSON_CreateObject()) == NULL){
+	cJSON* light = JsonWriter::encode(cfg);
+	if(light == NULL){
 		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando json");
-		return NULL;
 	}
-
-	// key: light.updFlags
-	cJSON_AddNumberToObject(light, JsonParser::p_updFlags, cfg.updFlagMask);
-
-	// key: light.evtFlags
-	cJSON_AddNumberToObject(light, JsonParser::p_evtFlags, cfg.evtFlagMask);
-
-	// key: fwupd.verbosity
-	cJSON_AddNumberToObject(light, JsonParser::p_verbosity, cfg.verbosity);
-
-	// key: alsData
-	if((alsData=cJSON_CreateObject()) == NULL){
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando alsData");
-		return NULL;
-	}
-
-	// key: alsData.lux
-	if((value=cJSON_CreateObject()) == NULL){
-		cJSON_Delete(alsData);
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando alsData.lux");
-		return NULL;
-	}
-	cJSON_AddNumberToObject(value, JsonParser::p_min, cfg.alsData.lux.min);
-	cJSON_AddNumberToObject(value, JsonParser::p_max, cfg.alsData.lux.max);
-	cJSON_AddNumberToObject(value, JsonParser::p_thres, cfg.alsData.lux.thres);
-	cJSON_AddItemToObject(alsData, JsonParser::p_lux, value);
-	cJSON_AddItemToObject(light, JsonParser::p_alsData, alsData);
-
-	// key: outData
-	if((outData=cJSON_CreateObject()) == NULL){
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData");
-		return NULL;
-	}
-	cJSON_AddNumberToObject(outData, JsonParser::p_mode, cfg.outData.mode);
-	cJSON_AddNumberToObject(outData, JsonParser::p_numActions, cfg.outData.numActions);
-
-	// key: outData.curve
-	if((curve=cJSON_CreateObject()) == NULL){
-		cJSON_Delete(outData);
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.curve");
-		return NULL;
-	}
-	cJSON_AddNumberToObject(curve, JsonParser::p_samples, cfg.outData.curve.samples);
-
-	// key: outData.curve.data
-	if((array=cJSON_CreateArray()) == NULL){
-		cJSON_Delete(curve);
-		cJSON_Delete(outData);
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.curve.data[]");
-		return NULL;
-	}
-	for(int i=0; i < cfg.outData.curve.samples; i++){
-		if((value = cJSON_CreateNumber(cfg.outData.curve.data[i])) == NULL){
-			cJSON_Delete(array);
-			cJSON_Delete(curve);
-			cJSON_Delete(outData);
-			cJSON_Delete(light);
-			DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.curve.data[%d]",i);
-			return NULL;
-		}
-		cJSON_AddItemToArray(array, value);
-	}
-	cJSON_AddItemToObject(curve, JsonParser::p_data, array);
-	cJSON_AddItemToObject(outData, JsonParser::p_curve, curve);
-
-	// key: outData.actions
-	if((array=cJSON_CreateArray()) == NULL){
-		cJSON_Delete(outData);
-		cJSON_Delete(light);
-		DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.actions[]");
-		return NULL;
-	}
-
-	for(int i=0; i < cfg.outData.numActions; i++){
-		if((value = cJSON_CreateObject()) == NULL){
-			cJSON_Delete(array);
-			cJSON_Delete(outData);
-			cJSON_Delete(light);
-			DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.actions[%d]",i);
-			return NULL;
-		}
-		cJSON_AddNumberToObject(value, JsonParser::p_id, cfg.outData.actions[i].id);
-		cJSON_AddNumberToObject(value, JsonParser::p_flags, cfg.outData.actions[i].flags);
-		cJSON_AddNumberToObject(value, JsonParser::p_date, cfg.outData.actions[i].date);
-		cJSON_AddNumberToObject(value, JsonParser::p_time, cfg.outData.actions[i].time);
-		cJSON_AddNumberToObject(value, JsonParser::p_astCorr, cfg.outData.actions[i].astCorr);
-		cJSON_AddNumberToObject(value, JsonParser::p_outValue, cfg.outData.actions[i].outValue);
-		if((luxLevel=cJSON_CreateObject()) == NULL){
-			cJSON_Delete(value);
-			cJSON_Delete(array);
-			cJSON_Delete(outData);
-			cJSON_Delete(light);
-			DEBUG_TRACE_E(_EXPR_, _MODULE_, "Error creando outData.curve.data[%d].luxLevel",i);
-			return NULL;
-		}
-		cJSON_AddNumberToObject(luxLevel, JsonParser::p_min, cfg.outData.actions[i].luxLevel.min);
-		cJSON_AddNumberToObject(luxLevel, JsonParser::p_max, cfg.outData.actions[i].luxLevel.max);
-		cJSON_AddNumberToObject(luxLevel, JsonParser::p_thres, cfg.outData.actions[i].luxLevel.thres);
-		cJSON_AddItemToObject(value, JsonParser::p_luxLevel, luxLevel);
-		cJSON_AddItemToArray(array, value);
-	}
-	cJSON_AddItemToObject(outData, JsonParser::p_actions, array);
-	cJSON_AddItemToObject(light, JsonParser::p_outData, outData);
 	return light;
 }
 
 
 //------------------------------------------------------------------------------------
 cJSON* getJsonFromLightStat(const Blob::LightStatData_t& stat){
-	cJSON* json = NULL;
-
-	if((json=cJSON_CreateObject()) == NULL){
-		return NULL;
-	}
-
-	cJSON_AddNumberToObject(json, JsonParser::p_flags, stat.flags);
-	cJSON_AddNumberToObject(json, JsonParser::p_outValue, stat.outValue);
-	return json;
+	return JsonWriter::encode(stat);
 }
 
 
@@ -243,111 +267,8 @@ uint32_t getLightManagerFromJson(Blob::LightBootData_t &obj, cJSON* json){
 
 //------------------------------------------------------------------------------------
 uint32_t getLightCfgFromJson(Blob::LightCfgData_t &cfg, cJSON* json){
-	cJSON *alsData = NULL;
-	cJSON *outData = NULL;
-	cJSON *array = NULL;
-	cJSON *value = NULL;
-	cJSON *luxLevel = NULL;
-	cJSON *item = NULL;
-	cJSON *obj = NULL;
-	uint32_t keys = Blob::LightKeyNone;
 	cfg._keys = 0;
-
-	if((obj = cJSON_GetObjectItem(json, JsonParser::p_updFlags)) != NULL){
-		cfg.updFlagMask = (Blob::LightUpdFlags)obj->valueint;
-		keys |= Blob::LightKeyCfgUpd;
-	}
-	if((obj = cJSON_GetObjectItem(json, JsonParser::p_evtFlags)) != NULL){
-		cfg.evtFlagMask = (Blob::LightEvtFlags)obj->valueint;
-		keys |= Blob::LightKeyCfgEvt;
-	}
-	if((obj = cJSON_GetObjectItem(json,JsonParser::p_verbosity)) != NULL){
-		cfg.verbosity = obj->valueint;
-		keys |= Blob::LightKeyCfgVerbosity;
-	}
-
-	//key: alsData
-	if((alsData = cJSON_GetObjectItem(json, JsonParser::p_alsData)) != NULL){
-		cJSON *lux = NULL;
-		if((lux = cJSON_GetObjectItem(alsData, JsonParser::p_lux)) != NULL){
-			if((obj = cJSON_GetObjectItem(lux, JsonParser::p_min)) != NULL){
-				cfg.alsData.lux.min = obj->valueint;
-			}
-			if((obj = cJSON_GetObjectItem(lux, JsonParser::p_max)) != NULL){
-				cfg.alsData.lux.max = obj->valueint;
-			}
-			if((obj = cJSON_GetObjectItem(lux, JsonParser::p_thres)) != NULL){
-				cfg.alsData.lux.thres = obj->valueint;
-			}
-			keys |= Blob::LightKeyCfgAls;
-		}
-	}
-
-	if((outData = cJSON_GetObjectItem(json, JsonParser::p_outData)) != NULL){
-		if((obj = cJSON_GetObjectItem(outData, JsonParser::p_mode)) != NULL){
-			cfg.outData.mode = (Blob::LightOutModeFlags)obj->valueint;
-			keys |= Blob::LightKeyCfgOutm;
-		}
-		if((obj = cJSON_GetObjectItem(outData, JsonParser::p_numActions)) != NULL){
-			cfg.outData.numActions = obj->valueint;
-			cfg.outData.numActions = (cfg.outData.numActions > Blob::MaxAllowedActionDataInArray)? Blob::MaxAllowedActionDataInArray : cfg.outData.numActions;
-		}
-
-		if((value = cJSON_GetObjectItem(outData, JsonParser::p_curve)) != NULL){
-			if((obj = cJSON_GetObjectItem(value, JsonParser::p_samples)) != NULL){
-				cfg.outData.curve.samples = obj->valueint;
-				cfg.outData.curve.samples = (cfg.outData.curve.samples > Blob::LightCurveSampleCount)? Blob::LightCurveSampleCount : cfg.outData.curve.samples;
-			}
-			if((obj = cJSON_GetObjectItem(value, JsonParser::p_data)) != NULL){
-				if(cfg.outData.curve.samples == cJSON_GetArraySize(obj)){
-					for(int i=0;i<cfg.outData.curve.samples;i++){
-						item = cJSON_GetArrayItem(obj, i);
-						cfg.outData.curve.data[i] = item->valueint;
-					}
-					keys |= Blob::LightKeyCfgCurve;
-				}
-			}
-		}
-
-		if((array = cJSON_GetObjectItem(outData, JsonParser::p_actions)) != NULL){
-			if(cfg.outData.numActions == cJSON_GetArraySize(array)){
-				for(int i=0;i<cfg.outData.numActions;i++){
-					value = cJSON_GetArrayItem(array, i);
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_id)) != NULL){
-						cfg.outData.actions[i].id = obj->valueint;
-					}
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_flags)) != NULL){
-						cfg.outData.actions[i].flags = (Blob::LightActionFlags)obj->valueint;
-					}
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_date)) != NULL){
-						cfg.outData.actions[i].date = obj->valueint;
-					}
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_time)) != NULL){
-						cfg.outData.actions[i].time = obj->valueint;
-					}
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_astCorr)) != NULL){
-						cfg.outData.actions[i].astCorr = obj->valueint;
-					}
-					if((obj = cJSON_GetObjectItem(value, JsonParser::p_outValue)) != NULL){
-						cfg.outData.actions[i].outValue = obj->valueint;
-					}
-
-					if((luxLevel = cJSON_GetObjectItem(value, JsonParser::p_luxLevel)) != NULL){
-						if((obj = cJSON_GetObjectItem(luxLevel, JsonParser::p_min)) != NULL){
-							cfg.outData.actions[i].luxLevel.min = obj->valueint;
-						}
-						if((obj = cJSON_GetObjectItem(luxLevel, JsonParser::p_max)) != NULL){
-							cfg.outData.actions[i].luxLevel.max = obj->valueint;
-						}
-						if((obj = cJSON_GetObjectItem(luxLevel, JsonParser::p_thres)) != NULL){
-							cfg.outData.actions[i].luxLevel.thres = obj->valueint;
-						}
-					}
-				}
-				keys |= Blob::LightKeyCfgActs;
-			}
-		}
-	}
+	uint32_t keys = JsonReader::decode(cfg, json);
 	cfg._keys = keys;
 	return keys;
 }
@@ -355,19 +276,10 @@ uint32_t getLightCfgFromJson(Blob::LightCfgData_t &cfg, cJSON* json){
 
 //------------------------------------------------------------------------------------
 uint32_t getLightStatFromJson(Blob::LightStatData_t &stat, cJSON* json){
-	cJSON *obj = NULL;
-	if((obj = cJSON_GetObjectItem(json, JsonParser::p_flags)) == NULL){
-		return 0;
-	}
-	stat.flags = obj->valueint;
-
-	// key: outValue
-	if((obj = cJSON_GetObjectItem(json, JsonParser::p_outValue)) == NULL){
-		return 0;
-	}
-	stat.outValue = obj->valueint;
-
-	return 1;
+	// el estado sólo es válido si incluye todos sus campos
+	uint32_t fields = 0;
+	JsonReader::decode(stat, json, &fields);
+	return (fields == 2)? 1 : 0;
 }
 
 
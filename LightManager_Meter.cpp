@@ -0,0 +1,190 @@
+/*
+ * LightManager_Meter.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	Integrador de uso de la salida: tiempo de encendido, integral del nivel, número de encendidos y energía
+ *	estimada a partir de la potencia nominal y de la curva de potencia configuradas. Se actualiza en cada cambio de
+ *	la salida acumulando el tramo anterior, por lo que no requiere notificaciones ni muestreo periódico.
+ */
+
+#include "LightManager.h"
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[LightM]........";
+#define _EXPR_	(!IS_ISR())
+
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+bool LightManager::meterAccumulate(LightMeter_t& m, uint64_t now_ms){
+	if(!m.started){
+		m.last_ms = now_ms;
+		m.saved_ms = now_ms;
+		m.started = true;
+		return false;
+	}
+	uint64_t elapsed = now_ms - m.last_ms;
+	m.last_ms = now_ms;
+	if(m.value > 0){
+		m.data.onMs += elapsed;
+		m.data.levelMs += (uint64_t)m.value * elapsed;
+		// W x ms = mJ
+		m.data.energyMj += ((uint64_t)m.cfg.ratedPower * m.power * elapsed) / 100;
+	}
+	return ((now_ms - m.saved_ms) >= MeterSavePeriodMs);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::meterSetOutput(LightMeter_t& m, uint8_t value, uint8_t power){
+	if(m.value == 0 && value > 0){
+		m.data.switchCount++;
+	}
+	m.value = value;
+	m.power = power;
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_meterRestore(){
+	LightMeterRecord_t rec;
+	if(restoreParameter("LigMeter", &rec, sizeof(LightMeterRecord_t), NVSInterface::TypeBlob) &&
+	   rec.crc == Blob::getCRC32(&rec, sizeof(LightMeterRecord_t) - sizeof(uint32_t))){
+		_meter.data = rec.data;
+	}
+	else{
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo los contadores de uso. Se inician a 0");
+		memset(&_meter.data, 0, sizeof(Blob::LightMeterData_t));
+	}
+	if(!restoreParameter("LigMeterCfg", &_meter.cfg, sizeof(Blob::LightMeterCfg_t), NVSInterface::TypeBlob) ||
+	   _meter.cfg.powerCurve.samples > Blob::LightCurveSampleCount){
+		memset(&_meter.cfg, 0, sizeof(Blob::LightMeterCfg_t));
+	}
+	_meter.started = false;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_meterUpdate(uint8_t level){
+	// acumula el tramo anterior con el estado previo
+	_meterSync();
+	meterSetOutput(_meter, level, _applyCurve(_meter.cfg.powerCurve, level));
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_meterSync(bool save){
+	uint64_t now = Kernel::get_ms_count();
+	if(!meterAccumulate(_meter, now) && !save){
+		return;
+	}
+	LightMeterRecord_t rec;
+	rec.data = _meter.data;
+	rec.crc = Blob::getCRC32(&rec, sizeof(LightMeterRecord_t) - sizeof(uint32_t));
+	if(!saveParameter("LigMeter", &rec, sizeof(LightMeterRecord_t), NVSInterface::TypeBlob)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando los contadores de uso!");
+		return;
+	}
+	_meter.saved_ms = now;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishMeter(uint32_t idTrans, Blob::ErrorCode code){
+	// incluye el tramo en curso
+	_meterSync();
+
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/meter/%s", _pub_topic_base);
+
+	Blob::LightMeterResponse_t resp;
+	resp.idTrans = idTrans;
+	resp.code = code;
+	resp.cfg = _meter.cfg;
+	resp.data = _meter.data;
+	MQ::MQClient::publish(pub_topic, &resp, sizeof(Blob::LightMeterResponse_t), &_publicationCb);
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+uint8_t LightManager::_limitPower(uint8_t level){
+	_power.level = level;
+	if(_power.budget == NULL){
+		return level;
+	}
+	// la demanda es la potencia del nivel sin limitar, de forma que no depende del factor aplicado
+	uint8_t power = _applyCurve(_meter.cfg.powerCurve, level);
+	uint16_t factor = _power.budget->update(_power.member, (uint32_t)_meter.cfg.ratedPower * power);
+	if(_meter.cfg.ratedPower == 0 || factor >= LightPowerBudget::FactorMax){
+		return level;
+	}
+	// la curva de potencia no tiene por qué ser lineal, por lo que busca el mayor nivel admisible
+	uint32_t allowed = ((uint32_t)power * factor) / LightPowerBudget::FactorMax;
+	while(level > 0 && _applyCurve(_meter.cfg.powerCurve, level) > allowed){
+		level--;
+	}
+	_power.level = level;
+	return level;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_powerLimitCb(){
+	// un único aviso pendiente basta, ya que el factor se lee al procesarlo. Puede invocarse desde varios hilos a
+	// la vez (ej: cambios de demanda de otras luminarias), por lo que el aviso se adquiere de forma atómica
+	if(!__sync_bool_compare_and_swap(&_power.pending, 0, 1)){
+		return;
+	}
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = RecvPowerLimit;
+	op->msg = NULL;
+	if(putMessage(op) != osOK){
+		Heap::memFree(op);
+		__sync_lock_release(&_power.pending);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishPowerCap(uint32_t idTrans, Blob::ErrorCode code){
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/powercap/%s", _pub_topic_base);
+
+	Blob::LightPowerCapResponse_t resp;
+	memset(&resp, 0, sizeof(Blob::LightPowerCapResponse_t));
+	resp.idTrans = idTrans;
+	resp.code = code;
+	resp.priority = _power.priority;
+	resp.factor = LightPowerBudget::FactorMax;
+	if(_power.budget){
+		resp.capW = _power.budget->getCap();
+		resp.demandW = (uint32_t)(_power.budget->getDemand() / 100);
+		resp.factor = _power.budget->getFactor(_power.priority);
+	}
+	MQ::MQClient::publish(pub_topic, &resp, sizeof(Blob::LightPowerCapResponse_t), &_publicationCb);
+	Heap::memFree(pub_topic);
+}
+
@@ -6,17 +6,59 @@
  */
 
 #include "LightManager.h"
+#include "LightManagerSchema.h"
 
 //------------------------------------------------------------------------------------
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[LightM]........";
 #define _EXPR_	(!IS_ISR())
 
+
+/** Graba o recupera los campos descritos en LightManagerSchema que tienen clave NV propia. Los escalares de un
+ *  byte se guardan como TypeUint8, el resto como TypeUint32 y las estructuras como TypeBlob. Las estructuras sin
+ *  clave propia sólo se recorren si <descend> está activo
+ */
+struct LightManager::NvsVisitor {
+	typedef bool (LightManager::*Access)(const char*, void*, size_t, NVSInterface::KeyValueType);
+
+	LightManager* self;
+	Access access;
+	const char* action;
+	bool descend;
+	bool ok;
+
+	template<typename T> void field(const Schema::Field_t& f, T* p){
+		if(f.nvs != NULL){
+			if(!(self->*access)(f.nvs, p, sizeof(T), _type(p, typename std::is_class<T>::type()))){
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS %s %s!", action, f.nvs);
+				ok = false;
+			}
+			return;
+		}
+		if(descend){
+			_nested(p, typename std::is_class<T>::type());
+		}
+	}
+	template<typename T, typename C> void array(const Schema::Field_t& f, T* items, C* count){}
+
+  private:
+	template<typename T> static NVSInterface::KeyValueType _type(T* p, std::true_type){
+		return NVSInterface::TypeBlob;
+	}
+	template<typename T> static NVSInterface::KeyValueType _type(T* p, std::false_type){
+		return (sizeof(T) == 1)? NVSInterface::TypeUint8 : NVSInterface::TypeUint32;
+	}
+	template<typename T> void _nested(T* p, std::true_type){
+		Schema::visit(*this, p);
+	}
+	template<typename T> void _nested(T* p, std::false_type){}
+};
+
  
 //------------------------------------------------------------------------------------
 bool LightManager::checkIntegrity(){
@@ -37,12 +79,12 @@ void LightManager::setDefaultConfig(){
 	_lightdata.uid = UID_LIGHT_MANAGER;
 	// inicializo flags
 	_lightdata.cfg.updFlagMask = Blob::EnableLightCfgUpdNotif;
-	_lightdata.cfg.evtFlagMask = (Blob::LightEvtFlags)(Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt);
-	// borra los rangos del sensor de iluminacin
+	_lightdata.cfg.evtFlagMask = (Blob::LightEvtFlags)(Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt | Blob::LightLateActionEvt);
+	// borra los rangos del sensor de iluminación
 	_lightdata.cfg.alsData = {0, 0, 0};
-	// establece control con rel NA y PWM0_10
+	// establece control con relé NA y PWM0_10
 	_lightdata.cfg.outData.mode = (Blob::LightOutModeFlags)(Blob::LightOutRelayNA | Blob::LightOutPwm);
-	// establece una curva de actuacin lineal
+	// establece una curva de actuación lineal
 	_lightdata.cfg.outData.curve.samples = 3;
 	_lightdata.cfg.outData.curve.data[0] = 0;
 	_lightdata.cfg.outData.curve.data[1] = 50;
@@ -51,6 +93,7 @@ void LightManager::setDefaultConfig(){
 	_sched->clrActions();
 	_lightdata.cfg.outData.numActions = _sched->getActionCount();
 	_lightdata.cfg.verbosity = ESP_LOG_DEBUG;
+	_configChanged();
 
 	saveConfig();
 }
@@ -58,109 +101,263 @@ void LightManager::setDefaultConfig(){
 
 //------------------------------------------------------------------------------------
 void LightManager::restoreConfig(){
-	uint32_t crc = 0;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recuperando datos de memoria NV...");
+	_boot.success = true;
+	for(uint8_t step = BootStepFlags; step < BootStepDone; step++){
+		_restoreConfigStep(step);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_restoreBootRecord(){
+	LightBootRecord_t rec;
 	_lightdata.uid = UID_LIGHT_MANAGER;
-	// inicializa estado como apagado
-	_lightdata.stat.outValue = 0;
 	_lightdata.stat.flags = Blob::LightNoEvents;
-	if(_driver010){
-		_driver010->setLevel(_lightdata.stat.outValue);
-	}
 
-	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recuperando datos de memoria NV...");
-	bool success = true;
-	if(!restoreParameter("LigUpdFla", &_lightdata.cfg.updFlagMask, sizeof(uint32_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo UpdFlags!");
-		success = false;
-	}
-	if(!restoreParameter("LigEvtFla", &_lightdata.cfg.evtFlagMask, sizeof(uint32_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo EvtFlags!");
-		success = false;
-	}
-	if(!restoreParameter("LigAlsDat", &_lightdata.cfg.alsData, sizeof(Blob::LightAlsData_t), NVSInterface::TypeBlob)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo AlsData!");
-		success = false;
+	// recupera la curva y el modo necesarios para aplicar la salida
+	if(restoreParameter("LigBootRec", &rec, sizeof(LightBootRecord_t), NVSInterface::TypeBlob) &&
+	   rec.crc == Blob::getCRC32(&rec, sizeof(LightBootRecord_t) - sizeof(uint32_t)) &&
+	   rec.curve.samples <= Blob::LightCurveSampleCount){
+		_lightdata.cfg.outData.curve = rec.curve;
+		_lightdata.cfg.outData.mode = rec.mode;
+	}
+	// si no hay registro válido, utiliza una curva lineal y el modo por defecto
+	else{
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo el registro de arranque. Curva lineal");
+		_lightdata.cfg.outData.mode = (Blob::LightOutModeFlags)(Blob::LightOutRelayNA | Blob::LightOutPwm);
+		_lightdata.cfg.outData.curve.samples = 3;
+		_lightdata.cfg.outData.curve.data[0] = 0;
+		_lightdata.cfg.outData.curve.data[1] = 50;
+		_lightdata.cfg.outData.curve.data[2] = 100;
 	}
-	if(!restoreParameter("LigOutDatMod", &_lightdata.cfg.outData.mode, sizeof(Blob::LightOutModeFlags), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo OutDataMode!");
-		success = false;
+
+	// recupera los contadores de uso antes de aplicar la salida
+	_meterRestore();
+
+	// recupera el umbral de alerta de retraso de las acciones programadas
+	uint32_t late_alert = 0;
+	if(!restoreParameter("LigLateAlrt", &late_alert, sizeof(uint32_t), NVSInterface::TypeUint32)){
+		late_alert = 0;
 	}
-	if(!restoreParameter("LigOutDatCur", &_lightdata.cfg.outData.curve, sizeof(Blob::LightCurve_t), NVSInterface::TypeBlob)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo OutDataCurve!");
-		success = false;
+	_sched->setLateAlert(late_alert);
+
+	// recupera el último valor de la salida del anillo de transiciones
+	_lightdata.stat.outValue = _restoreOutRing();
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Restaurado estado de arranque, outValue=%d", _lightdata.stat.outValue);
+	_applyOutput();
+	_commitSnapshot();
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_saveBootRecord(){
+	LightBootRecord_t rec;
+	rec.curve = _lightdata.cfg.outData.curve;
+	rec.mode = _lightdata.cfg.outData.mode;
+	rec.crc = Blob::getCRC32(&rec, sizeof(LightBootRecord_t) - sizeof(uint32_t));
+	if(!saveParameter("LigBootRec", &rec, sizeof(LightBootRecord_t), NVSInterface::TypeBlob)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando el registro de arranque!");
 	}
-	if(!restoreParameter("LigOutDatNum", &_lightdata.cfg.outData.numActions, sizeof(uint8_t), NVSInterface::TypeUint8)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo OutDataNumActions!");
-		success = false;
+}
+
+
+//------------------------------------------------------------------------------------
+bool LightManager::selectOutRingEntry(const LightOutRingEntry_t* slots, const bool* read, uint8_t count, LightOutRingEntry_t& entry){
+	bool found = false;
+	for(uint8_t i=0;i<count;i++){
+		if(!read[i] || slots[i].outValue > Blob::LightActionOutMax){
+			continue;
+		}
+		if(slots[i].crc != Blob::getCRC32((void*)&slots[i], sizeof(LightOutRingEntry_t) - sizeof(uint32_t))){
+			continue;
+		}
+		if(!found || (int32_t)(slots[i].seq - entry.seq) > 0){
+			found = true;
+			entry = slots[i];
+		}
 	}
-	if(!_sched->restoreActionList()){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo OutDataActions!");
-		success = false;
+	return found;
+}
+
+
+//------------------------------------------------------------------------------------
+uint8_t LightManager::_restoreOutRing(){
+	// lee el número fijo de posiciones y se queda con la entrada válida más reciente
+	LightOutRingEntry_t slots[OutRingSlots];
+	bool read[OutRingSlots];
+	for(uint8_t i=0;i<OutRingSlots;i++){
+		char key[] = "LigOutRing_X";
+		key[sizeof(key) - 2] = '0' + i;
+		read[i] = restoreParameter(key, &slots[i], sizeof(LightOutRingEntry_t), NVSInterface::TypeBlob);
+	}
+	LightOutRingEntry_t entry;
+	bool found = selectOutRingEntry(slots, read, OutRingSlots, entry);
+
+	// la siguiente escritura se realiza en la posición posterior a la más reciente
+	_out_ring.seq = (found)? (entry.seq + 1) : 0;
+	_out_ring.value = (found)? entry.outValue : 0;
+	_out_ring.valid = found;
+	return _out_ring.value;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_appendOutRing(uint8_t value){
+	// sólo se registran las transiciones. Durante la carga diferida no se graba cada cambio, sino el último valor
+	// al finalizarla
+	if((_out_ring.valid && _out_ring.value == value) || _boot.step < BootStepDone){
+		return;
 	}
+	LightOutRingEntry_t entry;
+	entry.seq = _out_ring.seq;
+	entry.outValue = value;
+	entry.crc = Blob::getCRC32(&entry, sizeof(LightOutRingEntry_t) - sizeof(uint32_t));
 
-	if(!restoreParameter("LigChk", &crc, sizeof(uint32_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo Checksum!");
-		success = false;
+	// cada valor sobrescribe la entrada más antigua, repartiendo las escrituras entre las posiciones
+	char key[] = "LigOutRing_X";
+	key[sizeof(key) - 2] = '0' + (entry.seq % OutRingSlots);
+	if(!saveParameter(key, &entry, sizeof(LightOutRingEntry_t), NVSInterface::TypeBlob)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando la transición de la salida!");
+		return;
 	}
-	if(!restoreParameter("LightVerbosity", &_lightdata.cfg.verbosity, sizeof(esp_log_level_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo verbosity!");
-		success = false;
+	_out_ring.seq++;
+	_out_ring.value = value;
+	_out_ring.valid = true;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_settleOutRing(){
+	// cada cambio rearma el timer, de forma que sólo se registra el valor que permanece estable
+	_wheel->start(_out_ring_tmr, LIGHTMANAGER_OUTRING_SETTLE_MS);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_restoreConfigStep(uint8_t step){
+	// acciones, una por paso
+	if(step >= BootStepActions && step < BootStepCalendars){
+		if(!_sched->restoreAction(step - BootStepActions)){
+			_boot.success = false;
+		}
+		return;
 	}
 
-	if(success){
-		// chequea el checksum crc32 y despus la integridad de los datos
-		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Datos recuperados. Chequeando integridad...");
-		if(Blob::getCRC32(&_lightdata.cfg, sizeof(Blob::LightCfgData_t)) != crc){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Ha fallado el checksum");
+	switch(step){
+		case BootStepFlags:{
+			_lightdata.uid = UID_LIGHT_MANAGER;
+			NvsVisitor nvs = {this, &LightManager::restoreParameter, "leyendo", false, true};
+			Schema::visit(nvs, &_lightdata.cfg);
+			if(!nvs.ok){
+				_boot.success = false;
+			}
+			return;
 		}
-    	else if(!checkIntegrity()){
-    		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Ha fallado el check de integridad.");
-    	}
-    	else{
-    		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Check de integridad OK!");
-    		esp_log_level_set(_MODULE_, _lightdata.cfg.verbosity);
-    		_sched->setVerbosity(_lightdata.cfg.verbosity);
-    		return;
-    	}
+
+		case BootStepOutput:{
+			NvsVisitor nvs = {this, &LightManager::restoreParameter, "leyendo", false, true};
+			Schema::visit(nvs, &_lightdata.cfg.outData);
+			if(!nvs.ok){
+				_boot.success = false;
+			}
+			return;
+		}
+
+		// los calendarios no forman parte de la configuración verificada por el checksum, los que no existan
+		// quedan vacíos
+		case BootStepCalendars:{
+			if(!_sched->restoreCalendars()){
+				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Calendarios sin definir");
+			}
+			return;
+		}
+
+		case BootStepCheck:{
+			uint32_t crc = 0;
+			if(!restoreParameter("LigChk", &crc, sizeof(uint32_t), NVSInterface::TypeUint32)){
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo Checksum!");
+				_boot.success = false;
+			}
+			bool valid = false;
+			if(_boot.success){
+				// chequea el checksum crc32 y después la integridad de los datos
+				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Datos recuperados. Chequeando integridad...");
+				if(Blob::getCRC32(&_lightdata.cfg, sizeof(Blob::LightCfgData_t)) != crc){
+					DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Ha fallado el checksum");
+				}
+				else if(!checkIntegrity()){
+					DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CFG. Ha fallado el check de integridad.");
+				}
+				else{
+					DEBUG_TRACE_W(_EXPR_, _MODULE_, "Check de integridad OK!");
+					// las configuraciones grabadas antes de añadir LightLateActionEvt no lo incluyen en la máscara
+					// de eventos. Se habilita una única vez, de forma que se respeta si después se deshabilita
+					uint32_t evt_rev = 0;
+					if(!restoreParameter("LigEvtRev", &evt_rev, sizeof(uint32_t), NVSInterface::TypeUint32) || evt_rev < EvtMaskRevision){
+						DEBUG_TRACE_I(_EXPR_, _MODULE_, "Migrando la máscara de eventos a la revisión %d", EvtMaskRevision);
+						_lightdata.cfg.evtFlagMask = (Blob::LightEvtFlags)(_lightdata.cfg.evtFlagMask | Blob::LightLateActionEvt);
+						saveConfig();
+					}
+					esp_log_level_set(_MODULE_, _lightdata.cfg.verbosity);
+					_sched->setVerbosity(_lightdata.cfg.verbosity);
+					_configChanged();
+					valid = true;
+				}
+			}
+			if(!valid){
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FS. Error en la recuperación de datos. Establece configuración por defecto");
+				setDefaultConfig();
+			}
+			// aplica de nuevo la salida con la curva definitiva y registra el valor resultante de los mensajes de
+			// control atendidos durante la carga
+			_applyOutput();
+			_appendOutRing(_lightdata.stat.outValue);
+			return;
+		}
+
+		default:
+			return;
 	}
-	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FS. Error en la recuperacin de datos. Establece configuracin por defecto");
-	setDefaultConfig();
 }
 
 
 //------------------------------------------------------------------------------------
 void LightManager::saveConfig(){
 	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Guardando datos en memoria NV...");
-	// almacena en el sistema de ficheros
-	if(!saveParameter("LigUpdFla", &_lightdata.cfg.updFlagMask, sizeof(uint32_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando UpdFlags!");
-	}
-	if(!saveParameter("LigEvtFla", &_lightdata.cfg.evtFlagMask, sizeof(uint32_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando EvtFlags!");
-	}
-	if(!saveParameter("LigAlsDat", &_lightdata.cfg.alsData, sizeof(Blob::LightAlsData_t), NVSInterface::TypeBlob)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando AlsData!");
-	}
-	if(!saveParameter("LigOutDatMod", &_lightdata.cfg.outData.mode, sizeof(Blob::LightOutModeFlags), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando OutDataMode!");
-	}
-	if(!saveParameter("LigOutDatCur", &_lightdata.cfg.outData.curve, sizeof(Blob::LightCurve_t), NVSInterface::TypeBlob)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando OutDataMode!");
-	}
-	if(!saveParameter("LigOutDatNum", &_lightdata.cfg.outData.numActions, sizeof(uint8_t), NVSInterface::TypeUint8)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando OutDataNumActions!");
-	}
+	// almacena en el sistema de ficheros los campos con clave propia y después las acciones
+	NvsVisitor nvs = {this, &LightManager::saveParameter, "grabando", true, true};
+	Schema::visit(nvs, &_lightdata.cfg);
 	if(!_sched->saveActionList()){
 		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando OutDataActions!");
 	}
-	if(!saveParameter("LightVerbosity", &_lightdata.cfg.verbosity, sizeof(esp_log_level_t), NVSInterface::TypeUint32)){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando verbosity!");
+	esp_log_level_set(_MODULE_, _lightdata.cfg.verbosity);
+	_sched->setVerbosity(_lightdata.cfg.verbosity);
+
+	uint32_t crc = Blob::getCRC32(&_lightdata.cfg, sizeof(Blob::LightCfgData_t));
+	if(!saveParameter("LigChk", &crc, sizeof(uint32_t), NVSInterface::TypeUint32)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando Checksum!");
 	}
-	else{
-		esp_log_level_set(_MODULE_, _lightdata.cfg.verbosity);
-		_sched->setVerbosity(_lightdata.cfg.verbosity);
+	uint32_t evt_rev = EvtMaskRevision;
+	if(!saveParameter("LigEvtRev", &evt_rev, sizeof(uint32_t), NVSInterface::TypeUint32)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando la revisión de la máscara de eventos!");
 	}
 
+	// la curva forma parte del registro de arranque
+	_saveBootRecord();
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_saveAction(uint8_t pos){
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Guardando acción %d en memoria NV...", pos);
+	if(!_sched->saveAction(pos)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando la acción %d!", pos);
+	}
+	if(!saveParameter("LigOutDatNum", &_lightdata.cfg.outData.numActions, sizeof(uint8_t), NVSInterface::TypeUint8)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando LigOutDatNum!");
+	}
+	// las acciones forman parte de la configuración verificada por el checksum
 	uint32_t crc = Blob::getCRC32(&_lightdata.cfg, sizeof(Blob::LightCfgData_t));
 	if(!saveParameter("LigChk", &crc, sizeof(uint32_t), NVSInterface::TypeUint32)){
 		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando Checksum!");
@@ -172,13 +369,13 @@ void LightManager::saveConfig(){
 void LightManager::_updateAndNotify(uint8_t value){
 	// si el estado es el mismo, no hace nada
 	if(value == _lightdata.stat.outValue){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Nuevo estado ya establecido.");
+		DLOG_W(_MODULE_, "Nuevo estado ya establecido.");
 		return;
 	}
 
-	// si la salida est fuera de rango, fija valor mximo
+	// si la salida está fuera de rango, fija valor máximo
 	if(value > Blob::LightActionOutMax){
-		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Nuevo estado fuera de rango, val=%d. Ajustado a max.", value);
+		DLOG_W(_MODULE_, "Nuevo estado fuera de rango, val=%d. Ajustado a max.", value);
 		value = Blob::LightActionOutMax;
 	}
 
@@ -191,63 +388,402 @@ void LightManager::_updateAndNotify(uint8_t value){
 	else if(value == 100){
 		_lightdata.stat.flags = Blob::LightOutOnEvt;
 	}
-	// cambio de estado de regulacin
+	// cambio de estado de regulación
 	else{
 		_lightdata.stat.flags = Blob::LightOutLevelChangeEvt;
 	}
 	_lightdata.stat.outValue = value;
-	if(_driver010){
-		_driver010->setLevel(_applyCurve(_lightdata.stat.outValue));
+	_applyOutput();
+	DLOG_D(_MODULE_, "LIGHT_VALUE, actualizado = %d", _lightdata.stat.outValue);
+
+	_commitSnapshot();
+	_settleOutRing();
+
+	// notifica el cambio de estado a través de la etapa de notificación
+	_notifyStat(_lightdata.stat.flags);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_notifyStat(uint32_t flags){
+	_notif.flags |= flags;
+
+	// si hay un intervalo en curso, agrupa el cambio y lo notificará al finalizar
+	if(_notif.armed){
+		_notif.pending = true;
+		return;
+	}
+
+	// en otro caso notifica inmediatamente e inicia un nuevo intervalo
+	_publishStat();
+	if(_notif.interval > 0){
+		_notif.armed = true;
+		_notif.pending = false;
+		_wheel->start(_notif_tmr, _notif.interval);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+bool LightManager::_publishStat(){
+	// sólo se notifican los eventos habilitados, si no hay ninguno descarta la notificación
+	Blob::LightStatData_t stat = _lightdata.stat;
+	stat.flags = _notif.flags & _lightdata.cfg.evtFlagMask;
+	_notif.flags = Blob::LightNoEvents;
+	if(stat.flags == Blob::LightNoEvents){
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Notificación descartada por evtFlagMask");
+		return false;
 	}
-	DEBUG_TRACE_D(_EXPR_, _MODULE_, "LIGHT_VALUE, actualizado = %d", _lightdata.stat.outValue);
 
-	// notifica el cambio de estado
 	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
 	MBED_ASSERT(pub_topic);
 	sprintf(pub_topic, "stat/value/%s", _pub_topic_base);
-	Blob::NotificationData_t<Blob::LightStatData_t> *notif = new Blob::NotificationData_t<Blob::LightStatData_t>(_lightdata.stat);
+	Blob::NotificationData_t<Blob::LightStatData_t> *notif = new Blob::NotificationData_t<Blob::LightStatData_t>(stat);
 	MBED_ASSERT(notif);
 	if(_json_supported){
+		JsonArena::begin();
 		cJSON* jboot = JsonParser::getJsonFromNotification(*notif);
 		MBED_ASSERT(jboot);
+		JsonArena::close();
 		MQ::MQClient::publish(pub_topic, &jboot, sizeof(cJSON**), &_publicationCb);
 		cJSON_Delete(jboot);
+		JsonArena::end();
+	}
+	else if(_cbor_supported){
+		uint8_t cresp[CBOR::LightCborStatMaxSize];
+		int32_t cresp_len = CBOR::getCborFromLightStat(stat, cresp, CBOR::LightCborStatMaxSize);
+		MBED_ASSERT(cresp_len > 0);
+		MQ::MQClient::publish(pub_topic, cresp, cresp_len, &_publicationCb);
 	}
 	else{
 		MQ::MQClient::publish(pub_topic, notif, sizeof(Blob::NotificationData_t<Blob::LightStatData_t>), &_publicationCb);
 	}
 	delete(notif);
 	Heap::memFree(pub_topic);
+	_simCheckOutput(stat.outValue);
+	return true;
 }
 
 
 // ----------------------------------------------------------------------------------
 void LightManager::_updateConfig(const light_manager& data, Blob::ErrorData_t& err){
-	if(data.cfg._keys & Blob::LightKeyCfgUpd){
-		_lightdata.cfg.updFlagMask = data.cfg.updFlagMask;
-	}
-	if(data.cfg._keys & Blob::LightKeyCfgEvt){
-		_lightdata.cfg.evtFlagMask = data.cfg.evtFlagMask;
-	}
-	if(data.cfg._keys & Blob::LightKeyCfgAls){
-		_lightdata.cfg.alsData = data.cfg.alsData;
-	}
-	if(data.cfg._keys & Blob::LightKeyCfgOutm){
-		_lightdata.cfg.outData.mode = data.cfg.outData.mode;
-	}
-	if(data.cfg._keys & Blob::LightKeyCfgCurve){
-		_lightdata.cfg.outData.curve = data.cfg.outData.curve;
-	}
+	Schema::copyKeys(_lightdata.cfg, data.cfg, data.cfg._keys);
+	// las acciones se indexan por su identificador
 	if(data.cfg._keys & Blob::LightKeyCfgActs){
 		_lightdata.cfg.outData.numActions = data.cfg.outData.numActions;
 		for(int i=0;i<data.cfg.outData.numActions;i++)
 			_lightdata.cfg.outData.actions[data.cfg.outData.actions[i].id] = data.cfg.outData.actions[i];
+		// actualiza la copia de evaluación del scheduler
+		_sched->rebuildEvalTable();
+	}
+	_configChanged();
+	strcpy(err.descr, Blob::errList[err.code]);
+}
+
+
+//------------------------------------------------------------------------------------
+uint16_t LightManager::_getSectionSize(uint8_t key) const{
+	// las acciones se actualizan de una en una mediante set/action y set/actclr, por lo que no son una sección
+	return Schema::getSectionSize(_lightdata.cfg, key);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_updateConfigSection(const Blob::LightSectionRequest_t& req, Blob::ErrorData_t& err){
+	// valida los límites de la sección (ej: número de muestras de la curva) antes de actualizarla
+	if(!Schema::setSection(_lightdata.cfg, req._keys, &req.data)){
+		err.code = Blob::ErrRangeValue;
 	}
-	if(data.cfg._keys & Blob::LightKeyCfgVerbosity){
-		_lightdata.cfg.verbosity = data.cfg.verbosity;
+	if(err.code == Blob::ErrOK){
+		_configChanged();
 	}
 	strcpy(err.descr, Blob::errList[err.code]);
 }
 
 
+//------------------------------------------------------------------------------------
+void LightManager::_setOutValue(uint8_t value, Blob::ErrorData_t& err){
+	// si la salida está fuera de rango, no hace nada y devuelve un error
+	if(value > Blob::LightActionOutMax){
+		err.code = Blob::ErrRangeValue;
+		strcpy(err.descr, Blob::errList[err.code]);
+		return;
+	}
+	// actualizo eventos de cambio de estado
+	// cambio a Off
+	if(value == 0){
+		_lightdata.stat.flags = Blob::LightOutOffEvt;
+	}
+	// cambio de estado a On
+	else if(value == 100){
+		_lightdata.stat.flags = Blob::LightOutOnEvt;
+	}
+	// cambio de estado de regulación
+	else{
+		_lightdata.stat.flags = Blob::LightOutLevelChangeEvt;
+	}
+	_lightdata.stat.outValue = value;
+	_applyOutput();
+	_commitSnapshot();
+	_settleOutRing();
+
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "LIGHT_VALUE_SET, actualizado = %d", _lightdata.stat.outValue);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishCfg(uint32_t idTrans, const Blob::ErrorData_t& err){
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/cfg/%s", _pub_topic_base);
+
+	// la configuración se serializa una única vez y en cada respuesta sólo se actualiza la cabecera
+	if(_json_supported){
+		RespCache_t& c = _cfg_cache[RespCodecJson];
+		cJSON* jresp = (cJSON*)c.data;
+		// las respuestas con error no se memorizan. Las memorizadas sobreviven al mensaje, por lo que no se
+		// generan en la arena JSON
+		if(jresp == NULL || err.code != Blob::ErrOK){
+			Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(idTrans, err, _lightdata);
+			MBED_ASSERT(resp);
+			jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
+			MBED_ASSERT(jresp);
+			delete(resp);
+			if(err.code == Blob::ErrOK){
+				c.data = jresp;
+			}
+		}
+		else{
+			cJSON_SetNumberValue(cJSON_GetObjectItem(jresp, JsonParser::p_idTrans), idTrans);
+		}
+		MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
+		if(jresp != c.data){
+			cJSON_Delete(jresp);
+		}
+	}
+	else if(_cbor_supported){
+		RespCache_t& c = _cfg_cache[RespCodecCbor];
+		if(c.data == NULL){
+			int32_t cdata_len = CBOR::getCborFromLightData(_lightdata, ObjSelectCfg, _cbor_buf, CBOR::LightCborMaxSize);
+			MBED_ASSERT(cdata_len > 0);
+			// ajusta la reserva al tamaño codificado
+			c.data = Heap::memAlloc(cdata_len);
+			MBED_ASSERT(c.data);
+			memcpy(c.data, _cbor_buf, cdata_len);
+			c.size = cdata_len;
+		}
+		int32_t chdr_len = CBOR::getCborResponseHeader(idTrans, err, _cbor_buf, CBOR::LightCborHeaderMaxSize);
+		MBED_ASSERT(chdr_len > 0);
+		memcpy(&_cbor_buf[chdr_len], c.data, c.size);
+		MQ::MQClient::publish(pub_topic, _cbor_buf, chdr_len + c.size, &_publicationCb);
+	}
+	else{
+		RespCache_t& c = _cfg_cache[RespCodecBlob];
+		if(c.data == NULL){
+			c.data = new Blob::Response_t<light_manager>(idTrans, err, _lightdata);
+			MBED_ASSERT(c.data);
+			c.size = sizeof(Blob::Response_t<light_manager>);
+		}
+		// el blob incluye el estado, que se actualiza junto con la cabecera
+		Blob::Response_t<light_manager>* resp = (Blob::Response_t<light_manager>*)c.data;
+		resp->idTrans = idTrans;
+		resp->error = err;
+		resp->data.stat = _lightdata.stat;
+		MQ::MQClient::publish(pub_topic, resp, c.size, &_publicationCb);
+	}
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishBoot(){
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/boot/%s", _pub_topic_base);
+
+	// la trama de arranque incluye el estado, por lo que en json y cbor se regenera si éste ha cambiado
+	if(_json_supported){
+		RespCache_t& c = _boot_cache[RespCodecJson];
+		if(c.data != NULL && memcmp(&c.stat, &_lightdata.stat, sizeof(Blob::LightStatData_t)) != 0){
+			cJSON_Delete((cJSON*)c.data);
+			c.data = NULL;
+		}
+		if(c.data == NULL){
+			Blob::NotificationData_t<light_manager> *notif = new Blob::NotificationData_t<light_manager>(_lightdata);
+			MBED_ASSERT(notif);
+			c.data = JsonParser::getJsonFromNotification(*notif, ObjSelectAll);
+			MBED_ASSERT(c.data);
+			c.stat = _lightdata.stat;
+			delete(notif);
+		}
+		cJSON* jboot = (cJSON*)c.data;
+		MQ::MQClient::publish(pub_topic, &jboot, sizeof(cJSON**), &_publicationCb);
+	}
+	else if(_cbor_supported){
+		RespCache_t& c = _boot_cache[RespCodecCbor];
+		if(c.data != NULL && memcmp(&c.stat, &_lightdata.stat, sizeof(Blob::LightStatData_t)) != 0){
+			Heap::memFree(c.data);
+			c.data = NULL;
+		}
+		if(c.data == NULL){
+			int32_t cdata_len = CBOR::getCborFromLightManager(_lightdata, ObjSelectAll, _cbor_buf, CBOR::LightCborMaxSize);
+			MBED_ASSERT(cdata_len > 0);
+			c.data = Heap::memAlloc(cdata_len);
+			MBED_ASSERT(c.data);
+			memcpy(c.data, _cbor_buf, cdata_len);
+			c.size = cdata_len;
+			c.stat = _lightdata.stat;
+		}
+		MQ::MQClient::publish(pub_topic, c.data, c.size, &_publicationCb);
+	}
+	else{
+		RespCache_t& c = _boot_cache[RespCodecBlob];
+		if(c.data == NULL){
+			c.data = new Blob::NotificationData_t<light_manager>(_lightdata);
+			MBED_ASSERT(c.data);
+			c.size = sizeof(Blob::NotificationData_t<light_manager>);
+		}
+		Blob::NotificationData_t<light_manager>* notif = (Blob::NotificationData_t<light_manager>*)c.data;
+		notif->data.stat = _lightdata.stat;
+		MQ::MQClient::publish(pub_topic, notif, c.size, &_publicationCb);
+	}
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_invalidateRespCache(){
+	if(_cfg_cache[RespCodecBlob].data){
+		delete((Blob::Response_t<light_manager>*)_cfg_cache[RespCodecBlob].data);
+	}
+	if(_boot_cache[RespCodecBlob].data){
+		delete((Blob::NotificationData_t<light_manager>*)_boot_cache[RespCodecBlob].data);
+	}
+	if(_cfg_cache[RespCodecJson].data){
+		cJSON_Delete((cJSON*)_cfg_cache[RespCodecJson].data);
+	}
+	if(_boot_cache[RespCodecJson].data){
+		cJSON_Delete((cJSON*)_boot_cache[RespCodecJson].data);
+	}
+	if(_cfg_cache[RespCodecCbor].data){
+		Heap::memFree(_cfg_cache[RespCodecCbor].data);
+	}
+	if(_boot_cache[RespCodecCbor].data){
+		Heap::memFree(_boot_cache[RespCodecCbor].data);
+	}
+	memset(_cfg_cache, 0, sizeof(_cfg_cache));
+	memset(_boot_cache, 0, sizeof(_boot_cache));
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishSlimResponse(const char* token, uint32_t idTrans, Blob::ErrorCode code){
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/%s/%s", token, _pub_topic_base);
+
+	Blob::LightSlimResponse_t resp;
+	resp.idTrans = idTrans;
+	resp.code = code;
+	resp.stat = _lightdata.stat;
+	MQ::MQClient::publish(pub_topic, &resp, sizeof(Blob::LightSlimResponse_t), &_publicationCb);
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishSchedule(const Blob::LightScheduleRequest_t& req){
+	Scheduler::BacktestEvent_t events[Blob::MaxScheduleTransitions];
+	uint8_t max = (req.count > Blob::MaxScheduleTransitions || req.count == 0)? Blob::MaxScheduleTransitions : req.count;
+	int32_t count = _sched->lookahead(_lightdata.stat.outValue, events, max);
+
+	Blob::LightScheduleResponse_t* resp = (Blob::LightScheduleResponse_t*)Heap::memAlloc(sizeof(Blob::LightScheduleResponse_t));
+	MBED_ASSERT(resp);
+	resp->idTrans = req.idTrans;
+	// sin hora local no se puede calcular la planificación
+	resp->code = (count < 0)? Blob::ErrRangeValue : Blob::ErrOK;
+	resp->count = (count < 0)? 0 : count;
+	for(int i=0;i<resp->count;i++){
+		resp->items[i].time = (uint32_t)events[i].time;
+		resp->items[i].id = events[i].id;
+		resp->items[i].outValue = events[i].outValue;
+	}
+
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/schedule/%s", _pub_topic_base);
+	// sólo se envían las transiciones obtenidas
+	MQ::MQClient::publish(pub_topic, resp, Blob::LightScheduleHeaderSize + (resp->count * sizeof(Blob::LightTransition_t)), &_publicationCb);
+	Heap::memFree(pub_topic);
+	Heap::memFree(resp);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_recordLatency(uint64_t recv_ms){
+	int32_t late_ms = _sched->recordApplied((uint32_t)(Kernel::get_ms_count() - recv_ms));
+	uint32_t alert_ms = _sched->getLateAlert();
+	if(late_ms < 0 || alert_ms == 0 || (uint32_t)late_ms <= alert_ms){
+		return;
+	}
+	// la alerta se notifica como un evento más del estado, filtrado por <evtFlagMask>
+	_notifyStat(Blob::LightLateActionEvt);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_notifyMissedActions(){
+	// una acción perdida equivale a un retraso superior a cualquier umbral
+	if(_sched->takeMissed() == 0 || _sched->getLateAlert() == 0){
+		return;
+	}
+	_notifyStat(Blob::LightLateActionEvt);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishLatency(uint32_t idTrans, Blob::ErrorCode code){
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/latency/%s", _pub_topic_base);
+
+	Blob::LightLatencyResponse_t resp;
+	resp.idTrans = idTrans;
+	resp.code = code;
+	resp.alertMs = _sched->getLateAlert();
+	resp.stats = _sched->getLatencyStats();
+	MQ::MQClient::publish(pub_topic, &resp, sizeof(Blob::LightLatencyResponse_t), &_publicationCb);
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_configChanged(){
+	_invalidateRespCache();
+	_cfg_version++;
+	// el modo o la curva pueden modificar la salida de cada driver
+	_applyOutput();
+	_commitSnapshot();
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_commitSnapshot(){
+	StatSnapshot_t snap;
+	snap.stat = _lightdata.stat;
+	snap.cfgVersion = _cfg_version;
+
+	// mientras se actualiza la copia 0 (secuencia impar) los lectores usan la copia 1 y viceversa, por lo
+	// que un lector nunca espera a que finalice la escritura
+	_snap.seq++;
+	__sync_synchronize();
+	_snap.buf[0] = snap;
+	__sync_synchronize();
+	_snap.seq++;
+	__sync_synchronize();
+	_snap.buf[1] = snap;
+	__sync_synchronize();
+}
+
+
 
@@ -11,8 +11,8 @@
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[LightM]........";
 #define _EXPR_	(!IS_ISR())
@@ -23,26 +23,29 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
 	State::Msg* st_msg = (State::Msg*)se->oe->value.p;
     switch((int)se->evt){
         case State::EV_ENTRY:{
-        	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Iniciando recuperacin de datos...");
-        	// recupera los datos de memoria NV
-        	restoreConfig();
-
-        	// realiza la suscripcin local ej: "cmd/$module/#"
+        	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Iniciando recuperación de datos...");
+        	// restaura la salida desde el registro de arranque. El resto de la configuración se carga de forma
+        	// diferida (ver RecvBootStep), atendiendo mientras tanto los mensajes de control
+        	_restoreBootRecord();
+        	_boot.success = true;
+        	_boot.step = BootStepFlags;
+
+        	// realiza la suscripción local ej: "cmd/$module/#"
         	char* sub_topic_local = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
         	MBED_ASSERT(sub_topic_local);
         	sprintf(sub_topic_local, "set/+/%s", _sub_topic_base);
         	if(MQ::MQClient::subscribe(sub_topic_local, new MQ::SubscribeCallback(this, &LightManager::subscriptionCb)) == MQ::SUCCESS){
-        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripcin LOCAL hecha a %s", sub_topic_local);
+        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripción LOCAL hecha a %s", sub_topic_local);
         	}
         	else{
-        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripcin LOCAL a %s", sub_topic_local);
+        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripción LOCAL a %s", sub_topic_local);
         	}
         	sprintf(sub_topic_local, "get/+/%s", _sub_topic_base);
         	if(MQ::MQClient::subscribe(sub_topic_local, new MQ::SubscribeCallback(this, &LightManager::subscriptionCb)) == MQ::SUCCESS){
-        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripcin LOCAL hecha a %s", sub_topic_local);
+        		DEBUG_TRACE_D(_EXPR_, _MODULE_, "Sucripción LOCAL hecha a %s", sub_topic_local);
         	}
         	else{
-        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripcin LOCAL a %s", sub_topic_local);
+        		DEBUG_TRACE_E(_EXPR_, _MODULE_, "ERR_SUBSC en la suscripción LOCAL a %s", sub_topic_local);
         	}
         	Heap::memFree(sub_topic_local);
 
@@ -55,32 +58,16 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en cmd/$BASE/cfg/set
+        // Procesa datos recibidos de la publicación en cmd/$BASE/cfg/set
         case RecvCfgSet:{
         	Blob::SetRequest_t<light_manager>* req = (Blob::SetRequest_t<light_manager>*)st_msg->msg;
-			// si no hay errores, actualiza la configuracin
+			// si no hay errores, actualiza la configuración
 			if(req->_error.code == Blob::ErrOK){
 				_updateConfig(req->data, req->_error);
 			}
-        	// si hay errores en el mensaje o en la actualizacin, devuelve resultado sin hacer nada
+        	// si hay errores en el mensaje o en la actualización, devuelve resultado sin hacer nada
         	if(req->_error.code != Blob::ErrOK){
-        		char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-				MBED_ASSERT(pub_topic);
-				sprintf(pub_topic, "stat/cfg/%s", _pub_topic_base);
-
-				Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(req->idTrans, req->_error, _lightdata);
-
-				if(_json_supported){
-					cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
-					MBED_ASSERT(jresp);
-					MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
-					cJSON_Delete(jresp);
-				}
-				else{
-					MQ::MQClient::publish(pub_topic, resp, sizeof(Blob::Response_t<light_manager>), &_publicationCb);
-				}
-				delete(resp);
-				Heap::memFree(pub_topic);
+        		_publishCfg(req->idTrans, req->_error);
 				return State::HANDLED;
         	}
 
@@ -89,62 +76,20 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
 
         	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Config actualizada");
 
-        	// si est habilitada la notificacin de actualizacin, lo notifica
+        	// si está habilitada la notificación de actualización, lo notifica
         	if((_lightdata.cfg.updFlagMask & Blob::EnableLightCfgUpdNotif) != 0){
-				char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-				MBED_ASSERT(pub_topic);
-				sprintf(pub_topic, "stat/cfg/%s", _pub_topic_base);
-				Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(req->idTrans, req->_error, _lightdata);
-
-				if(_json_supported){
-					cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
-					MBED_ASSERT(jresp);
-					MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
-					cJSON_Delete(jresp);
-				}
-				else{
-					MQ::MQClient::publish(pub_topic, resp, sizeof(Blob::Response_t<light_manager>), &_publicationCb);
-				}
-				delete(resp);
-				Heap::memFree(pub_topic);
+        		_publishCfg(req->idTrans, req->_error);
         	}
 
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en cmd/$BASE/value/set
+        // Procesa datos recibidos de la publicación en cmd/$BASE/value/set
         case RecvStatSet:{
         	Blob::SetRequest_t<light_manager>* req = (Blob::SetRequest_t<light_manager>*)st_msg->msg;
-        	// si el mensaje recibido no tiene errores de preprocesado contina
+        	// si el mensaje recibido no tiene errores de preprocesado continúa
         	if(req->_error.code == Blob::ErrOK){
-				// actualiza el estado de la luminaria
-				uint8_t value =  req->data.stat.outValue;
-				// si la salida est fuera de rango, no hace nada y devuelve un error
-				if(value > Blob::LightActionOutMax){
-					req->_error.code = Blob::ErrRangeValue;
-					strcpy(req->_error.descr, Blob::errList[req->_error.code]);
-				}
-				else{
-					// actualizo eventos de cambio de estado
-					// cambio a Off
-					if(value == 0){
-						_lightdata.stat.flags = Blob::LightOutOffEvt;
-					}
-					// cambio de estado a On
-					else if(value == 100){
-						_lightdata.stat.flags = Blob::LightOutOnEvt;
-					}
-					// cambio de estado de regulacin
-					else{
-						_lightdata.stat.flags = Blob::LightOutLevelChangeEvt;
-					}
-					_lightdata.stat.outValue = value;
-					if(_driver010){
-						_driver010->setLevel(_applyCurve(_lightdata.stat.outValue));
-					}
-
-					DEBUG_TRACE_I(_EXPR_, _MODULE_, "LIGHT_VALUE_SET, actualizado = %d", _lightdata.stat.outValue);
-				}
+        		_setOutValue(req->data.stat.outValue, req->_error);
         	}
 
         	// notifica el cambio de estado
@@ -154,46 +99,218 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
 			Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(req->idTrans, req->_error, _lightdata);
 			MBED_ASSERT(resp);
 			if(_json_supported){
+				JsonArena::begin();
 				cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectState);
 				MBED_ASSERT(jresp);
+				JsonArena::close();
 				MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
 				cJSON_Delete(jresp);
+				JsonArena::end();
+			}
+			else if(_cbor_supported){
+				uint8_t cresp[CBOR::LightCborStatMaxSize];
+				int32_t cresp_len = CBOR::getCborFromLightResponse(req->idTrans, req->_error, resp->data, ObjSelectState, cresp, CBOR::LightCborStatMaxSize);
+				MBED_ASSERT(cresp_len > 0);
+				MQ::MQClient::publish(pub_topic, cresp, cresp_len, &_publicationCb);
 			}
 			else{
 				MQ::MQClient::publish(pub_topic, resp, sizeof(Blob::Response_t<light_manager>), &_publicationCb);
 			}
 			delete(resp);
 			Heap::memFree(pub_topic);
+			_simCheckOutput(_lightdata.stat.outValue);
         	return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en cmd/$BASE/cfg/get
-        case RecvCfgGet:{
+        // Procesa una solicitud compacta recibida en set/level
+        case RecvLevelSet:{
+        	Blob::LightLevelRequest_t* req = (Blob::LightLevelRequest_t*)st_msg->msg;
+        	Blob::ErrorData_t err;
+        	err.code = Blob::ErrOK;
+        	_setOutValue(req->outValue, err);
+        	_publishSlimResponse("level", req->idTrans, err.code);
+        	_simCheckOutput(_lightdata.stat.outValue);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud compacta recibida en set/action o set/actclr. Sólo se graba la acción modificada
+        case RecvActionSet:
+        case RecvActionClr:{
+        	Blob::ErrorData_t err;
+        	err.code = Blob::ErrOK;
+        	uint32_t idTrans;
+        	const char* token;
+        	uint8_t pos;
+        	if(st_msg->sig == RecvActionSet){
+        		Blob::LightActionRequest_t* req = (Blob::LightActionRequest_t*)st_msg->msg;
+        		idTrans = req->idTrans;
+        		token = "action";
+        		pos = req->pos;
+        		// las acciones se indexan por su identificador, igual que en la configuración completa
+        		if(req->action.id != req->pos || req->action.outValue > (int8_t)Blob::LightActionOutMax || _sched->setAction(req->pos, req->action) != 0){
+        			err.code = Blob::ErrRangeValue;
+        		}
+        	}
+        	else{
+        		Blob::LightActionClrRequest_t* req = (Blob::LightActionClrRequest_t*)st_msg->msg;
+        		idTrans = req->idTrans;
+        		token = "actclr";
+        		pos = req->pos;
+        		if(_sched->clrActionByPos(req->pos) != 0){
+        			err.code = Blob::ErrRangeValue;
+        		}
+        	}
+        	if(err.code == Blob::ErrOK){
+        		_lightdata.cfg.outData.numActions = _sched->getActionCount();
+        		_configChanged();
+        		_saveAction(pos);
+        		DEBUG_TRACE_I(_EXPR_, _MODULE_, "Acción %d actualizada", pos);
+        		if((_lightdata.cfg.updFlagMask & Blob::EnableLightCfgUpdNotif) != 0){
+        			strcpy(err.descr, Blob::errList[err.code]);
+        			_publishCfg(idTrans, err);
+        		}
+        	}
+        	_publishSlimResponse(token, idTrans, err.code);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud compacta recibida en set/calendar. Sólo se graba el calendario modificado
+        case RecvCalendarSet:{
+        	Blob::LightCalendarRequest_t* req = (Blob::LightCalendarRequest_t*)st_msg->msg;
+        	Blob::ErrorCode code = Blob::ErrOK;
+        	if(_sched->setCalendar(req->index, req->calendar) != 0){
+        		code = Blob::ErrRangeValue;
+        	}
+        	else{
+        		_sched->saveCalendar(req->index);
+        		DEBUG_TRACE_I(_EXPR_, _MODULE_, "Calendario %d actualizado", req->index);
+        	}
+        	_publishSlimResponse("calendar", req->idTrans, code);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud recibida en get/schedule
+        case RecvScheduleGet:{
+        	_publishSchedule(*(Blob::LightScheduleRequest_t*)st_msg->msg);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud recibida en get/meter
+        case RecvMeterGet:{
         	Blob::GetRequest_t* req = (Blob::GetRequest_t*)st_msg->msg;
+        	_publishMeter(req->idTrans, Blob::ErrOK);
+        	return State::HANDLED;
+        }
 
-			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Respondiendo datos de configuracin solicitados");
-			char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-			MBED_ASSERT(pub_topic);
-			sprintf(pub_topic, "stat/cfg/%s", _pub_topic_base);
+        // Procesa una solicitud compacta recibida en set/meter
+        case RecvMeterSet:{
+        	Blob::LightMeterCfgRequest_t* req = (Blob::LightMeterCfgRequest_t*)st_msg->msg;
+        	Blob::ErrorCode code = Blob::ErrOK;
+        	if(req->cfg.powerCurve.samples > Blob::LightCurveSampleCount){
+        		code = Blob::ErrRangeValue;
+        	}
+        	else{
+        		// el tramo en curso se acumula con los parámetros anteriores y se graba, para que los contadores
+        		// registrados con ellos no dependan de la siguiente grabación horaria
+        		_meterSync(true);
+        		_meter.cfg = req->cfg;
+        		// actualiza la potencia del tramo en curso y la demanda comunicada al servicio de límite
+        		_applyOutput();
+        		if(!saveParameter("LigMeterCfg", &_meter.cfg, sizeof(Blob::LightMeterCfg_t), NVSInterface::TypeBlob)){
+        			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando MeterCfg!");
+        		}
+        	}
+        	_publishMeter(req->idTrans, code);
+        	return State::HANDLED;
+        }
 
-			// responde con los datos solicitados y con los errores (si hubiera) de la decodificacin de la solicitud
-			Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(req->idTrans, req->_error, _lightdata);
-			MBED_ASSERT(resp);
-			if(_json_supported){
-				cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
-				MBED_ASSERT(jresp);
-				MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
-				cJSON_Delete(jresp);
-			}
-			else{
-				MQ::MQClient::publish(pub_topic, resp, sizeof(Blob::Response_t<light_manager>), &_publicationCb);
-			}
-			delete(resp);
-			Heap::memFree(pub_topic);
+        // Procesa una solicitud compacta recibida en set/powercap
+        case RecvPowerCapSet:{
+        	Blob::LightPowerCapRequest_t* req = (Blob::LightPowerCapRequest_t*)st_msg->msg;
+        	Blob::ErrorCode code = Blob::ErrOK;
+        	if(_power.budget == NULL){
+        		code = Blob::ErrRangeValue;
+        	}
+        	else{
+        		// el servicio avisa a todas las instancias cuyo factor cambia, incluida ésta
+        		_power.budget->setCap(req->capW);
+        	}
+        	_publishPowerCap(req->idTrans, code);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud recibida en get/powercap
+        case RecvPowerCapGet:{
+        	Blob::GetRequest_t* req = (Blob::GetRequest_t*)st_msg->msg;
+        	_publishPowerCap(req->idTrans, (_power.budget)? Blob::ErrOK : Blob::ErrRangeValue);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud recibida en get/latency
+        case RecvLatencyGet:{
+        	Blob::GetRequest_t* req = (Blob::GetRequest_t*)st_msg->msg;
+        	_publishLatency(req->idTrans, Blob::ErrOK);
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud compacta recibida en set/latency
+        case RecvLatencySet:{
+        	Blob::LightLatencyCfgRequest_t* req = (Blob::LightLatencyCfgRequest_t*)st_msg->msg;
+        	_sched->setLateAlert(req->alertMs);
+        	if(req->reset){
+        		_sched->clearLatencyStats();
+        	}
+        	if(!saveParameter("LigLateAlrt", &req->alertMs, sizeof(uint32_t), NVSInterface::TypeUint32)){
+        		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS grabando LateAlert!");
+        	}
+        	_publishLatency(req->idTrans, Blob::ErrOK);
+        	return State::HANDLED;
+        }
+
+        // Procesa un cambio del factor de potencia de su prioridad
+        case RecvPowerLimit:{
+        	// libera el aviso antes de leer el factor, para que un cambio posterior genere uno nuevo
+        	__sync_lock_release(&_power.pending);
+        	_applyOutput();
+        	return State::HANDLED;
+        }
+
+        // Registra un driver de salida adicional y le aplica el nivel actual, sin esperar al siguiente cambio
+        case RecvOutDriverAdd:{
+        	LightOutputDriver* drv = *(LightOutputDriver**)st_msg->msg;
+        	_addOutputDriver(drv);
+        	_applyOutput();
+        	return State::HANDLED;
+        }
+
+        // Procesa una solicitud compacta recibida en set/section
+        case RecvSectionSet:{
+        	Blob::LightSectionRequest_t* req = (Blob::LightSectionRequest_t*)st_msg->msg;
+        	Blob::ErrorData_t err;
+        	err.code = Blob::ErrOK;
+        	_updateConfigSection(*req, err);
+        	if(err.code == Blob::ErrOK){
+        		saveConfig();
+        		DEBUG_TRACE_I(_EXPR_, _MODULE_, "Sección de config actualizada");
+        		if((_lightdata.cfg.updFlagMask & Blob::EnableLightCfgUpdNotif) != 0){
+        			_publishCfg(req->idTrans, err);
+        		}
+        	}
+        	_publishSlimResponse("section", req->idTrans, err.code);
+        	return State::HANDLED;
+        }
+
+        // Procesa datos recibidos de la publicación en cmd/$BASE/cfg/get
+        case RecvCfgGet:{
+        	Blob::GetRequest_t* req = (Blob::GetRequest_t*)st_msg->msg;
+
+			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Respondiendo datos de configuración solicitados");
+			// responde con los datos solicitados y con los errores (si hubiera) de la decodificación de la solicitud
+			_publishCfg(req->idTrans, req->_error);
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en cmd/$BASE/value/get
+        // Procesa datos recibidos de la publicación en cmd/$BASE/value/get
         case RecvStatGet:{
         	Blob::GetRequest_t* req = (Blob::GetRequest_t*)st_msg->msg;
         	// prepara el topic al que responder
@@ -203,18 +320,27 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
 
 			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Respondiendo datos de estado solicitados");
 
-			// responde con los datos solicitados y con los errores (si hubiera) de la decodificacin de la solicitud
+			// responde con los datos solicitados y con los errores (si hubiera) de la decodificación de la solicitud
 			Blob::Response_t<light_manager>* resp = new Blob::Response_t<light_manager>(req->idTrans, req->_error, _lightdata);
 			MBED_ASSERT(resp);
 
-			// borra los flags de evento ya que es una respuesta sin ms
+			// borra los flags de evento ya que es una respuesta sin más
 			resp->data.stat.flags = Blob::LightNoEvents;
 
 			if(_json_supported){
+				JsonArena::begin();
 				cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectState);
 				MBED_ASSERT(jresp);
+				JsonArena::close();
 				MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
 				cJSON_Delete(jresp);
+				JsonArena::end();
+			}
+			else if(_cbor_supported){
+				uint8_t cresp[CBOR::LightCborStatMaxSize];
+				int32_t cresp_len = CBOR::getCborFromLightResponse(req->idTrans, req->_error, resp->data, ObjSelectState, cresp, CBOR::LightCborStatMaxSize);
+				MBED_ASSERT(cresp_len > 0);
+				MQ::MQClient::publish(pub_topic, cresp, cresp_len, &_publicationCb);
 			}
 			else {
 				MQ::MQClient::publish(pub_topic, resp, sizeof(Blob::Response_t<light_manager>), &_publicationCb);
@@ -224,39 +350,42 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en get/boot
+        // Procesa datos recibidos de la publicación en get/boot
         case RecvBootGet:{
-        	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
-			MBED_ASSERT(pub_topic);
-			sprintf(pub_topic, "stat/boot/%s", _pub_topic_base);
-			Blob::NotificationData_t<light_manager> *notif = new Blob::NotificationData_t<light_manager>(_lightdata);
-			MBED_ASSERT(notif);
-			if(_json_supported){
-				cJSON* jboot = JsonParser::getJsonFromNotification(*notif, ObjSelectAll);
-				MBED_ASSERT(jboot);
-				MQ::MQClient::publish(pub_topic, &jboot, sizeof(cJSON**), &_publicationCb);
-				cJSON_Delete(jboot);
-			}
-			else {
-				MQ::MQClient::publish(pub_topic, notif, sizeof(Blob::NotificationData_t<light_manager>), &_publicationCb);
-			}
-			delete(notif);
-			Heap::memFree(pub_topic);
+        	_publishBoot();
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en set/time
+        // Procesa datos recibidos de la publicación en set/time
         case RecvTimeSet:{
-        	Blob::LightTimeData_t ast = *(Blob::LightTimeData_t*)st_msg->msg;
+        	TimeMsg_t* tm = (TimeMsg_t*)st_msg->msg;
 			int8_t new_out_value;
 			// ejecuta el scheduler y en caso de que haya un nuevo estado de la carga, lo notifica
-			if((new_out_value = _sched->updateTimestamp(ast)) != -1){
+			if((new_out_value = _sched->updateTimestamp(tm->data)) != -1){
 				_updateAndNotify(new_out_value);
+				_recordLatency(tm->recv_ms);
 			}
+			_notifyMissedActions();
+			// las actualizaciones horarias periódicas aseguran la grabación de los contadores de uso
+			_meterSync();
             return State::HANDLED;
         }
 
-        // Procesa datos recibidos de la publicacin en set/lux
+        // Procesa una hora local compacta recibida en set/time
+        case RecvLocaltimeSet:{
+        	LocaltimeMsg_t* lt = (LocaltimeMsg_t*)st_msg->msg;
+			int8_t new_out_value;
+			// ejecuta el scheduler con los datos de calendario previos y la nueva hora local
+			if((new_out_value = _sched->updateLocaltime(lt->t)) != -1){
+				_updateAndNotify(new_out_value);
+				_recordLatency(lt->recv_ms);
+			}
+			_notifyMissedActions();
+			_meterSync();
+            return State::HANDLED;
+        }
+
+        // Procesa datos recibidos de la publicación en set/lux
         case RecvLuxSet:{
 	        Blob::LightLuxLevel lux = *(Blob::LightLuxLevel*)st_msg->msg;
 	        int8_t new_out_value;
@@ -267,6 +396,65 @@ State::StateResult LightManager::Init_EventHandler(State::StateEvent* se){
             return State::HANDLED;
         }
 
+        // Ejecuta un paso de la carga diferida de la configuración
+        case RecvBootStep:{
+        	if(_boot.step < BootStepDone){
+        		_restoreConfigStep(_boot.step++);
+        		if(_boot.step == BootStepDone){
+        			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Configuración cargada");
+        		}
+        	}
+            return State::HANDLED;
+        }
+
+        // Finaliza el intervalo mínimo de notificación
+        case RecvNotifFlush:{
+        	// si se han agrupado cambios durante el intervalo, notifica el último estado
+        	if(_notif.pending){
+        		_notif.pending = false;
+        		_publishStat();
+        		// inicia un nuevo intervalo para seguir limitando la tasa de notificación
+        		if(_notif.interval > 0){
+        			_wheel->start(_notif_tmr, _notif.interval);
+        			return State::HANDLED;
+        		}
+        	}
+        	_notif.armed = false;
+            return State::HANDLED;
+        }
+
+        // Registra en memoria NV el valor estable de la salida
+        case RecvOutRingSave:{
+        	_appendOutRing(_lightdata.stat.outValue);
+            return State::HANDLED;
+        }
+
+        // Avanza un paso del simulador de eventos
+        case RecvSimStep:{
+        	if(!_sim.running){
+        		return State::HANDLED;
+        	}
+        	// en modo lo más rápido posible, inyecta el siguiente evento y encadena el siguiente paso
+        	if(_sim.speed == 0 && _sim.next < _sim.count){
+        		_simInject();
+        		_simPostStep();
+        		return State::HANDLED;
+        	}
+        	// si no quedan eventos, finaliza la reproducción contabilizando las notificaciones no recibidas
+        	if(_sim.next >= _sim.count){
+        		if(_sim.expected != NULL && _sim.result.notified < _sim.exp_count){
+        			if(_sim.result.mismatches == 0){
+        				_sim.result.firstMismatch = _sim.result.notified;
+        			}
+        			_sim.result.mismatches += _sim.exp_count - _sim.result.notified;
+        		}
+        		stopSimulator();
+        		_sim.result.done = true;
+        		DEBUG_TRACE_I(_EXPR_, _MODULE_, "Simulación finalizada. Eventos=%d, notificaciones=%d, errores=%d", _sim.result.injected, _sim.result.notified, _sim.result.mismatches);
+        	}
+            return State::HANDLED;
+        }
+
         case State::EV_EXIT:{
             nextState();
             return State::HANDLED;
@@ -11,22 +11,33 @@
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[LightM]........";
 #define _EXPR_	(!IS_ISR())
 
+
+/** Claves decodificadas de un evento temporal CBOR que sólo incluye la hora local */
+static const uint32_t CborLocaltimeOnly = (1 << 0);
+
  
 //------------------------------------------------------------------------------------
 void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len){
-    // si es un comando para actualizar los parmetros minmax...
+	_dispatchMessage(topic, msg, msg_len, _json_supported, _cbor_supported);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_dispatchMessage(const char* topic, void* msg, uint16_t msg_len, bool json, bool cbor){
+    // si es un comando para actualizar los parámetros minmax...
     if(MQ::MQClient::isTokenRoot(topic, "set/cfg")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic set/cfg, len=%d", msg_len);
 
         Blob::SetRequest_t<light_manager>* req = NULL;
         bool json_decoded = false;
-		if(_json_supported){
+        bool cbor_decoded = false;
+		if(json){
 			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
 			MBED_ASSERT(req);
 			if(!(json_decoded = JsonParser::getSetRequestFromJson(*req, *(cJSON**)msg))){
@@ -34,18 +45,27 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_JSON. Decodificando el mensaje");
 			}
 		}
+		else if(cbor){
+			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
+			MBED_ASSERT(req);
+			memset(req, 0, sizeof(Blob::SetRequest_t<light_manager>));
+			if(!(cbor_decoded = CBOR::getLightSetRequestFromCbor(*req, (const uint8_t*)msg, msg_len))){
+				Heap::memFree(req);
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+			}
+		}
 
-        // en primer lugar asegura que los datos tienen el tamao correcto
-        if(!json_decoded && msg_len != sizeof(Blob::SetRequest_t<light_manager>)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el n de datos del mensaje, topic [%s]", topic);
+        // en primer lugar asegura que los datos tienen el tamaño correcto
+        if(!json_decoded && !cbor_decoded && msg_len != sizeof(Blob::SetRequest_t<light_manager>)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
 			return;
         }
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
-        if(!json_decoded){
+        if(!json_decoded && !cbor_decoded){
 			// el mensaje es un blob tipo light_manager
 			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
 			MBED_ASSERT(req);
@@ -55,7 +75,7 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 		// apunta a los datos
 		op->msg = req;
 
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -67,11 +87,12 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 
     // si es un comando para actualizar el estado de la luminaria
     if(MQ::MQClient::isTokenRoot(topic, "set/value")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic set/value, len=%d", msg_len);
 
         Blob::SetRequest_t<light_manager>* req = NULL;
         bool json_decoded = false;
-		if(_json_supported){
+        bool cbor_decoded = false;
+		if(json){
 			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
 			MBED_ASSERT(req);
 			if(!(json_decoded = JsonParser::getSetRequestFromJson(*req, *(cJSON**)msg))){
@@ -79,18 +100,27 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_JSON. Decodificando el mensaje");
 			}
 		}
+		else if(cbor){
+			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
+			MBED_ASSERT(req);
+			memset(req, 0, sizeof(Blob::SetRequest_t<light_manager>));
+			if(!(cbor_decoded = CBOR::getLightSetRequestFromCbor(*req, (const uint8_t*)msg, msg_len))){
+				Heap::memFree(req);
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+			}
+		}
 
-        // en primer lugar asegura que los datos tienen el tamao correcto
-        if(!json_decoded && msg_len != sizeof(Blob::SetRequest_t<light_manager>)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el n de datos del mensaje, topic [%s]", topic);
+        // en primer lugar asegura que los datos tienen el tamaño correcto
+        if(!json_decoded && !cbor_decoded && msg_len != sizeof(Blob::SetRequest_t<light_manager>)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
 			return;
         }
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
-        if(!json_decoded){
+        if(!json_decoded && !cbor_decoded){
 			// el mensaje es un blob tipo light_manager
 			req = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
 			MBED_ASSERT(req);
@@ -100,7 +130,7 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 		// apunta a los datos
 		op->msg = req;
 
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -110,13 +140,14 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
         return;
     }
 
-    // si es un comando para notificar un cambio en el luxmetro
+    // si es un comando para notificar un cambio en el luxómetro
     if(MQ::MQClient::isTokenRoot(topic, "set/lux")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic set/lux, len=%d", msg_len);
 
         Blob::LightLuxLevel* req = NULL;
         bool json_decoded = false;
-		if(_json_supported){
+        bool cbor_decoded = false;
+		if(json){
 			req = (Blob::LightLuxLevel*)Heap::memAlloc(sizeof(Blob::LightLuxLevel));
 			MBED_ASSERT(req);
 			if(!(json_decoded = JsonParser::getObjFromJson(*req, *(cJSON**)msg))){
@@ -124,18 +155,27 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_JSON. Decodificando el mensaje");
 			}
 		}
+		else if(cbor){
+			req = (Blob::LightLuxLevel*)Heap::memAlloc(sizeof(Blob::LightLuxLevel));
+			MBED_ASSERT(req);
+			memset(req, 0, sizeof(Blob::LightLuxLevel));
+			if(!(cbor_decoded = CBOR::getLightLuxFromCbor(*req, (const uint8_t*)msg, msg_len))){
+				Heap::memFree(req);
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+			}
+		}
 
-        // en primer lugar asegura que los datos tienen el tamao correcto
-        if(!json_decoded && msg_len != sizeof(Blob::LightLuxLevel)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el n de datos del mensaje, topic [%s]", topic);
+        // en primer lugar asegura que los datos tienen el tamaño correcto
+        if(!json_decoded && !cbor_decoded && msg_len != sizeof(Blob::LightLuxLevel)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
 			return;
         }
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
-        if(!json_decoded){
+        if(!json_decoded && !cbor_decoded){
 			// el mensaje es un blob tipo Blob::LightStatData_t
 			req = (Blob::LightLuxLevel*)Heap::memAlloc(sizeof(Blob::LightLuxLevel));
 			MBED_ASSERT(req);
@@ -145,7 +185,7 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 		// apunta a los datos
 		op->msg = req;
 
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -157,40 +197,77 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 
     // si es un comando para notificar un cambio en el timestamp del calendario
     if(MQ::MQClient::isTokenRoot(topic, "set/time")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic set/time, len=%d", msg_len);
 
         Blob::LightTimeData_t *req = NULL;
         bool json_decoded = false;
-		if(_json_supported){
-			req = (Blob::LightTimeData_t*)Heap::memAlloc(sizeof(Blob::LightTimeData_t));
+        bool cbor_decoded = false;
+        uint32_t cbor_keys = 0;
+		if(json){
+			req = (Blob::LightTimeData_t*)Heap::memAlloc(sizeof(TimeMsg_t));
 			MBED_ASSERT(req);
 			if(!(json_decoded = JsonParser::getObjFromJson(*req, *(cJSON**)msg))){
 				Heap::memFree(req);
 				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_JSON. Decodificando el mensaje");
 			}
 		}
+		else if(cbor){
+			req = (Blob::LightTimeData_t*)Heap::memAlloc(sizeof(TimeMsg_t));
+			MBED_ASSERT(req);
+			memset(req, 0, sizeof(TimeMsg_t));
+			if(!(cbor_decoded = ((cbor_keys = CBOR::getLightTimeFromCbor(*req, (const uint8_t*)msg, msg_len)) != 0))){
+				Heap::memFree(req);
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+			}
+		}
 
-        // en primer lugar asegura que los datos tienen el tamao correcto
-        if(!json_decoded && msg_len != sizeof(Blob::LightTimeData_t)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el n de datos del mensaje, topic [%s]", topic);
+        // si sólo se recibe la hora local, el orto y el ocaso se calculan localmente. En modo JSON o CBOR un mensaje
+        // que no se ha podido decodificar nunca se interpreta como blob
+        if((!json && !cbor && msg_len == sizeof(Blob::LightLocaltime_t)) || (cbor_decoded && cbor_keys == CborLocaltimeOnly)){
+        	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+        	MBED_ASSERT(op);
+        	LocaltimeMsg_t* t = (LocaltimeMsg_t*)Heap::memAlloc(sizeof(LocaltimeMsg_t));
+        	MBED_ASSERT(t);
+        	if(cbor_decoded){
+        		t->t = req->stat.localtime;
+        		Heap::memFree(req);
+        	}
+        	else{
+        		t->t = *((Blob::LightLocaltime_t*)msg);
+        	}
+        	// instante de recepción, para medir el retraso de las acciones programadas
+        	t->recv_ms = Kernel::get_ms_count();
+        	op->sig = RecvLocaltimeSet;
+        	op->msg = t;
+        	if(putMessage(op) != osOK){
+        		Heap::memFree(op->msg);
+        		Heap::memFree(op);
+        	}
+        	return;
+        }
+
+        // en primer lugar asegura que los datos tienen el tamaño correcto
+        if(!json_decoded && !cbor_decoded && msg_len != sizeof(Blob::LightTimeData_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
 			return;
         }
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
-        if(!json_decoded){
+        if(!json_decoded && !cbor_decoded){
 			// el mensaje es un blob tipo Blob::LightStatData_t
-			req = (Blob::LightTimeData_t*)Heap::memAlloc(sizeof(Blob::LightTimeData_t));
+			req = (Blob::LightTimeData_t*)Heap::memAlloc(sizeof(TimeMsg_t));
 			MBED_ASSERT(req);
 			*req = *((Blob::LightTimeData_t*)msg);
         }
+        ((TimeMsg_t*)req)->recv_ms = Kernel::get_ms_count();
 		op->sig = RecvTimeSet;
 		// apunta a los datos
 		op->msg = req;
 
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -200,32 +277,205 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
         return;
     }
 
+    // si es una solicitud compacta, sólo se admite en formato blob y con el tamaño exacto del tipo asociado. En
+    // formato JSON o CBOR se responde con error
+    if(MQ::MQClient::isTokenRoot(topic, "set/level") || MQ::MQClient::isTokenRoot(topic, "set/action") ||
+       MQ::MQClient::isTokenRoot(topic, "set/actclr") || MQ::MQClient::isTokenRoot(topic, "set/calendar") ||
+       MQ::MQClient::isTokenRoot(topic, "set/meter") || MQ::MQClient::isTokenRoot(topic, "set/powercap") ||
+       MQ::MQClient::isTokenRoot(topic, "set/latency") || MQ::MQClient::isTokenRoot(topic, "set/section")){
+        DLOG_D(_MODULE_, "Recibido topic compacto, len=%d", msg_len);
+
+        if(json || cbor){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FMT. Las solicitudes compactas sólo se admiten en formato blob, topic [%s]", topic);
+        	_publishFormatError(topic, msg, msg_len, json);
+        	return;
+        }
+
+        if(MQ::MQClient::isTokenRoot(topic, "set/level")){
+        	if(msg_len == sizeof(Blob::LightLevelRequest_t)){
+        		_postSlimRequest(RecvLevelSet, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/action")){
+        	if(msg_len == sizeof(Blob::LightActionRequest_t)){
+        		_postSlimRequest(RecvActionSet, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/actclr")){
+        	if(msg_len == sizeof(Blob::LightActionClrRequest_t)){
+        		_postSlimRequest(RecvActionClr, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/calendar")){
+        	if(msg_len == sizeof(Blob::LightCalendarRequest_t)){
+        		_postSlimRequest(RecvCalendarSet, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/meter")){
+        	if(msg_len == sizeof(Blob::LightMeterCfgRequest_t)){
+        		_postSlimRequest(RecvMeterSet, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/powercap")){
+        	if(msg_len == sizeof(Blob::LightPowerCapRequest_t)){
+        		_postSlimRequest(RecvPowerCapSet, msg, msg_len);
+        		return;
+        	}
+        }
+        else if(MQ::MQClient::isTokenRoot(topic, "set/latency")){
+        	if(msg_len == sizeof(Blob::LightLatencyCfgRequest_t)){
+        		_postSlimRequest(RecvLatencySet, msg, msg_len);
+        		return;
+        	}
+        }
+        // la trama de una sección incluye la cabecera y únicamente los datos de la sección indicada
+        else if(msg_len > Blob::LightSectionHeaderSize){
+        	uint16_t size = _getSectionSize(((Blob::LightSectionRequest_t*)msg)->_keys);
+        	if(size != 0 && msg_len == Blob::LightSectionHeaderSize + size){
+        		_postSlimRequest(RecvSectionSet, msg, msg_len);
+        		return;
+        	}
+        }
+        DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        return;
+    }
+
+    // la consulta de las próximas transiciones sólo se admite en formato blob y se resuelve en la máquina de estados,
+    // que es la propietaria del scheduler. En formato JSON o CBOR se responde con error
+    if(MQ::MQClient::isTokenRoot(topic, "get/schedule")){
+        DLOG_D(_MODULE_, "Recibido topic get/schedule, len=%d", msg_len);
+        if(json || cbor){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FMT. Consulta sólo admitida en formato blob, topic [%s]", topic);
+        	_publishFormatError(topic, msg, msg_len, json);
+        	return;
+        }
+        if(msg_len != sizeof(Blob::LightScheduleRequest_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        	return;
+        }
+        _postSlimRequest(RecvScheduleGet, msg, msg_len);
+        return;
+    }
+
+    // la consulta de los contadores de uso sigue el mismo criterio, ya que el integrador se actualiza en la
+    // máquina de estados
+    if(MQ::MQClient::isTokenRoot(topic, "get/meter")){
+        DLOG_D(_MODULE_, "Recibido topic get/meter, len=%d", msg_len);
+        if(json || cbor){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FMT. Consulta sólo admitida en formato blob, topic [%s]", topic);
+        	_publishFormatError(topic, msg, msg_len, json);
+        	return;
+        }
+        if(msg_len != sizeof(Blob::GetRequest_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        	return;
+        }
+        _postSlimRequest(RecvMeterGet, msg, msg_len);
+        return;
+    }
+
+    if(MQ::MQClient::isTokenRoot(topic, "get/powercap")){
+        DLOG_D(_MODULE_, "Recibido topic get/powercap, len=%d", msg_len);
+        if(json || cbor){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FMT. Consulta sólo admitida en formato blob, topic [%s]", topic);
+        	_publishFormatError(topic, msg, msg_len, json);
+        	return;
+        }
+        if(msg_len != sizeof(Blob::GetRequest_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        	return;
+        }
+        _postSlimRequest(RecvPowerCapGet, msg, msg_len);
+        return;
+    }
+
+    if(MQ::MQClient::isTokenRoot(topic, "get/latency")){
+        DLOG_D(_MODULE_, "Recibido topic get/latency, len=%d", msg_len);
+        if(json || cbor){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_FMT. Consulta sólo admitida en formato blob, topic [%s]", topic);
+        	_publishFormatError(topic, msg, msg_len, json);
+        	return;
+        }
+        if(msg_len != sizeof(Blob::GetRequest_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        	return;
+        }
+        _postSlimRequest(RecvLatencyGet, msg, msg_len);
+        return;
+    }
+
+    // las solicitudes de estado se responden directamente desde la instantánea, sin pasar por la máquina de estados.
+    // En formato blob, get/value requiere la respuesta completa y se sigue procesando en la máquina de estados
+    if(MQ::MQClient::isTokenRoot(topic, "get/level") || (MQ::MQClient::isTokenRoot(topic, "get/value") && (json || cbor))){
+        DLOG_D(_MODULE_, "Recibido topic de lectura directa, len=%d", msg_len);
+
+        Blob::GetRequest_t req;
+        bool slim = MQ::MQClient::isTokenRoot(topic, "get/level");
+        if(slim){
+        	if(json || cbor || msg_len != sizeof(Blob::GetRequest_t)){
+        		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
+        		return;
+        	}
+        	req = *((Blob::GetRequest_t*)msg);
+        }
+        else if(json){
+        	if(!JsonParser::getGetRequestFromJson(req, *(cJSON**)msg)){
+        		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_JSON. Decodificando el mensaje");
+        		return;
+        	}
+        }
+        else{
+        	memset(&req, 0, sizeof(Blob::GetRequest_t));
+        	if(!CBOR::getGetRequestFromCbor(req, (const uint8_t*)msg, msg_len)){
+        		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+        		return;
+        	}
+        }
+        _publishStatSnapshot(req.idTrans, req._error, slim);
+        return;
+    }
+
     // si es un comando para solicitar lectura de datos...
     if(MQ::MQClient::isTokenRoot(topic, "get/cfg") || MQ::MQClient::isTokenRoot(topic, "get/value")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic de lectura, len=%d", msg_len);
 
         Blob::GetRequest_t* req = NULL;
         bool json_decoded = false;
-        if(_json_supported){
+        bool cbor_decoded = false;
+        if(json){
 			req = (Blob::GetRequest_t*)Heap::memAlloc(sizeof(Blob::GetRequest_t));
 			MBED_ASSERT(req);
 			if(!(json_decoded = JsonParser::getGetRequestFromJson(*req, *(cJSON**)msg))){
 				Heap::memFree(req);
 			}
         }
+        else if(cbor){
+        	req = (Blob::GetRequest_t*)Heap::memAlloc(sizeof(Blob::GetRequest_t));
+        	MBED_ASSERT(req);
+        	memset(req, 0, sizeof(Blob::GetRequest_t));
+        	if(!(cbor_decoded = CBOR::getGetRequestFromCbor(*req, (const uint8_t*)msg, msg_len))){
+        		Heap::memFree(req);
+        		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_CBOR. Decodificando el mensaje");
+        	}
+        }
 
-        // Antes de nada, chequea que el tamao de la zona horaria es correcto, en caso contrario, descarta el topic
-        if(!json_decoded && msg_len != sizeof(Blob::GetRequest_t)){
-        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el n de datos del mensaje, topic [%s]", topic);
+        // Antes de nada, chequea que el tamaño de la zona horaria es correcto, en caso contrario, descarta el topic
+        if(!json_decoded && !cbor_decoded && msg_len != sizeof(Blob::GetRequest_t)){
+        	DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_MSG. Error en el nº de datos del mensaje, topic [%s]", topic);
 			return;
         }
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
         // el mensaje es un blob tipo Blob::GetRequest_t
-        if(!json_decoded){
+        if(!json_decoded && !cbor_decoded){
         	req = (Blob::GetRequest_t*)Heap::memAlloc(sizeof(Blob::GetRequest_t));
         	MBED_ASSERT(req);
         	*req = *((Blob::GetRequest_t*)msg);
@@ -237,7 +487,7 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
         // apunta a los datos
 		op->msg = req;
 
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -247,18 +497,18 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
         return;
     }
 
-    // si es un comando para solicitar la configuracin
+    // si es un comando para solicitar la configuración
     if(MQ::MQClient::isTokenRoot(topic, "get/boot")){
-        DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recibido topic %s", topic);
+        DLOG_D(_MODULE_, "Recibido topic get/boot, len=%d", msg_len);
 
-        // crea el mensaje para publicar en la mquina de estados
+        // crea el mensaje para publicar en la máquina de estados
         State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
         MBED_ASSERT(op);
 
         op->sig = RecvBootGet;
 		// apunta a los datos
 		op->msg = NULL;
-		// postea en la cola de la mquina de estados
+		// postea en la cola de la máquina de estados
 		if(putMessage(op) != osOK){
 			if(op->msg){
 				Heap::memFree(op->msg);
@@ -272,4 +522,108 @@ void LightManager::subscriptionCb(const char* topic, void* msg, uint16_t msg_len
 }
 
 
+//------------------------------------------------------------------------------------
+void LightManager::_postSlimRequest(uint32_t sig, const void* msg, uint16_t msg_len){
+	// crea el mensaje para publicar en la máquina de estados
+	State::Msg* op = (State::Msg*)Heap::memAlloc(sizeof(State::Msg));
+	MBED_ASSERT(op);
+	op->sig = sig;
+
+	// copia únicamente los bytes recibidos (las secciones de configuración son de tamaño variable)
+	op->msg = Heap::memAlloc(msg_len);
+	MBED_ASSERT(op->msg);
+	memcpy(op->msg, msg, msg_len);
+
+	// postea en la cola de la máquina de estados
+	if(putMessage(op) != osOK){
+		Heap::memFree(op->msg);
+		Heap::memFree(op);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishStatSnapshot(uint32_t idTrans, const Blob::ErrorData_t& err, bool slim){
+	StatSnapshot_t snap;
+	getStatSnapshot(snap);
+	// borra los flags de evento ya que es una respuesta sin más
+	snap.stat.flags = Blob::LightNoEvents;
+
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	sprintf(pub_topic, "stat/%s/%s", (slim)? "level" : "value", _pub_topic_base);
+
+	if(slim){
+		Blob::LightSlimResponse_t resp;
+		resp.idTrans = idTrans;
+		resp.code = err.code;
+		resp.stat = snap.stat;
+		MQ::MQClient::publish(pub_topic, &resp, sizeof(Blob::LightSlimResponse_t), &_publicationCb);
+		Heap::memFree(pub_topic);
+		return;
+	}
+
+	_publishSnapshotResponse(pub_topic, idTrans, err);
+	Heap::memFree(pub_topic);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishSnapshotResponse(const char* pub_topic, uint32_t idTrans, const Blob::ErrorData_t& err){
+	StatSnapshot_t snap;
+	getStatSnapshot(snap);
+	snap.stat.flags = Blob::LightNoEvents;
+
+	// sólo se codifican el uid y el estado, la configuración no se lee fuera del hilo de LightManager
+	Blob::Response_t<light_manager>* resp = (Blob::Response_t<light_manager>*)Heap::memAlloc(sizeof(Blob::Response_t<light_manager>));
+	MBED_ASSERT(resp);
+	resp->idTrans = idTrans;
+	resp->error = err;
+	resp->data.uid = UID_LIGHT_MANAGER;
+	resp->data.stat = snap.stat;
+	if(_json_supported){
+		// no se utiliza la arena JSON, que puede estar adquirida por el hilo de LightManager, para que la
+		// respuesta nunca espere al procesamiento en curso
+		cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectState);
+		MBED_ASSERT(jresp);
+		MQ::MQClient::publish(pub_topic, &jresp, sizeof(cJSON**), &_publicationCb);
+		cJSON_Delete(jresp);
+	}
+	else{
+		uint8_t cresp[CBOR::LightCborStatMaxSize];
+		int32_t cresp_len = CBOR::getCborFromLightResponse(idTrans, err, resp->data, ObjSelectState, cresp, CBOR::LightCborStatMaxSize);
+		MBED_ASSERT(cresp_len > 0);
+		MQ::MQClient::publish(pub_topic, cresp, cresp_len, &_publicationCb);
+	}
+	Heap::memFree(resp);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightManager::_publishFormatError(const char* topic, void* msg, uint16_t msg_len, bool json){
+	// recupera el identificador de la transacción, si la solicitud lo incluye
+	Blob::GetRequest_t req(0);
+	if(json){
+		JsonParser::getGetRequestFromJson(req, *(cJSON**)msg);
+	}
+	else{
+		CBOR::getGetRequestFromCbor(req, (const uint8_t*)msg, msg_len);
+	}
+	Blob::ErrorData_t err;
+	err.code = Blob::ErrRangeValue;
+	strcpy(err.descr, Blob::errList[err.code]);
+
+	// la respuesta se publica en el recurso de la solicitud: "set/meter/..." -> "stat/meter/$BASE"
+	const char* token = strchr(topic, '/');
+	token = (token)? token + 1 : topic;
+	const char* end = strchr(token, '/');
+	int token_len = (end)? (int)(end - token) : (int)strlen(token);
+	char* pub_topic = (char*)Heap::memAlloc(MQ::MQClient::getMaxTopicLen());
+	MBED_ASSERT(pub_topic);
+	snprintf(pub_topic, MQ::MQClient::getMaxTopicLen(), "stat/%.*s/%s", token_len, token, _pub_topic_base);
+	_publishSnapshotResponse(pub_topic, req.idTrans, err);
+	Heap::memFree(pub_topic);
+}
+
+
 
@@ -0,0 +1,184 @@
+/*
+ * LightOutputDriver.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "LightOutputDriver.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[LightOut]......";
+#define _EXPR_	(!IS_ISR())
+
+/** Byte de dirección DALI de una trama de nivel directo */
+static const uint8_t DaliBroadcastAddr = 0xFE;
+static const uint8_t DaliGroupAddr = 0x80;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+LightOutputDriver::LightOutputDriver(uint32_t modes, uint8_t channels) :
+		_channels((channels == 0)? 1 : (channels > MaxChannels)? MaxChannels : channels), _modes(modes) {
+	memset(_shadow, 0, sizeof(_shadow));
+	memset(_target, 0, sizeof(_target));
+	_dirty = 0;
+	_valid = false;
+	_writes = 0;
+	_skipped = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutputDriver::setLevel(uint8_t level){
+	for(uint8_t i=0;i<_channels;i++){
+		setLevel(i, level);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutputDriver::setLevel(uint8_t channel, uint8_t level){
+	if(channel >= _channels){
+		return;
+	}
+	level = _quantize((level > Blob::LightActionOutMax)? Blob::LightActionOutMax : level);
+	_target[channel] = level;
+	// si coincide con lo último escrito, el canal no se reenvía
+	if(_valid && _shadow[channel] == level){
+		_dirty &= ~(1 << channel);
+		return;
+	}
+	_dirty |= (1 << channel);
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t LightOutputDriver::flush(){
+	if(_dirty == 0){
+		_skipped++;
+		return 0;
+	}
+	uint32_t dirty = _dirty;
+	_write(_target, dirty);
+	uint32_t count = 0;
+	for(uint8_t i=0;i<_channels;i++){
+		if(dirty & (1 << i)){
+			_shadow[i] = _target[i];
+			count++;
+		}
+	}
+	// el registro sombra es válido cuando se han escrito todos los canales al menos una vez
+	if(!_valid && dirty == ((1UL << _channels) - 1)){
+		_valid = true;
+	}
+	_dirty = 0;
+	_writes++;
+	return count;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutputDriver::invalidate(){
+	_valid = false;
+	_dirty = (1UL << _channels) - 1;
+}
+
+
+//------------------------------------------------------------------------------------
+LightOutPwm010Driver::LightOutPwm010Driver(PinName pin, bool defdbg) :
+		LightOutputDriver(Blob::LightOutPwm | Blob::LightOut010, 1) {
+	_drv = new Driver_Pwm010(pin, Driver_Pwm010::OnIsLowLevel, 1, defdbg);
+	MBED_ASSERT(_drv);
+	_drv->setScaleFactor(1);
+}
+
+
+//------------------------------------------------------------------------------------
+LightOutPwm010Driver::~LightOutPwm010Driver(){
+	delete(_drv);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutPwm010Driver::_write(const uint8_t* levels, uint32_t dirty){
+	_drv->setLevel(levels[0]);
+}
+
+
+//------------------------------------------------------------------------------------
+LightOutRelayDriver::LightOutRelayDriver(PinName pin, Blob::LightOutModeFlags mode) :
+		LightOutputDriver(mode, 1), _nc(mode == Blob::LightOutRelayNC) {
+	// arranca con la luminaria apagada
+	_out = new DigitalOut(pin, (_nc)? 1 : 0);
+	MBED_ASSERT(_out);
+}
+
+
+//------------------------------------------------------------------------------------
+LightOutRelayDriver::~LightOutRelayDriver(){
+	delete(_out);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutRelayDriver::_write(const uint8_t* levels, uint32_t dirty){
+	int on = (levels[0] > 0)? 1 : 0;
+	_out->write((_nc)? !on : on);
+}
+
+
+//------------------------------------------------------------------------------------
+LightOutDaliDriver::LightOutDaliDriver(Callback<void(uint8_t, uint8_t)> tx, uint8_t channels, uint8_t first_addr, int8_t group) :
+		LightOutputDriver(Blob::LightOutDali, channels), _tx(tx), _first_addr(first_addr), _group(group) {
+	MBED_ASSERT(first_addr + _channels <= 64 && group < 16);
+	_frames = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightOutDaliDriver::_write(const uint8_t* levels, uint32_t dirty){
+	// si cambian todos los equipos al mismo nivel, basta una trama de grupo o broadcast
+	uint32_t all = (1UL << _channels) - 1;
+	bool same = (dirty == all);
+	for(uint8_t i=1;i<_channels && same;i++){
+		same = (levels[i] == levels[0]);
+	}
+	if(same){
+		uint8_t addr = (_group == Broadcast)? DaliBroadcastAddr : (uint8_t)(DaliGroupAddr | (_group << 1));
+		_tx(addr, _toArc(levels[0]));
+		_frames++;
+		DEBUG_TRACE_D(_EXPR_, _MODULE_, "DALI grupo addr=%x, nivel=%d", addr, levels[0]);
+		return;
+	}
+	// en otro caso, una trama por equipo modificado
+	for(uint8_t i=0;i<_channels;i++){
+		if(dirty & (1 << i)){
+			_tx((uint8_t)((_first_addr + i) << 1), _toArc(levels[i]));
+			_frames++;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+uint8_t LightOutDaliDriver::_toArc(uint8_t level){
+	// el nivel ya tiene aplicada la curva de activación, por lo que se escala linealmente a 1..254
+	if(level == 0){
+		return 0;
+	}
+	return (uint8_t)(1 + ((uint32_t)(level - 1) * 253) / (Blob::LightActionOutMax - 1));
+}
+
@@ -0,0 +1,298 @@
+/*
+ * LightOutputDriver.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	LightOutputDriver es la interfaz de los drivers de salida de LightManager. Cada driver declara los modos de
+ *	LightOutModeFlags que implementa y LightManager sólo escribe en los drivers que corresponden al modo configurado
+ *	en <outData.mode>.
+ *
+ *	La clase base mantiene un registro sombra con el último nivel escrito en cada canal:
+ *
+ *		setLevel: actualiza el nivel deseado de uno o de todos los canales. Si coincide con el registro sombra, el
+ *		canal no se marca como modificado
+ *
+ *		flush: envía en una única operación (_write) los canales modificados, de forma que cada driver puede
+ *		agruparlos (ej: una única trama DALI de grupo o broadcast)
+ *
+ *	Drivers incluidos:
+ *
+ *		LightOutPwm010Driver: salida PWM / 0-10V a través de Driver_Pwm010
+ *		LightOutRelayDriver: salida de relé normalmente abierto o cerrado
+ *		LightOutDaliDriver: salida DALI (comando de nivel directo), a través de una callback de transmisión
+ *		LightOutRecordDriver: driver sin hardware que registra todas las escrituras (tests y simulación)
+ */
+
+#ifndef __LightOutputDriver__H
+#define __LightOutputDriver__H
+
+#include "mbed.h"
+#include "LightManagerBlob.h"
+#include "Driver_Pwm010.h"
+
+class LightOutputDriver {
+  public:
+
+	/** Número máximo de canales por driver */
+	static const uint8_t MaxChannels = 16;
+
+
+	/** Crea el driver
+	 *
+	 * @param modes Modos (LightOutModeFlags) que implementa el driver
+	 * @param channels Número de canales
+	 */
+	LightOutputDriver(uint32_t modes, uint8_t channels);
+
+
+	/** Destructor */
+	virtual ~LightOutputDriver(){}
+
+
+	/** Comprueba si el driver implementa alguno de los modos indicados
+	 *
+	 * @param mode Modos configurados
+	 * @return True si debe utilizarse
+	 */
+	bool isSelected(uint32_t mode) const {
+		return ((_modes & mode) != 0);
+	}
+
+
+	/** Actualiza el nivel deseado de todos los canales
+	 *
+	 * @param level Nivel tras aplicar la curva (0..100)
+	 */
+	void setLevel(uint8_t level);
+
+
+	/** Actualiza el nivel deseado de un canal
+	 *
+	 * @param channel Canal
+	 * @param level Nivel tras aplicar la curva (0..100)
+	 */
+	void setLevel(uint8_t channel, uint8_t level);
+
+
+	/** Envía los canales modificados desde la última escritura
+	 *
+	 * @return Número de canales escritos
+	 */
+	uint32_t flush();
+
+
+	/** Invalida el registro sombra, forzando la escritura de todos los canales en el siguiente <flush> (ej: tras
+	 *  reiniciar el bus o el equipo controlado)
+	 */
+	void invalidate();
+
+
+	/** Obtiene el último nivel escrito en un canal
+	 *
+	 * @param channel Canal
+	 * @return Nivel
+	 */
+	uint8_t getLevel(uint8_t channel) const {
+		return (channel < _channels)? _shadow[channel] : 0;
+	}
+
+
+	/** Obtiene el número de operaciones de escritura realizadas */
+	uint32_t getWrites() const {
+		return _writes;
+	}
+
+
+	/** Obtiene el número de actualizaciones descartadas por no modificar el registro sombra */
+	uint32_t getSkipped() const {
+		return _skipped;
+	}
+
+  protected:
+
+	/** Número de canales */
+	const uint8_t _channels;
+
+
+	/** Convierte el nivel al valor que distingue el driver (ej: on/off en un relé), de forma que dos niveles
+	 *  equivalentes no se reescriban
+	 *
+	 * @param level Nivel (0..100)
+	 * @return Nivel equivalente
+	 */
+	virtual uint8_t _quantize(uint8_t level){
+		return level;
+	}
+
+
+	/** Escribe en el hardware los canales modificados
+	 *
+	 * @param levels Nivel de cada canal
+	 * @param dirty Máscara de canales modificados
+	 */
+	virtual void _write(const uint8_t* levels, uint32_t dirty) = 0;
+
+  private:
+
+	/** Modos implementados */
+	const uint32_t _modes;
+
+	/** Registro sombra con el último nivel escrito */
+	uint8_t _shadow[MaxChannels];
+
+	/** Nivel deseado de cada canal */
+	uint8_t _target[MaxChannels];
+
+	/** Máscara de canales modificados */
+	uint32_t _dirty;
+
+	/** Flag de registro sombra válido */
+	bool _valid;
+
+	/** Estadísticas */
+	uint32_t _writes;
+	uint32_t _skipped;
+};
+
+
+//------------------------------------------------------------------------------------
+/** Salida PWM / 0-10V de un canal */
+class LightOutPwm010Driver : public LightOutputDriver {
+  public:
+	/** Crea el driver
+	 *
+	 * @param pin Pin de salida
+	 * @param defdbg Flag de depuración
+	 */
+	LightOutPwm010Driver(PinName pin, bool defdbg = false);
+
+	virtual ~LightOutPwm010Driver();
+
+  protected:
+	virtual void _write(const uint8_t* levels, uint32_t dirty);
+
+  private:
+	Driver_Pwm010* _drv;
+};
+
+
+//------------------------------------------------------------------------------------
+/** Salida de relé de un canal, normalmente abierto o normalmente cerrado */
+class LightOutRelayDriver : public LightOutputDriver {
+  public:
+	/** Crea el driver
+	 *
+	 * @param pin Pin de control del relé
+	 * @param mode LightOutRelayNA o LightOutRelayNC
+	 */
+	LightOutRelayDriver(PinName pin, Blob::LightOutModeFlags mode);
+
+	virtual ~LightOutRelayDriver();
+
+  protected:
+	virtual uint8_t _quantize(uint8_t level){
+		return (level > 0)? Blob::LightActionOutMax : 0;
+	}
+
+	virtual void _write(const uint8_t* levels, uint32_t dirty);
+
+  private:
+	DigitalOut* _out;
+	const bool _nc;
+};
+
+
+//------------------------------------------------------------------------------------
+/** Salida DALI. Cada canal es un equipo con dirección corta consecutiva a partir de <first_addr>. Cuando todos
+ *  los canales cambian al mismo nivel, se envía una única trama a la dirección de grupo (o broadcast)
+ */
+class LightOutDaliDriver : public LightOutputDriver {
+  public:
+	/** Dirección broadcast */
+	static const int8_t Broadcast = -1;
+
+	/** Crea el driver
+	 *
+	 * @param tx Callback de transmisión de una trama directa (byte de dirección, nivel de arco)
+	 * @param channels Número de equipos
+	 * @param first_addr Dirección corta del primer equipo (0..63)
+	 * @param group Grupo que contiene todos los equipos (0..15) o <Broadcast>
+	 */
+	LightOutDaliDriver(Callback<void(uint8_t, uint8_t)> tx, uint8_t channels, uint8_t first_addr = 0, int8_t group = Broadcast);
+
+	/** Obtiene el número de tramas enviadas */
+	uint32_t getFrames() const {
+		return _frames;
+	}
+
+  protected:
+	virtual void _write(const uint8_t* levels, uint32_t dirty);
+
+  private:
+	Callback<void(uint8_t, uint8_t)> _tx;
+	const uint8_t _first_addr;
+	const int8_t _group;
+	uint32_t _frames;
+
+	/** Convierte un nivel 0..100 al nivel de arco DALI (0: apagado, 1..254) */
+	static uint8_t _toArc(uint8_t level);
+};
+
+
+//------------------------------------------------------------------------------------
+/** Driver sin hardware que registra todas las escrituras */
+class LightOutRecordDriver : public LightOutputDriver {
+  public:
+	/** Número máximo de escrituras registradas */
+	static const uint32_t MaxRecords = 32;
+
+	/** Escritura registrada */
+	struct Record_t {
+		uint32_t dirty;					//!< Canales escritos
+		uint8_t levels[MaxChannels];	//!< Nivel de cada canal
+	};
+
+	/** Crea el driver
+	 *
+	 * @param modes Modos a los que responde
+	 * @param channels Número de canales
+	 */
+	LightOutRecordDriver(uint32_t modes, uint8_t channels = 1) : LightOutputDriver(modes, channels), _count(0) {}
+
+	/** Obtiene el número de escrituras realizadas (puede superar <MaxRecords>) */
+	uint32_t getCount() const {
+		return _count;
+	}
+
+	/** Obtiene una escritura registrada
+	 *
+	 * @param i Índice (0..MaxRecords-1)
+	 */
+	const Record_t& getRecord(uint32_t i) const {
+		return _records[i % MaxRecords];
+	}
+
+	/** Borra el registro */
+	void clear(){
+		_count = 0;
+	}
+
+  protected:
+	virtual void _write(const uint8_t* levels, uint32_t dirty){
+		Record_t& r = _records[_count % MaxRecords];
+		r.dirty = dirty;
+		memcpy(r.levels, levels, sizeof(r.levels));
+		_count++;
+	}
+
+  private:
+	Record_t _records[MaxRecords];
+	uint32_t _count;
+};
+
+#endif /*__LightOutputDriver__H */
+
+/**** END OF FILE ****/
+
+
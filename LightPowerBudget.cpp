@@ -0,0 +1,253 @@
+/*
+ * LightPowerBudget.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "LightPowerBudget.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[PwBudget]......";
+#define _EXPR_	(!IS_ISR())
+
+
+Mutex LightPowerBudget::_default_mtx;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+LightPowerBudget* LightPowerBudget::getDefault(){
+	static LightPowerBudget* budget = NULL;
+	_default_mtx.lock();
+	if(budget == NULL){
+		budget = new LightPowerBudget();
+		MBED_ASSERT(budget);
+	}
+	_default_mtx.unlock();
+	return budget;
+}
+
+
+//------------------------------------------------------------------------------------
+LightPowerBudget::LightPowerBudget() : _cb_done(_mtx) {
+	memset(_members, 0, sizeof(_members));
+	memset(_demand, 0, sizeof(_demand));
+	_total = 0;
+	for(uint8_t p=0;p<Priorities;p++){
+		_factor[p] = FactorMax;
+	}
+	_cap_w = 0;
+	_notifications = 0;
+	_pending = NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightPowerBudget::attach(Member_t& m, uint8_t priority, Callback<void()> cb){
+	priority = (priority < Priorities)? priority : (Priorities - 1);
+	Notify_t notify = {NULL, 0, NULL, 0, NULL};
+	_mtx.lock();
+	// si ya estaba registrado, lo desenlaza manteniendo su demanda
+	if(m.pprev != NULL){
+		*m.pprev = m.next;
+		if(m.next){
+			m.next->pprev = m.pprev;
+		}
+		_demand[m.priority] -= m.demand;
+		_total -= m.demand;
+	}
+	m.priority = priority;
+	m.cb = cb;
+	m.next = _members[priority];
+	if(m.next){
+		m.next->pprev = &m.next;
+	}
+	m.pprev = &_members[priority];
+	_members[priority] = &m;
+	_demand[priority] += m.demand;
+	_total += m.demand;
+	_rebalance(&m, notify);
+	_mtx.unlock();
+	_notify(notify);
+}
+
+
+//------------------------------------------------------------------------------------
+void LightPowerBudget::detach(Member_t& m){
+	Notify_t notify = {NULL, 0, NULL, 0, NULL};
+	_mtx.lock();
+	if(m.pprev != NULL){
+		*m.pprev = m.next;
+		if(m.next){
+			m.next->pprev = m.pprev;
+		}
+		m.next = NULL;
+		m.pprev = NULL;
+		_demand[m.priority] -= m.demand;
+		_total -= m.demand;
+		m.demand = 0;
+		_rebalance(NULL, notify);
+	}
+	// descarta sus avisos pendientes y, si su callback está en ejecución en otro hilo, espera a que finalice
+	for(;;){
+		bool running = false;
+		for(Notify_t* n = _pending; n != NULL; n = n->next){
+			for(uint32_t i=0;i<n->count;i++){
+				if(n->members[i] == &m){
+					n->members[i] = NULL;
+				}
+			}
+			if(n->current == &m && n->thread != osThreadGetId()){
+				running = true;
+			}
+		}
+		if(!running){
+			break;
+		}
+		_cb_done.wait();
+	}
+	_mtx.unlock();
+	_notify(notify);
+}
+
+
+//------------------------------------------------------------------------------------
+uint16_t LightPowerBudget::update(Member_t& m, uint32_t demand){
+	Notify_t notify = {NULL, 0, NULL, 0, NULL};
+	_mtx.lock();
+	if(m.pprev == NULL){
+		_mtx.unlock();
+		return FactorMax;
+	}
+	// actualiza la demanda por diferencia
+	if(demand != m.demand){
+		_demand[m.priority] = _demand[m.priority] - m.demand + demand;
+		_total = _total - m.demand + demand;
+		m.demand = demand;
+		_rebalance(&m, notify);
+	}
+	uint16_t factor = _factor[m.priority];
+	_mtx.unlock();
+	_notify(notify);
+	return factor;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightPowerBudget::setCap(uint32_t cap_w){
+	Notify_t notify = {NULL, 0, NULL, 0, NULL};
+	_mtx.lock();
+	if(cap_w != _cap_w){
+		DEBUG_TRACE_I(_EXPR_, _MODULE_, "Límite de potencia %dW -> %dW", _cap_w, cap_w);
+		_cap_w = cap_w;
+		_rebalance(NULL, notify);
+	}
+	_mtx.unlock();
+	_notify(notify);
+}
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE METHODS IMPLEMENTATION --------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void LightPowerBudget::_rebalance(Member_t* origin, Notify_t& notify){
+	notify.members = NULL;
+	notify.count = 0;
+	// potencia disponible en cW
+	uint64_t avail = (uint64_t)_cap_w * 100;
+	bool limited = (_cap_w != 0 && _total > avail);
+	bool changed[Priorities];
+	uint32_t count = 0;
+	for(uint8_t p=0;p<Priorities;p++){
+		uint16_t factor = FactorMax;
+		if(limited){
+			if(_demand[p] <= avail){
+				avail -= _demand[p];
+			}
+			else{
+				factor = (uint16_t)((avail * FactorMax) / _demand[p]);
+				avail = 0;
+			}
+		}
+		changed[p] = (factor != _factor[p]);
+		if(!changed[p]){
+			continue;
+		}
+		_factor[p] = factor;
+		for(Member_t* m = _members[p]; m != NULL; m = m->next){
+			if(m != origin && m->cb){
+				count++;
+			}
+		}
+	}
+	if(count == 0){
+		return;
+	}
+	// recopila los miembros para invocar sus callbacks tras liberar el mutex
+	notify.members = new Member_t*[count];
+	MBED_ASSERT(notify.members);
+	for(uint8_t p=0;p<Priorities;p++){
+		if(!changed[p]){
+			continue;
+		}
+		for(Member_t* m = _members[p]; m != NULL; m = m->next){
+			if(m != origin && m->cb){
+				notify.members[notify.count++] = m;
+			}
+		}
+	}
+	_notifications += notify.count;
+	notify.current = NULL;
+	notify.thread = osThreadGetId();
+	notify.next = _pending;
+	_pending = &notify;
+}
+
+
+//------------------------------------------------------------------------------------
+void LightPowerBudget::_notify(Notify_t& notify){
+	if(notify.members == NULL){
+		return;
+	}
+	_mtx.lock();
+	for(uint32_t i=0;i<notify.count;i++){
+		// los miembros dados de baja tras la recopilación se han eliminado de la lista
+		Member_t* m = notify.members[i];
+		if(m == NULL){
+			continue;
+		}
+		Callback<void()> cb = m->cb;
+		notify.current = m;
+		_mtx.unlock();
+		cb();
+		_mtx.lock();
+		notify.current = NULL;
+		_cb_done.notify_all();
+	}
+	// elimina la lista de las que están en curso
+	Notify_t** pp = &_pending;
+	while(*pp != &notify){
+		pp = &(*pp)->next;
+	}
+	*pp = notify.next;
+	_mtx.unlock();
+	delete[] notify.members;
+	notify.members = NULL;
+	notify.count = 0;
+}
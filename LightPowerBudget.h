@@ -0,0 +1,194 @@
+/*
+ * LightPowerBudget.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	LightPowerBudget es un servicio compartido que limita la potencia total de las luminarias de una instalación
+ *	(ej: un mismo alimentador durante un evento de respuesta a la demanda). Cada instancia de LightManager se
+ *	registra como miembro con una prioridad y comunica su demanda de potencia (la correspondiente a su nivel tras la
+ *	curva, sin limitar):
+ *
+ *		update: actualiza la demanda de un miembro. Coste O(1), ya que sólo modifica el total de su prioridad
+ *
+ *		setCap: actualiza el límite de potencia (0: sin límite)
+ *
+ *	Cuando la demanda supera el límite, el reparto se realiza por prioridades (0: máxima). Las prioridades altas
+ *	reciben su demanda completa mientras quede potencia y la primera prioridad que no cabe se escala con el
+ *	factor restante. Las prioridades inferiores quedan a 0. El cálculo sólo recorre las prioridades.
+ *
+ *	Si el factor de una prioridad cambia, se invoca la callback de todos sus miembros (salvo el que provoca el
+ *	cambio, que lo obtiene como resultado de <update>). Los miembros a avisar se recopilan con el servicio
+ *	bloqueado y sus callbacks se invocan tras liberarlo, en el contexto del hilo que modifica la demanda o el
+ *	límite, por lo que pueden consultar el servicio pero deben limitarse a enviar mensajes. Al igual que la
+ *	cancelación de un temporizador de <TimingWheel>, <detach> descarta los avisos pendientes del miembro y espera
+ *	a que finalice su callback si está en ejecución en otro hilo, por lo que tras él el miembro puede destruirse.
+ */
+
+#ifndef __LightPowerBudget__H
+#define __LightPowerBudget__H
+
+#include "mbed.h"
+
+class LightPowerBudget {
+  public:
+
+	/** Número de prioridades (0: máxima) */
+	static const uint8_t Priorities = 4;
+
+	/** Factor sin limitación (por mil) */
+	static const uint16_t FactorMax = 1000;
+
+
+	/** Miembro registrado en el servicio. Se enlaza directamente en la lista de su prioridad, por lo que no
+	 *  requiere memoria dinámica
+	 */
+	struct Member_t {
+		Member_t* next;				//!< Siguiente miembro de la prioridad
+		Member_t** pprev;			//!< Enlace que apunta a este miembro (NULL si no está registrado)
+		uint32_t demand;			//!< Demanda en cW (W x 100)
+		uint8_t priority;			//!< Prioridad
+		Callback<void()> cb;		//!< Callback a invocar al cambiar el factor de su prioridad
+
+		Member_t() : next(NULL), pprev(NULL), demand(0), priority(0) {}
+	};
+
+
+	/** Obtiene el servicio compartido, creándolo en la primera llamada. Puede invocarse desde varios hilos a la
+	 *  vez, todos obtienen la misma instancia
+	 *
+	 * @return Servicio compartido
+	 */
+	static LightPowerBudget* getDefault();
+
+
+	/** Crea el servicio sin límite de potencia */
+	LightPowerBudget();
+
+
+	/** Registra un miembro. Si ya estaba registrado, actualiza su prioridad manteniendo su demanda
+	 *
+	 * @param m Miembro
+	 * @param priority Prioridad (se limita a Priorities-1)
+	 * @param cb Callback de cambio del factor de su prioridad
+	 */
+	void attach(Member_t& m, uint8_t priority, Callback<void()> cb);
+
+
+	/** Elimina un miembro y su demanda. Descarta sus avisos pendientes y, si su callback está en ejecución en
+	 *  otro hilo, espera a que finalice
+	 *
+	 * @param m Miembro
+	 */
+	void detach(Member_t& m);
+
+
+	/** Actualiza la demanda de un miembro
+	 *
+	 * @param m Miembro
+	 * @param demand Demanda en cW
+	 * @return Factor (por mil) a aplicar por el miembro
+	 */
+	uint16_t update(Member_t& m, uint32_t demand);
+
+
+	/** Actualiza el límite de potencia
+	 *
+	 * @param cap_w Límite en W (0: sin límite)
+	 */
+	void setCap(uint32_t cap_w);
+
+
+	/** Obtiene el límite de potencia
+	 *
+	 * @return Límite en W (0: sin límite)
+	 */
+	uint32_t getCap() const {
+		return _cap_w;
+	}
+
+
+	/** Obtiene el factor actual de una prioridad
+	 *
+	 * @param priority Prioridad
+	 * @return Factor (por mil)
+	 */
+	uint16_t getFactor(uint8_t priority) const {
+		return _factor[(priority < Priorities)? priority : (Priorities - 1)];
+	}
+
+
+	/** Obtiene la demanda total, sin limitar
+	 *
+	 * @return Demanda en cW
+	 */
+	uint64_t getDemand() const {
+		return _total;
+	}
+
+
+	/** Obtiene el número de notificaciones de cambio de factor enviadas */
+	uint32_t getNotifications() const {
+		return _notifications;
+	}
+
+  private:
+
+	/** Miembros de cada prioridad */
+	Member_t* _members[Priorities];
+
+	/** Demanda de cada prioridad y total (cW) */
+	uint64_t _demand[Priorities];
+	uint64_t _total;
+
+	/** Factor de cada prioridad */
+	uint16_t _factor[Priorities];
+
+	/** Límite en W */
+	uint32_t _cap_w;
+
+	/** Estadísticas */
+	uint32_t _notifications;
+
+	/** Mutex de acceso al servicio */
+	Mutex _mtx;
+
+	/** Mutex de creación del servicio compartido */
+	static Mutex _default_mtx;
+
+	/** Miembros recopilados en <_rebalance> para invocar sus callbacks fuera del mutex */
+	struct Notify_t {
+		Member_t** members;			//!< Miembros a avisar (NULL si no hay avisos, o el que se da de baja antes)
+		uint32_t count;				//!< Número de miembros
+		Member_t* current;			//!< Miembro cuya callback está en ejecución (NULL si ninguno)
+		osThreadId thread;			//!< Hilo que invoca las callbacks
+		Notify_t* next;				//!< Siguiente lista de avisos en curso
+	};
+	/** Listas de avisos en curso, para que <detach> descarte o espere los de un miembro */
+	Notify_t* _pending;
+	/** Aviso de callback finalizada, para las bajas en espera */
+	ConditionVariable _cb_done;
+
+
+	/** Recalcula el factor de cada prioridad y recopila los miembros de las que cambian, registrando la lista
+	 *  en <_pending>. Se invoca con el mutex adquirido
+	 *
+	 * @param origin Miembro que provoca el cambio, al que no se notifica (NULL si no existe)
+	 * @param notify Recibe los miembros a avisar con <_notify> tras liberar el mutex
+	 */
+	void _rebalance(Member_t* origin, Notify_t& notify);
+
+
+	/** Invoca las callbacks de los miembros recopilados en <_rebalance> que siguen registrados y libera la
+	 *  lista. Se invoca con el mutex liberado
+	 *
+	 * @param notify Miembros a avisar
+	 */
+	void _notify(Notify_t& notify);
+};
+
+#endif /*__LightPowerBudget__H */
+
+/**** END OF FILE ****/
+
+
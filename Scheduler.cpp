@@ -6,6 +6,8 @@
  */
 
 #include "Scheduler.h"
+#include <math.h>
+#include <ctype.h>
 
 
 
@@ -13,8 +15,8 @@
 //-- PRIVATE TYPEDEFS ----------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-/** Macro para imprimir trazas de depuracin, siempre que se haya configurado un objeto
- *	Logger vlido (ej: _debug)
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
  */
 static const char* _MODULE_ = "[Schduler]......";
 #define _EXPR_	(!IS_ISR())
@@ -42,50 +44,208 @@ static Blob::LightActionFlags weekDayFlagsFromTM(int wday){
 
 
 //------------------------------------------------------------------------------------
-static int32_t getExecutionTime(const Blob::LightAction_t* action, const Blob::LightTimeData_t& data){
-	int32_t result = -1;
-	tm now;
-	localtime_r(&data.stat.localtime, &now);
-	uint16_t date = now.tm_mday * 128 + now.tm_mon;
+static int32_t getLocalOffset(time_t t){
+	tm loc, utc;
+	localtime_r(&t, &loc);
+	gmtime_r(&t, &utc);
+	int32_t offset = (loc.tm_hour - utc.tm_hour) * 60 + (loc.tm_min - utc.tm_min);
+	// corrige el cambio de día entre la hora local y la UTC
+	if(loc.tm_year != utc.tm_year || loc.tm_yday != utc.tm_yday){
+		offset += (loc.tm_year > utc.tm_year || (loc.tm_year == utc.tm_year && loc.tm_yday > utc.tm_yday))? 1440 : -1440;
+	}
+	return offset;
+}
 
-	// si la mscara de periodos no coincide, termina con error
-	if((action->flags & (1 << data.stat.period)) == 0 && data.stat.period != -1)
-		return -1;
 
-	// si la accin es a una fecha concreta y no coincide, termina
-	if((action->flags & (Blob::LightActionFixDate)) && date != action->date)
-		return -1;
+//------------------------------------------------------------------------------------
+/** Regla de cambio de horario de una cadena TZ POSIX (Mm.w.d, Jn o n) */
+struct TzRule_t {
+	char type;				//!< 'M', 'J' o 'N' (día del año contando desde 0)
+	int16_t m, w, d;		//!< Mes, semana y día de la semana (regla M) o día del año (J, N)
+	int32_t time;			//!< Hora local del cambio (min)
+};
 
-	// si la accin es por das de la semana y no coincide
-	if((action->flags & (Blob::LightActionSun|Blob::LightActionMon|Blob::LightActionTue|Blob::LightActionWed|Blob::LightActionThr|Blob::LightActionFri|Blob::LightActionSat)) && (action->flags & weekDayFlagsFromTM(now.tm_wday)) == 0)
-		return -1;
 
-	// en este punto, la accin es ejecutable hoy:
+//------------------------------------------------------------------------------------
+static bool isLeapYear(int year){
+	return ((year % 4) == 0 && (year % 100) != 0) || (year % 400) == 0;
+}
+
+
+//------------------------------------------------------------------------------------
+static const char* parseTzName(const char* p){
+	if(*p == '<'){
+		const char* end = strchr(p, '>');
+		return (end != NULL && end > p + 1)? (end + 1) : NULL;
+	}
+	const char* start = p;
+	while(isalpha((unsigned char)*p)){
+		p++;
+	}
+	return (p > start)? p : NULL;
+}
+
 
-	// si es al orto...
-	time_t period_corr = 0;
-	if(action->flags & Blob::LightActionDawn){
-		if(data.stat.period >= 0){
-			period_corr = data.cfg.geoloc.astCorr[data.stat.period][0];
+//------------------------------------------------------------------------------------
+static const char* parseTzTime(const char* p, int32_t& minutes){
+	int32_t sign = 1;
+	if(*p == '+' || *p == '-'){
+		sign = (*p == '-')? -1 : 1;
+		p++;
+	}
+	if(!isdigit((unsigned char)*p)){
+		return NULL;
+	}
+	int32_t field[3] = {0, 0, 0};
+	for(int f=0;f<3;f++){
+		while(isdigit((unsigned char)*p)){
+			field[f] = field[f] * 10 + (*p++ - '0');
 		}
-		result = action->astCorr + data.stat.dawn + period_corr;
+		if(f == 2 || *p != ':' || !isdigit((unsigned char)p[1])){
+			break;
+		}
+		p++;
+	}
+	minutes = sign * (field[0] * 60 + field[1]);
+	return p;
+}
+
+
+//------------------------------------------------------------------------------------
+static const char* parseTzRule(const char* p, TzRule_t& r){
+	r.time = 120;
+	if(*p == 'M'){
+		r.type = 'M';
+		char* end;
+		r.m = strtol(p + 1, &end, 10);
+		if(*end != '.') return NULL;
+		r.w = strtol(end + 1, &end, 10);
+		if(*end != '.') return NULL;
+		r.d = strtol(end + 1, &end, 10);
+		if(r.m < 1 || r.m > 12 || r.w < 1 || r.w > 5 || r.d < 0 || r.d > 6) return NULL;
+		p = end;
 	}
-	// si es al ocaso...
-	else if(action->flags & Blob::LightActionDusk){
-		if(data.stat.period >= 0){
-			period_corr = data.cfg.geoloc.astCorr[data.stat.period][1];
+	else{
+		r.type = (*p == 'J')? 'J' : 'N';
+		if(*p == 'J'){
+			p++;
 		}
-		result = action->astCorr + data.stat.dusk + period_corr;
+		if(!isdigit((unsigned char)*p)) return NULL;
+		char* end;
+		r.d = strtol(p, &end, 10);
+		p = end;
 	}
-	// si no, es que es a una hora fija
-	else if(action->flags & (Blob::LightActionFixTime)){
-		result = action->time;
+	if(*p == '/'){
+		p = parseTzTime(p + 1, r.time);
 	}
+	return p;
+}
 
-	return result;
+
+//------------------------------------------------------------------------------------
+static int32_t getTzRuleYday(const TzRule_t& r, int year){
+	bool leap = isLeapYear(year);
+	if(r.type == 'J'){
+		// 1..365 sin contar el 29 de febrero
+		return r.d - 1 + ((leap && r.d > 59)? 1 : 0);
+	}
+	if(r.type == 'N'){
+		return r.d;
+	}
+	// día d de la semana w del mes m (w=5: el último del mes)
+	static const int16_t MonthStart[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};
+	int32_t first = MonthStart[r.m - 1] + ((leap && r.m > 2)? 1 : 0);
+	int32_t days = MonthStart[r.m] - MonthStart[r.m - 1] + ((leap && r.m == 2)? 1 : 0);
+	int32_t y = year - 1;
+	int32_t wday = (first + y + y/4 - y/100 + y/400 + 1) % 7;
+	int32_t mday = ((r.d - wday + 7) % 7) + (r.w - 1) * 7;
+	if(mday >= days){
+		mday -= 7;
+	}
+	return first + mday;
+}
+
+
+//------------------------------------------------------------------------------------
+static bool getTimezoneOffset(const char* tz, int year, int yday, int32_t& offset){
+	// formato TZ POSIX: std offset [dst [offset] [,start[/time],end[/time]]], con el desplazamiento positivo al
+	// oeste de UTC. Sin reglas se aplican las de EEUU
+	if(tz == NULL || (tz = parseTzName(tz)) == NULL){
+		return false;
+	}
+	int32_t std_off;
+	if((tz = parseTzTime(tz, std_off)) == NULL){
+		return false;
+	}
+	offset = -std_off;
+	if(*tz == 0){
+		return true;
+	}
+	if((tz = parseTzName(tz)) == NULL){
+		return false;
+	}
+	int32_t dst_off = std_off - 60;
+	if(*tz != 0 && *tz != ','){
+		if((tz = parseTzTime(tz, dst_off)) == NULL){
+			return false;
+		}
+	}
+	TzRule_t start = {'M', 3, 2, 0, 120}, end = {'M', 11, 1, 0, 120};
+	if(*tz == ','){
+		if((tz = parseTzRule(tz + 1, start)) == NULL || *tz != ',' || (tz = parseTzRule(tz + 1, end)) == NULL){
+			return false;
+		}
+	}
+	// horario de verano vigente al mediodía local del día
+	int32_t now = yday * 1440 + 720;
+	int32_t from = getTzRuleYday(start, year) * 1440 + start.time;
+	int32_t to = getTzRuleYday(end, year) * 1440 + end.time;
+	bool dst = (from < to)? (now >= from && now < to) : (now >= from || now < to);
+	if(dst){
+		offset = -dst_off;
+	}
+	return true;
 }
 
- 
+
+//------------------------------------------------------------------------------------
+static void getSunEventsUTC(int yday, double lat, double lon, int32_t& rise, int32_t& set){
+	// ecuación del tiempo y declinación solar (aproximación NOAA), calculadas al mediodía
+	const double deg = M_PI / 180.0;
+	double g = (2.0 * M_PI / 365.0) * yday;
+	double eqtime = 229.18 * (0.000075 + 0.001868*cos(g) - 0.032077*sin(g) - 0.014615*cos(2*g) - 0.040849*sin(2*g));
+	double decl = 0.006918 - 0.399912*cos(g) + 0.070257*sin(g) - 0.006758*cos(2*g) + 0.000907*sin(2*g) - 0.002697*cos(3*g) + 0.00148*sin(3*g);
+	double noon = 720.0 - 4.0*lon - eqtime;
+
+	// ángulo horario del orto/ocaso considerando la refracción (90.833º). En noche polar el orto y el ocaso
+	// coinciden con el mediodía y en día polar abarcan las 24h
+	double cos_ha = cos(90.833 * deg)/(cos(lat * deg) * cos(decl)) - tan(lat * deg) * tan(decl);
+	double ha = (cos_ha >= 1.0)? 0 : (cos_ha <= -1.0)? 180.0 : acos(cos_ha) / deg;
+	rise = (int32_t)lround(noon - 4.0*ha);
+	set = (int32_t)lround(noon + 4.0*ha);
+}
+
+
+//------------------------------------------------------------------------------------
+static const uint32_t WeekDayFlagMask = (Blob::LightActionSun|Blob::LightActionMon|Blob::LightActionTue|Blob::LightActionWed|Blob::LightActionThr|Blob::LightActionFri|Blob::LightActionSat);
+
+
+//------------------------------------------------------------------------------------
+const char* Scheduler::ActionKeyFmt = "SchAction_%d";
+const uint32_t Scheduler::LatencyBinMs[Blob::LightLatencyBins - 1] = {1000, 2000, 5000, 10000, 30000, 60000, 120000};
+
+
+//------------------------------------------------------------------------------------
+static bool isCandidateOn(uint32_t flags, int wday, int8_t period){
+	// criterios de periodo y día de la semana de las acciones al orto o al ocaso
+	if(period != -1 && (flags & (1 << period)) == 0)
+		return false;
+	if((flags & WeekDayFlagMask) && (flags & weekDayFlagsFromTM(wday)) == 0)
+		return false;
+	return true;
+}
+
+
 //------------------------------------------------------------------------------------
 //-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
 //------------------------------------------------------------------------------------
@@ -109,6 +269,22 @@ Scheduler::Scheduler(uint8_t action_count, Blob::LightAction_t* actions,FSManage
     _lux = 0;
     
     _action_list = actions;
+    MBED_ASSERT(_max_action_count <= Blob::MaxAllowedActionDataInArray);
+    memset(&_eval, 0, sizeof(EvalTable_t));
+    _compiled.valid = false;
+    _plan.year = -1;
+    memset(_calendars, 0, sizeof(_calendars));
+    _sun_table.year = -1;
+    _sun_calc_enabled = true;
+    _last_localtime = 0;
+    _exec.pending = false;
+    _exec.year = -1;
+    _exec.minute = -1;
+    _exec.expected = 0;
+    _exec.missed = 0;
+    _plan_rev = 0;
+    _late_alert_ms = 0;
+    clearLatencyStats();
 
     DEBUG_TRACE_I(_EXPR_, _MODULE_, "Scheduler OK!");
 }
@@ -119,24 +295,30 @@ int32_t Scheduler::setAction(uint8_t pos, Blob::LightAction_t& action){
 	if(pos >= _max_action_count)
 		return -1;
 
+	// el calendario sustituye a la fecha fija, ya que ambos utilizan el campo <date>
+	if((action.flags & Blob::LightActionCalendar) != 0 && ((action.flags & Blob::LightActionFixDate) != 0 || action.date >= Blob::MaxCalendars))
+		return -1;
+
 	_action_list[pos] = action;
+	_loadEvalEntry(pos);
 	return 0;
 }
 
 
 //------------------------------------------------------------------------------------
-int32_t Scheduler::clrActionByPos(int8_t pos){
+int32_t Scheduler::clrActionByPos(uint8_t pos){
 	if(pos >= _max_action_count)
 		return -1;
 
 	_action_list[pos]={
 			0, 						// id: 		no se utiliza
-			Blob::LightNoActions,	// flags: 	Sin accin asignada
+			Blob::LightNoActions,	// flags: 	Sin acción asignada
 			0,						// date:
 			0,						// time:
 			0,						// astCorr:
 			{0,0,0},				// luxLevel:
-			-1};					// outValue: -1 Accin desactivada
+			-1};					// outValue: -1 Acción desactivada
+	_loadEvalEntry(pos);
 	return 0;
 }
 
@@ -147,12 +329,13 @@ int32_t Scheduler::clrActionById(int8_t id){
 		if(_action_list[i].id == id){
 			_action_list[i]={
 						0, 						// id: 		no se utiliza
-						Blob::LightNoActions,	// flags: 	Sin accin asignada
+						Blob::LightNoActions,	// flags: 	Sin acción asignada
 						0,						// date:
 						0,						// time:
 						0,						// astCorr:
 						{0,0,0},				// luxLevel:
-						-1};					// outValue: -1 Accin desactivada
+						-1};					// outValue: -1 Acción desactivada
+			_loadEvalEntry(i);
 		}
 	}
 	return 0;
@@ -164,13 +347,14 @@ void Scheduler::clrActions(){
 	for(int i=0;i<_max_action_count;i++){
 		_action_list[i]={
 					0, 						// id: 		no se utiliza
-					Blob::LightNoActions,	// flags: 	Sin accin asignada
+					Blob::LightNoActions,	// flags: 	Sin acción asignada
 					0,						// date:
 					0,						// time:
 					0,						// astCorr:
 					{0,0,0},				// luxLevel:
-					-1};					// outValue: -1 Accin desactivada
+					-1};					// outValue: -1 Acción desactivada
 	}
+	rebuildEvalTable();
 }
 
 
@@ -191,10 +375,7 @@ bool Scheduler::restoreActionList(){
 	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Recuperando datos de memoria NV...");
 	bool result = true;
 	for(int i=0;i<_max_action_count;i++){
-		char paramId[strlen("SchAct_XX")];
-		sprintf(paramId, "SchAct_%d", i);
-		if(!_fs->restore(paramId, &_action_list[i], sizeof(Blob::LightAction_t), NVSInterface::TypeBlob)){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo SchAction_%d!", i);
+		if(!restoreAction(i)){
 			result = false;
 		}
 	}
@@ -202,27 +383,108 @@ bool Scheduler::restoreActionList(){
 }
 
 
+//------------------------------------------------------------------------------------
+bool Scheduler::restoreAction(uint8_t pos){
+	if(pos >= _max_action_count)
+		return false;
+
+	char paramId[ActionKeySize];
+	sprintf(paramId, ActionKeyFmt, pos);
+	bool result = _fs->restore(paramId, &_action_list[pos], sizeof(Blob::LightAction_t), NVSInterface::TypeBlob);
+	if(!result){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS leyendo %s!", paramId);
+	}
+	_loadEvalEntry(pos);
+	return result;
+}
+
+
 //------------------------------------------------------------------------------------
 bool Scheduler::saveActionList(){
 	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Guardando datos en memoria NV...");
 	bool result = true;
 	for(int i=0;i<_max_action_count;i++){
-		char paramId[strlen("SchAction_XX")];
-		sprintf(paramId, "SchAction_%d", i);
-		if(!_fs->save(paramId, &_action_list[i], sizeof(Blob::LightAction_t), NVSInterface::TypeBlob)){
-			DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS guardando accion i=%d", i);
+		if(!saveAction(i)){
+			result = false;
+		}
+	}
+	return result;
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::saveAction(uint8_t pos){
+	if(pos >= _max_action_count)
+		return false;
+
+	char paramId[ActionKeySize];
+	sprintf(paramId, ActionKeyFmt, pos);
+	if(!_fs->save(paramId, &_action_list[pos], sizeof(Blob::LightAction_t), NVSInterface::TypeBlob)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS guardando accion i=%d", pos);
+		return false;
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t Scheduler::setCalendar(uint8_t index, const Blob::LightCalendar_t& cal){
+	if(index >= Blob::MaxCalendars)
+		return -1;
+
+	_calendars[index] = cal;
+	_calendars[index].name[Blob::LightCalendarNameLen - 1] = 0;
+	// el plan del día en curso puede cambiar
+	_plan.year = -1;
+	return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+const Blob::LightCalendar_t* Scheduler::getCalendar(uint8_t index){
+	return (index < Blob::MaxCalendars)? &_calendars[index] : NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::restoreCalendars(){
+	bool result = true;
+	for(int i=0;i<Blob::MaxCalendars;i++){
+		char paramId[strlen("SchCal_X") + 1];
+		sprintf(paramId, "SchCal_%d", i);
+		if(!_fs->restore(paramId, &_calendars[i], sizeof(Blob::LightCalendar_t), NVSInterface::TypeBlob)){
+			memset(&_calendars[i], 0, sizeof(Blob::LightCalendar_t));
 			result = false;
 		}
 	}
+	_plan.year = -1;
 	return result;
 }
 
 
+//------------------------------------------------------------------------------------
+bool Scheduler::saveCalendar(uint8_t index){
+	if(index >= Blob::MaxCalendars)
+		return false;
+
+	char paramId[strlen("SchCal_X") + 1];
+	sprintf(paramId, "SchCal_%d", index);
+	if(!_fs->save(paramId, &_calendars[index], sizeof(Blob::LightCalendar_t), NVSInterface::TypeBlob)){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_NVS guardando calendario i=%d", index);
+		return false;
+	}
+	return true;
+}
+
+
 //------------------------------------------------------------------------------------
 bool Scheduler::checkIntegrity(){
 	for(int i=0;i<_max_action_count;i++){
+		// en las acciones con calendario, <date> es el índice del calendario
+		bool cal = (_action_list[i].flags & Blob::LightActionCalendar) != 0;
 		if((_action_list[i].id >= _max_action_count) ||
-			   (_action_list[i].date < Blob::LightActionDateMin || _action_list[i].date > Blob::LightActionDateMax) ||
+			   (cal && _action_list[i].date >= Blob::MaxCalendars) ||
+			   (!cal && (_action_list[i].date < Blob::LightActionDateMin || _action_list[i].date > Blob::LightActionDateMax)) ||
 			   (_action_list[i].time > Blob::LightActionTimeMax) ||
 			   (_action_list[i].outValue > Blob::LightActionOutMax)){
 			return false;
@@ -237,16 +499,18 @@ Blob::LightAction_t* Scheduler::findCurrAction(Blob::LightActionFlags filter, co
 	tm now;
 	localtime_r(&data.stat.localtime, &now);
 	uint16_t curr_time = (now.tm_hour * 60) + now.tm_min;
-	int32_t exec_time = -1;
+	const DayPlan_t& plan = _getDayPlan(now, data);
 	Blob::LightAction_t* curr = NULL;
 
-	for(int i=0;i<_max_action_count;i++){
-		if(_action_list[i].id != 0 && (_action_list[i].flags & filter) != 0){
-			int32_t action_time = getExecutionTime(&_action_list[i], data);
-			if(action_time >= 0 && action_time <= curr_time && action_time > exec_time){
-				curr = &_action_list[i];
-				exec_time = action_time;
-			}
+	// recorre el plan hacia atrás desde el minuto actual. Si varias acciones coinciden en el mismo minuto,
+	// prevalece la de menor posición
+	for(int k = _upperBound(plan, curr_time) - 1; k >= 0; k--){
+		if(curr != NULL && plan.minute[k] != plan.minute[k+1]){
+			break;
+		}
+		uint8_t i = plan.pos[k];
+		if(_eval.id[i] != 0 && (_eval.flags[i] & filter) != 0){
+			curr = &_action_list[i];
 		}
 	}
 
@@ -258,24 +522,26 @@ Blob::LightAction_t* Scheduler::findCurrAction(Blob::LightActionFlags filter, co
 int8_t Scheduler::updateLux(Blob::LightLuxLevel lux){
 	int8_t result = -1;
 	_lux = lux;
-	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Ejecutando scheduler con lux=%d", _lux);
+	DLOG_D(_MODULE_, "Ejecutando scheduler con lux=%d", _lux);
 	for(int i=0;i<_max_action_count;i++){
-		// busca acciones asociadas al sensor de iluminacin, que no estn en ejecucin
-		if(result == -1 && _action_list[i].id >= 0 && (_action_list[i].flags & (Blob::LightActionAls|Blob::LighActionAlsActive)) == Blob::LightActionAls){
-			// si el nivel de luminosidad est en rango, las activa
+		// busca acciones asociadas al sensor de iluminación, que no estén en ejecución
+		if(result == -1 && _eval.id[i] >= 0 && (_eval.flags[i] & (Blob::LightActionAls|Blob::LighActionAlsActive)) == Blob::LightActionAls){
+			// si el nivel de luminosidad está en rango, las activa
 			if(_lux >= _action_list[i].luxLevel.min && _lux <= _action_list[i].luxLevel.max){
-				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Prog id=%d, ejecutado por Lux=%d, out=%d", _action_list[i].id, _lux, _action_list[i].outValue);
-				_action_list[i].flags = (Blob::LightActionFlags)(_action_list[i].flags | Blob::LighActionAlsActive);
-				result = _action_list[i].outValue;
+				DLOG_D(_MODULE_, "Prog id=%d, ejecutado por Lux=%d, out=%d", _eval.id[i], _lux, _eval.outValue[i]);
+				_eval.flags[i] |= Blob::LighActionAlsActive;
+				_action_list[i].flags = (Blob::LightActionFlags)_eval.flags[i];
+				result = _eval.outValue[i];
 				continue;
 			}
 		}
-		// busca acciones asociadas al sensor de iluminacin, que estn en ejecucin
-		else if(_action_list[i].id >= 0 && (_action_list[i].flags & (Blob::LightActionAls|Blob::LighActionAlsActive)) == (Blob::LightActionAls|Blob::LighActionAlsActive)){
-			// si el nivel de luminosidad est fuera de rango (+ threshold) , las desactiva
+		// busca acciones asociadas al sensor de iluminación, que estén en ejecución
+		else if(_eval.id[i] >= 0 && (_eval.flags[i] & (Blob::LightActionAls|Blob::LighActionAlsActive)) == (Blob::LightActionAls|Blob::LighActionAlsActive)){
+			// si el nivel de luminosidad está fuera de rango (+ threshold) , las desactiva
 			if(_lux <= (_action_list[i].luxLevel.min-_action_list[i].luxLevel.thres) || _lux >= (_action_list[i].luxLevel.max+_action_list[i].luxLevel.thres)){
-				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Prog id=%d, sale de rango Lux=%d", _action_list[i].id, _lux);
-				_action_list[i].flags = (Blob::LightActionFlags)(_action_list[i].flags & ~Blob::LighActionAlsActive);
+				DLOG_D(_MODULE_, "Prog id=%d, sale de rango Lux=%d", _eval.id[i], _lux);
+				_eval.flags[i] &= ~Blob::LighActionAlsActive;
+				_action_list[i].flags = (Blob::LightActionFlags)_eval.flags[i];
 				continue;
 			}
 		}
@@ -286,33 +552,676 @@ int8_t Scheduler::updateLux(Blob::LightLuxLevel lux){
 
 //------------------------------------------------------------------------------------
 int8_t Scheduler::updateTimestamp(const Blob::LightTimeData_t& ast){
+	bool jump = _isClockJump(ast.stat.localtime);
+	_last_localtime = ast.stat.localtime;
 	_ast_data = ast;
-	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Ejecutando scheduler con timestamp_flags=%x", _ast_data.stat.flags);
-	for(int i=0;i<_max_action_count;i++){
-		// busca acciones asociadas a una hora fija...
-		if(_action_list[i].id >= 0 && (_action_list[i].flags & Blob::LightActionFixTime) != 0){
-			// si la hora coincide y los das de la semana tambin, se ejecuta
-			tm now;
-			localtime_r(&_ast_data.stat.localtime, &now);
-			uint16_t hhmm = now.tm_hour*60 + now.tm_min;
-			if(hhmm == _action_list[i].time && (weekDayFlagsFromTM(now.tm_wday) & _action_list[i].flags) !=0){
-				DEBUG_TRACE_D(_EXPR_, _MODULE_, "Prog id=%d, ejecutado por timestamp=%d, out=%d", _action_list[i].id, hhmm, _action_list[i].outValue);
-				return _action_list[i].outValue;
+	_applySunTimes(_ast_data);
+	DLOG_D(_MODULE_, "Ejecutando scheduler con timestamp_flags=%x", _ast_data.stat.flags);
+	tm now;
+	localtime_r(&_ast_data.stat.localtime, &now);
+	uint16_t hhmm = now.tm_hour*60 + now.tm_min;
+	const DayPlan_t& plan = _getDayPlan(now, _ast_data);
+	time_t minute_start = _ast_data.stat.localtime - now.tm_sec;
+	time_t day_start = minute_start - (hhmm * 60);
+	// con la hora continua, las acciones previstas que han quedado atrás ya no se ejecutan
+	if(!jump){
+		_checkMissedActions(plan, now, day_start, minute_start);
+	}
+	int sel = _selectTimestampAction(plan, hhmm);
+	// tras un salto, una acción desactivada en el minuto de llegada no impide resolver la acción vigente
+	if(sel >= 0 && (!jump || _eval.outValue[sel] >= 0)){
+		uint8_t i = sel;
+		DLOG_D(_MODULE_, "Prog id=%d, ejecutado por timestamp=%d, out=%d", _eval.id[i], hhmm, _eval.outValue[i]);
+		// el instante previsto es el comienzo del minuto del plan, que ya incluye las correcciones astronómicas
+		_exec.pending = true;
+		_exec.id = _eval.id[i];
+		_exec.observed = _ast_data.stat.localtime;
+		_exec.intended = minute_start;
+		_trackNextAction(plan, now, hhmm, day_start);
+		return _eval.outValue[i];
+	}
+	// si la hora ha saltado, no se espera al siguiente hito y se aplica la acción vigente. Si la acción prevista
+	// ha quedado atrás y es la vigente, se mide su retraso desde su instante previsto. En caso contrario se pierde
+	if(jump){
+		int8_t id;
+		int8_t result = _resolveCurrAction(_ast_data, id);
+		if(_exec.minute >= 0 && _exec.expected < minute_start){
+			if(result >= 0 && id == _exec.expectedId){
+				_exec.pending = true;
+				_exec.id = id;
+				_exec.observed = _ast_data.stat.localtime;
+				_exec.intended = _exec.expected;
+			}
+			else{
+				_latency.missed++;
+				_exec.missed++;
+				DEBUG_TRACE_W(_EXPR_, _MODULE_, "Prog id=%d no ejecutado tras el salto horario", _exec.expectedId);
 			}
 		}
+		_trackNextAction(plan, now, hhmm, day_start);
+		return result;
 	}
+	_trackNextAction(plan, now, hhmm, day_start);
 	return -1;
 }
 
 
+//------------------------------------------------------------------------------------
+int8_t Scheduler::updateLocaltime(time_t localtime){
+	Blob::LightTimeData_t ast = _ast_data;
+	ast.stat.localtime = localtime;
+	return updateTimestamp(ast);
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t Scheduler::recordApplied(uint32_t queue_ms){
+	if(!_exec.pending){
+		return -1;
+	}
+	_exec.pending = false;
+	uint32_t late_ms = (uint32_t)(_exec.observed - _exec.intended) * 1000 + queue_ms;
+	uint8_t bin = 0;
+	while(bin < Blob::LightLatencyBins - 1 && late_ms >= LatencyBinMs[bin]){
+		bin++;
+	}
+	_latency.bins[bin]++;
+	_latency.count++;
+	if(_late_alert_ms != 0 && late_ms > _late_alert_ms){
+		_latency.late++;
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Prog id=%d ejecutado con %dms de retraso", _exec.id, late_ms);
+	}
+	if(late_ms >= _latency.maxMs){
+		_latency.maxMs = late_ms;
+		_latency.maxId = _exec.id;
+	}
+	_latency.lastId = _exec.id;
+	_latency.lastIntended = (uint32_t)_exec.intended;
+	_latency.lastMs = late_ms;
+	return (int32_t)late_ms;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::clearLatencyStats(){
+	memset(&_latency, 0, sizeof(Blob::LightLatencyStats_t));
+	_latency.maxId = -1;
+	_latency.lastId = -1;
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::getSunTimes(time_t t, int16_t& dawn, int16_t& dusk){
+	return _lookupSunTimes(_ast_data.cfg.geoloc.coords[0], _ast_data.cfg.geoloc.coords[1], _ast_data.cfg.geoloc.timezone, t, dawn, dusk);
+}
+
+
 //------------------------------------------------------------------------------------
 void Scheduler::setVerbosity(esp_log_level_t verbosity){
 	esp_log_level_set(_MODULE_, verbosity);
 }
 
 
+//------------------------------------------------------------------------------------
+void Scheduler::rebuildEvalTable(){
+	for(int i=0;i<_max_action_count;i++){
+		_loadEvalEntry(i);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t Scheduler::backtest(time_t from, time_t to, const Blob::LightTimeData_t& data, uint8_t init_value, BacktestResult_t& result,
+							BacktestEvent_t* events, uint32_t max_events, BacktestMode mode, BacktestDayCallback day_cb){
+	if(to <= from){
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "ERR_BACKTEST. Rango de fechas incorrecto");
+		return -1;
+	}
+	memset(&result, 0, sizeof(BacktestResult_t));
+	result.finalValue = (init_value > Blob::LightActionOutMax)? Blob::LightActionOutMax : init_value;
+	Blob::LightTimeData_t day_data = data;
+	time_t last_t = from;
+
+	// parte de las 00:00 del día inicial
+	tm day;
+	localtime_r(&from, &day);
+	day.tm_hour = 0;
+	day.tm_min = 0;
+	day.tm_sec = 0;
+	day.tm_isdst = -1;
+	time_t day_start = mktime(&day);
+
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Iniciando backtest modo=%d", mode);
+	while(day_start < to){
+		// actualiza los datos del calendario del día en curso
+		day_data.stat.localtime = day_start;
+		_applySunTimes(day_data);
+		if(day_cb){
+			day_cb(day_data);
+		}
+
+		// calcula el comienzo del día siguiente
+		tm next = day;
+		next.tm_mday++;
+		next.tm_isdst = -1;
+		time_t next_start = mktime(&next);
+
+		if(mode == BacktestByEvent){
+			// obtiene el plan del día, ordenado por hora y por posición en la tabla
+			DayPlan_t plan;
+			_buildDayPlan(day, day_data, plan);
+			// salta de evento en evento. Si varias acciones coinciden en el mismo minuto, sólo se ejecuta la primera
+			// (ver <updateTimestamp>), que no modifica la salida si está desactivada
+			int32_t last_exec = -1;
+			for(int k=0;k<plan.count;k++){
+				uint8_t i = plan.pos[k];
+				if(plan.minute[k] == last_exec)
+					continue;
+				last_exec = plan.minute[k];
+				if(_eval.outValue[i] < 0)
+					continue;
+				tm at = day;
+				at.tm_hour = plan.minute[k] / 60;
+				at.tm_min = plan.minute[k] % 60;
+				at.tm_sec = 0;
+				at.tm_isdst = -1;
+				time_t t = mktime(&at);
+				if(t < from || t >= to)
+					continue;
+				uint8_t value = (_eval.outValue[i] > Blob::LightActionOutMax)? Blob::LightActionOutMax : _eval.outValue[i];
+				if(value != result.finalValue){
+					_backtestApply(t, value, _eval.id[i], last_t, result, events, max_events);
+				}
+			}
+		}
+		else{
+			// recorre el día minuto a minuto con la misma selección que <updateTimestamp>
+			DayPlan_t plan;
+			_buildDayPlan(day, day_data, plan);
+			for(time_t t = day_start; t < next_start && t < to; t += 60){
+				if(t < from)
+					continue;
+				tm now;
+				localtime_r(&t, &now);
+				int sel = _selectTimestampAction(plan, now.tm_hour*60 + now.tm_min);
+				if(sel < 0 || _eval.outValue[sel] < 0)
+					continue;
+				uint8_t value = (_eval.outValue[sel] > Blob::LightActionOutMax)? Blob::LightActionOutMax : _eval.outValue[sel];
+				if(value != result.finalValue){
+					_backtestApply(t, value, _eval.id[sel], last_t, result, events, max_events);
+				}
+			}
+		}
+
+		day = next;
+		day_start = next_start;
+	}
+
+	// acumula el tiempo restante hasta el final del rango
+	if(result.finalValue > 0){
+		result.onSeconds += (uint32_t)(to - last_t);
+		result.levelSeconds += (uint64_t)result.finalValue * (uint32_t)(to - last_t);
+	}
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Backtest finalizado con %d eventos", result.eventCount);
+	return (result.eventCount < max_events)? result.eventCount : max_events;
+}
+
+
+
+//------------------------------------------------------------------------------------
+int32_t Scheduler::lookahead(uint8_t curr_value, BacktestEvent_t* events, uint32_t max_events){
+	if(_last_localtime == 0){
+		return -1;
+	}
+	time_t now = _last_localtime;
+	uint8_t value = (curr_value > Blob::LightActionOutMax)? Blob::LightActionOutMax : curr_value;
+	uint32_t count = 0;
+	Blob::LightTimeData_t day_data = _ast_data;
+
+	// parte de las 00:00 del día en curso
+	tm day;
+	localtime_r(&now, &day);
+	day.tm_hour = 0;
+	day.tm_min = 0;
+	day.tm_sec = 0;
+	day.tm_isdst = -1;
+	time_t day_start = mktime(&day);
+
+	for(int d=0; d<LookaheadDays && count < max_events; d++){
+		day_data.stat.localtime = day_start;
+		_applySunTimes(day_data);
+		DayPlan_t plan;
+		_buildDayPlan(day, day_data, plan);
+		// mismo criterio que <updateTimestamp>: en un mismo minuto sólo se ejecuta la primera acción
+		int32_t last_exec = -1;
+		for(int k=0;k<plan.count && count < max_events;k++){
+			uint8_t i = plan.pos[k];
+			if(plan.minute[k] == last_exec)
+				continue;
+			last_exec = plan.minute[k];
+			if(_eval.outValue[i] < 0)
+				continue;
+			tm at = day;
+			at.tm_hour = plan.minute[k] / 60;
+			at.tm_min = plan.minute[k] % 60;
+			at.tm_sec = 0;
+			at.tm_isdst = -1;
+			time_t t = mktime(&at);
+			uint8_t out = (_eval.outValue[i] > Blob::LightActionOutMax)? Blob::LightActionOutMax : _eval.outValue[i];
+			if(t <= now || out == value)
+				continue;
+			events[count].time = t;
+			events[count].id = _eval.id[i];
+			events[count].outValue = out;
+			value = out;
+			count++;
+		}
+		day.tm_mday++;
+		day.tm_isdst = -1;
+		day_start = mktime(&day);
+	}
+	return count;
+}
+
+
 
 //------------------------------------------------------------------------------------
 //-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
 //------------------------------------------------------------------------------------
 
+
+//------------------------------------------------------------------------------------
+void Scheduler::_loadEvalEntry(uint8_t pos){
+	const Blob::LightAction_t& action = _action_list[pos];
+	_eval.flags[pos] = (uint32_t)action.flags;
+	_eval.time[pos] = action.time;
+	_eval.date[pos] = action.date;
+	_eval.astCorr[pos] = action.astCorr;
+	_eval.outValue[pos] = action.outValue;
+	_eval.id[pos] = action.id;
+	// la tabla de decisión se compila de nuevo en la siguiente evaluación
+	_compiled.valid = false;
+	_plan.year = -1;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_compile(){
+	int16_t offset[ExecKindCount][Blob::MaxAllowedActionDataInArray];
+	memset(_compiled.classMask, 0, sizeof(_compiled.classMask));
+	memset(_compiled.count, 0, sizeof(_compiled.count));
+	memset(_compiled.fixTimeMask, 0, sizeof(_compiled.fixTimeMask));
+
+	for(int i=0;i<_max_action_count;i++){
+		uint32_t flags = _eval.flags[i];
+		if(_eval.id[i] < 0){
+			continue;
+		}
+		// acciones a hora fija: requieren algún día de la semana, con independencia del periodo, de la fecha fija
+		// y de que también estén asociadas al orto o al ocaso
+		if(flags & Blob::LightActionFixTime){
+			for(int w=0;w<7;w++){
+				if(flags & weekDayFlagsFromTM(w)){
+					_compiled.fixTimeMask[w] |= (1 << i);
+				}
+			}
+			_compileInsert(ExecFixTime, i, _eval.time[i], offset);
+		}
+
+		// acciones al orto o al ocaso (prevalece el orto si tiene ambos flags), candidatas por periodo y día
+		int kind;
+		if(flags & Blob::LightActionDawn){
+			kind = ExecDawn;
+		}
+		else if(flags & Blob::LightActionDusk){
+			kind = ExecDusk;
+		}
+		else{
+			continue;
+		}
+		for(int w=0;w<7;w++){
+			for(int p=0;p<PeriodClasses;p++){
+				if(isCandidateOn(flags, w, p - 1)){
+					_compiled.classMask[w][p] |= (1 << i);
+				}
+			}
+		}
+		_compileInsert(kind, i, _eval.astCorr[i], offset);
+	}
+	_compiled.valid = true;
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Tabla compilada: hora fija=%d, orto=%d, ocaso=%d", _compiled.count[ExecFixTime], _compiled.count[ExecDawn], _compiled.count[ExecDusk]);
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_compileInsert(int kind, uint8_t pos, int16_t off, int16_t offset[][Blob::MaxAllowedActionDataInArray]){
+	// inserta la acción ordenada por desplazamiento y, a igualdad, por posición. Dentro de un mismo tipo de hito
+	// el orden no depende del día, ya que el orto, el ocaso y la corrección del periodo son comunes
+	int j = _compiled.count[kind]++;
+	while(j > 0 && offset[kind][j-1] > off){
+		offset[kind][j] = offset[kind][j-1];
+		_compiled.order[kind][j] = _compiled.order[kind][j-1];
+		j--;
+	}
+	offset[kind][j] = off;
+	_compiled.order[kind][j] = pos;
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::_isCalendarDay(uint8_t pos, const tm& day){
+	uint32_t flags = _eval.flags[pos];
+	if((flags & Blob::LightActionCalendar) == 0 || _eval.date[pos] >= Blob::MaxCalendars){
+		return true;
+	}
+	uint16_t bit = Blob::getCalendarDay(day.tm_mon, day.tm_mday);
+	bool in_cal = (_calendars[_eval.date[pos]].days[bit >> 5] & (1UL << (bit & 31))) != 0;
+	return ((flags & Blob::LightActionCalendarExcl) != 0)? !in_cal : in_cal;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_buildDayPlan(const tm& day, const Blob::LightTimeData_t& data, DayPlan_t& plan){
+	if(!_compiled.valid){
+		_compile();
+	}
+	int8_t period = data.stat.period;
+	uint16_t date = day.tm_mday * 128 + day.tm_mon;
+	plan.year = day.tm_year;
+	plan.yday = day.tm_yday;
+	plan.period = period;
+	plan.dawn = data.stat.dawn;
+	plan.dusk = data.stat.dusk;
+	plan.periodCorr[0] = (period >= 0)? data.cfg.geoloc.astCorr[period][0] : 0;
+	plan.periodCorr[1] = (period >= 0)? data.cfg.geoloc.astCorr[period][1] : 0;
+	plan.count = 0;
+
+	// selecciona las acciones candidatas de la clase del día
+	uint32_t mask = 0;
+	if(period >= -1 && period < PeriodClasses - 1){
+		mask = _compiled.classMask[day.tm_wday][period + 1];
+	}
+	else{
+		for(int i=0;i<_max_action_count;i++){
+			mask |= (uint32_t)isCandidateOn(_eval.flags[i], day.tm_wday, period) << i;
+		}
+	}
+
+	// mezcla las listas de cada tipo de hito, ya ordenadas, descartando las de calendario de otros días. Las de
+	// hora fija se seleccionan por día de la semana y las del orto y el ocaso por su clase de día y fecha fija
+	uint32_t fixed = _compiled.fixTimeMask[day.tm_wday];
+	int32_t base[ExecKindCount] = {0, plan.dawn + plan.periodCorr[0], plan.dusk + plan.periodCorr[1]};
+	uint8_t next[ExecKindCount] = {0, 0, 0};
+	int32_t head[ExecKindCount];
+	for(;;){
+		int sel = -1;
+		for(int k=0;k<ExecKindCount;k++){
+			head[k] = -1;
+			while(next[k] < _compiled.count[k]){
+				uint8_t i = _compiled.order[k][next[k]];
+				int32_t minute = (k == ExecFixTime)? _eval.time[i] : base[k] + _eval.astCorr[i];
+				bool candidate = (k == ExecFixTime)? ((fixed & (1 << i)) != 0) :
+								 ((mask & (1 << i)) != 0 && ((_eval.flags[i] & Blob::LightActionFixDate) == 0 || _eval.date[i] == date));
+				if(candidate && _isCalendarDay(i, day) && minute >= 0 && minute <= Blob::LightActionTimeMax){
+					head[k] = minute;
+					break;
+				}
+				next[k]++;
+			}
+			if(head[k] >= 0 && (sel < 0 || head[k] < head[sel] ||
+			   (head[k] == head[sel] && _compiled.order[k][next[k]] < _compiled.order[sel][next[sel]]))){
+				sel = k;
+			}
+		}
+		if(sel < 0){
+			break;
+		}
+		plan.minute[plan.count] = head[sel];
+		plan.pos[plan.count] = _compiled.order[sel][next[sel]];
+		plan.count++;
+		next[sel]++;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+const Scheduler::DayPlan_t& Scheduler::_getDayPlan(const tm& day, const Blob::LightTimeData_t& data){
+	int8_t period = data.stat.period;
+	int8_t corr0 = (period >= 0)? data.cfg.geoloc.astCorr[period][0] : 0;
+	int8_t corr1 = (period >= 0)? data.cfg.geoloc.astCorr[period][1] : 0;
+	if(!_compiled.valid || _plan.year != day.tm_year || _plan.yday != day.tm_yday || _plan.period != period ||
+	   _plan.dawn != data.stat.dawn || _plan.dusk != data.stat.dusk || _plan.periodCorr[0] != corr0 || _plan.periodCorr[1] != corr1){
+		_buildDayPlan(day, data, _plan);
+		_plan_rev++;
+	}
+	return _plan;
+}
+
+
+//------------------------------------------------------------------------------------
+int Scheduler::_selectTimestampAction(const DayPlan_t& plan, int32_t minute){
+	// las entradas de un mismo minuto están ordenadas por posición en la tabla
+	uint8_t k = _upperBound(plan, minute - 1);
+	return (k < plan.count && plan.minute[k] == minute)? plan.pos[k] : -1;
+}
+
+
+//------------------------------------------------------------------------------------
+int Scheduler::_lastAppliedAction(const DayPlan_t& plan, int32_t minute){
+	// recorre los minutos del plan hacia atrás. En cada uno sólo se ejecuta la primera entrada, que no modifica la
+	// salida si está desactivada
+	for(int k = _upperBound(plan, minute) - 1; k >= 0; k--){
+		if(k > 0 && plan.minute[k-1] == plan.minute[k])
+			continue;
+		if(_eval.outValue[plan.pos[k]] >= 0)
+			return plan.pos[k];
+	}
+	return -1;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_trackNextAction(const DayPlan_t& plan, const tm& day, int32_t from, time_t day_start){
+	uint8_t k = _upperBound(plan, from);
+	_exec.year = day.tm_year;
+	_exec.yday = day.tm_yday;
+	_exec.planRev = _plan_rev;
+	_exec.from = from;
+	_exec.minute = (k < plan.count)? plan.minute[k] : -1;
+	if(k < plan.count){
+		_exec.expectedId = _eval.id[plan.pos[k]];
+		_exec.expected = day_start + (plan.minute[k] * 60);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_checkMissedActions(const DayPlan_t& plan, const tm& day, time_t day_start, time_t minute_start){
+	if(_exec.year < 0){
+		return;
+	}
+	bool today = (_exec.year == day.tm_year && _exec.yday == day.tm_yday);
+	// si el plan del día ha cambiado desde el cálculo (ej: nuevo orto u ocaso), la acción prevista se calcula de
+	// nuevo desde el mismo minuto
+	if(today && _exec.planRev != _plan_rev){
+		_trackNextAction(plan, day, _exec.from, day_start);
+	}
+	for(;;){
+		// si no quedaban acciones en el día del cálculo, al cambiar de día la prevista es la primera del nuevo día
+		if(_exec.minute < 0){
+			if(today){
+				return;
+			}
+			_trackNextAction(plan, day, -1, day_start);
+			today = true;
+			continue;
+		}
+		if(_exec.expected >= minute_start){
+			return;
+		}
+		_latency.missed++;
+		_exec.missed++;
+		DEBUG_TRACE_W(_EXPR_, _MODULE_, "Prog id=%d no ejecutado, instante previsto %d", _exec.expectedId, (uint32_t)_exec.expected);
+		// continúa por la siguiente acción del mismo día o por la primera del nuevo día
+		if(today){
+			_trackNextAction(plan, day, _exec.minute, day_start);
+		}
+		else{
+			_exec.minute = -1;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+uint8_t Scheduler::_upperBound(const DayPlan_t& plan, int32_t minute){
+	uint8_t lo = 0, hi = plan.count;
+	while(lo < hi){
+		uint8_t mid = (lo + hi) / 2;
+		if(plan.minute[mid] <= minute){
+			lo = mid + 1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::_isClockJump(time_t localtime){
+	if(_last_localtime == 0){
+		return true;
+	}
+	int64_t delta = (int64_t)localtime - (int64_t)_last_localtime;
+	return (delta < 0 || delta > ClockJumpThreshold);
+}
+
+
+//------------------------------------------------------------------------------------
+int8_t Scheduler::_resolveCurrAction(const Blob::LightTimeData_t& data, int8_t& id){
+	tm now;
+	localtime_r(&data.stat.localtime, &now);
+	int pos = _lastAppliedAction(_getDayPlan(now, data), now.tm_hour*60 + now.tm_min);
+
+	// si no hay ninguna acción ejecutada hoy, busca la última del día anterior
+	if(pos < 0){
+		Blob::LightTimeData_t prev = data;
+		tm day = now;
+		day.tm_hour = 0;
+		day.tm_min = 0;
+		day.tm_sec = 0;
+		day.tm_isdst = -1;
+		prev.stat.localtime = mktime(&day) - 1;
+		_applySunTimes(prev);
+		localtime_r(&prev.stat.localtime, &day);
+		DayPlan_t plan;
+		_buildDayPlan(day, prev, plan);
+		pos = _lastAppliedAction(plan, Blob::LightActionTimeMax);
+	}
+
+	if(pos < 0){
+		DLOG_D(_MODULE_, "Salto horario sin acción vigente");
+		id = -1;
+		return -1;
+	}
+	id = _eval.id[pos];
+	DLOG_D(_MODULE_, "Salto horario. Prog id=%d vigente, out=%d", id, _eval.outValue[pos]);
+	return _eval.outValue[pos];
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_applySunTimes(Blob::LightTimeData_t& data){
+	int16_t dawn, dusk;
+	if(_sun_calc_enabled && _lookupSunTimes(data.cfg.geoloc.coords[0], data.cfg.geoloc.coords[1], data.cfg.geoloc.timezone, data.stat.localtime, dawn, dusk)){
+		data.stat.dawn = dawn;
+		data.stat.dusk = dusk;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+bool Scheduler::_lookupSunTimes(double lat, double lon, const char* tz, time_t t, int16_t& dawn, int16_t& dusk){
+	if(lat == 0 && lon == 0){
+		return false;
+	}
+	tm day;
+	localtime_r(&t, &day);
+	// recalcula la tabla si cambia el año, la geolocalización o la zona horaria
+	uint32_t tz_crc = Blob::getCRC32(tz, strlen(tz));
+	if(_sun_table.year != day.tm_year || _sun_table.lat != lat || _sun_table.lon != lon || _sun_table.tzCrc != tz_crc){
+		_sun_table.lat = lat;
+		_sun_table.lon = lon;
+		_sun_table.tzCrc = tz_crc;
+		_buildSunTable(day.tm_year, tz);
+	}
+	dawn = _sun_table.dawn[day.tm_yday];
+	dusk = _sun_table.dusk[day.tm_yday];
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_buildSunTable(int year, const char* tz){
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Calculando tabla de orto y ocaso del año %d", 1900 + year);
+	for(int i=0;i<366;i++){
+		// diferencia horaria vigente al mediodía local de cada día, según la zona horaria de la geolocalización o,
+		// si no se indica, la del sistema
+		int32_t offset;
+		if(!getTimezoneOffset(tz, 1900 + year, i, offset)){
+			tm day;
+			memset(&day, 0, sizeof(tm));
+			day.tm_year = year;
+			day.tm_mday = i + 1;
+			day.tm_hour = 12;
+			day.tm_isdst = -1;
+			offset = getLocalOffset(mktime(&day));
+		}
+		int32_t rise, set;
+		getSunEventsUTC(i, _sun_table.lat, _sun_table.lon, rise, set);
+		// día polar
+		if(set - rise >= 1440){
+			_sun_table.dawn[i] = 0;
+			_sun_table.dusk[i] = Blob::LightActionTimeMax;
+			continue;
+		}
+		_sun_table.dawn[i] = ((rise + offset) % 1440 + 1440) % 1440;
+		_sun_table.dusk[i] = ((set + offset) % 1440 + 1440) % 1440;
+	}
+	_sun_table.year = year;
+}
+
+
+//------------------------------------------------------------------------------------
+void Scheduler::_backtestApply(time_t t, uint8_t value, int8_t id, time_t& last_t, BacktestResult_t& result, BacktestEvent_t* events, uint32_t max_events){
+	// acumula el tiempo transcurrido con el estado previo
+	uint32_t elapsed = (uint32_t)(t - last_t);
+	if(result.finalValue > 0){
+		result.onSeconds += elapsed;
+		result.levelSeconds += (uint64_t)result.finalValue * elapsed;
+	}
+
+	// clasifica la conmutación
+	if(result.finalValue == 0 && value > 0){
+		result.switchOnCount++;
+	}
+	else if(result.finalValue > 0 && value == 0){
+		result.switchOffCount++;
+	}
+	else{
+		result.levelChangeCount++;
+	}
+
+	// registra el evento si hay espacio en el buffer
+	if(events != NULL && result.eventCount < max_events){
+		events[result.eventCount].time = t;
+		events[result.eventCount].id = id;
+		events[result.eventCount].outValue = value;
+	}
+	result.eventCount++;
+	result.finalValue = value;
+	last_t = t;
+}
+
@@ -4,19 +4,34 @@
  *  Created on: Jun 2018
  *      Author: raulMrello
  *
- *	Scheduler es el mdulo encargado de gestionar la ejecucin de los programas. La operativa es como sigue en funcin
+ *	Scheduler es el módulo encargado de gestionar la ejecución de los programas. La operativa es como sigue en función
  *	de los servicios que proporciona:
  *
- *		buildActionList: crea una lista ordenada de las acciones que cumplen los criterios de ejecucin
- *		para el da, hora, periodo actual
+ *		buildActionList: crea una lista ordenada de las acciones que cumplen los criterios de ejecución
+ *		para el día, hora, periodo actual
  *
- *		getLastAction: obtiene la ltima accin de la lista ordenada que se ejecut o NULL si no hay
+ *		getLastAction: obtiene la última acción de la lista ordenada que se ejecutó o NULL si no hay
  *
- *		getNewAction: obtiene la accin que se debe ejecutar justo a la hora actual
+ *		getNewAction: obtiene la acción que se debe ejecutar justo a la hora actual
  *
- *		findCurrAction: Busca la accin que debera estar en ejecucin y hace un backtest en el rango de
+ *		findCurrAction: Busca la acción que debería estar en ejecución y hace un backtest en el rango de
  *		fechas establecido
  *
+ *		backtest: simula la ejecución de la tabla de acciones en un rango de fechas, obteniendo la secuencia
+ *		de cambios de la salida, el número de conmutaciones y las horas de encendido
+ *
+ *		lookahead: obtiene los próximos cambios de la salida a partir del instante actual
+ *
+ *	Las acciones pueden restringirse a los días de un calendario (festivos, temporadas...) o excluirse en ellos. Cada
+ *	calendario es un mapa de bits de 366 días, por lo que la comprobación se resuelve con un único test de bit.
+ *
+ *	Las acciones temporales no se evalúan una a una. Cada vez que cambia la tabla de acciones se compila una tabla
+ *	de decisión con las acciones candidatas de cada clase de día (día de la semana para las de hora fija, día de
+ *	la semana x periodo para las del orto y el ocaso) y el orden de las acciones de cada tipo de hito (hora fija,
+ *	orto, ocaso). A partir de ella se obtiene el plan de cada día (lista de instantes de ejecución ordenada,
+ *	incluyendo las correcciones astronómicas y de periodo), que se conserva mientras no cambie el día o los datos
+ *	del calendario, de forma que cada evaluación se resuelve con una búsqueda binaria sobre el plan.
+ *
  *
  */
  
@@ -27,16 +42,52 @@
 #include "LightManagerBlob.h"
 #include "FSManager.h"
 #include "List.h"
+#include "DeferredLog.h"
    
 class Scheduler {
   public:
 
+    /** Modos de simulación del backtest
+     * 	@enum BacktestByMinute Evalúa la tabla de acciones minuto a minuto (referencia)
+     * 	@enum BacktestByEvent Salta directamente entre los instantes de ejecución de cada día (rápido)
+     */
+    enum BacktestMode{
+    	BacktestByMinute,
+    	BacktestByEvent,
+    };
+
+
+    /** Cambio de estado de la salida registrado durante un backtest */
+    struct BacktestEvent_t {
+    	time_t time;				//!< Instante de ejecución
+    	int8_t id;					//!< Identificador de la acción ejecutada
+    	uint8_t outValue;			//!< Nuevo valor de la salida
+    };
+
+
+    /** Resultado acumulado de un backtest */
+    struct BacktestResult_t {
+    	uint32_t eventCount;		//!< Número de cambios de la salida (puede superar el tamaño del buffer de eventos)
+    	uint32_t switchOnCount;		//!< Número de encendidos (Off -> On/Dim)
+    	uint32_t switchOffCount;	//!< Número de apagados (On/Dim -> Off)
+    	uint32_t levelChangeCount;	//!< Número de cambios de nivel sin apagar ni encender
+    	uint32_t onSeconds;			//!< Segundos con la salida activa (horas de encendido * 3600)
+    	uint64_t levelSeconds;		//!< Integral del nivel de salida (0..100) por segundos
+    	uint8_t finalValue;			//!< Valor de la salida al final del rango
+    };
+
+
+    /** Callback para completar los datos del calendario (periodo, orto, ocaso) de cada día simulado.
+     *  Recibe el objeto con <stat.localtime> apuntando a las 00:00 del día a completar
+     */
+    typedef Callback<void(Blob::LightTimeData_t&)> BacktestDayCallback;
+
     
-    /** Crea un gestor de ejecucin de acciones
-     * 	@param action_count Nmero mximo de acciones gestionables por scheduler
+    /** Crea un gestor de ejecución de acciones
+     * 	@param action_count Número máximo de acciones gestionables por scheduler
      * 	@param actions Puntero al array de acciones
      * 	@param fs Objeto FSManager para operaciones de backup
-     * 	@param defdbg Flag para habilitar depuracin por defecto
+     * 	@param defdbg Flag para habilitar depuración por defecto
      */
     Scheduler(uint8_t action_count, Blob::LightAction_t* actions, FSManager* fs, bool defdbg = false);
 
@@ -45,15 +96,24 @@ class Scheduler {
     ~Scheduler(){}
 
 
-    /** Actualiza el valor del luxmetro
+    /** Actualiza el valor del luxómetro
      *
-     * @param lux Iluminacin
+     * @param lux Iluminación
      * @return 0..100:Nuevo estado de la carga, -1:No hay acciones a ejecutar
      */
     int8_t updateLux(Blob::LightLuxLevel lux);
 
 
-    /** Actualiza el timestamp actual
+    /** Actualiza el timestamp actual. Ejecuta la primera acción del plan del día en el minuto actual. Si detecta
+     *  una discontinuidad en la hora local (primera sincronización, corrección NTP, cambio de horario) y no hay
+     *  ninguna, resuelve la acción vigente con el mismo plan: la última que habría modificado la salida con la
+     *  hora continua, consultando el día anterior si es necesario.
+     *  Las acciones a hora fija se ejecutan cuando coinciden la hora y alguno de sus días de la semana, sin
+     *  comprobar la máscara de periodos ni la fecha fija (las que no indican ningún día no se ejecutan). Las
+     *  acciones al orto o al ocaso se filtran por periodo, día de la semana y fecha fija.
+     *  Mantiene la siguiente acción prevista en el plan del día: si una actualización la deja atrás sin
+     *  ejecutarla, se cuenta como perdida (ver <takeMissed>), salvo que se aplique como vigente tras un salto
+     *  horario, en cuyo caso su retraso se mide desde su instante previsto
      *
      * @param ast Estado del calendario
      * @return 0..100:Nuevo estado de la carga, -1:No hay acciones a ejecutar
@@ -61,23 +121,53 @@ class Scheduler {
     int8_t updateTimestamp(const Blob::LightTimeData_t& ast);
 
 
-    /** Aade una nueva accin en memoria
-     * 	@param pos Posicin en la que aadir la accin
-     *  @param action Accin a aadir.
+    /** Actualiza únicamente la hora local, conservando los datos de calendario (geolocalización, periodo)
+     *  recibidos en la última llamada a <updateTimestamp>. El orto y el ocaso se obtienen de la tabla local.
+     *
+     * @param localtime Hora local
+     * @return 0..100:Nuevo estado de la carga, -1:No hay acciones a ejecutar
+     */
+    int8_t updateLocaltime(time_t localtime);
+
+
+    /** Habilita o deshabilita el cálculo local del orto y el ocaso a partir de las coordenadas de
+     *  geolocalización. Si está deshabilitado se utilizan los valores recibidos en <updateTimestamp>
+     *
+     * @param flag True para habilitar el cálculo local
+     */
+    void setSunCalcEnabled(bool flag){
+    	_sun_calc_enabled = flag;
+    }
+
+
+    /** Obtiene la hora del orto y del ocaso (min. día, hora local) de la fecha indicada, calculada a partir de
+     *  las coordenadas y la zona horaria de la geolocalización actual
+     *
+     * @param t Instante del día a consultar
+     * @param dawn Recibe la hora del orto
+     * @param dusk Recibe la hora del ocaso
+     * @return True si se ha podido calcular, False si no hay coordenadas de geolocalización
+     */
+    bool getSunTimes(time_t t, int16_t& dawn, int16_t& dusk);
+
+
+    /** Añade una nueva acción en memoria
+     * 	@param pos Posición en la que añadir la acción
+     *  @param action Acción a añadir.
      *  @return Resultado 0:Ok, <0:error
      */
     int32_t setAction(uint8_t pos, Blob::LightAction_t& action);
 
 
-    /** Elimina una accin por su posicin
-     *  @param pos Posicin de la maniobra a borrar
+    /** Elimina una acción por su posición
+     *  @param pos Posición de la maniobra a borrar
      *  @return Resultado 0:Ok, <0:error
      */
-    int32_t clrActionByPos(int8_t pos);
+    int32_t clrActionByPos(uint8_t pos);
 
 
     /** Elimina una o varias acciones por <id>
-     *  @param id Id de la accin/acciones a borrar
+     *  @param id Id de la acción/acciones a borrar
      *  @return Resultado 0:Ok, <0:error
      */
     int32_t clrActionById(int8_t id);
@@ -88,65 +178,457 @@ class Scheduler {
     void clrActions();
 
 
-    /** Obtiene el nmero de acciones
-     *  @return Acciones no vacas
+    /** Obtiene el número de acciones
+     *  @return Acciones no vacías
      */
     uint8_t getActionCount();
 
 
     /** Recupera la lista de acciones del sistema de backup
-     * 	@return True si recupera todos los parmetros.
+     * 	@return True si recupera todos los parámetros.
      */
     bool restoreActionList();
 
 
+    /** Recupera una única acción del sistema de backup, permitiendo una carga escalonada de la lista
+     * 	@param pos Posición de la acción
+     * 	@return True si la recupera correctamente
+     */
+    bool restoreAction(uint8_t pos);
+
+
     /** Guarda la lista de acciones en el sistema de backup
      *  @return True si se graba de forma correcta
      */
     bool saveActionList();
 
 
-    /** Valida la informacin recuperada de las acciones
-     * 	@return True si recupera correctamente la informacin
+    /** Guarda una única acción en el sistema de backup, con la misma clave que lee <restoreAction>
+     *  @param pos Posición de la acción
+     *  @return True si se graba de forma correcta
+     */
+    bool saveAction(uint8_t pos);
+
+
+    /** Actualiza un calendario. Las acciones con el flag LightActionCalendar lo referencian por su índice
+     *  @param index Índice del calendario
+     *  @param cal Calendario
+     *  @return Resultado 0:Ok, <0:error
+     */
+    int32_t setCalendar(uint8_t index, const Blob::LightCalendar_t& cal);
+
+
+    /** Obtiene un calendario
+     *  @param index Índice del calendario
+     *  @return Calendario o NULL si el índice no es válido
+     */
+    const Blob::LightCalendar_t* getCalendar(uint8_t index);
+
+
+    /** Recupera los calendarios del sistema de backup. Los que no existan quedan vacíos
+     * 	@return True si los recupera todos
+     */
+    bool restoreCalendars();
+
+
+    /** Guarda un calendario en el sistema de backup
+     *  @param index Índice del calendario
+     *  @return True si se graba de forma correcta
+     */
+    bool saveCalendar(uint8_t index);
+
+
+    /** Valida la información recuperada de las acciones
+     * 	@return True si recupera correctamente la información
      */
     bool checkIntegrity();
 
 
-    /** Obtiene la accin que debe ejecutarse en el instante actual
-     *  @param filter Flags con los criterios de bsqueda (mscara de das, periodos, etc...)
-     *  @param ast_data Datos para obtener los criterios de ejecucin actual (hora, fecha, periodo...)
-     *  @return Accin en ejecucin o NULL si no hay acciones que cumplan el criterio
+    /** Obtiene la acción que debe ejecutarse en el instante actual
+     *  @param filter Flags con los criterios de búsqueda (máscara de días, periodos, etc...)
+     *  @param ast_data Datos para obtener los criterios de ejecución actual (hora, fecha, periodo...)
+     *  @return Acción en ejecución o NULL si no hay acciones que cumplan el criterio
      */
     Blob::LightAction_t* findCurrAction(Blob::LightActionFlags filter, const Blob::LightTimeData_t& data);
 
 
     /**
-     * Establece el nivel de las trazas de depuracin
-     * @param verbosity Nivel de depuracin
+     * Establece el nivel de las trazas de depuración
+     * @param verbosity Nivel de depuración
      */
     void setVerbosity(esp_log_level_t verbosity);
 
+
+    /** Reconstruye la copia de evaluación de las acciones a partir del array empaquetado. Debe invocarse
+     *  siempre que el array de acciones se modifique desde fuera del scheduler (ej: actualización de
+     *  configuración o recuperación de memoria NV).
+     */
+    void rebuildEvalTable();
+
+
+    /** Simula la ejecución de la tabla de acciones en el rango [from, to). Las acciones asociadas al
+     *  sensor ALS no se simulan. Los datos astronómicos y de periodo se toman de <data> o, si se indica,
+     *  de la callback <day_cb> que se invoca al comienzo de cada día simulado.
+     *  @param from Instante inicial
+     *  @param to Instante final (no incluido)
+     *  @param data Datos del calendario (geolocalización, periodo, orto, ocaso)
+     *  @param init_value Valor de la salida al comienzo del rango
+     *  @param result Recibe el resultado acumulado
+     *  @param events Buffer que recibe la secuencia de cambios de la salida (puede ser NULL)
+     *  @param max_events Tamaño del buffer <events>
+     *  @param mode Modo de simulación
+     *  @param day_cb Callback opcional para actualizar los datos del calendario de cada día
+     *  @return Número de eventos escritos en <events> o <0 en caso de error
+     */
+    int32_t backtest(time_t from, time_t to, const Blob::LightTimeData_t& data, uint8_t init_value, BacktestResult_t& result,
+    				 BacktestEvent_t* events, uint32_t max_events, BacktestMode mode = BacktestByEvent,
+					 BacktestDayCallback day_cb = BacktestDayCallback());
+
+
+    /** Número máximo de días consultados por <lookahead> */
+    static const uint8_t LookaheadDays = 8;
+
+
+    /** Obtiene los próximos cambios de la salida a partir de la última hora local recibida en
+     *  <updateTimestamp>, recorriendo el plan de cada día. Las acciones asociadas al sensor ALS no se incluyen
+     *  @param curr_value Valor actual de la salida
+     *  @param events Buffer que recibe los cambios, ordenados por instante de ejecución
+     *  @param max_events Tamaño del buffer
+     *  @return Número de cambios obtenidos o <0 si aún no se ha recibido la hora local
+     */
+    int32_t lookahead(uint8_t curr_value, BacktestEvent_t* events, uint32_t max_events);
+
+
+    /** Límites superiores (ms) de los tramos del histograma de retraso. El último tramo no tiene límite */
+    static const uint32_t LatencyBinMs[Blob::LightLatencyBins - 1];
+
+
+    /** Registra la aplicación de la salida tras la última acción ejecutada por <updateTimestamp>. El retraso es la
+     *  diferencia entre el instante previsto de la acción y la hora local recibida, más el tiempo que el mensaje
+     *  ha esperado en la cola hasta su proceso. Tras un salto horario puede superar el minuto de la acción
+     *  @param queue_ms Tiempo transcurrido desde la recepción de la hora local (ms)
+     *  @return Retraso (ms) o -1 si no hay ninguna acción pendiente de registrar
+     */
+    int32_t recordApplied(uint32_t queue_ms);
+
+
+    /** Actualiza el umbral de alerta de retraso
+     *  @param alert_ms Umbral (ms, 0: deshabilitada)
+     */
+    void setLateAlert(uint32_t alert_ms){
+    	_late_alert_ms = alert_ms;
+    }
+
+
+    /** Obtiene el umbral de alerta de retraso
+     *  @return Umbral (ms, 0: deshabilitada)
+     */
+    uint32_t getLateAlert() const {
+    	return _late_alert_ms;
+    }
+
+
+    /** Obtiene el número de acciones perdidas desde la llamada anterior, es decir, aquellas cuyo instante previsto
+     *  ha quedado atrás en <updateTimestamp> sin ejecutarse (ej: actualizaciones horarias retrasadas)
+     *  @return Acciones perdidas
+     */
+    uint32_t takeMissed(){
+    	uint32_t missed = _exec.missed;
+    	_exec.missed = 0;
+    	return missed;
+    }
+
+
+    /** Obtiene el histograma de retraso
+     *  @return Histograma
+     */
+    const Blob::LightLatencyStats_t& getLatencyStats() const {
+    	return _latency;
+    }
+
+
+    /** Borra el histograma de retraso */
+    void clearLatencyStats();
+
 private:
 
+    /** Copia de evaluación de las acciones, organizada como structure-of-arrays con accesos alineados.
+     *  Contiene únicamente los campos consultados en cada evaluación. El resto (umbrales ALS) se siguen
+     *  leyendo de <_action_list>, que conserva el formato empaquetado para las tramas y la memoria NV.
+     */
+    struct EvalTable_t {
+    	uint32_t flags[Blob::MaxAllowedActionDataInArray];		//!< Flags de control de cada acción
+    	uint16_t time[Blob::MaxAllowedActionDataInArray];		//!< Hora fija de activación (min. día)
+    	uint16_t date[Blob::MaxAllowedActionDataInArray];		//!< Fecha ddMM de activación
+    	int8_t astCorr[Blob::MaxAllowedActionDataInArray];		//!< Corrección sobre el hito astronómico
+    	int8_t outValue[Blob::MaxAllowedActionDataInArray];		//!< Valor de salida
+    	int8_t id[Blob::MaxAllowedActionDataInArray];			//!< Identificador de la acción
+    };
+
+    /** Tipos de hito de ejecución de las acciones temporales */
+    enum ExecKind{
+    	ExecFixTime,
+    	ExecDawn,
+    	ExecDusk,
+    	ExecKindCount
+    };
+
+    /** Número de clases de periodo (sin periodo, periodos 0..7) */
+    static const uint8_t PeriodClasses = 9;
+
+    /** Tabla de decisión compilada a partir de la copia de evaluación */
+    struct CompiledTable_t {
+    	uint32_t classMask[7][PeriodClasses];						//!< Acciones candidatas por día de la semana y periodo
+    	uint8_t order[ExecKindCount][Blob::MaxAllowedActionDataInArray];	//!< Posiciones de cada tipo de hito, ordenadas por desplazamiento
+    	uint8_t count[ExecKindCount];								//!< Número de acciones de cada tipo de hito
+    	uint32_t fixTimeMask[7];									//!< Acciones a hora fija candidatas en cada día de la semana
+    	bool valid;													//!< Flag de tabla compilada
+    };
+
+    /** Plan de ejecución de un día, ordenado por instante de ejecución y posición en la tabla. Es la única fuente
+     *  de los criterios de ejecución: en cada minuto se ejecuta su primera entrada
+     */
+    struct DayPlan_t {
+    	int16_t year;										//!< Año (tm_year) o -1 si no es válido
+    	int16_t yday;										//!< Día del año
+    	int8_t period;										//!< Periodo
+    	int16_t dawn;										//!< Orto
+    	int16_t dusk;										//!< Ocaso
+    	int8_t periodCorr[2];								//!< Corrección del periodo sobre el orto y el ocaso
+    	uint8_t count;										//!< Número de entradas
+    	uint16_t minute[Blob::MaxAllowedActionDataInArray];	//!< Instante de ejecución (min. día)
+    	uint8_t pos[Blob::MaxAllowedActionDataInArray];		//!< Posición de la acción
+    };
+
     /** Puntero al array de acciones */
     Blob::LightAction_t* _action_list;
 
-    /** Nmero mximo de acciones */
+    /** Número máximo de acciones */
     const uint8_t _max_action_count;
 
-    /** Parmetros de ejecucin */
+    /** Copia de evaluación de las acciones */
+    EvalTable_t _eval;
+
+    /** Tabla de decisión compilada */
+    CompiledTable_t _compiled;
+
+    /** Calendarios */
+    Blob::LightCalendar_t _calendars[Blob::MaxCalendars];
+
+    /** Plan del día de la última evaluación */
+    DayPlan_t _plan;
+
+    /** Tabla anual de orto y ocaso (min. día, hora local) calculada a partir de las coordenadas y la zona horaria */
+    struct SunTable_t {
+    	double lat;							//!< Latitud con la que se calculó la tabla
+    	double lon;							//!< Longitud con la que se calculó la tabla
+    	uint32_t tzCrc;						//!< CRC de la zona horaria con la que se calculó la tabla
+    	int16_t year;						//!< Año de la tabla (tm_year) o -1 si no es válida
+    	uint16_t dawn[366];					//!< Orto de cada día del año
+    	uint16_t dusk[366];					//!< Ocaso de cada día del año
+    };
+    SunTable_t _sun_table;
+
+    /** Flag para habilitar el cálculo local de orto y ocaso */
+    bool _sun_calc_enabled;
+
+    /** Máxima diferencia (seg) entre dos actualizaciones consecutivas de la hora local para considerarlas
+     *  continuas. Por encima (o si la hora retrocede) se resuelve la acción vigente
+     */
+    static const int32_t ClockJumpThreshold = 180;
+
+    /** Hora local de la última actualización o 0 si aún no se ha recibido ninguna */
+    time_t _last_localtime;
+
+    /** Última acción ejecutada por <updateTimestamp>, pendiente de registrar su retraso, y siguiente acción prevista
+     *  en el plan del día, para detectar las que quedan atrás sin ejecutarse
+     */
+    struct {
+    	bool pending;						//!< Flag de acción pendiente de registrar
+    	int8_t id;							//!< Identificador de la acción
+    	time_t intended;					//!< Instante previsto
+    	time_t observed;					//!< Hora local recibida
+    	int16_t year;						//!< Día del plan de la acción prevista (tm_year) o -1 si no se ha calculado
+    	int16_t yday;						//!< Día del plan de la acción prevista (tm_yday)
+    	uint32_t planRev;					//!< Revisión del plan con la que se calculó
+    	int16_t from;						//!< Minuto del día a partir del cual se buscó
+    	int16_t minute;						//!< Minuto del día de la acción prevista o -1 si no quedan en el día
+    	int8_t expectedId;					//!< Identificador de la acción prevista
+    	time_t expected;					//!< Comienzo del minuto de la acción prevista
+    	uint32_t missed;					//!< Acciones perdidas pendientes de obtener con <takeMissed>
+    }_exec;
+
+    /** Revisión del plan del día, se incrementa cada vez que se genera de nuevo */
+    uint32_t _plan_rev;
+
+    /** Histograma de retraso */
+    Blob::LightLatencyStats_t _latency;
+
+    /** Umbral de alerta de retraso (ms, 0: deshabilitada) */
+    uint32_t _late_alert_ms;
+
+    /** Parámetros de ejecución */
     Blob::LightTimeData_t _ast_data;
     Blob::LightLuxLevel _lux;
 
-    /** Parmetros de bsqueda y filtrado */
+    /** Parámetros de búsqueda y filtrado */
     Blob::LightActionFlags _filter;
     
     /**Gestor del sistema de backup */
     FSManager* _fs;
 
-    /** Flag de depuracin */
+    /** Flag de depuración */
     const bool _defdbg;
 
+    /** Formato de la clave de cada acción en el sistema de backup, y tamaño para la posición más alta */
+    static const char* ActionKeyFmt;
+    static const uint8_t ActionKeySize = sizeof("SchAction_255");
+
+
+    /** Comprueba si la hora local recibida supone una discontinuidad respecto de la anterior
+     *  @param localtime Hora local recibida
+     *  @return True si la hora ha saltado
+     */
+    bool _isClockJump(time_t localtime);
+
+
+    /** Obtiene la salida de la acción temporal vigente en el instante de <data>. Si no hay ninguna
+     *  ejecutada en el día en curso, toma la última del día anterior
+     *  @param data Datos del calendario del instante actual
+     *  @param id Recibe el identificador de la acción vigente (-1 si no hay ninguna)
+     *  @return 0..100:Estado de la carga, -1:No hay acción vigente
+     */
+    int8_t _resolveCurrAction(const Blob::LightTimeData_t& data, int8_t& id);
+
+
+    /** Actualiza una entrada de la copia de evaluación desde el array empaquetado
+     *  @param pos Posición de la acción
+     */
+    void _loadEvalEntry(uint8_t pos);
+
+
+    /** Compila la tabla de decisión a partir de la copia de evaluación
+     */
+    void _compile();
+
+
+    /** Inserta una acción en la lista compilada de un tipo de hito
+     *  @param kind Tipo de hito
+     *  @param pos Posición de la acción
+     *  @param off Desplazamiento (hora fija o corrección astronómica)
+     *  @param offset Desplazamientos de las acciones ya insertadas
+     */
+    void _compileInsert(int kind, uint8_t pos, int16_t off, int16_t offset[][Blob::MaxAllowedActionDataInArray]);
+
+
+    /** Comprueba el calendario asociado a una acción
+     *  @param pos Posición de la acción
+     *  @param day Fecha del día
+     *  @return True si la acción no tiene calendario o el día cumple su criterio
+     */
+    bool _isCalendarDay(uint8_t pos, const tm& day);
+
+
+    /** Genera el plan de ejecución de un día
+     *  @param day Fecha del día
+     *  @param data Datos del calendario del día (periodo, orto, ocaso, correcciones)
+     *  @param plan Recibe el plan
+     */
+    void _buildDayPlan(const tm& day, const Blob::LightTimeData_t& data, DayPlan_t& plan);
+
+
+    /** Obtiene el plan del día indicado, reutilizando el de la evaluación anterior si no ha cambiado el día,
+     *  los datos del calendario ni la tabla de acciones
+     *  @param day Fecha del día
+     *  @param data Datos del calendario del día
+     *  @return Plan del día
+     */
+    const DayPlan_t& _getDayPlan(const tm& day, const Blob::LightTimeData_t& data);
+
+
+    /** Selecciona la acción que <updateTimestamp> ejecuta en un minuto del día: la primera entrada del plan en
+     *  ese minuto, es decir, la de menor posición en la tabla
+     *  @param plan Plan del día
+     *  @param minute Minuto del día
+     *  @return Posición de la acción o -1 si no hay ninguna
+     */
+    int _selectTimestampAction(const DayPlan_t& plan, int32_t minute);
+
+
+    /** Obtiene la última acción que ha modificado la salida hasta el minuto indicado con la hora continua, es
+     *  decir, la última seleccionada por <_selectTimestampAction> que no está desactivada
+     *  @param plan Plan del día
+     *  @param minute Minuto del día (incluido)
+     *  @return Posición de la acción o -1 si no hay ninguna
+     */
+    int _lastAppliedAction(const DayPlan_t& plan, int32_t minute);
+
+
+    /** Calcula la siguiente acción prevista en el plan del día a partir del minuto indicado
+     *  @param plan Plan del día
+     *  @param day Fecha del día
+     *  @param from Minuto del día (excluido) a partir del cual se busca (-1: desde el comienzo del día)
+     *  @param day_start Comienzo del día (hora local)
+     */
+    void _trackNextAction(const DayPlan_t& plan, const tm& day, int32_t from, time_t day_start);
+
+
+    /** Registra como perdidas las acciones previstas que han quedado atrás sin ejecutarse desde la actualización
+     *  anterior, siempre que la hora sea continua
+     *  @param plan Plan del día
+     *  @param day Fecha del día
+     *  @param day_start Comienzo del día (hora local)
+     *  @param minute_start Comienzo del minuto actual (hora local)
+     */
+    void _checkMissedActions(const DayPlan_t& plan, const tm& day, time_t day_start, time_t minute_start);
+
+
+    /** Obtiene la primera entrada del plan cuyo instante de ejecución es posterior al indicado
+     *  @param plan Plan del día
+     *  @param minute Minuto del día
+     *  @return Índice de la entrada o <plan.count> si no hay ninguna
+     */
+    static uint8_t _upperBound(const DayPlan_t& plan, int32_t minute);
+
+
+    /** Completa el orto y el ocaso de los datos de calendario a partir de la tabla local, si está habilitada
+     *  y hay coordenadas disponibles
+     *  @param data Datos del calendario a completar (se usa <stat.localtime> como fecha)
+     */
+    void _applySunTimes(Blob::LightTimeData_t& data);
+
+
+    /** Obtiene el orto y el ocaso de la tabla local, recalculándola si cambia el año, las coordenadas o la zona
+     *  horaria
+     *  @param lat Latitud
+     *  @param lon Longitud
+     *  @param tz Zona horaria en formato TZ POSIX (vacía: la del sistema)
+     *  @param t Instante del día a consultar
+     *  @param dawn Recibe la hora del orto
+     *  @param dusk Recibe la hora del ocaso
+     *  @return True si se ha podido calcular, False si no hay coordenadas de geolocalización
+     */
+    bool _lookupSunTimes(double lat, double lon, const char* tz, time_t t, int16_t& dawn, int16_t& dusk);
+
+
+    /** Recalcula la tabla de orto y ocaso para el año indicado
+     *  @param year Año (tm_year)
+     *  @param tz Zona horaria en formato TZ POSIX (vacía: la del sistema)
+     */
+    void _buildSunTable(int year, const char* tz);
+
+
+    /** Registra un cambio de estado durante el backtest y acumula el tiempo transcurrido con el estado previo
+     *  @param t Instante del cambio
+     *  @param value Nuevo valor de la salida
+     *  @param id Identificador de la acción
+     *  @param last_t Instante del último cambio, se actualiza a <t>
+     *  @param result Resultado acumulado
+     *  @param events Buffer de eventos
+     *  @param max_events Tamaño del buffer
+     */
+    static void _backtestApply(time_t t, uint8_t value, int8_t id, time_t& last_t, BacktestResult_t& result, BacktestEvent_t* events, uint32_t max_events);
+
 };
      
 #endif /*__Scheduler__H */
@@ -0,0 +1,266 @@
+/*
+ * TimingWheel.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "TimingWheel.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Macro para imprimir trazas de depuración, siempre que se haya configurado un objeto
+ *	Logger válido (ej: _debug)
+ */
+static const char* _MODULE_ = "[TmWheel].......";
+#define _EXPR_	(!IS_ISR())
+
+
+Mutex TimingWheel::_default_mtx;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+TimingWheel* TimingWheel::getDefault(){
+	static TimingWheel* wheel = NULL;
+	_default_mtx.lock();
+	if(wheel == NULL){
+		wheel = new TimingWheel();
+		MBED_ASSERT(wheel);
+	}
+	_default_mtx.unlock();
+	return wheel;
+}
+
+
+//------------------------------------------------------------------------------------
+TimingWheel::TimingWheel(uint32_t tick_ms) : _tick_ms((tick_ms > 0)? tick_ms : 1), _cb_done(_mtx) {
+	memset(_slots, 0, sizeof(_slots));
+	_now = 0;
+	_base_ms = Kernel::get_ms_count();
+	_wake = 0;
+	_count = 0;
+	_running = false;
+	_current = NULL;
+	_cb_thread = NULL;
+	_tmr = new RtosTimer(callback(this, &TimingWheel::_onTimer), osTimerOnce, "TmWheelTmr");
+	MBED_ASSERT(_tmr);
+	DEBUG_TRACE_D(_EXPR_, _MODULE_, "Rueda de temporización creada, tick=%dms", _tick_ms);
+}
+
+
+//------------------------------------------------------------------------------------
+TimingWheel::~TimingWheel(){
+	_tmr->stop();
+	delete(_tmr);
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::start(Timer_t& t, uint32_t delay_ms){
+	_mtx.lock();
+	if(t.pprev != NULL){
+		_unlink(&t);
+	}
+	// con la rueda detenida no hay ticks pendientes de procesar, por lo que se resincroniza con el kernel. En
+	// otro caso, el retardo se cuenta desde el tick <_now> sumando el tiempo transcurrido desde él, aunque la
+	// rueda aún no lo haya procesado, y se redondea al tick superior para no vencer antes de tiempo
+	uint64_t now_ms = Kernel::get_ms_count();
+	if(!_running){
+		_base_ms = now_ms;
+	}
+	uint64_t due_ms = (uint64_t)delay_ms + ((now_ms > _base_ms)? (now_ms - _base_ms) : 0);
+	uint64_t ticks = (due_ms + _tick_ms - 1) / _tick_ms;
+	ticks = (ticks == 0)? 1 : (ticks > MaxDelayTicks)? MaxDelayTicks : ticks;
+	t.expires = _now + (uint32_t)ticks;
+	_insert(&t);
+	// reprograma el timer del kernel si el nuevo vencimiento es anterior al programado
+	if(!_running || (int32_t)(t.expires - _wake) < 0){
+		_program();
+	}
+	_mtx.unlock();
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::cancel(Timer_t& t){
+	_mtx.lock();
+	for(;;){
+		if(t.pprev != NULL){
+			_unlink(&t);
+		}
+		// si su callback está en ejecución en otro hilo, espera a que finalice, ya que puede haberlo rearmado
+		if(_current != &t || _cb_thread == osThreadGetId()){
+			break;
+		}
+		_cb_done.wait();
+	}
+	_mtx.unlock();
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::tick(){
+	_mtx.lock();
+	_step();
+	_base_ms += _tick_ms;
+	_program();
+	_mtx.unlock();
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_onTimer(){
+	_mtx.lock();
+	// avanza los ticks transcurridos desde el último procesado, al menos hasta el programado. La rueda sigue
+	// marcada en marcha para que los temporizadores armados desde las callbacks partan del tick actual
+	uint32_t ticks = ((int32_t)(_wake - _now) > 0)? (_wake - _now) : 0;
+	uint64_t now_ms = Kernel::get_ms_count();
+	if(now_ms > _base_ms && (now_ms - _base_ms) / _tick_ms > ticks){
+		ticks = (uint32_t)((now_ms - _base_ms) / _tick_ms);
+	}
+	while(ticks-- > 0){
+		_step();
+		_base_ms += _tick_ms;
+	}
+	_program();
+	_mtx.unlock();
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_step(){
+	_now++;
+	uint32_t index = _now & LevelMask;
+
+	// al completar una vuelta de un nivel, redistribuye la posición correspondiente del nivel superior
+	if(index == 0){
+		for(uint8_t level = 1; level < Levels; level++){
+			uint32_t i = (_now >> (LevelBits * level)) & LevelMask;
+			_cascade(level, i);
+			if(i != 0){
+				break;
+			}
+		}
+	}
+
+	// procesa en bloque los vencimientos del tick. Las callbacks se ejecutan sin el mutex, por lo que
+	// pueden rearmar o cancelar temporizadores
+	Timer_t* t;
+	while((t = _slots[0][index]) != NULL){
+		_unlink(t);
+		Callback<void()> cb = t->cb;
+		_current = t;
+		_cb_thread = osThreadGetId();
+		_mtx.unlock();
+		if(cb){
+			cb();
+		}
+		_mtx.lock();
+		_current = NULL;
+		_cb_done.notify_all();
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_program(){
+	// sin temporizadores armados, detiene el tick del kernel
+	if(_count == 0){
+		if(_running){
+			_running = false;
+			_tmr->stop();
+		}
+		return;
+	}
+	// descuenta el tiempo ya transcurrido desde el tick <_now>
+	_wake = _now + _nextEvent();
+	int64_t delay = (int64_t)(_wake - _now) * _tick_ms;
+	uint64_t now_ms = Kernel::get_ms_count();
+	if(now_ms > _base_ms){
+		delay -= (int64_t)(now_ms - _base_ms);
+	}
+	_tmr->stop();
+	_tmr->start((delay > 0)? (uint32_t)delay : 1);
+	_running = true;
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t TimingWheel::_nextEvent() const{
+	// una posición del nivel <level> se procesa (nivel 0) o redistribuye cuando se completa una vuelta del
+	// nivel inferior, por lo que basta con buscar la primera ocupada a partir de la actual en cada nivel
+	uint32_t next = 0;
+	for(uint8_t level = 0; level < Levels; level++){
+		uint8_t shift = LevelBits * level;
+		for(uint32_t k = 1; k <= LevelSlots; k++){
+			uint32_t at = ((_now >> shift) + k) << shift;
+			if(_slots[level][(at >> shift) & LevelMask] != NULL){
+				uint32_t ticks = at - _now;
+				if(next == 0 || ticks < next){
+					next = ticks;
+				}
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_insert(Timer_t* t){
+	uint32_t delta = t->expires - _now;
+	uint8_t level = 0;
+	while(level < (Levels - 1) && delta >= ((uint32_t)1 << (LevelBits * (level + 1)))){
+		level++;
+	}
+	Timer_t** head = &_slots[level][(t->expires >> (LevelBits * level)) & LevelMask];
+	t->next = *head;
+	if(t->next != NULL){
+		t->next->pprev = &t->next;
+	}
+	*head = t;
+	t->pprev = head;
+	_count++;
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_unlink(Timer_t* t){
+	*t->pprev = t->next;
+	if(t->next != NULL){
+		t->next->pprev = t->pprev;
+	}
+	t->next = NULL;
+	t->pprev = NULL;
+	_count--;
+}
+
+
+//------------------------------------------------------------------------------------
+void TimingWheel::_cascade(uint8_t level, uint32_t index){
+	Timer_t* t = _slots[level][index];
+	_slots[level][index] = NULL;
+	while(t != NULL){
+		Timer_t* next = t->next;
+		_count--;
+		_insert(t);
+		t = next;
+	}
+}
+
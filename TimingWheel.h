@@ -0,0 +1,223 @@
+/*
+ * TimingWheel.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	TimingWheel es un servicio de temporización compartido, basado en una rueda jerárquica de 4 niveles de 64
+ *	posiciones cada uno. Permite que múltiples instancias (LightManager, Scheduler, ...) registren vencimientos
+ *	sin necesidad de crear un timer del kernel por cada uno de ellos:
+ *
+ *		start: arma (o rearma) un temporizador con un retardo en ms. Coste O(1)
+ *
+ *		cancel: desarma un temporizador y espera a que finalice su callback si está en ejecución. Coste O(1)
+ *
+ *	Un único RtosTimer hace avanzar la rueda y procesa en bloque todos los vencimientos desde el mismo hilo. No
+ *	es periódico: se programa para el siguiente tick con trabajo (un vencimiento o la redistribución de una
+ *	posición de un nivel superior), de forma que un retardo largo no genera un tick del kernel cada
+ *	DefaultTickMs. Sin temporizadores armados, el RtosTimer permanece detenido.
+ *
+ *	Los temporizadores (Timer_t) pertenecen al módulo que los utiliza, que debe cancelarlos antes de destruirlos.
+ *	Las callbacks se ejecutan en el contexto del timer del kernel, por lo que deben limitarse a enviar mensajes
+ *	(igual que las callbacks de un RtosTimer).
+ */
+
+#ifndef __TimingWheel__H
+#define __TimingWheel__H
+
+#include "mbed.h"
+
+class TimingWheel {
+  public:
+
+	/** Temporizador registrado en la rueda. Se enlaza directamente en la posición correspondiente, por lo
+	 *  que no requiere memoria dinámica
+	 */
+	struct Timer_t {
+		Timer_t* next;				//!< Siguiente temporizador de la posición
+		Timer_t** pprev;			//!< Enlace que apunta a este temporizador (NULL si no está armado)
+		uint32_t expires;			//!< Tick de vencimiento
+		Callback<void()> cb;		//!< Callback a invocar en el vencimiento
+
+		Timer_t() : next(NULL), pprev(NULL), expires(0) {}
+		Timer_t(Callback<void()> c) : next(NULL), pprev(NULL), expires(0), cb(c) {}
+	};
+
+
+	/** Periodo del tick por defecto en ms */
+	static const uint32_t DefaultTickMs = 10;
+
+
+	/** Obtiene el servicio compartido, creándolo en la primera llamada. Puede invocarse desde varios hilos a la
+	 *  vez, todos obtienen la misma instancia
+	 *
+	 * @return Rueda de temporización compartida
+	 */
+	static TimingWheel* getDefault();
+
+
+	/** Crea una rueda de temporización
+	 *
+	 * @param tick_ms Periodo del tick en ms
+	 */
+	TimingWheel(uint32_t tick_ms = DefaultTickMs);
+
+
+	/** Destructor */
+	~TimingWheel();
+
+
+	/** Arma un temporizador. Si ya estaba armado, se rearma con el nuevo retardo
+	 *
+	 * @param t Temporizador
+	 * @param delay_ms Retardo en ms (se redondea al tick superior, mínimo 1 tick)
+	 */
+	void start(Timer_t& t, uint32_t delay_ms);
+
+
+	/** Desarma un temporizador. Si su callback está en ejecución en otro hilo, espera a que finalice (y lo desarma
+	 *  de nuevo si la callback lo ha rearmado), de forma que al retornar la callback no se volverá a invocar y el
+	 *  propietario puede destruirlo. No hace nada si no estaba armado
+	 *
+	 * @param t Temporizador
+	 */
+	void cancel(Timer_t& t);
+
+
+	/** Comprueba si un temporizador está armado
+	 *
+	 * @param t Temporizador
+	 * @return True si está pendiente de vencer
+	 */
+	bool isArmed(const Timer_t& t) const {
+		return (t.pprev != NULL);
+	}
+
+
+	/** Obtiene el número de temporizadores armados
+	 *
+	 * @return Temporizadores armados
+	 */
+	uint32_t getCount() const {
+		return _count;
+	}
+
+
+	/** Obtiene el periodo del tick
+	 *
+	 * @return Periodo en ms
+	 */
+	uint32_t getTickMs() const {
+		return _tick_ms;
+	}
+
+
+	/** Hace avanzar la rueda un tick y procesa los vencimientos. Permite avanzar la rueda de forma manual
+	 *  (ej: tests), el RtosTimer interno la hace avanzar según el tiempo transcurrido
+	 */
+	void tick();
+
+  private:
+
+	/** Dimensiones de la rueda */
+	static const uint8_t LevelBits = 6;
+	static const uint32_t LevelSlots = (1 << LevelBits);
+	static const uint32_t LevelMask = (LevelSlots - 1);
+	static const uint8_t Levels = 4;
+
+	/** Retardo máximo en ticks. Los retardos superiores se limitan a este valor */
+	static const uint32_t MaxDelayTicks = (1 << (LevelBits * Levels)) - 1;
+
+	/** Posiciones de cada nivel */
+	Timer_t* _slots[Levels][LevelSlots];
+
+	/** Ticks procesados */
+	uint32_t _now;
+
+	/** Instante (ms del kernel) correspondiente al tick <_now> */
+	uint64_t _base_ms;
+
+	/** Tick para el que está programado el RtosTimer */
+	uint32_t _wake;
+
+	/** Temporizadores armados */
+	uint32_t _count;
+
+	/** Periodo del tick en ms */
+	const uint32_t _tick_ms;
+
+	/** Timer del kernel que hace avanzar la rueda */
+	RtosTimer* _tmr;
+
+	/** Flag de timer del kernel en marcha */
+	bool _running;
+
+	/** Temporizador cuya callback está en ejecución (NULL si ninguno) y el hilo que la ejecuta */
+	Timer_t* _current;
+	osThreadId _cb_thread;
+
+	/** Mutex de acceso a la rueda */
+	Mutex _mtx;
+
+	/** Aviso de callback finalizada, para las cancelaciones en espera */
+	ConditionVariable _cb_done;
+
+	/** Mutex de creación del servicio compartido */
+	static Mutex _default_mtx;
+
+
+	/** Callback del RtosTimer, avanza la rueda los ticks transcurridos y la programa de nuevo
+	 *
+	 */
+	void _onTimer();
+
+
+	/** Avanza la rueda un tick y procesa sus vencimientos. Debe invocarse con el mutex adquirido, que se libera
+	 *  durante la ejecución de cada callback
+	 *
+	 */
+	void _step();
+
+
+	/** Programa el RtosTimer para el siguiente tick con trabajo o lo detiene si no hay temporizadores armados.
+	 *  Debe invocarse con el mutex adquirido
+	 *
+	 */
+	void _program();
+
+
+	/** Obtiene el número de ticks hasta el siguiente tick con trabajo: la primera posición ocupada del nivel 0
+	 *  o la redistribución de la primera posición ocupada de un nivel superior
+	 *
+	 * @return Ticks (1 .. LevelSlots^Levels)
+	 */
+	uint32_t _nextEvent() const;
+
+
+	/** Enlaza un temporizador en la posición correspondiente a su vencimiento
+	 *
+	 * @param t Temporizador
+	 */
+	void _insert(Timer_t* t);
+
+
+	/** Desenlaza un temporizador de su posición
+	 *
+	 * @param t Temporizador
+	 */
+	void _unlink(Timer_t* t);
+
+
+	/** Redistribuye los temporizadores de una posición de un nivel superior en los niveles inferiores
+	 *
+	 * @param level Nivel
+	 * @param index Posición
+	 */
+	void _cascade(uint8_t level, uint32_t index);
+};
+
+#endif /*__TimingWheel__H */
+
+/**** END OF FILE ****/
+
+
@@ -0,0 +1,200 @@
+/*
+ * HostRuntime.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+#include "HostRuntime.h"
+
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE TYPEDEFS ----------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Índice del hilo del pool en curso (-1 si no pertenece al pool) */
+static thread_local int s_worker_id = -1;
+
+/** Runtime al que pertenece el hilo en curso */
+static thread_local const HostRuntime* s_worker_rt = NULL;
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+HostRuntime::HostRuntime(uint32_t workers, uint32_t batch) : _batch((batch > 0)? batch : 1) {
+	if(workers == 0){
+		workers = std::thread::hardware_concurrency();
+		workers = (workers > 0)? workers : 1;
+	}
+	_pending = 0;
+	_queued = 0;
+	_sleeping = 0;
+	_stop = false;
+	_runs = 0;
+	_steals = 0;
+	for(uint32_t i=0;i<workers;i++){
+		_workers.push_back(new Worker());
+	}
+	for(uint32_t i=0;i<workers;i++){
+		_workers[i]->th = std::thread(&HostRuntime::_workerLoop, this, i);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+HostRuntime::~HostRuntime(){
+	{
+		std::lock_guard<std::mutex> lock(_idle_mtx);
+		_stop = true;
+	}
+	_idle_cv.notify_all();
+	// los hilos que siguen en ejecución pueden robar de cualquier cola, por lo que no se libera ninguna hasta
+	// que hayan terminado todos
+	for(uint32_t i=0;i<_workers.size();i++){
+		_workers[i]->th.join();
+	}
+	for(uint32_t i=0;i<_workers.size();i++){
+		delete(_workers[i]);
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void HostRuntime::schedule(Actor* actor){
+	uint8_t state = actor->_state.load();
+	for(;;){
+		// si está en reposo, pasa a la cola de listos
+		if(state == Actor::StateIdle){
+			if(actor->_state.compare_exchange_weak(state, Actor::StateScheduled)){
+				_pending++;
+				_push(actor);
+				return;
+			}
+		}
+		// si está en ejecución, se volverá a encolar al terminar
+		else if(state == Actor::StateRunning){
+			if(actor->_state.compare_exchange_weak(state, Actor::StateRunningNotified)){
+				return;
+			}
+		}
+		// ya está pendiente de ejecución
+		else{
+			return;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void HostRuntime::waitIdle(){
+	std::unique_lock<std::mutex> lock(_idle_mtx);
+	_done_cv.wait(lock, [this]{ return _pending.load() == 0; });
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+void HostRuntime::_workerLoop(uint32_t id){
+	s_worker_id = (int)id;
+	s_worker_rt = this;
+	while(!_stop){
+		Actor* actor = _take(id);
+		if(actor != NULL){
+			_execute(actor);
+			continue;
+		}
+		// sin trabajo, espera a que se encole algún actor o a la parada
+		std::unique_lock<std::mutex> lock(_idle_mtx);
+		_sleeping++;
+		_idle_cv.wait(lock, [this]{ return _stop.load() || _queued.load() > 0; });
+		_sleeping--;
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+void HostRuntime::_push(Actor* actor){
+	uint32_t id;
+	if(s_worker_rt == this){
+		id = (uint32_t)s_worker_id;
+	}
+	else{
+		// desde fuera del pool, reparte los actores entre las colas
+		static std::atomic<uint32_t> next(0);
+		id = next++ % _workers.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(_workers[id]->mtx);
+		_workers[id]->ready.push_back(actor);
+		_queued++;
+	}
+	// sólo se despierta a un hilo si hay alguno esperando. <_queued> se incrementa antes de consultar
+	// <_sleeping>, y el hilo incrementa <_sleeping> antes de consultar <_queued>, por lo que al menos uno de los
+	// dos ve al otro. El aviso se realiza con el mutex para que no llegue antes de que el hilo entre en espera
+	if(_sleeping.load() > 0){
+		std::lock_guard<std::mutex> lock(_idle_mtx);
+		_idle_cv.notify_one();
+	}
+}
+
+
+//------------------------------------------------------------------------------------
+HostRuntime::Actor* HostRuntime::_take(uint32_t id){
+	// la cola propia se consume en orden de llegada
+	{
+		Worker* w = _workers[id];
+		std::lock_guard<std::mutex> lock(w->mtx);
+		if(!w->ready.empty()){
+			Actor* actor = w->ready.front();
+			w->ready.pop_front();
+			_queued--;
+			return actor;
+		}
+	}
+	// roba del extremo opuesto de las colas de los demás hilos
+	for(uint32_t i=1;i<_workers.size();i++){
+		Worker* w = _workers[(id + i) % _workers.size()];
+		std::lock_guard<std::mutex> lock(w->mtx);
+		if(!w->ready.empty()){
+			Actor* actor = w->ready.back();
+			w->ready.pop_back();
+			_queued--;
+			_steals++;
+			return actor;
+		}
+	}
+	return NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+void HostRuntime::_execute(Actor* actor){
+	actor->_state = Actor::StateRunning;
+	bool more = actor->run(_batch);
+	_runs++;
+
+	// si quedan mensajes o se han recibido durante la ejecución, vuelve a la cola
+	uint8_t state = Actor::StateRunning;
+	if(more || !actor->_state.compare_exchange_strong(state, Actor::StateIdle)){
+		actor->_state = Actor::StateScheduled;
+		_push(actor);
+		return;
+	}
+
+	// el actor queda en reposo
+	if(--_pending == 0){
+		std::lock_guard<std::mutex> lock(_idle_mtx);
+		_done_cv.notify_all();
+	}
+}
+
@@ -0,0 +1,180 @@
+/*
+ * HostRuntime.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *	HostRuntime es un entorno de ejecución para PC (Linux) que permite simular miles de objetos activos sin un hilo
+ *	por objeto. Los objetos activos (Actor) se planifican como tareas ligeras sobre un pool fijo de hilos con robo
+ *	de trabajo (work-stealing):
+ *
+ *		- Cada hilo mantiene su propia cola de actores listos. Los actores que se rearman desde un hilo del pool
+ *		  se encolan en su cola local y los hilos sin trabajo roban actores de las colas de los demás.
+ *
+ *		- Cada actor conserva la semántica de buzón: <schedule> sólo indica que tiene mensajes pendientes, y el
+ *		  actor se ejecuta en un único hilo a la vez, procesando un lote de mensajes en cada ejecución.
+ *
+ *	Este módulo sólo depende de la librería estándar de C++11 y no forma parte del firmware. Su alcance se limita al
+ *	planificador: LightManager no puede ejecutarse todavía sobre él, ya que ActiveModule crea un hilo por instancia
+ *	y el repositorio no incluye una capa de compatibilidad mbed para PC. bench_HostRuntime.cpp mide el escalado
+ *	del planificador con actores sintéticos y, si se compila con BENCH_SCHEDULER sobre una capa mbed externa, con
+ *	instancias reales de Scheduler, que no derivan de ActiveModule.
+ */
+
+#ifndef __HostRuntime__H
+#define __HostRuntime__H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class HostRuntime {
+  public:
+
+	/** Objeto activo planificable en el runtime */
+	class Actor {
+	  public:
+		Actor() : _state(StateIdle) {}
+		virtual ~Actor(){}
+
+		/** Procesa los mensajes pendientes del buzón
+		 *
+		 * @param max Número máximo de mensajes a procesar
+		 * @return True si quedan mensajes pendientes
+		 */
+		virtual bool run(uint32_t max) = 0;
+
+	  private:
+		friend class HostRuntime;
+
+		/** Estados de planificación del actor */
+		enum {
+			StateIdle,				//!< Sin mensajes pendientes
+			StateScheduled,			//!< En la cola de algún hilo
+			StateRunning,			//!< En ejecución
+			StateRunningNotified,	//!< En ejecución y con nuevos mensajes recibidos durante la misma
+		};
+		std::atomic<uint8_t> _state;
+	};
+
+
+	/** Lote de mensajes por defecto en cada ejecución de un actor */
+	static const uint32_t DefaultBatch = 16;
+
+
+	/** Crea el runtime e inicia los hilos del pool
+	 *
+	 * @param workers Número de hilos (0: uno por núcleo)
+	 * @param batch Lote de mensajes por ejecución
+	 */
+	HostRuntime(uint32_t workers = 0, uint32_t batch = DefaultBatch);
+
+
+	/** Detiene y espera a todos los hilos del pool antes de liberar sus colas. Los actores pendientes no se
+	 *  ejecutan
+	 */
+	~HostRuntime();
+
+
+	/** Indica que un actor tiene mensajes pendientes. Puede invocarse desde cualquier hilo
+	 *
+	 * @param actor Actor
+	 */
+	void schedule(Actor* actor);
+
+
+	/** Espera a que no haya ningún actor pendiente ni en ejecución */
+	void waitIdle();
+
+
+	/** Obtiene el número de hilos del pool */
+	uint32_t getWorkers() const {
+		return (uint32_t)_workers.size();
+	}
+
+
+	/** Obtiene el número de ejecuciones de actores */
+	uint64_t getRuns() const {
+		return _runs;
+	}
+
+
+	/** Obtiene el número de actores robados de otras colas */
+	uint64_t getSteals() const {
+		return _steals;
+	}
+
+  private:
+
+	/** Hilo del pool con su cola de actores listos */
+	struct Worker {
+		std::mutex mtx;
+		std::deque<Actor*> ready;
+		std::thread th;
+	};
+
+	std::vector<Worker*> _workers;
+	const uint32_t _batch;
+
+	/** Actores encolados o en ejecución */
+	std::atomic<uint32_t> _pending;
+
+	/** Actores encolados, a la espera de un hilo */
+	std::atomic<uint32_t> _queued;
+
+	/** Hilos en espera de trabajo */
+	std::atomic<uint32_t> _sleeping;
+
+	/** Flag de parada */
+	std::atomic<bool> _stop;
+
+	/** Espera de los hilos sin trabajo y de <waitIdle>. Los avisos se realizan con <_idle_mtx> adquirido para
+	 *  que no se pierdan entre la comprobación de la condición y la espera
+	 */
+	std::mutex _idle_mtx;
+	std::condition_variable _idle_cv;
+	std::condition_variable _done_cv;
+
+	/** Estadísticas */
+	std::atomic<uint64_t> _runs;
+	std::atomic<uint64_t> _steals;
+
+
+	/** Bucle de ejecución de un hilo del pool
+	 *
+	 * @param id Índice del hilo
+	 */
+	void _workerLoop(uint32_t id);
+
+
+	/** Encola un actor listo, en la cola del hilo en curso si pertenece al pool
+	 *
+	 * @param actor Actor
+	 */
+	void _push(Actor* actor);
+
+
+	/** Obtiene el siguiente actor de la cola propia o, si está vacía, lo roba de otra
+	 *
+	 * @param id Índice del hilo
+	 * @return Actor o NULL si no hay ninguno
+	 */
+	Actor* _take(uint32_t id);
+
+
+	/** Ejecuta un actor y lo vuelve a encolar si tiene mensajes pendientes
+	 *
+	 * @param actor Actor
+	 */
+	void _execute(Actor* actor);
+};
+
+#endif /*__HostRuntime__H */
+
+/**** END OF FILE ****/
+
+
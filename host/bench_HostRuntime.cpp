@@ -0,0 +1,228 @@
+/*
+ * bench_HostRuntime.cpp
+ *
+ *	Benchmark de escalado del runtime de simulación. Crea un número elevado de actores con un buzón y mide el
+ *	número de mensajes procesados por segundo con un número creciente de hilos en el pool. Verifica además que
+ *	ningún actor se ejecuta en dos hilos a la vez. El escalado sólo es representativo hasta el número de núcleos de
+ *	la máquina: con más hilos que núcleos, los hilos compiten por el mismo núcleo y el resultado se marca como tal.
+ *
+ *	Se ejecutan dos tipos de actores:
+ *
+ *		- BenchActor: actor sintético con una carga por mensaje similar a una evaluación del scheduler. Sólo
+ *		  depende de la librería estándar.
+ *
+ *		- SchedulerActor (con BENCH_SCHEDULER): cada actor es una instancia real de Scheduler con su tabla de
+ *		  acciones, y cada mensaje es un minuto de hora local que se evalúa con <updateTimestamp>. Todas las
+ *		  instancias deben obtener los mismos cambios de la salida que una instancia ejecutada sin el runtime.
+ *		  Requiere una capa de compatibilidad mbed para PC externa al repositorio (mbed.h, FSManager.h, List.h
+ *		  y Blob).
+ *
+ *	Compilación y ejecución en Linux:
+ *
+ *		g++ -std=c++11 -O2 -pthread host/HostRuntime.cpp host/bench_HostRuntime.cpp -o bench_HostRuntime
+ *
+ *		g++ -std=c++11 -O2 -pthread -DBENCH_SCHEDULER -I. -I<capa mbed PC> host/HostRuntime.cpp
+ *			host/bench_HostRuntime.cpp Scheduler.cpp DeferredLog.cpp -o bench_HostRuntime
+ *
+ *		./bench_HostRuntime [actores] [mensajes por actor] [máximo de hilos]
+ */
+
+#include "HostRuntime.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#if defined(BENCH_SCHEDULER)
+#include "Scheduler.h"
+#endif
+
+
+/** Actor sintético con un buzón de mensajes pendientes */
+class BenchActor : public HostRuntime::Actor {
+  public:
+	BenchActor() : _mailbox(0), _inside(false), _acc(1), _processed(0), _overlaps(0) {}
+
+	/** Postea un mensaje y avisa al runtime (NULL: ejecución sin el runtime) */
+	void post(HostRuntime* rt){
+		_mailbox++;
+		if(rt){
+			rt->schedule(this);
+		}
+	}
+
+	virtual bool run(uint32_t max){
+		// comprueba la ejecución de uno en uno
+		if(_inside.exchange(true)){
+			_overlaps++;
+		}
+		uint32_t done = 0;
+		while(done < max && _mailbox.load() > 0){
+			_mailbox--;
+			// carga equivalente a recorrer una tabla de 20 acciones
+			for(int i=0;i<20;i++){
+				_acc = _acc * 1103515245u + 12345u + (_acc >> 7);
+			}
+			done++;
+		}
+		_processed += done;
+		_inside = false;
+		return (_mailbox.load() > 0);
+	}
+
+	uint64_t getProcessed() const { return _processed; }
+	uint32_t getOverlaps() const { return _overlaps; }
+	uint32_t getAcc() const { return _acc; }
+
+	/** Sin referencia que comprobar */
+	bool check(const BenchActor&) const { return true; }
+
+  private:
+	std::atomic<uint32_t> _mailbox;
+	std::atomic<bool> _inside;
+	uint32_t _acc;
+	uint64_t _processed;
+	uint32_t _overlaps;
+};
+
+
+#if defined(BENCH_SCHEDULER)
+/** Actor con una instancia real de Scheduler. Cada mensaje avanza un minuto la hora local y la evalúa */
+class SchedulerActor : public HostRuntime::Actor {
+  public:
+	SchedulerActor() : _sched(Blob::MaxAllowedActionDataInArray, _actions, NULL), _mailbox(0), _inside(false),
+						_changes(0), _out(-1), _processed(0), _overlaps(0) {
+		// encendido 10 min antes del ocaso, reducción al 30% a la 01:00 de lunes a viernes y apagado 15 min
+		// después del orto, con el orto y el ocaso calculados para Madrid
+		_sched.clrActions();
+		Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, 0, -10, {0,0,0}, 100};
+		_sched.setAction(0, act);
+		act = {2, (Blob::LightActionFlags)(0x7C | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+		_sched.setAction(1, act);
+		act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionDawn), 0, 0, 15, {0,0,0}, 0};
+		_sched.setAction(2, act);
+		memset(&_data, 0, sizeof(Blob::LightTimeData_t));
+		strcpy(_data.cfg.geoloc.timezone, "CET-1CEST,M3.5.0,M10.5.0/3");
+		_data.cfg.geoloc.coords[0] = 40.4168;
+		_data.cfg.geoloc.coords[1] = -3.7038;
+		_data.stat.period = -1;
+		_data.stat.localtime = 1546300800 + (17 * 3600);	// 01.01.2019 17:00
+	}
+
+	/** Postea un mensaje y avisa al runtime (NULL: ejecución sin el runtime) */
+	void post(HostRuntime* rt){
+		_mailbox++;
+		if(rt){
+			rt->schedule(this);
+		}
+	}
+
+	virtual bool run(uint32_t max){
+		if(_inside.exchange(true)){
+			_overlaps++;
+		}
+		uint32_t done = 0;
+		while(done < max && _mailbox.load() > 0){
+			_mailbox--;
+			int8_t out = _sched.updateTimestamp(_data);
+			if(out >= 0 && out != _out){
+				_out = out;
+				_changes++;
+			}
+			_data.stat.localtime += 60;
+			done++;
+		}
+		_processed += done;
+		_inside = false;
+		return (_mailbox.load() > 0);
+	}
+
+	uint64_t getProcessed() const { return _processed; }
+	uint32_t getOverlaps() const { return _overlaps; }
+	uint32_t getAcc() const { return ((uint32_t)_changes << 8) | (uint8_t)_out; }
+
+	/** Comprueba que la secuencia de cambios coincide con la de la instancia de referencia */
+	bool check(const SchedulerActor& ref) const { return _changes == ref._changes && _out == ref._out; }
+
+  private:
+	Blob::LightAction_t _actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler _sched;
+	Blob::LightTimeData_t _data;
+	std::atomic<uint32_t> _mailbox;
+	std::atomic<bool> _inside;
+	uint32_t _changes;
+	int8_t _out;
+	uint64_t _processed;
+	uint32_t _overlaps;
+};
+#endif
+
+
+//------------------------------------------------------------------------------------
+template<typename T> static bool runBench(const char* name, uint32_t actors, uint32_t msgs, uint32_t cores, uint32_t max_workers){
+	// referencia ejecutada sin el runtime
+	T* ref = new T();
+	for(uint32_t m=0;m<msgs;m++){
+		ref->post(NULL);
+	}
+	ref->run(msgs);
+	printf("%s\n", name);
+
+	double base = 0;
+	for(uint32_t workers = 1; workers <= max_workers; workers *= 2){
+		T* fleet = new T[actors];
+		HostRuntime* rt = new HostRuntime(workers);
+		auto t0 = std::chrono::steady_clock::now();
+		// cada ronda entrega un mensaje a cada actor, como un evento de difusión (ej: set/time)
+		for(uint32_t m=0;m<msgs;m++){
+			for(uint32_t a=0;a<actors;a++){
+				fleet[a].post(rt);
+			}
+		}
+		rt->waitIdle();
+		auto t1 = std::chrono::steady_clock::now();
+
+		uint64_t processed = 0;
+		uint32_t overlaps = 0, acc = 0, mismatches = 0;
+		for(uint32_t a=0;a<actors;a++){
+			processed += fleet[a].getProcessed();
+			overlaps += fleet[a].getOverlaps();
+			acc ^= fleet[a].getAcc();
+			mismatches += fleet[a].check(*ref)? 0 : 1;
+		}
+		double secs = std::chrono::duration<double>(t1 - t0).count();
+		double rate = processed / secs;
+		base = (workers == 1)? rate : base;
+		printf("hilos=%2u  msg/s=%10.0f  escalado=%5.2fx  ejecuciones=%llu  robos=%llu  solapes=%u  [%08x]%s\n",
+				workers, rate, rate / base, (unsigned long long)rt->getRuns(), (unsigned long long)rt->getSteals(), overlaps, acc,
+				(workers > cores)? "  (más hilos que núcleos)" : "");
+		delete(rt);
+		delete[](fleet);
+		if(processed != (uint64_t)actors * msgs || overlaps != 0 || mismatches != 0){
+			printf("ERROR: procesados=%llu esperados=%llu, discrepancias=%u\n", (unsigned long long)processed, (unsigned long long)actors * msgs, mismatches);
+			delete(ref);
+			return false;
+		}
+	}
+	delete(ref);
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char* argv[]){
+	uint32_t actors = (argc > 1)? atoi(argv[1]) : 20000;
+	uint32_t msgs = (argc > 2)? atoi(argv[2]) : 50;
+	uint32_t cores = std::thread::hardware_concurrency();
+	cores = (cores > 0)? cores : 1;
+	uint32_t max_workers = (argc > 3)? atoi(argv[3]) : cores;
+	printf("Actores=%u, mensajes/actor=%u, núcleos=%u, hilos máx=%u\n", actors, msgs, cores, max_workers);
+
+	if(!runBench<BenchActor>("Actores sintéticos", actors, msgs, cores, max_workers)){
+		return 1;
+	}
+#if defined(BENCH_SCHEDULER)
+	if(!runBench<SchedulerActor>("Instancias de Scheduler", actors, msgs, cores, max_workers)){
+		return 1;
+	}
+#endif
+	return 0;
+}
@@ -1,7 +1,7 @@
 /*
  * test_LightManager.cpp
  *
- *	Test unitario para el mdulo LightManager
+ *	Test unitario para el módulo LightManager
  */
 
 
@@ -12,6 +12,7 @@
 #include "unity.h"
 #include "LightManager.h"
 #include "JsonParserBlob.h"
+#include "LightManagerSchema.h"
 
 //------------------------------------------------------------------------------------
 //-- REQUIRED HEADERS & COMPONENTS FOR TESTING ---------------------------------------
@@ -28,6 +29,12 @@ static void subscriptionCb(const char* topic, void* msg, uint16_t msg_len);
 static void publishedCb(const char* topic, int32_t result);
 static void executePrerequisites();
 static bool s_test_done = false;
+static uint32_t s_wheel_fired[4];
+static uint32_t s_wheel_now = 0;
+static void wheelCb0(){ s_wheel_fired[0] = s_wheel_now; }
+static void wheelCb1(){ s_wheel_fired[1] = s_wheel_now; }
+static void wheelCb2(){ s_wheel_fired[2] = s_wheel_now; }
+static void wheelCb3(){ s_wheel_fired[3] = s_wheel_now; }
 
 
 //------------------------------------------------------------------------------------
@@ -46,7 +53,7 @@ static const char* _MODULE_ = "[TEST_Light]....";
 
 //---------------------------------------------------------------------------
 /**
- * @brief Se verifica la creacin del objeto y la suscripcin a topics
+ * @brief Se verifica la creación del objeto y la suscripción a topics
  * MQLib
  */
 TEST_CASE("Init & MQLib suscription..............", "[LightManager]") {
@@ -105,7 +112,7 @@ TEST_CASE("Test get/cfg/light [blob]......................", "[LightManager]"){
 	res = MQ::MQClient::subscribe("stat/cfg/light", new MQ::SubscribeCallback(&GetCfgLightCb));
 	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
 
-	// solicita la configuracin mediante un GetRequest
+	// solicita la configuración mediante un GetRequest
 	Blob::GetRequest_t greq;
 	greq.idTrans = 4;
 	greq._error.code = Blob::ErrOK;
@@ -138,8 +145,8 @@ TEST_CASE("Test get/cfg/light [blob]......................", "[LightManager]"){
 
 //---------------------------------------------------------------------------
 /**
- * @brief Se verifican las publicaciones y suscripciones JSON, para ello el mdulo
- * LightManager debe ser compilado con la opcin COMP_ENABLE_JSON_SUPPORT=1 o se debe
+ * @brief Se verifican las publicaciones y suscripciones JSON, para ello el módulo
+ * LightManager debe ser compilado con la opción COMP_ENABLE_JSON_SUPPORT=1 o se debe
  * activar dicha capacidad mediante LightManager::setJSONSupport(true)
  */
 TEST_CASE("JSON support .........................", "[LightManager]"){
@@ -170,7 +177,7 @@ TEST_CASE("JSON support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// solicita la configuracin mediante un GetRequest
+	// solicita la configuración mediante un GetRequest
 	Blob::GetRequest_t* greq = new Blob::GetRequest_t(1);
 	TEST_ASSERT_NOT_NULL(greq);
 	cJSON* jreq = JsonParser::getJsonFromObj(*greq);
@@ -197,7 +204,7 @@ TEST_CASE("JSON support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// solicita la configuracin mediante un GetRequest
+	// solicita la configuración mediante un GetRequest
 	greq = new Blob::GetRequest_t(2);
 	TEST_ASSERT_NOT_NULL(greq);
 	jreq = JsonParser::getJsonFromObj(*greq);
@@ -224,7 +231,7 @@ TEST_CASE("JSON support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// actualiza la configuracin mediante un SetRequest
+	// actualiza la configuración mediante un SetRequest
 	Blob::SetRequest_t<Blob::LightCfgData_t> req;
 	req.idTrans = 3;
 	req.data.updFlagMask=1;
@@ -237,19 +244,19 @@ TEST_CASE("JSON support .........................", "[LightManager]"){
 		req.data.outData.curve.data[i] = def_data[i];
 	}
 	req.data.outData.numActions=2;
-	req.data.outData.actions[0].id=0;							//!< Identificador de la accin
-	req.data.outData.actions[0].flags=524415;				//!< Flags de control de la accin a realizar
-	req.data.outData.actions[0].date=0;						//!< Fecha ddMM para activar la accin
-	req.data.outData.actions[0].time=1440; 						//!< Hora fija de activacin (min. da)
-	req.data.outData.actions[0].astCorr=0;						//!< Correccin sobre el hito astronmico en caso de estar habilitado
-	req.data.outData.actions[0].luxLevel={0,300,50};				//!< Nivel de luminosidad a partir de la cual se activar
+	req.data.outData.actions[0].id=0;							//!< Identificador de la acción
+	req.data.outData.actions[0].flags=524415;				//!< Flags de control de la acción a realizar
+	req.data.outData.actions[0].date=0;						//!< Fecha ddMM para activar la acción
+	req.data.outData.actions[0].time=1440; 						//!< Hora fija de activación (min. día)
+	req.data.outData.actions[0].astCorr=0;						//!< Corrección sobre el hito astronómico en caso de estar habilitado
+	req.data.outData.actions[0].luxLevel={0,300,50};				//!< Nivel de luminosidad a partir de la cual se activará
 	req.data.outData.actions[0].outValue=100;
-	req.data.outData.actions[1].id=0;							//!< Identificador de la accin
-	req.data.outData.actions[1].flags=524415;				//!< Flags de control de la accin a realizar
-	req.data.outData.actions[1].date=0;						//!< Fecha ddMM para activar la accin
-	req.data.outData.actions[1].time=1440; 						//!< Hora fija de activacin (min. da)
-	req.data.outData.actions[1].astCorr=0;						//!< Correccin sobre el hito astronmico en caso de estar habilitado
-	req.data.outData.actions[1].luxLevel={700,250000,50};				//!< Nivel de luminosidad a partir de la cual se activar
+	req.data.outData.actions[1].id=0;							//!< Identificador de la acción
+	req.data.outData.actions[1].flags=524415;				//!< Flags de control de la acción a realizar
+	req.data.outData.actions[1].date=0;						//!< Fecha ddMM para activar la acción
+	req.data.outData.actions[1].time=1440; 						//!< Hora fija de activación (min. día)
+	req.data.outData.actions[1].astCorr=0;						//!< Corrección sobre el hito astronómico en caso de estar habilitado
+	req.data.outData.actions[1].luxLevel={700,250000,50};				//!< Nivel de luminosidad a partir de la cual se activará
 	req.data.outData.actions[1].outValue=0;
 
 	jreq = JsonParser::getJsonFromSetRequest(req, JsonParser::p_data);
@@ -275,8 +282,8 @@ TEST_CASE("JSON support .........................", "[LightManager]"){
 
 //---------------------------------------------------------------------------
 /**
- * @brief Se verifican las publicaciones y suscripciones JSON, para ello el mdulo
- * LightManager debe ser compilado con la opcin ASTCAL_ENABLE_JSON_SUPPORT=1 o se debe
+ * @brief Se verifican las publicaciones y suscripciones JSON, para ello el módulo
+ * LightManager debe ser compilado con la opción ASTCAL_ENABLE_JSON_SUPPORT=1 o se debe
  * activar dicha capacidad mediante LightManager::setJSONSupport(true)
  */
 TEST_CASE("Blob support .........................", "[LightManager]"){
@@ -307,7 +314,7 @@ TEST_CASE("Blob support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// solicita la configuracin mediante un GetRequest
+	// solicita la configuración mediante un GetRequest
 	Blob::GetRequest_t greq;
 	greq.idTrans = 4;
 	greq._error.code = Blob::ErrOK;
@@ -330,7 +337,7 @@ TEST_CASE("Blob support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// solicita la configuracin mediante un GetRequest
+	// solicita la configuración mediante un GetRequest
 	greq.idTrans = 5;
 	greq._error.code = Blob::ErrOK;
 	greq._error.descr[0] = 0;
@@ -352,7 +359,7 @@ TEST_CASE("Blob support .........................", "[LightManager]"){
 	// borra flag de resultado
 	s_test_done = false;
 
-	// actualiza la configuracin mediante un SetRequest
+	// actualiza la configuración mediante un SetRequest
 	Blob::SetRequest_t<Blob::LightCfgData_t> sreq;
 	sreq.idTrans = 6;
 	sreq.keys = Blob::LightKeyCfgAll;
@@ -368,19 +375,19 @@ TEST_CASE("Blob support .........................", "[LightManager]"){
 		sreq.data.outData.curve.data[i] = def_data[i];
 	}
 	sreq.data.outData.numActions=2;
-	sreq.data.outData.actions[0].id=0;							//!< Identificador de la accin
-	sreq.data.outData.actions[0].flags=524415;				//!< Flags de control de la accin a realizar
-	sreq.data.outData.actions[0].date=0;						//!< Fecha ddMM para activar la accin
-	sreq.data.outData.actions[0].time=1440; 						//!< Hora fija de activacin (min. da)
-	sreq.data.outData.actions[0].astCorr=0;						//!< Correccin sobre el hito astronmico en caso de estar habilitado
-	sreq.data.outData.actions[0].luxLevel={0,300,50};				//!< Nivel de luminosidad a partir de la cual se activar
+	sreq.data.outData.actions[0].id=0;							//!< Identificador de la acción
+	sreq.data.outData.actions[0].flags=524415;				//!< Flags de control de la acción a realizar
+	sreq.data.outData.actions[0].date=0;						//!< Fecha ddMM para activar la acción
+	sreq.data.outData.actions[0].time=1440; 						//!< Hora fija de activación (min. día)
+	sreq.data.outData.actions[0].astCorr=0;						//!< Corrección sobre el hito astronómico en caso de estar habilitado
+	sreq.data.outData.actions[0].luxLevel={0,300,50};				//!< Nivel de luminosidad a partir de la cual se activará
 	sreq.data.outData.actions[0].outValue=100;
-	sreq.data.outData.actions[1].id=0;							//!< Identificador de la accin
-	sreq.data.outData.actions[1].flags=524415;				//!< Flags de control de la accin a realizar
-	sreq.data.outData.actions[1].date=0;						//!< Fecha ddMM para activar la accin
-	sreq.data.outData.actions[1].time=1440; 						//!< Hora fija de activacin (min. da)
-	sreq.data.outData.actions[1].astCorr=0;						//!< Correccin sobre el hito astronmico en caso de estar habilitado
-	sreq.data.outData.actions[1].luxLevel={700,250000,50};				//!< Nivel de luminosidad a partir de la cual se activar
+	sreq.data.outData.actions[1].id=0;							//!< Identificador de la acción
+	sreq.data.outData.actions[1].flags=524415;				//!< Flags de control de la acción a realizar
+	sreq.data.outData.actions[1].date=0;						//!< Fecha ddMM para activar la acción
+	sreq.data.outData.actions[1].time=1440; 						//!< Hora fija de activación (min. día)
+	sreq.data.outData.actions[1].astCorr=0;						//!< Corrección sobre el hito astronómico en caso de estar habilitado
+	sreq.data.outData.actions[1].luxLevel={700,250000,50};				//!< Nivel de luminosidad a partir de la cual se activará
 	sreq.data.outData.actions[1].outValue=0;
 
 	res = MQ::MQClient::publish("set/cfg/light", &sreq, sizeof(Blob::SetRequest_t<Blob::LightCfgData_t>), &s_published_cb);
@@ -396,6 +403,1983 @@ TEST_CASE("Blob support .........................", "[LightManager]"){
 	TEST_ASSERT_TRUE(s_test_done);
 }
 
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica la reproducción de una traza de mensajes "set/value" y la
+ * secuencia de valores notificados en "stat/value"
+ */
+TEST_CASE("Simulator trace replay ...............", "[LightManager]"){
+	static const uint8_t values[] = {0, 100, 40, 40, 0};
+	static const uint8_t expected[] = {0, 100, 40, 40, 0};
+	static Blob::SetRequest_t<light_manager> reqs[sizeof(values)];
+	static LightManager::SimEvent_t trace[sizeof(values)];
+	for(int i=0;i<sizeof(values);i++){
+		memset(&reqs[i], 0, sizeof(Blob::SetRequest_t<light_manager>));
+		reqs[i].idTrans = 100 + i;
+		reqs[i]._error.code = Blob::ErrOK;
+		reqs[i].data.stat.outValue = values[i];
+		trace[i] = {(uint32_t)(i * 1000), LightManager::SimValueSet, &reqs[i], sizeof(Blob::SetRequest_t<light_manager>)};
+	}
+
+	// reproduce la traza lo más rápido posible con el soporte JSON activo, que no debe verse alterado
+	light->setJSONSupport(true);
+	light->startSimulator(trace, sizeof(values), 0, expected, sizeof(expected));
+	LightManager::SimResult_t result;
+	double count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+		TEST_ASSERT_TRUE(light->isJSONSupported());
+		light->getSimulatorResult(result);
+	}while(!result.done && count < 10);
+	TEST_ASSERT_TRUE(result.done);
+	TEST_ASSERT_EQUAL(sizeof(values), result.injected);
+	TEST_ASSERT_EQUAL(sizeof(expected), result.notified);
+	TEST_ASSERT_EQUAL(0, result.mismatches);
+	TEST_ASSERT_TRUE(light->isJSONSupported());
+	light->setJSONSupport(false);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el backtest por eventos y el backtest minuto a minuto
+ * obtienen el mismo resultado sobre un año completo
+ */
+TEST_CASE("Scheduler backtest ...................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+
+	// encendido diario a las 20:00, reducción al 30% a la 01:00 y apagado los lunes a las 07:00
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 1200, 0, {0,0,0}, 100};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(Blob::LightActionMon | Blob::LightActionFixTime), 0, 420, 0, {0,0,0}, 0};
+	sched->setAction(2, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	time_t from = 1546300800;	// 01.01.2019 00:00 UTC
+	time_t to = from + (365 * 86400);
+
+	Scheduler::BacktestResult_t by_event, by_minute;
+	int32_t n_event = sched->backtest(from, to, data, 0, by_event, NULL, 0, Scheduler::BacktestByEvent);
+	int32_t n_minute = sched->backtest(from, to, data, 0, by_minute, NULL, 0, Scheduler::BacktestByMinute);
+	TEST_ASSERT_EQUAL(0, n_event);
+	TEST_ASSERT_EQUAL(0, n_minute);
+	TEST_ASSERT_EQUAL(by_minute.eventCount, by_event.eventCount);
+	TEST_ASSERT_EQUAL(by_minute.switchOnCount, by_event.switchOnCount);
+	TEST_ASSERT_EQUAL(by_minute.switchOffCount, by_event.switchOffCount);
+	TEST_ASSERT_EQUAL(by_minute.onSeconds, by_event.onSeconds);
+	TEST_ASSERT_TRUE(by_event.switchOffCount >= 52);
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Backtest: eventos=%d, encendidos=%d, horas=%d", by_event.eventCount, by_event.switchOnCount, by_event.onSeconds/3600);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el backtest obtiene la misma secuencia de cambios que
+ * la ejecución minuto a minuto de updateTimestamp, incluyendo acciones a hora
+ * fija sin días de la semana o fuera de su fecha fija, acciones desactivadas y
+ * acciones que coinciden en el mismo minuto
+ */
+TEST_CASE("Scheduler backtest vs timestamp ......", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// encendido 10 min antes del ocaso, apagado 15 min después del orto, 50% a las 23:00 con fecha fija 2 de
+	// enero, 20% a las 22:00 sin días de la semana, 80% los lunes a la hora del encendido (no se ejecuta por
+	// coincidir con éste), acción desactivada los fines de semana a las 03:00 que anula la del 10% de esa hora
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, 0, -10, {0,0,0}, 100};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionDawn), 0, 0, 15, {0,0,0}, 0};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionFixDate), (2 * 128) + 0, 1380, 0, {0,0,0}, 50};
+	sched->setAction(2, act);
+	act = {4, (Blob::LightActionFlags)(Blob::LightActionFixTime), 0, 1320, 0, {0,0,0}, 20};
+	sched->setAction(3, act);
+	act = {5, (Blob::LightActionFlags)(Blob::LightActionMon | Blob::LightActionFixTime), 0, 1070, 0, {0,0,0}, 80};
+	sched->setAction(4, act);
+	act = {6, (Blob::LightActionFlags)(Blob::LightActionSat | Blob::LightActionSun | Blob::LightActionFixTime), 0, 180, 0, {0,0,0}, -1};
+	sched->setAction(5, act);
+	act = {7, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 180, 0, {0,0,0}, 10};
+	sched->setAction(6, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	data.stat.dawn = 480;
+	data.stat.dusk = 1080;
+	time_t from = 1546300800;	// 01.01.2019 00:00 UTC
+	time_t to = from + (14 * 86400);
+
+	// la primera sincronización resuelve el valor inicial, a partir de ahí se registra cada cambio de la salida
+	data.stat.localtime = from;
+	int8_t init_value = sched->updateTimestamp(data);
+	TEST_ASSERT_EQUAL(50, init_value);
+	Scheduler::BacktestEvent_t expected[64];
+	uint32_t count = 0;
+	int8_t value = init_value;
+	for(time_t t = from + 60; t < to; t += 60){
+		data.stat.localtime = t;
+		int8_t result = sched->updateTimestamp(data);
+		if(result >= 0 && result != value){
+			TEST_ASSERT_TRUE(count < 64);
+			expected[count].time = t;
+			expected[count].outValue = result;
+			count++;
+			value = result;
+		}
+	}
+	TEST_ASSERT_TRUE(count > 28);
+
+	Scheduler::BacktestEvent_t events[64];
+	Scheduler::BacktestMode modes[] = {Scheduler::BacktestByEvent, Scheduler::BacktestByMinute};
+	for(int m=0;m<2;m++){
+		Scheduler::BacktestResult_t result;
+		data.stat.localtime = from;
+		TEST_ASSERT_EQUAL(count, sched->backtest(from + 60, to, data, init_value, result, events, 64, modes[m]));
+		for(uint32_t i=0;i<count;i++){
+			TEST_ASSERT_EQUAL(expected[i].time, events[i].time);
+			TEST_ASSERT_EQUAL(expected[i].outValue, events[i].outValue);
+		}
+		TEST_ASSERT_EQUAL(value, result.finalValue);
+	}
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que tras la primera sincronización o un salto horario se
+ * aplica la acción vigente sin esperar al siguiente hito
+ */
+TEST_CASE("Scheduler catch-up ...................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// encendido diario a las 20:00 y reducción al 30% a la 01:00
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 1200, 0, {0,0,0}, 100};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(1, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_isdst = -1;
+
+	// primera sincronización a las 00:30, la acción vigente es la de las 20:00 del día anterior
+	day.tm_min = 30;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(100, sched->updateTimestamp(data));
+
+	// actualización continua sin hito, no hay cambios
+	data.stat.localtime += 60;
+	TEST_ASSERT_EQUAL(-1, sched->updateTimestamp(data));
+
+	// salto a las 12:00, la acción vigente es la de la 01:00
+	day.tm_hour = 12;
+	day.tm_min = 0;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(30, sched->updateLocaltime(data.stat.localtime));
+
+	// retroceso a las 21:00 del día anterior
+	day.tm_mday = 1;
+	day.tm_hour = 21;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(100, sched->updateLocaltime(data.stat.localtime));
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la rueda de temporización vence cada temporizador en
+ * su tick, incluso tras redistribuirlo desde los niveles superiores, y que un
+ * temporizador cancelado no vence
+ */
+TEST_CASE("Timing wheel .........................", "[LightManager]"){
+	// tick de 1 minuto para que el timer del kernel no interfiera con el avance manual
+	TimingWheel* wheel = new TimingWheel(60000);
+	TEST_ASSERT_NOT_NULL(wheel);
+	TimingWheel::Timer_t t0(callback(wheelCb0)), t1(callback(wheelCb1)), t2(callback(wheelCb2)), t3(callback(wheelCb3));
+	memset(s_wheel_fired, 0, sizeof(s_wheel_fired));
+	s_wheel_now = 0;
+
+	wheel->start(t0, 60000 * 5);
+	wheel->start(t1, 60000 * 64);
+	wheel->start(t2, 60000 * 4100);
+	wheel->start(t3, 60000 * 10);
+	TEST_ASSERT_EQUAL(4, wheel->getCount());
+	wheel->cancel(t3);
+	TEST_ASSERT_FALSE(wheel->isArmed(t3));
+	TEST_ASSERT_EQUAL(3, wheel->getCount());
+
+	for(s_wheel_now = 1; s_wheel_now <= 5000; s_wheel_now++){
+		wheel->tick();
+	}
+	TEST_ASSERT_EQUAL(5, s_wheel_fired[0]);
+	TEST_ASSERT_EQUAL(64, s_wheel_fired[1]);
+	TEST_ASSERT_EQUAL(4100, s_wheel_fired[2]);
+	TEST_ASSERT_EQUAL(0, s_wheel_fired[3]);
+	TEST_ASSERT_EQUAL(0, wheel->getCount());
+	delete(wheel);
+}
+
+//------------------------------------------------------------------------------------------------------------------
+static volatile uint32_t s_wheel_phase = 0;
+static void wheelSlowCb(){
+	s_wheel_phase = 1;
+	Thread::wait(200);
+	s_wheel_phase = 2;
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la cancelación de un temporizador cuya callback está
+ * en ejecución espera a que ésta finalice
+ */
+TEST_CASE("Timing wheel cancel ..................", "[LightManager]"){
+	TimingWheel* wheel = new TimingWheel();
+	TEST_ASSERT_NOT_NULL(wheel);
+	TimingWheel::Timer_t t(callback(wheelSlowCb));
+	s_wheel_phase = 0;
+	wheel->start(t, 20);
+	double count = 0;
+	do{
+		Thread::wait(1);
+		count += 0.001;
+	}while(s_wheel_phase == 0 && count < 10);
+	TEST_ASSERT_EQUAL(1, s_wheel_phase);
+	wheel->cancel(t);
+	TEST_ASSERT_EQUAL(2, s_wheel_phase);
+	TEST_ASSERT_FALSE(wheel->isArmed(t));
+	delete(wheel);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el plan del día compilado aplica las correcciones
+ * astronómicas y de periodo con las mismas reglas que la ejecución
+ */
+TEST_CASE("Scheduler day plan ...................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// encendido 10 min antes del ocaso, apagado 15 min después del orto y reducción al 50% a las 23:00 del 2 de enero
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, 0, -10, {0,0,0}, 100};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionDawn), 0, 0, 15, {0,0,0}, 0};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionFixDate), (2 * 128) + 0, 1380, 0, {0,0,0}, 50};
+	sched->setAction(2, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	data.stat.dawn = 480;
+	data.stat.dusk = 1080;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_hour = 17;
+	day.tm_min = 50;
+	day.tm_isdst = -1;
+	const Blob::LightActionFlags filter = (Blob::LightActionFlags)(Blob::LightActionFixTime|Blob::LightActionDawn|Blob::LightActionDusk);
+
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(100, sched->updateTimestamp(data));
+	data.stat.localtime += 60;
+	TEST_ASSERT_EQUAL(-1, sched->updateTimestamp(data));
+	day.tm_hour = 23;
+	day.tm_min = 30;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(3, sched->findCurrAction(filter, data)->id);
+
+	// la fecha fija no restringe a las acciones a hora fija, que al día siguiente aplican igual que en la ejecución
+	day.tm_mday = 3;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(3, sched->findCurrAction(filter, data)->id);
+	day.tm_min = 0;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(50, sched->updateTimestamp(data));
+
+	// la corrección del periodo desplaza el orto
+	data.stat.period = 0;
+	data.cfg.geoloc.astCorr[0][0] = 5;
+	day.tm_hour = 8;
+	day.tm_min = 17;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_NULL(sched->findCurrAction(filter, data));
+	day.tm_min = 20;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(2, sched->findCurrAction(filter, data)->id);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las acciones a hora fija requieren algún día de la
+ * semana y no se filtran por periodo ni por fecha fija, tanto al ejecutarlas
+ * como al resolver la acción vigente
+ */
+TEST_CASE("Scheduler fixed time .................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// 10:00 sin días de la semana, 10:01 todos los días con fecha fija 1 de enero y sin máscara de periodo
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(Blob::LightActionFixTime), 0, 600, 0, {0,0,0}, 30};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionFixDate), (1 * 128) + 0, 601, 0, {0,0,0}, 40};
+	sched->setAction(1, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = 7;
+	data.stat.dawn = 480;
+	data.stat.dusk = 1080;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_hour = 9;
+	day.tm_min = 59;
+	day.tm_isdst = -1;
+
+	// la primera sincronización resuelve con las mismas reglas la acción vigente, que es la de las 10:01 del día
+	// anterior y no la de las 10:00 sin días de la semana. A partir de ahí sólo se ejecutan las que coinciden
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(40, sched->updateTimestamp(data));
+	data.stat.localtime += 60;
+	TEST_ASSERT_EQUAL(-1, sched->updateTimestamp(data));
+	data.stat.localtime += 60;
+	TEST_ASSERT_EQUAL(40, sched->updateTimestamp(data));
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que una acción asociada a un calendario sólo se ejecuta
+ * en sus días y que una acción excluida no se ejecuta en ellos
+ */
+TEST_CASE("Scheduler calendars ..................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// festivos: 1 y 6 de enero y del 1 al 15 de agosto
+	Blob::LightCalendar_t cal;
+	memset(&cal, 0, sizeof(Blob::LightCalendar_t));
+	strcpy(cal.name, "festivos");
+	uint16_t days[] = {Blob::getCalendarDay(0, 1), Blob::getCalendarDay(0, 6)};
+	for(int i=0;i<2;i++){
+		cal.days[days[i] >> 5] |= (1UL << (days[i] & 31));
+	}
+	for(int d=1;d<=15;d++){
+		uint16_t bit = Blob::getCalendarDay(7, d);
+		cal.days[bit >> 5] |= (1UL << (bit & 31));
+	}
+	TEST_ASSERT_EQUAL(0, sched->setCalendar(2, cal));
+	TEST_ASSERT_EQUAL(-1, sched->setCalendar(Blob::MaxCalendars, cal));
+
+	// encendido a las 18:00 los días laborables y a las 20:00 los festivos
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionCalendar | Blob::LightActionCalendarExcl), 2, 1080, 0, {0,0,0}, 100};
+	TEST_ASSERT_EQUAL(0, sched->setAction(0, act));
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionCalendar), 2, 1200, 0, {0,0,0}, 50};
+	TEST_ASSERT_EQUAL(0, sched->setAction(1, act));
+	act.date = Blob::MaxCalendars;
+	TEST_ASSERT_EQUAL(-1, sched->setAction(2, act));
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	const Blob::LightActionFlags filter = (Blob::LightActionFlags)(Blob::LightActionFixTime|Blob::LightActionDawn|Blob::LightActionDusk);
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 120;
+	day.tm_hour = 21;
+	day.tm_isdst = -1;
+	int mon[] = {0, 0, 7, 7};
+	int mday[] = {6, 7, 15, 16};
+	int8_t id[] = {2, 1, 2, 1};
+	for(int i=0;i<4;i++){
+		day.tm_mon = mon[i];
+		day.tm_mday = mday[i];
+		data.stat.localtime = mktime(&day);
+		TEST_ASSERT_EQUAL(id[i], sched->findCurrAction(filter, data)->id);
+	}
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la consulta de las próximas transiciones devuelve
+ * únicamente los cambios de la salida a partir de la hora actual
+ */
+TEST_CASE("Scheduler lookahead ..................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+	Scheduler::BacktestEvent_t events[4];
+	TEST_ASSERT_EQUAL(-1, sched->lookahead(0, events, 4));
+
+	// encendido diario a las 20:00, reducción al 30% a la 01:00 y de nuevo al 30% a las 02:00 (sin cambio)
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 1200, 0, {0,0,0}, 100};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 120, 0, {0,0,0}, 30};
+	sched->setAction(2, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_min = 30;
+	day.tm_isdst = -1;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(100, sched->updateTimestamp(data));
+
+	TEST_ASSERT_EQUAL(4, sched->lookahead(100, events, 4));
+	uint16_t minute[] = {60, 1200, 60, 1200};
+	uint8_t value[] = {30, 100, 30, 100};
+	for(int i=0;i<4;i++){
+		tm at;
+		localtime_r(&events[i].time, &at);
+		TEST_ASSERT_EQUAL(minute[i], at.tm_hour * 60 + at.tm_min);
+		TEST_ASSERT_EQUAL(value[i], events[i].outValue);
+	}
+	TEST_ASSERT_EQUAL(2, events[0].id);
+	tm at;
+	localtime_r(&events[2].time, &at);
+	TEST_ASSERT_EQUAL(3, at.tm_mday);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las próximas transiciones coinciden con la ejecución
+ * de updateTimestamp para las acciones a hora fija sin días de la semana o
+ * fuera de su fecha fija
+ */
+TEST_CASE("Scheduler lookahead fixed time .......", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// 10:00 sin días de la semana (nunca se ejecuta), 10:01 todos los días con fecha fija 1 de enero (se ejecuta
+	// cada día) y encendido diario a las 20:00
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(Blob::LightActionFixTime), 0, 600, 0, {0,0,0}, 70};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime | Blob::LightActionFixDate), (1 * 128) + 0, 601, 0, {0,0,0}, 40};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 1200, 0, {0,0,0}, 100};
+	sched->setAction(2, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_min = 30;
+	day.tm_isdst = -1;
+	data.stat.localtime = mktime(&day);
+	TEST_ASSERT_EQUAL(100, sched->updateTimestamp(data));
+
+	Scheduler::BacktestEvent_t events[4];
+	TEST_ASSERT_EQUAL(4, sched->lookahead(100, events, 4));
+	uint16_t minute[] = {601, 1200, 601, 1200};
+	uint8_t value[] = {40, 100, 40, 100};
+	for(int i=0;i<4;i++){
+		tm at;
+		localtime_r(&events[i].time, &at);
+		TEST_ASSERT_EQUAL(minute[i], at.tm_hour * 60 + at.tm_min);
+		TEST_ASSERT_EQUAL(value[i], events[i].outValue);
+	}
+
+	// la ejecución minuto a minuto produce los mismos cambios
+	uint32_t count = 0;
+	for(time_t t = data.stat.localtime + 60; count < 4; t += 60){
+		data.stat.localtime = t;
+		int8_t result = sched->updateTimestamp(data);
+		if(result >= 0){
+			TEST_ASSERT_EQUAL(events[count].time, t);
+			TEST_ASSERT_EQUAL(events[count].outValue, result);
+			count++;
+		}
+	}
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el retraso de cada acción programada se mide desde
+ * su instante previsto y se acumula en el histograma
+ */
+TEST_CASE("Scheduler latency ....................", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+	sched->setLateAlert(10000);
+
+	// reducción al 30% a la 01:00 y apagado a las 02:00
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 120, 0, {0,0,0}, 0};
+	sched->setAction(1, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_min = 30;
+	day.tm_isdst = -1;
+	data.stat.localtime = mktime(&day);
+
+	// la acción vigente resuelta en el arranque no se mide
+	sched->updateTimestamp(data);
+	TEST_ASSERT_EQUAL(-1, sched->recordApplied(0));
+
+	// hora local recibida 20s tarde y procesada tras 500ms en la cola
+	TEST_ASSERT_EQUAL(30, sched->updateLocaltime(data.stat.localtime + 30*60 + 20));
+	TEST_ASSERT_EQUAL(20500, sched->recordApplied(500));
+	TEST_ASSERT_EQUAL(-1, sched->recordApplied(500));
+	TEST_ASSERT_EQUAL(0, sched->updateLocaltime(data.stat.localtime + 90*60 + 3));
+	TEST_ASSERT_EQUAL(3000, sched->recordApplied(0));
+
+	const Blob::LightLatencyStats_t& stats = sched->getLatencyStats();
+	TEST_ASSERT_EQUAL(2, stats.count);
+	TEST_ASSERT_EQUAL(1, stats.late);
+	TEST_ASSERT_EQUAL(1, stats.bins[2]);
+	TEST_ASSERT_EQUAL(1, stats.bins[4]);
+	TEST_ASSERT_EQUAL(20500, stats.maxMs);
+	TEST_ASSERT_EQUAL(1, stats.maxId);
+	TEST_ASSERT_EQUAL(2, stats.lastId);
+	TEST_ASSERT_EQUAL(data.stat.localtime + 90*60, stats.lastIntended);
+	sched->clearLatencyStats();
+	TEST_ASSERT_EQUAL(0, sched->getLatencyStats().count);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las acciones cuyo instante queda atrás sin ejecutarse
+ * se registran como perdidas, incluso al cambiar de día, y que la acción
+ * aplicada tras un salto horario se mide desde su instante previsto
+ */
+TEST_CASE("Scheduler missed actions .............", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	sched->setSunCalcEnabled(false);
+
+	// encendido al 50% a las 00:00, reducción al 30% a la 01:00 y apagado a las 02:00
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(0, act);
+	act = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 120, 0, {0,0,0}, 0};
+	sched->setAction(1, act);
+	act = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 0, 0, {0,0,0}, 50};
+	sched->setAction(2, act);
+
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 0;
+	day.tm_mday = 2;
+	day.tm_isdst = -1;
+	time_t midnight = mktime(&day);
+
+	// arranque a las 00:58:30, la acción vigente no se mide
+	TEST_ASSERT_EQUAL(50, sched->updateLocaltime(midnight + 58*60 + 30));
+	TEST_ASSERT_EQUAL(-1, sched->recordApplied(0));
+	TEST_ASSERT_EQUAL(-1, sched->updateLocaltime(midnight + 59*60 + 30));
+	TEST_ASSERT_EQUAL(0, sched->takeMissed());
+
+	// la actualización de la 01:00 no llega y la siguiente ya no ejecuta la acción
+	TEST_ASSERT_EQUAL(-1, sched->updateLocaltime(midnight + 61*60 + 30));
+	TEST_ASSERT_EQUAL(1, sched->takeMissed());
+	TEST_ASSERT_EQUAL(0, sched->takeMissed());
+	TEST_ASSERT_EQUAL(1, sched->getLatencyStats().missed);
+
+	// tras un salto a las 02:30 se aplica la acción de las 02:00 con 30 minutos de retraso
+	TEST_ASSERT_EQUAL(0, sched->updateLocaltime(midnight + 150*60));
+	TEST_ASSERT_EQUAL(30*60*1000, sched->recordApplied(0));
+	TEST_ASSERT_EQUAL(1, sched->getLatencyStats().bins[Blob::LightLatencyBins - 1]);
+	TEST_ASSERT_EQUAL(midnight + 120*60, sched->getLatencyStats().lastIntended);
+	TEST_ASSERT_EQUAL(0, sched->takeMissed());
+
+	// la acción de las 00:00 del día siguiente queda atrás al cambiar de día
+	TEST_ASSERT_EQUAL(0, sched->updateLocaltime(midnight + 1439*60 + 30));
+	TEST_ASSERT_EQUAL(-1, sched->recordApplied(0));
+	TEST_ASSERT_EQUAL(-1, sched->updateLocaltime(midnight + 1441*60 + 30));
+	TEST_ASSERT_EQUAL(1, sched->takeMissed());
+	TEST_ASSERT_EQUAL(2, sched->getLatencyStats().missed);
+	TEST_ASSERT_EQUAL(1, sched->getLatencyStats().count);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las acciones grabadas con saveActionList se recuperan
+ * una a una con restoreAction (carga escalonada del arranque), incluidas las
+ * posiciones de dos cifras
+ */
+TEST_CASE("Scheduler action save & restore ......", "[LightManager]"){
+	executePrerequisites();
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, fs);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	uint8_t last = Blob::MaxAllowedActionDataInArray - 1;
+	Blob::LightAction_t act = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 60, 0, {0,0,0}, 30};
+	sched->setAction(0, act);
+	act = {(int8_t)(last + 1), (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, 0, -10, {0,0,0}, 100};
+	sched->setAction(last, act);
+	TEST_ASSERT_TRUE(sched->saveActionList());
+
+	Blob::LightAction_t restored[Blob::MaxAllowedActionDataInArray];
+	Scheduler* boot = new Scheduler(Blob::MaxAllowedActionDataInArray, restored, fs);
+	TEST_ASSERT_NOT_NULL(boot);
+	boot->clrActions();
+	for(uint8_t i=0;i<Blob::MaxAllowedActionDataInArray;i++){
+		TEST_ASSERT_TRUE(boot->restoreAction(i));
+	}
+	TEST_ASSERT_EQUAL(0, memcmp(actions, restored, sizeof(actions)));
+	TEST_ASSERT_EQUAL(2, boot->getActionCount());
+	TEST_ASSERT_FALSE(boot->restoreAction(Blob::MaxAllowedActionDataInArray));
+	delete(boot);
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el orto y el ocaso calculados se expresan en la zona
+ * horaria de la geolocalización, con su horario de verano, y que la tabla se
+ * recalcula al cambiarla
+ */
+TEST_CASE("Scheduler sun table timezone .........", "[LightManager]"){
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+
+	// Madrid el 15/01/2019 y el 21/06/2019 a las 12:00, en UTC y en hora peninsular (CET/CEST)
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.cfg.geoloc.coords[0] = 40.4168;
+	data.cfg.geoloc.coords[1] = -3.7038;
+	data.stat.period = -1;
+	time_t days[] = {1547553600, 1561118400};
+	int16_t shift[] = {60, 120};
+	for(int i=0;i<2;i++){
+		int16_t dawn_utc, dusk_utc, dawn, dusk;
+		data.stat.localtime = days[i];
+		strcpy(data.cfg.geoloc.timezone, "UTC0");
+		sched->updateTimestamp(data);
+		TEST_ASSERT_TRUE(sched->getSunTimes(days[i], dawn_utc, dusk_utc));
+		strcpy(data.cfg.geoloc.timezone, "CET-1CEST,M3.5.0,M10.5.0/3");
+		sched->updateTimestamp(data);
+		TEST_ASSERT_TRUE(sched->getSunTimes(days[i], dawn, dusk));
+		TEST_ASSERT_EQUAL(shift[i], dawn - dawn_utc);
+		TEST_ASSERT_EQUAL(shift[i], dusk - dusk_utc);
+	}
+	delete(sched);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la respuesta de estado se genera íntegramente en la
+ * arena JSON y que un documento que no cabe en ella (configuración) se completa
+ * desde el heap
+ */
+TEST_CASE("JSON arena ...........................", "[LightManager]"){
+	Blob::LightBootData_t* data = (Blob::LightBootData_t*)Heap::memAlloc(sizeof(Blob::LightBootData_t));
+	TEST_ASSERT_NOT_NULL(data);
+	memset(data, 0, sizeof(Blob::LightBootData_t));
+	data->cfg.outData.numActions = Blob::MaxAllowedActionDataInArray;
+	data->cfg.outData.curve.samples = Blob::LightCurveSampleCount;
+	data->stat.outValue = 50;
+	Blob::ErrorData_t err;
+	err.code = Blob::ErrOK;
+	strcpy(err.descr, Blob::errList[err.code]);
+	Blob::Response_t<Blob::LightBootData_t>* resp = new Blob::Response_t<Blob::LightBootData_t>(1, err, *data);
+	TEST_ASSERT_NOT_NULL(resp);
+
+	// respuesta de estado, cabe en la arena
+	uint32_t overflows = JsonArena::getOverflows();
+	JsonArena::begin();
+	cJSON* jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectState);
+	TEST_ASSERT_NOT_NULL(jresp);
+	JsonArena::close();
+	char* str = cJSON_PrintUnformatted(jresp);
+	TEST_ASSERT_NOT_NULL(str);
+	cJSON_Delete(jresp);
+	JsonArena::end();
+	TEST_ASSERT_EQUAL(overflows, JsonArena::getOverflows());
+	TEST_ASSERT_TRUE(JsonArena::getHighWater() > 0 && JsonArena::getHighWater() <= JsonArena::Size);
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Arena JSON: uso=%d de %d, trama=%d", JsonArena::getHighWater(), JsonArena::Size, strlen(str));
+	free(str);
+
+	// respuesta de configuración, desborda la arena y el resto de nodos se sirven desde el heap
+	JsonArena::begin();
+	jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
+	TEST_ASSERT_NOT_NULL(jresp);
+	JsonArena::close();
+	str = cJSON_PrintUnformatted(jresp);
+	TEST_ASSERT_NOT_NULL(str);
+	cJSON_Delete(jresp);
+	JsonArena::end();
+	TEST_ASSERT_TRUE(JsonArena::getOverflows() > overflows);
+	free(str);
+
+	// fuera de la arena, los documentos se sirven desde el heap sin afectar a sus estadísticas
+	overflows = JsonArena::getOverflows();
+	jresp = JsonParser::getJsonFromResponse(*resp, ObjSelectCfg);
+	TEST_ASSERT_NOT_NULL(jresp);
+	cJSON_Delete(jresp);
+	TEST_ASSERT_EQUAL(overflows, JsonArena::getOverflows());
+	delete(resp);
+	Heap::memFree(data);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las trazas diferidas conservan sus argumentos y que,
+ * al desbordar el buffer, se pierden las más antiguas
+ */
+TEST_CASE("Deferred log .........................", "[LightManager]"){
+	// registro dedicado, sin el consumidor del hilo de LightManager que presenta el registro compartido
+	DeferredLog* log = new DeferredLog();
+	TEST_ASSERT_NOT_NULL(log);
+	for(uint32_t i=0;i<DeferredLog::RingSize + 4;i++){
+		log->write(ESP_LOG_DEBUG, _MODULE_, "Traza diferida %d de %d", i, DeferredLog::RingSize + 4);
+	}
+	DeferredLog::Record_t rec;
+	TEST_ASSERT_TRUE(log->read(rec));
+	TEST_ASSERT_EQUAL(4, rec.args[0]);
+	TEST_ASSERT_EQUAL(2, rec.nargs);
+	TEST_ASSERT_EQUAL(4, log->getLost());
+	TEST_ASSERT_EQUAL(DeferredLog::RingSize - 1, log->flush());
+	TEST_ASSERT_FALSE(log->read(rec));
+	delete(log);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que los drivers de salida sólo escriben los canales
+ * modificados y que un cambio común a todos los equipos DALI se envía en una
+ * única trama de grupo
+ */
+static uint8_t s_dali_frames[8][2];
+static uint32_t s_dali_count = 0;
+static void daliTx(uint8_t addr, uint8_t arc){
+	s_dali_frames[s_dali_count % 8][0] = addr;
+	s_dali_frames[s_dali_count % 8][1] = arc;
+	s_dali_count++;
+}
+
+TEST_CASE("Output drivers .......................", "[LightManager]"){
+	LightOutRecordDriver rec(Blob::LightOutPwm, 4);
+	TEST_ASSERT_TRUE(rec.isSelected(Blob::LightOutRelayNA | Blob::LightOutPwm));
+	TEST_ASSERT_FALSE(rec.isSelected(Blob::LightOutDali));
+	rec.invalidate();
+	rec.setLevel(50);
+	TEST_ASSERT_EQUAL(4, rec.flush());
+	rec.setLevel(50);
+	TEST_ASSERT_EQUAL(0, rec.flush());
+	rec.setLevel(2, 70);
+	TEST_ASSERT_EQUAL(1, rec.flush());
+	TEST_ASSERT_EQUAL(2, rec.getCount());
+	TEST_ASSERT_EQUAL(0x4, rec.getRecord(1).dirty);
+	TEST_ASSERT_EQUAL(70, rec.getRecord(1).levels[2]);
+	TEST_ASSERT_EQUAL(1, rec.getSkipped());
+
+	s_dali_count = 0;
+	LightOutDaliDriver dali(callback(daliTx), 4, 10, 3);
+	dali.invalidate();
+	dali.setLevel(100);
+	dali.flush();
+	TEST_ASSERT_EQUAL(1, s_dali_count);
+	TEST_ASSERT_EQUAL(0x80 | (3 << 1), s_dali_frames[0][0]);
+	TEST_ASSERT_EQUAL(254, s_dali_frames[0][1]);
+	dali.setLevel(100);
+	dali.setLevel(1, 0);
+	dali.flush();
+	TEST_ASSERT_EQUAL(2, s_dali_count);
+	TEST_ASSERT_EQUAL(11 << 1, s_dali_frames[1][0]);
+	TEST_ASSERT_EQUAL(0, s_dali_frames[1][1]);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que el límite de potencia se reparte por prioridades y
+ * que sólo se avisa a los miembros de las prioridades cuyo factor cambia
+ */
+static uint32_t s_budget_notif[3];
+static void budgetCb0(){ s_budget_notif[0]++; }
+static void budgetCb1(){ s_budget_notif[1]++; }
+static void budgetCb2(){ s_budget_notif[2]++; }
+
+TEST_CASE("Power budget .........................", "[LightManager]"){
+	LightPowerBudget budget;
+	LightPowerBudget::Member_t m0, m1, m2;
+	memset(s_budget_notif, 0, sizeof(s_budget_notif));
+	budget.attach(m0, 0, callback(budgetCb0));
+	budget.attach(m1, 1, callback(budgetCb1));
+	budget.attach(m2, 2, callback(budgetCb2));
+
+	// 60W + 60W + 30W sin límite
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.update(m0, 6000));
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.update(m1, 6000));
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.update(m2, 3000));
+	TEST_ASSERT_EQUAL(15000, budget.getDemand());
+	TEST_ASSERT_EQUAL(0, budget.getNotifications());
+
+	// límite de 100W: la prioridad 1 recibe los 40W restantes y la 2 queda a 0
+	budget.setCap(100);
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.getFactor(0));
+	TEST_ASSERT_EQUAL(666, budget.getFactor(1));
+	TEST_ASSERT_EQUAL(0, budget.getFactor(2));
+	TEST_ASSERT_EQUAL(0, s_budget_notif[0]);
+	TEST_ASSERT_EQUAL(1, s_budget_notif[1]);
+	TEST_ASSERT_EQUAL(1, s_budget_notif[2]);
+
+	// el miembro que provoca el cambio recibe el factor como resultado, sin aviso
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.update(m2, 0));
+	TEST_ASSERT_EQUAL(1, s_budget_notif[2]);
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.update(m0, 2000));
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.getFactor(1));
+	TEST_ASSERT_EQUAL(2, s_budget_notif[1]);
+
+	// sin cambios de factor no hay avisos
+	budget.setCap(0);
+	budget.detach(m1);
+	TEST_ASSERT_EQUAL(2000, budget.getDemand());
+	TEST_ASSERT_EQUAL(3, budget.getNotifications());
+	budget.detach(m0);
+	budget.detach(m2);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las callbacks del servicio de potencia se invocan
+ * fuera del recorrido de los miembros, de forma que un miembro puede darse de
+ * baja desde su propia callback sin que el resto de su prioridad pierda el aviso
+ */
+static LightPowerBudget* s_reent_budget;
+static LightPowerBudget::Member_t* s_reent_member;
+static uint32_t s_reent_notif[2];
+static void reentCbA(){ s_reent_notif[0]++; }
+static void reentCbB(){ s_reent_notif[1]++; s_reent_budget->detach(*s_reent_member); }
+
+TEST_CASE("Power budget reentrant callbacks .....", "[LightManager]"){
+	LightPowerBudget budget;
+	LightPowerBudget::Member_t m0, mA, mB;
+	memset(s_reent_notif, 0, sizeof(s_reent_notif));
+	s_reent_budget = &budget;
+	s_reent_member = &mB;
+	budget.attach(m0, 0, callback(budgetCb0));
+	budget.attach(mA, 1, callback(reentCbA));
+	budget.attach(mB, 1, callback(reentCbB));
+	budget.update(m0, 6000);
+	budget.update(mA, 3000);
+	budget.update(mB, 3000);
+
+	// al limitar a 100W se avisa a los dos miembros de la prioridad 1. La baja de B libera potencia y genera un
+	// segundo aviso a A con el factor restablecido
+	budget.setCap(100);
+	TEST_ASSERT_EQUAL(1, s_reent_notif[1]);
+	TEST_ASSERT_EQUAL(2, s_reent_notif[0]);
+	TEST_ASSERT_EQUAL(LightPowerBudget::FactorMax, budget.getFactor(1));
+	TEST_ASSERT_EQUAL(9000, budget.getDemand());
+	budget.detach(mA);
+	budget.detach(m0);
+}
+
+
+//------------------------------------------------------------------------------------
+static volatile uint32_t s_inflight_phase = 0;
+static void inflightSlowCb(){
+	s_inflight_phase = 1;
+	Thread::wait(200);
+	s_inflight_phase = 2;
+}
+static void inflightCapCb(){ s_reent_budget->setCap(100); }
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la baja de un miembro cuya callback está en ejecución
+ * en otro hilo espera a que ésta finalice
+ */
+TEST_CASE("Power budget detach in flight ........", "[LightManager]"){
+	LightPowerBudget budget;
+	LightPowerBudget::Member_t m0, m1;
+	s_reent_budget = &budget;
+	s_inflight_phase = 0;
+	budget.attach(m0, 0, callback(budgetCb0));
+	budget.attach(m1, 1, callback(inflightSlowCb));
+	budget.update(m0, 6000);
+	budget.update(m1, 6000);
+
+	// el límite se aplica desde el hilo de la rueda de temporización, que invoca la callback lenta de m1
+	TimingWheel* wheel = new TimingWheel();
+	TEST_ASSERT_NOT_NULL(wheel);
+	TimingWheel::Timer_t t(callback(inflightCapCb));
+	wheel->start(t, 20);
+	double count = 0;
+	do{
+		Thread::wait(1);
+		count += 0.001;
+	}while(s_inflight_phase == 0 && count < 10);
+	TEST_ASSERT_EQUAL(1, s_inflight_phase);
+	budget.detach(m1);
+	TEST_ASSERT_EQUAL(2, s_inflight_phase);
+	wheel->cancel(t);
+	delete(wheel);
+	budget.detach(m0);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica la integración de los contadores de uso: tiempo activo,
+ * integral del nivel, energía estimada en mJ, número de encendidos y la
+ * limitación de la grabación a un registro por hora
+ */
+TEST_CASE("Meter integrator .....................", "[LightManager]"){
+	LightManager::LightMeter_t m;
+	memset(&m, 0, sizeof(LightManager::LightMeter_t));
+	m.cfg.ratedPower = 100;
+
+	// la primera llamada sólo inicia la integración
+	TEST_ASSERT_FALSE(LightManager::meterAccumulate(m, 1000));
+	TEST_ASSERT_EQUAL(0, (uint32_t)m.data.onMs);
+
+	// encendido al 40% con un 50% de potencia durante 2s: 100W x 50% x 2s = 100J
+	LightManager::meterSetOutput(m, 40, 50);
+	TEST_ASSERT_EQUAL(1, m.data.switchCount);
+	TEST_ASSERT_FALSE(LightManager::meterAccumulate(m, 3000));
+	TEST_ASSERT_EQUAL(2000, (uint32_t)m.data.onMs);
+	TEST_ASSERT_EQUAL(80000, (uint32_t)m.data.levelMs);
+	TEST_ASSERT_EQUAL(100000, (uint32_t)m.data.energyMj);
+
+	// un cambio de nivel sin pasar por off no cuenta como encendido
+	LightManager::meterSetOutput(m, 80, 100);
+	TEST_ASSERT_EQUAL(1, m.data.switchCount);
+	TEST_ASSERT_FALSE(LightManager::meterAccumulate(m, 4000));
+	TEST_ASSERT_EQUAL(3000, (uint32_t)m.data.onMs);
+	TEST_ASSERT_EQUAL(160000, (uint32_t)m.data.levelMs);
+	TEST_ASSERT_EQUAL(200000, (uint32_t)m.data.energyMj);
+
+	// con la salida apagada no se acumula nada
+	LightManager::meterSetOutput(m, 0, 0);
+	TEST_ASSERT_FALSE(LightManager::meterAccumulate(m, 10000));
+	TEST_ASSERT_EQUAL(3000, (uint32_t)m.data.onMs);
+	TEST_ASSERT_EQUAL(160000, (uint32_t)m.data.levelMs);
+	TEST_ASSERT_EQUAL(200000, (uint32_t)m.data.energyMj);
+	LightManager::meterSetOutput(m, 10, 10);
+	TEST_ASSERT_EQUAL(2, m.data.switchCount);
+
+	// la grabación se solicita una vez transcurrida una hora desde la última
+	TEST_ASSERT_FALSE(LightManager::meterAccumulate(m, 1000 + LightManager::MeterSavePeriodMs - 1));
+	TEST_ASSERT_TRUE(LightManager::meterAccumulate(m, 1000 + LightManager::MeterSavePeriodMs));
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que un evento temporal codificado en CBOR se decodifica
+ * correctamente con todos los datos del calendario (las coordenadas se
+ * transmiten en millonésimas de grado)
+ */
+TEST_CASE("CBOR codec ...........................", "[LightManager]"){
+	Blob::LightTimeData_t src, dst;
+	memset(&src, 0, sizeof(Blob::LightTimeData_t));
+	memset(&dst, 0, sizeof(Blob::LightTimeData_t));
+	src.stat.localtime = 1546300800;
+	src.stat.period = 2;
+	src.stat.dawn = 480;
+	src.stat.dusk = 1080;
+	src.stat.flags = 0x21;
+	src.cfg.updFlagMask = 3;
+	src.cfg.evtFlagMask = 7;
+	strcpy(src.cfg.geoloc.timezone, "GMT-1GMT-2,M3.5.0/2,M10.5.0");
+	src.cfg.geoloc.coords[0] = 40.416;
+	src.cfg.geoloc.coords[1] = -3.703;
+	src.cfg.geoloc.astCorr[2][0] = -15;
+	src.cfg.geoloc.astCorr[2][1] = 20;
+
+	uint8_t* buf = (uint8_t*)Heap::memAlloc(CBOR::LightCborMaxSize);
+	TEST_ASSERT_NOT_NULL(buf);
+	int32_t len = CBOR::getCborFromLightTime(src, buf, CBOR::LightCborMaxSize);
+	TEST_ASSERT_TRUE(len > 0);
+	TEST_ASSERT_TRUE(CBOR::getLightTimeFromCbor(dst, buf, len) != 0);
+	TEST_ASSERT_EQUAL(src.stat.localtime, dst.stat.localtime);
+	TEST_ASSERT_EQUAL(src.stat.period, dst.stat.period);
+	TEST_ASSERT_EQUAL(src.stat.dawn, dst.stat.dawn);
+	TEST_ASSERT_EQUAL(src.stat.dusk, dst.stat.dusk);
+	TEST_ASSERT_DOUBLE_WITHIN(0.000001, src.cfg.geoloc.coords[0], dst.cfg.geoloc.coords[0]);
+	TEST_ASSERT_DOUBLE_WITHIN(0.000001, src.cfg.geoloc.coords[1], dst.cfg.geoloc.coords[1]);
+	TEST_ASSERT_EQUAL(src.stat.flags, dst.stat.flags);
+	TEST_ASSERT_EQUAL(src.cfg.updFlagMask, dst.cfg.updFlagMask);
+	TEST_ASSERT_EQUAL(src.cfg.evtFlagMask, dst.cfg.evtFlagMask);
+	TEST_ASSERT_EQUAL(0, strcmp(src.cfg.geoloc.timezone, dst.cfg.geoloc.timezone));
+	TEST_ASSERT_EQUAL(0, memcmp(src.cfg.geoloc.astCorr, dst.cfg.geoloc.astCorr, sizeof(src.cfg.geoloc.astCorr)));
+	Heap::memFree(buf);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que una respuesta CBOR con la configuración, las acciones
+ * y el estado se decodifica como la solicitud SET equivalente, y que la curva se
+ * limita al número de muestras admitido
+ */
+TEST_CASE("CBOR cfg round trip ..................", "[LightManager]"){
+	Blob::LightBootData_t* src = (Blob::LightBootData_t*)Heap::memAlloc(sizeof(Blob::LightBootData_t));
+	Blob::SetRequest_t<light_manager>* dst = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
+	uint8_t* buf = (uint8_t*)Heap::memAlloc(CBOR::LightCborMaxSize);
+	TEST_ASSERT_NOT_NULL(src);
+	TEST_ASSERT_NOT_NULL(dst);
+	TEST_ASSERT_NOT_NULL(buf);
+	memset(src, 0, sizeof(Blob::LightBootData_t));
+	memset(dst, 0, sizeof(Blob::SetRequest_t<light_manager>));
+	src->uid = 0x1234;
+	src->cfg.updFlagMask = (Blob::LightUpdFlags)1;
+	src->cfg.evtFlagMask = (Blob::LightEvtFlags)6;
+	src->cfg.verbosity = ESP_LOG_WARN;
+	src->cfg.alsData.lux = {100, 2000, 25};
+	src->cfg.outData.mode = Blob::LightOut010;
+	for(int i=0;i<Blob::LightCurveSampleCount;i++){
+		src->cfg.outData.curve.data[i] = -50 + i;
+	}
+	// un número de muestras fuera de rango se codifica limitado
+	src->cfg.outData.curve.samples = Blob::LightCurveSampleCount + 10;
+	src->cfg.outData.numActions = Blob::MaxAllowedActionDataInArray;
+	for(int i=0;i<Blob::MaxAllowedActionDataInArray;i++){
+		src->cfg.outData.actions[i] = {(int8_t)i, (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, (uint16_t)(i * 60), (int8_t)(-i), {(uint32_t)i, (uint32_t)(1000 + i), 5}, (int8_t)(i * 5)};
+	}
+	src->stat.flags = 0x3;
+	src->stat.outValue = 55;
+
+	Blob::ErrorData_t err;
+	err.code = Blob::ErrOK;
+	int32_t len = CBOR::getCborFromLightResponse(9, err, *src, ObjSelectAll, buf, CBOR::LightCborMaxSize);
+	TEST_ASSERT_TRUE(len > 0);
+	TEST_ASSERT_TRUE(CBOR::getLightSetRequestFromCbor(*dst, buf, len) != 0);
+	TEST_ASSERT_EQUAL(9, dst->idTrans);
+	TEST_ASSERT_EQUAL(src->uid, dst->data.uid);
+	TEST_ASSERT_EQUAL(Blob::LightKeyCfgAll, dst->data.cfg._keys);
+	TEST_ASSERT_EQUAL(src->cfg.updFlagMask, dst->data.cfg.updFlagMask);
+	TEST_ASSERT_EQUAL(src->cfg.evtFlagMask, dst->data.cfg.evtFlagMask);
+	TEST_ASSERT_EQUAL(src->cfg.verbosity, dst->data.cfg.verbosity);
+	TEST_ASSERT_EQUAL(0, memcmp(&src->cfg.alsData, &dst->data.cfg.alsData, sizeof(Blob::LightAlsData_t)));
+	TEST_ASSERT_EQUAL(src->cfg.outData.mode, dst->data.cfg.outData.mode);
+	TEST_ASSERT_EQUAL(Blob::LightCurveSampleCount, dst->data.cfg.outData.curve.samples);
+	TEST_ASSERT_EQUAL(0, memcmp(src->cfg.outData.curve.data, dst->data.cfg.outData.curve.data, Blob::LightCurveSampleCount));
+	TEST_ASSERT_EQUAL(src->cfg.outData.numActions, dst->data.cfg.outData.numActions);
+	TEST_ASSERT_EQUAL(0, memcmp(src->cfg.outData.actions, dst->data.cfg.outData.actions, sizeof(src->cfg.outData.actions)));
+	TEST_ASSERT_EQUAL(src->stat.flags, dst->data.stat.flags);
+	TEST_ASSERT_EQUAL(src->stat.outValue, dst->data.stat.outValue);
+
+	// el estado se codifica en el buffer reducido de las respuestas de estado
+	len = CBOR::getCborFromLightResponse(0xFFFFFFFF, err, *src, ObjSelectState, buf, CBOR::LightCborStatMaxSize);
+	TEST_ASSERT_TRUE(len > 0);
+
+	Heap::memFree(buf);
+	Heap::memFree(dst);
+	Heap::memFree(src);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las tramas CBOR truncadas, con longitudes indefinidas,
+ * con textos que exceden la trama o con anidamientos excesivos se rechazan
+ */
+TEST_CASE("CBOR malformed input .................", "[LightManager]"){
+	Blob::GetRequest_t req;
+	Blob::LightTimeData_t t;
+	memset(&t, 0, sizeof(Blob::LightTimeData_t));
+
+	// {0: 5} es correcta, truncada no
+	const uint8_t ok[] = {0xA1, 0x00, 0x05};
+	TEST_ASSERT_TRUE(CBOR::getGetRequestFromCbor(req, ok, sizeof(ok)) != 0);
+	TEST_ASSERT_EQUAL(0, CBOR::getGetRequestFromCbor(req, ok, sizeof(ok) - 1));
+
+	// mapa de longitud indefinida
+	const uint8_t indef[] = {0xBF, 0x00, 0x05, 0xFF};
+	TEST_ASSERT_EQUAL(0, CBOR::getGetRequestFromCbor(req, indef, sizeof(indef)));
+
+	// clave desconocida con un texto cuya longitud excede la trama
+	const uint8_t text[] = {0xA2, 0x18, 0x40, 0x7B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0, 0x00, 0x05};
+	TEST_ASSERT_EQUAL(0, CBOR::getGetRequestFromCbor(req, text, sizeof(text)));
+
+	// clave desconocida con arrays anidados más allá del límite
+	uint8_t deep[64];
+	uint32_t n = 0;
+	deep[n++] = 0xA2;
+	deep[n++] = 0x18;
+	deep[n++] = 0x40;
+	for(int i=0;i<32;i++){
+		deep[n++] = 0x81;
+	}
+	deep[n++] = 0x00;
+	deep[n++] = 0x00;
+	deep[n++] = 0x05;
+	TEST_ASSERT_EQUAL(0, CBOR::getGetRequestFromCbor(req, deep, n));
+
+	// zona horaria que no cabe en el destino
+	uint8_t tz[8 + sizeof(t.cfg.geoloc.timezone)];
+	n = 0;
+	tz[n++] = 0xA1;
+	tz[n++] = 0x18;
+	tz[n++] = CBOR::CborKeyTimezone;
+	tz[n++] = 0x78;
+	tz[n++] = sizeof(t.cfg.geoloc.timezone);
+	for(int i=0;i<sizeof(t.cfg.geoloc.timezone);i++){
+		tz[n++] = 'A';
+	}
+	TEST_ASSERT_EQUAL(0, CBOR::getLightTimeFromCbor(t, tz, n));
+
+	// curva con más muestras de las admitidas
+	const uint8_t curve[] = {0xA1, 0x02, 0xA1, 0x08, 0xA1, 0x11, 0xA1, 0x13, 0x98, 0xFF};
+	Blob::SetRequest_t<light_manager>* sreq = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
+	TEST_ASSERT_NOT_NULL(sreq);
+	memset(sreq, 0, sizeof(Blob::SetRequest_t<light_manager>));
+	TEST_ASSERT_EQUAL(0, CBOR::getLightSetRequestFromCbor(*sreq, curve, sizeof(curve)));
+	Heap::memFree(sreq);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que las secciones, los límites y el codec JSON generados
+ * a partir de LightManagerSchema se corresponden con la configuración
+ */
+TEST_CASE("Config schema ........................", "[LightManager]"){
+	Blob::LightCfgData_t src, dst;
+	memset(&src, 0, sizeof(Blob::LightCfgData_t));
+	memset(&dst, 0, sizeof(Blob::LightCfgData_t));
+	src.updFlagMask = (Blob::LightUpdFlags)3;
+	src.evtFlagMask = (Blob::LightEvtFlags)5;
+	src.verbosity = ESP_LOG_DEBUG;
+	src.alsData.lux.min = 10;
+	src.alsData.lux.max = 500;
+	src.alsData.lux.thres = 5;
+	src.outData.mode = Blob::LightOutRelayNA;
+	src.outData.curve.samples = 3;
+	src.outData.curve.data[0] = 0;
+	src.outData.curve.data[1] = -50;
+	src.outData.curve.data[2] = 100;
+	src.outData.numActions = 2;
+	for(int i=0;i<2;i++){
+		src.outData.actions[i].id = i;
+		src.outData.actions[i].time = 600 + i;
+		src.outData.actions[i].outValue = 50 * i;
+		src.outData.actions[i].luxLevel.max = 100 + i;
+	}
+
+	// tamaño de las secciones, las acciones no admiten actualización compacta
+	TEST_ASSERT_EQUAL(sizeof(Blob::LightCurve_t), Schema::getSectionSize(src, Blob::LightKeyCfgCurve));
+	TEST_ASSERT_EQUAL(sizeof(Blob::LightAlsData_t), Schema::getSectionSize(src, Blob::LightKeyCfgAls));
+	TEST_ASSERT_EQUAL(0, Schema::getSectionSize(src, Blob::LightKeyCfgActs));
+	TEST_ASSERT_EQUAL(0, Schema::getSectionSize(src, 0));
+
+	// una curva con más muestras de las admitidas se rechaza sin modificar la configuración
+	Blob::LightCurve_t curve = src.outData.curve;
+	curve.samples = Blob::LightCurveSampleCount + 1;
+	TEST_ASSERT_FALSE(Schema::setSection(dst, Blob::LightKeyCfgCurve, &curve));
+	TEST_ASSERT_EQUAL(0, dst.outData.curve.samples);
+	TEST_ASSERT_TRUE(Schema::setSection(dst, Blob::LightKeyCfgCurve, &src.outData.curve));
+	TEST_ASSERT_EQUAL(0, memcmp(&dst.outData.curve, &src.outData.curve, sizeof(Blob::LightCurve_t)));
+
+	// sólo se copian las secciones indicadas
+	memset(&dst, 0, sizeof(Blob::LightCfgData_t));
+	Schema::copyKeys(dst, src, Blob::LightKeyCfgOutm | Blob::LightKeyCfgAls);
+	TEST_ASSERT_EQUAL(src.outData.mode, dst.outData.mode);
+	TEST_ASSERT_EQUAL(src.alsData.lux.max, dst.alsData.lux.max);
+	TEST_ASSERT_EQUAL(0, dst.updFlagMask);
+	TEST_ASSERT_EQUAL(0, dst.outData.curve.samples);
+
+	// codificación y decodificación JSON completa
+	memset(&dst, 0, sizeof(Blob::LightCfgData_t));
+	cJSON* json = JSON::getJsonFromLightCfg(src);
+	TEST_ASSERT_NOT_NULL(json);
+	TEST_ASSERT_EQUAL(Blob::LightKeyCfgAll, JSON::getLightCfgFromJson(dst, json));
+	cJSON_Delete(json);
+	TEST_ASSERT_EQUAL(src.updFlagMask, dst.updFlagMask);
+	TEST_ASSERT_EQUAL(src.evtFlagMask, dst.evtFlagMask);
+	TEST_ASSERT_EQUAL(src.verbosity, dst.verbosity);
+	TEST_ASSERT_EQUAL(0, memcmp(&dst.alsData, &src.alsData, sizeof(Blob::LightAlsData_t)));
+	TEST_ASSERT_EQUAL(0, memcmp(&dst.outData, &src.outData, sizeof(Blob::LightOutData_t)));
+}
+
+//------------------------------------------------------------------------------------------------------------------
+static Blob::LightSlimResponse_t s_slim_resp;
+static uint16_t s_slim_len = 0;
+static volatile bool s_slim_done = false;
+static void SlimRespCb(const char* topic, void* msg, uint16_t msg_len){
+	DEBUG_TRACE_I(_EXPR_, _MODULE_, "Recibido mensaje en topic %s", topic);
+	s_slim_len = msg_len;
+	if(msg_len == sizeof(Blob::LightSlimResponse_t)){
+		s_slim_resp = *((Blob::LightSlimResponse_t*)msg);
+	}
+	s_slim_done = true;
+}
+static bool waitSlimResponse(){
+	double count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+	}while(!s_slim_done && count < 10);
+	return (s_slim_done && s_slim_len == sizeof(Blob::LightSlimResponse_t));
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifican las solicitudes compactas de cambio de nivel, de
+ * actualización de una sección de la configuración y de alta de una acción,
+ * así como el contenido de sus respuestas compactas
+ */
+TEST_CASE("Slim requests ........................", "[LightManager]"){
+	light->setJSONSupport(false);
+	light->setCBORSupport(false);
+
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/level/light", new MQ::SubscribeCallback(&SlimRespCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	res = MQ::MQClient::subscribe("stat/section/light", new MQ::SubscribeCallback(&SlimRespCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	res = MQ::MQClient::subscribe("stat/action/light", new MQ::SubscribeCallback(&SlimRespCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	// -----------------------------------------------
+	// cambio de nivel, la respuesta incluye el nuevo estado
+	s_slim_done = false;
+	Blob::LightLevelRequest_t lreq = {7, 40};
+	res = MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitSlimResponse());
+	TEST_ASSERT_EQUAL(7, s_slim_resp.idTrans);
+	TEST_ASSERT_EQUAL(Blob::ErrOK, s_slim_resp.code);
+	TEST_ASSERT_EQUAL(40, s_slim_resp.stat.outValue);
+
+	// -----------------------------------------------
+	// actualiza únicamente la curva, la trama no incluye el resto de secciones
+	s_slim_done = false;
+	Blob::LightSectionRequest_t sreq;
+	sreq.idTrans = 8;
+	sreq._keys = Blob::LightKeyCfgCurve;
+	sreq.data.curve.samples = Blob::LightCurveSampleCount;
+	for(int i=0;i<Blob::LightCurveSampleCount;i++){
+		sreq.data.curve.data[i] = i * 10;
+	}
+	res = MQ::MQClient::publish("set/section/light", &sreq, Blob::LightSectionHeaderSize + sizeof(Blob::LightCurve_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitSlimResponse());
+	TEST_ASSERT_EQUAL(8, s_slim_resp.idTrans);
+	TEST_ASSERT_EQUAL(Blob::ErrOK, s_slim_resp.code);
+	TEST_ASSERT_EQUAL(40, s_slim_resp.stat.outValue);
+
+	// -----------------------------------------------
+	// una acción cuyo identificador no coincide con su posición se rechaza
+	s_slim_done = false;
+	Blob::LightActionRequest_t areq;
+	memset(&areq, 0, sizeof(Blob::LightActionRequest_t));
+	areq.idTrans = 13;
+	areq.pos = 3;
+	areq.action = {4, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, 600, 0, {0,0,0}, 100};
+	res = MQ::MQClient::publish("set/action/light", &areq, sizeof(Blob::LightActionRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitSlimResponse());
+	TEST_ASSERT_EQUAL(13, s_slim_resp.idTrans);
+	TEST_ASSERT_EQUAL(Blob::ErrRangeValue, s_slim_resp.code);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static volatile bool s_starve_blocked = false;
+static volatile bool s_starve_release = false;
+static volatile uint32_t s_starve_next = 0;
+static volatile uint32_t s_starve_levels = 0;
+static volatile uint32_t s_starve_section_at = 0;
+static void StarveLevelCb(const char* topic, void* msg, uint16_t msg_len){
+	if(msg_len != sizeof(Blob::LightSlimResponse_t)){
+		return;
+	}
+	uint32_t id = ((Blob::LightSlimResponse_t*)msg)->idTrans;
+	if(id < 300 || id >= 330){
+		return;
+	}
+	s_starve_levels++;
+	// la primera respuesta retiene el hilo de LightManager mientras se llenan las colas
+	if(id == 300){
+		s_starve_blocked = true;
+		while(!s_starve_release){
+			Thread::wait(10);
+		}
+	}
+	// cada respuesta encola un nuevo cambio de nivel, de forma que la clase de control nunca queda vacía
+	if(s_starve_next < 330){
+		Blob::LightLevelRequest_t lreq = {s_starve_next, (uint8_t)((s_starve_next & 1)? 90 : 10)};
+		s_starve_next++;
+		MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+	}
+}
+static void StarveSectionCb(const char* topic, void* msg, uint16_t msg_len){
+	if(msg_len == sizeof(Blob::LightSlimResponse_t) && ((Blob::LightSlimResponse_t*)msg)->idTrans == 399){
+		s_starve_section_at = s_starve_levels;
+	}
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que un cambio de configuración se atiende tras un número
+ * limitado de mensajes de control, aunque la clase de control nunca se vacíe
+ */
+TEST_CASE("Queue class starvation ...............", "[LightManager]"){
+	light->setJSONSupport(false);
+	light->setCBORSupport(false);
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/level/light", new MQ::SubscribeCallback(&StarveLevelCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	res = MQ::MQClient::subscribe("stat/section/light", new MQ::SubscribeCallback(&StarveSectionCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	// retiene el hilo de LightManager en la respuesta al primer cambio de nivel
+	s_starve_blocked = false;
+	s_starve_release = false;
+	s_starve_levels = 0;
+	s_starve_section_at = 0;
+	Blob::LightLevelRequest_t lreq = {300, 10};
+	res = MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	double count = 0;
+	do{
+		Thread::wait(10);
+		count += 0.01;
+	}while(!s_starve_blocked && count < 10);
+	TEST_ASSERT_TRUE(s_starve_blocked);
+
+	// encola un cambio de configuración y, tras él, más cambios de nivel
+	Blob::LightSectionRequest_t sreq;
+	sreq.idTrans = 399;
+	sreq._keys = Blob::LightKeyCfgEvt;
+	sreq.data.evtFlagMask = (Blob::LightEvtFlags)(Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt);
+	res = MQ::MQClient::publish("set/section/light", &sreq, Blob::LightSectionHeaderSize + sizeof(Blob::LightEvtFlags), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	for(s_starve_next = 301; s_starve_next < 304; s_starve_next++){
+		lreq = {s_starve_next, 90};
+		res = MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	}
+
+	// libera el hilo: la sección se atiende tras, como mucho, MaxClassStarvation(8) mensajes de control
+	s_starve_release = true;
+	count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+	}while(s_starve_section_at == 0 && count < 10);
+	TEST_ASSERT_TRUE(s_starve_section_at > 1);
+	TEST_ASSERT_TRUE(s_starve_section_at <= 1 + 8);
+
+	// la ráfaga de control continúa hasta completarse
+	count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+	}while(s_starve_levels < 30 && count < 10);
+	TEST_ASSERT_EQUAL(30, s_starve_levels);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static LightManager* s_boot_light = NULL;
+static volatile bool s_boot_done = false;
+static volatile bool s_boot_restored = false;
+static void BootLevelCb(const char* topic, void* msg, uint16_t msg_len){
+	// se ejecuta en el hilo de la instancia, tras procesar el cambio de nivel
+	if(msg_len == sizeof(Blob::LightSlimResponse_t) && ((Blob::LightSlimResponse_t*)msg)->idTrans == 500){
+		s_boot_restored = s_boot_light->isOutputRestored();
+		s_boot_done = true;
+	}
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que un cambio de nivel recibido al inicio de la carga
+ * diferida de la configuración se atiende una vez restaurada la salida
+ */
+TEST_CASE("Boot holds control messages ..........", "[LightManager]"){
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/level/light2", new MQ::SubscribeCallback(&BootLevelCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	// crea una segunda instancia sin driver, que inicia la carga diferida al arrancar
+	s_boot_light = new LightManager(NC, fs, true);
+	TEST_ASSERT_NOT_NULL(s_boot_light);
+	s_boot_light->setPublicationBase("light2");
+	s_boot_light->setSubscriptionBase("light2");
+	double count = 0;
+	do{
+		Thread::wait(1);
+		count += 0.001;
+	}while(!s_boot_light->ready() && count < 10);
+	TEST_ASSERT_TRUE(s_boot_light->ready());
+
+	// solicita el cambio de nivel en cuanto la instancia está suscrita
+	s_boot_done = false;
+	Blob::LightLevelRequest_t lreq = {500, 70};
+	res = MQ::MQClient::publish("set/level/light2", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+	}while(!s_boot_done && count < 10);
+	TEST_ASSERT_TRUE(s_boot_done);
+	TEST_ASSERT_TRUE(s_boot_restored);
+
+	// el valor se mantiene tras finalizar la carga
+	Thread::wait(1000);
+	LightManager::StatSnapshot_t snap;
+	s_boot_light->getStatSnapshot(snap);
+	TEST_ASSERT_EQUAL(70, snap.stat.outValue);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static void buildOutRingEntry(LightManager::LightOutRingEntry_t& e, uint32_t seq, uint8_t value){
+	e.seq = seq;
+	e.outValue = value;
+	e.crc = Blob::getCRC32(&e, sizeof(LightManager::LightOutRingEntry_t) - sizeof(uint32_t));
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica la selección de la entrada más reciente del anillo de
+ * transiciones de la salida ante posiciones interrumpidas o corruptas
+ */
+TEST_CASE("Output ring restore ..................", "[LightManager]"){
+	LightManager::LightOutRingEntry_t slots[LightManager::OutRingSlots];
+	bool read[LightManager::OutRingSlots];
+	LightManager::LightOutRingEntry_t entry;
+
+	// anillo vacío
+	for(int i=0;i<LightManager::OutRingSlots;i++){
+		read[i] = false;
+	}
+	TEST_ASSERT_FALSE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+
+	// anillo completo, la secuencia 17 es la más reciente
+	for(int i=0;i<LightManager::OutRingSlots;i++){
+		buildOutRingEntry(slots[i], 10 + i, 10 * i);
+		read[i] = true;
+	}
+	TEST_ASSERT_TRUE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+	TEST_ASSERT_EQUAL(17, entry.seq);
+	TEST_ASSERT_EQUAL(70, entry.outValue);
+
+	// escritura interrumpida de la más reciente: el valor cambia pero el checksum es el de la entrada anterior
+	slots[7].outValue = 20;
+	TEST_ASSERT_TRUE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+	TEST_ASSERT_EQUAL(16, entry.seq);
+	TEST_ASSERT_EQUAL(60, entry.outValue);
+
+	// un único bit erróneo en la secuencia invalida la entrada, aunque el checksum de 8 bits coincidiera
+	buildOutRingEntry(slots[7], 17, 70);
+	slots[7].seq ^= 0x100;
+	TEST_ASSERT_TRUE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+	TEST_ASSERT_EQUAL(16, entry.seq);
+
+	// posición no leída (tamaño distinto o inexistente) y valor fuera de rango con checksum correcto
+	read[6] = false;
+	buildOutRingEntry(slots[5], 15, Blob::LightActionOutMax + 1);
+	TEST_ASSERT_TRUE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+	TEST_ASSERT_EQUAL(14, entry.seq);
+	TEST_ASSERT_EQUAL(40, entry.outValue);
+
+	// desbordamiento de la secuencia: 0 es posterior a 0xFFFFFFFF
+	buildOutRingEntry(slots[0], 0xFFFFFFFF, 30);
+	buildOutRingEntry(slots[1], 0, 90);
+	for(int i=2;i<LightManager::OutRingSlots;i++){
+		read[i] = false;
+	}
+	TEST_ASSERT_TRUE(LightManager::selectOutRingEntry(slots, read, LightManager::OutRingSlots, entry));
+	TEST_ASSERT_EQUAL(0, entry.seq);
+	TEST_ASSERT_EQUAL(90, entry.outValue);
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la instantánea del estado refleja los cambios de la
+ * salida y que la versión de configuración se incrementa al modificarla
+ */
+TEST_CASE("State snapshot .......................", "[LightManager]"){
+	LightManager::StatSnapshot_t snap, prev;
+	light->getStatSnapshot(prev);
+
+	// cambia la salida y espera a que la instantánea lo refleje
+	Blob::LightLevelRequest_t lreq = {9, 60};
+	MQ::ErrorResult res = MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	double count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+		light->getStatSnapshot(snap);
+	}while(snap.stat.outValue != 60 && count < 10);
+	TEST_ASSERT_EQUAL(60, snap.stat.outValue);
+	TEST_ASSERT_EQUAL(prev.cfgVersion, snap.cfgVersion);
+
+	// modifica una sección de la configuración
+	Blob::LightSectionRequest_t sreq;
+	sreq.idTrans = 10;
+	sreq._keys = Blob::LightKeyCfgEvt;
+	sreq.data.evtFlagMask = (Blob::LightEvtFlags)(Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt);
+	res = MQ::MQClient::publish("set/section/light", &sreq, Blob::LightSectionHeaderSize + sizeof(Blob::LightEvtFlags), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+		light->getStatSnapshot(snap);
+	}while(snap.cfgVersion == prev.cfgVersion && count < 10);
+	TEST_ASSERT_NOT_EQUAL(prev.cfgVersion, snap.cfgVersion);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static bool waitOutValue(uint8_t value){
+	LightManager::StatSnapshot_t snap;
+	double count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+		light->getStatSnapshot(snap);
+	}while(snap.stat.outValue != value && count < 10);
+	return (snap.stat.outValue == value);
+}
+
+//------------------------------------------------------------------------------------------------------------------
+static Blob::LightSlimResponse_t s_snap_resp;
+static volatile uint32_t s_snap_id = 0;
+static volatile bool s_snap_done = false;
+static void SnapRespCb(const char* topic, void* msg, uint16_t msg_len){
+	// sólo registra la respuesta a la lectura en curso, el resto son respuestas a los cambios de nivel
+	if(msg_len == sizeof(Blob::LightSlimResponse_t) && ((Blob::LightSlimResponse_t*)msg)->idTrans == s_snap_id){
+		s_snap_resp = *((Blob::LightSlimResponse_t*)msg);
+		s_snap_done = true;
+	}
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la lectura de la instantánea y la respuesta a "get/level"
+ * se completan en el hilo del solicitante mientras el hilo de LightManager está
+ * ocupado procesando una ráfaga de cambios de nivel
+ */
+TEST_CASE("State snapshot under load ............", "[LightManager]"){
+	light->setJSONSupport(false);
+	light->setCBORSupport(false);
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/level/light", new MQ::SubscribeCallback(&SnapRespCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	for(uint32_t i = 0; i < 8; i++){
+		// encola una ráfaga de cambios de nivel sin esperar a sus respuestas
+		for(uint32_t j = 0; j < 4; j++){
+			Blob::LightLevelRequest_t lreq = {100 + (i * 4) + j, (uint8_t)((j & 1)? 90 : 10)};
+			MQ::MQClient::publish("set/level/light", &lreq, sizeof(Blob::LightLevelRequest_t), &s_published_cb);
+		}
+
+		// la instantánea es siempre un estado completo
+		LightManager::StatSnapshot_t snap;
+		light->getStatSnapshot(snap);
+		TEST_ASSERT_TRUE(snap.stat.outValue == 10 || snap.stat.outValue == 90 || snap.stat.outValue == 60);
+
+		// la respuesta se publica antes de que finalice la publicación de la solicitud, sin esperar a la ráfaga
+		s_snap_done = false;
+		s_snap_id = 200 + i;
+		Blob::GetRequest_t greq(s_snap_id);
+		greq._error.code = Blob::ErrOK;
+		greq._error.descr[0] = 0;
+		res = MQ::MQClient::publish("get/level/light", &greq, sizeof(Blob::GetRequest_t), &s_published_cb);
+		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+		TEST_ASSERT_TRUE(s_snap_done);
+		TEST_ASSERT_EQUAL(s_snap_id, s_snap_resp.idTrans);
+		TEST_ASSERT_EQUAL(Blob::ErrOK, s_snap_resp.code);
+		TEST_ASSERT_TRUE(s_snap_resp.stat.outValue == 10 || s_snap_resp.stat.outValue == 90 || s_snap_resp.stat.outValue == 60);
+	}
+
+	// la ráfaga termina en 90
+	TEST_ASSERT_TRUE(waitOutValue(90));
+	s_snap_id = 0;
+}
+
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que una actualización "set/time" con sólo la hora local
+ * ejecuta las acciones astronómicas con el orto y el ocaso calculados localmente
+ * a partir de la geolocalización recibida en la última actualización completa
+ */
+TEST_CASE("Localtime only set/time ..............", "[LightManager]"){
+	light->setJSONSupport(false);
+	light->setCBORSupport(false);
+
+	// calendario completo del 21/06/2019 a las 12:00 en Madrid, sin orto ni ocaso
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.cfg.geoloc.coords[0] = 40.4168;
+	data.cfg.geoloc.coords[1] = -3.7038;
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 5;
+	day.tm_mday = 21;
+	day.tm_hour = 12;
+	day.tm_isdst = -1;
+	data.stat.localtime = mktime(&day);
+
+	// obtiene el ocaso esperado con un scheduler independiente
+	Blob::LightAction_t actions[Blob::MaxAllowedActionDataInArray];
+	Scheduler* sched = new Scheduler(Blob::MaxAllowedActionDataInArray, actions, NULL);
+	TEST_ASSERT_NOT_NULL(sched);
+	sched->clrActions();
+	int16_t dawn, dusk;
+	sched->updateTimestamp(data);
+	TEST_ASSERT_TRUE(sched->getSunTimes(data.stat.localtime, dawn, dusk));
+	delete(sched);
+
+	// apagado diario al orto y encendido diario al ocaso
+	Blob::LightActionRequest_t areq;
+	memset(&areq, 0, sizeof(Blob::LightActionRequest_t));
+	areq.idTrans = 11;
+	areq.pos = 1;
+	areq.action = {1, (Blob::LightActionFlags)(0x7F | Blob::LightActionDawn), 0, 0, 0, {0,0,0}, 0};
+	MQ::ErrorResult res = MQ::MQClient::publish("set/action/light", &areq, sizeof(Blob::LightActionRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	areq.idTrans = 12;
+	areq.pos = 2;
+	areq.action = {2, (Blob::LightActionFlags)(0x7F | Blob::LightActionDusk), 0, 0, 0, {0,0,0}, 100};
+	res = MQ::MQClient::publish("set/action/light", &areq, sizeof(Blob::LightActionRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	// a las 12:00 la acción vigente es la del orto
+	res = MQ::MQClient::publish("set/time/light", &data, sizeof(Blob::LightTimeData_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitOutValue(0));
+
+	// un minuto antes del ocaso calculado la salida sigue apagada
+	day.tm_hour = dusk / 60;
+	day.tm_min = dusk % 60;
+	day.tm_isdst = -1;
+	Blob::LightLocaltime_t t = mktime(&day) - 60;
+	res = MQ::MQClient::publish("set/time/light", &t, sizeof(Blob::LightLocaltime_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_FALSE(waitOutValue(100));
+
+	// al llegar al ocaso calculado se enciende
+	t += 60;
+	res = MQ::MQClient::publish("set/time/light", &t, sizeof(Blob::LightLocaltime_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitOutValue(100));
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static Blob::LightStatData_t s_notif_stat;
+static volatile uint32_t s_notif_count = 0;
+static void NotifStatCb(const char* topic, void* msg, uint16_t msg_len){
+	// sólo registra las notificaciones no solicitadas, el resto son respuestas a "set/value"
+	if(msg_len == sizeof(Blob::NotificationData_t<Blob::LightStatData_t>)){
+		s_notif_stat = ((Blob::NotificationData_t<Blob::LightStatData_t>*)msg)->data;
+		s_notif_count++;
+	}
+}
+static bool waitNotifCount(uint32_t count, uint32_t ms){
+	uint32_t elapsed = 0;
+	while(s_notif_count < count && elapsed < ms){
+		Thread::wait(100);
+		elapsed += 100;
+	}
+	return (s_notif_count == count);
+}
+static void setEvtFlagMask(uint32_t idTrans, uint32_t mask){
+	s_slim_done = false;
+	Blob::LightSectionRequest_t sreq;
+	sreq.idTrans = idTrans;
+	sreq._keys = Blob::LightKeyCfgEvt;
+	sreq.data.evtFlagMask = (Blob::LightEvtFlags)mask;
+	MQ::ErrorResult res = MQ::MQClient::publish("set/section/light", &sreq, Blob::LightSectionHeaderSize + sizeof(Blob::LightEvtFlags), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitSlimResponse());
+	TEST_ASSERT_EQUAL(Blob::ErrOK, s_slim_resp.code);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica la etapa de notificación de "stat/value": los eventos no
+ * habilitados en <evtFlagMask> no se notifican, los cambios producidos durante
+ * el intervalo mínimo se agrupan en una única notificación con los eventos
+ * acumulados y el último valor, y ésta se publica al finalizar el intervalo
+ */
+TEST_CASE("Notification stage ...................", "[LightManager]"){
+	light->setJSONSupport(false);
+	light->setCBORSupport(false);
+	uint32_t interval = light->getNotifInterval();
+	light->setNotifInterval(2000);
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/value/light", new MQ::SubscribeCallback(&NotifStatCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	// sólo se notifican el encendido y los cambios de regulación
+	setEvtFlagMask(30, Blob::LightOutOnEvt | Blob::LightOutLevelChangeEvt);
+
+	// acciones diarias consecutivas a las 10:00 (40), 10:01 (100), 10:02 (0) y 10:03 (60)
+	static const uint8_t values[] = {40, 100, 0, 60};
+	Blob::LightActionRequest_t areq;
+	memset(&areq, 0, sizeof(Blob::LightActionRequest_t));
+	for(uint8_t i = 0; i < sizeof(values); i++){
+		areq.idTrans = 31 + i;
+		areq.pos = 3 + i;
+		areq.action = {(int8_t)(3 + i), (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, (uint16_t)(600 + i), 0, {0,0,0}, (int8_t)values[i]};
+		res = MQ::MQClient::publish("set/action/light", &areq, sizeof(Blob::LightActionRequest_t), &s_published_cb);
+		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	}
+
+	// calendario completo del 22/06/2019 a las 09:59 en Madrid, la acción vigente es la del orto
+	Blob::LightTimeData_t data;
+	memset(&data, 0, sizeof(Blob::LightTimeData_t));
+	data.cfg.geoloc.coords[0] = 40.4168;
+	data.cfg.geoloc.coords[1] = -3.7038;
+	data.stat.period = -1;
+	tm day;
+	memset(&day, 0, sizeof(tm));
+	day.tm_year = 119;
+	day.tm_mon = 5;
+	day.tm_mday = 22;
+	day.tm_hour = 9;
+	day.tm_min = 59;
+	day.tm_isdst = -1;
+	data.stat.localtime = mktime(&day);
+
+	// el apagado no está habilitado en <evtFlagMask> y no se notifica, ni al cambiar ni al finalizar el intervalo
+	s_notif_count = 0;
+	res = MQ::MQClient::publish("set/time/light", &data, sizeof(Blob::LightTimeData_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitOutValue(0));
+	Thread::wait(5000);
+	TEST_ASSERT_EQUAL(0, s_notif_count);
+
+	// sin un intervalo en curso, el cambio se notifica inmediatamente
+	Blob::LightLocaltime_t t = data.stat.localtime + 60;
+	res = MQ::MQClient::publish("set/time/light", &t, sizeof(Blob::LightLocaltime_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitNotifCount(1, 1000));
+	TEST_ASSERT_EQUAL(Blob::LightOutLevelChangeEvt, s_notif_stat.flags);
+	TEST_ASSERT_EQUAL(40, s_notif_stat.outValue);
+
+	// los cambios durante el intervalo se agrupan y no se notifican hasta que finaliza
+	for(uint8_t i = 1; i < sizeof(values); i++){
+		t += 60;
+		res = MQ::MQClient::publish("set/time/light", &t, sizeof(Blob::LightLocaltime_t), &s_published_cb);
+		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	}
+	TEST_ASSERT_TRUE(waitOutValue(60));
+	TEST_ASSERT_EQUAL(1, s_notif_count);
+
+	// al finalizar el intervalo se notifica el último valor con los eventos habilitados acumulados
+	TEST_ASSERT_TRUE(waitNotifCount(2, 3000));
+	TEST_ASSERT_EQUAL(Blob::LightOutOnEvt | Blob::LightOutLevelChangeEvt, s_notif_stat.flags);
+	TEST_ASSERT_EQUAL(60, s_notif_stat.outValue);
+
+	// sin nuevos cambios, el siguiente intervalo finaliza sin notificar
+	Thread::wait(5000);
+	TEST_ASSERT_EQUAL(2, s_notif_count);
+
+	// restaura las acciones, los eventos por defecto y el intervalo
+	Blob::LightActionClrRequest_t creq;
+	for(uint8_t i = 0; i < sizeof(values); i++){
+		creq.idTrans = 35 + i;
+		creq.pos = 3 + i;
+		res = MQ::MQClient::publish("set/actclr/light", &creq, sizeof(Blob::LightActionClrRequest_t), &s_published_cb);
+		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	}
+	setEvtFlagMask(39, Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt | Blob::LightLateActionEvt);
+	light->setNotifInterval(interval);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------
+static Blob::SetRequest_t<light_manager>* s_cache_resp = NULL;
+static volatile bool s_cache_done = false;
+static void CacheCfgCb(const char* topic, void* msg, uint16_t msg_len){
+	// la suscripción se mantiene tras el test, en el que se reserva el destino
+	if(s_cache_resp == NULL){
+		return;
+	}
+	// decodifica la respuesta en el formato activo como la solicitud SET equivalente
+	memset(s_cache_resp, 0, sizeof(Blob::SetRequest_t<light_manager>));
+	bool ok;
+	if(light->isJSONSupported()){
+		ok = JsonParser::getSetRequestFromJson(*s_cache_resp, *(cJSON**)msg);
+	}
+	else if(light->isCBORSupported()){
+		ok = (CBOR::getLightSetRequestFromCbor(*s_cache_resp, (const uint8_t*)msg, msg_len) != 0);
+	}
+	else{
+		ok = (msg_len == sizeof(Blob::Response_t<light_manager>));
+		if(ok){
+			s_cache_resp->idTrans = ((Blob::Response_t<light_manager>*)msg)->idTrans;
+			s_cache_resp->data = ((Blob::Response_t<light_manager>*)msg)->data;
+		}
+	}
+	s_cache_done = ok;
+}
+static bool requestCfg(uint32_t idTrans){
+	MQ::ErrorResult res;
+	s_cache_done = false;
+	Blob::GetRequest_t greq(idTrans);
+	greq._error.code = Blob::ErrOK;
+	greq._error.descr[0] = 0;
+	if(light->isJSONSupported()){
+		cJSON* jreq = JsonParser::getJsonFromObj(greq);
+		TEST_ASSERT_NOT_NULL(jreq);
+		res = MQ::MQClient::publish("get/cfg/light", &jreq, sizeof(cJSON**), &s_published_cb);
+		cJSON_Delete(jreq);
+	}
+	else if(light->isCBORSupported()){
+		// {0: idTrans}, con idTrans entre 24 y 255
+		const uint8_t creq[] = {0xA1, 0x00, 0x18, (uint8_t)idTrans};
+		res = MQ::MQClient::publish("get/cfg/light", (void*)creq, sizeof(creq), &s_published_cb);
+	}
+	else{
+		res = MQ::MQClient::publish("get/cfg/light", &greq, sizeof(Blob::GetRequest_t), &s_published_cb);
+	}
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	double count = 0;
+	do{
+		Thread::wait(100);
+		count += 0.1;
+	}while(!s_cache_done && count < 10);
+	return (s_cache_done && s_cache_resp->idTrans == idTrans);
+}
+static void setAction(uint32_t idTrans, const Blob::LightAction_t& action){
+	s_slim_done = false;
+	Blob::LightActionRequest_t areq;
+	areq.idTrans = idTrans;
+	areq.pos = action.id;
+	areq.action = action;
+	MQ::ErrorResult res = MQ::MQClient::publish("set/action/light", &areq, sizeof(Blob::LightActionRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	TEST_ASSERT_TRUE(waitSlimResponse());
+	TEST_ASSERT_EQUAL(Blob::ErrOK, s_slim_resp.code);
+}
+static void setRespCodec(uint8_t codec){
+	light->setJSONSupport(codec == 1);
+	light->setCBORSupport(codec == 2);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Se verifica que la respuesta memorizada a "get/cfg" incluye el
+ * identificador de cada solicitud y que, tras un cambio de la configuración por
+ * "set/section" o "set/action", la siguiente respuesta refleja el cambio, en
+ * formato blob, JSON y CBOR
+ */
+TEST_CASE("Response cache .......................", "[LightManager]"){
+	s_cache_resp = (Blob::SetRequest_t<light_manager>*)Heap::memAlloc(sizeof(Blob::SetRequest_t<light_manager>));
+	TEST_ASSERT_NOT_NULL(s_cache_resp);
+	MQ::ErrorResult res = MQ::MQClient::subscribe("stat/cfg/light", new MQ::SubscribeCallback(&CacheCfgCb));
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+
+	static const uint32_t masks[] = {Blob::LightOutOnEvt, Blob::LightOutOffEvt, Blob::LightOutLevelChangeEvt};
+	for(uint8_t codec = 0; codec < 3; codec++){
+		uint32_t id = 40 + (codec * 10);
+
+		// la primera respuesta genera la configuración memorizada y la segunda sólo actualiza la cabecera
+		setRespCodec(codec);
+		TEST_ASSERT_TRUE(requestCfg(id));
+		TEST_ASSERT_TRUE(requestCfg(id + 1));
+
+		// las solicitudes compactas sólo se admiten en formato blob
+		setRespCodec(0);
+		setEvtFlagMask(id + 2, masks[codec]);
+		setRespCodec(codec);
+		TEST_ASSERT_TRUE(requestCfg(id + 3));
+		TEST_ASSERT_EQUAL(masks[codec], s_cache_resp->data.cfg.evtFlagMask);
+
+		// hora fija distinta en cada formato
+		Blob::LightAction_t action = {3, (Blob::LightActionFlags)(0x7F | Blob::LightActionFixTime), 0, (uint16_t)(600 + codec), 0, {0,0,0}, 50};
+		setRespCodec(0);
+		setAction(id + 4, action);
+		setRespCodec(codec);
+		TEST_ASSERT_TRUE(requestCfg(id + 5));
+		TEST_ASSERT_EQUAL(action.time, s_cache_resp->data.cfg.outData.actions[3].time);
+		TEST_ASSERT_EQUAL(action.outValue, s_cache_resp->data.cfg.outData.actions[3].outValue);
+		TEST_ASSERT_TRUE(requestCfg(id + 6));
+		TEST_ASSERT_EQUAL(action.time, s_cache_resp->data.cfg.outData.actions[3].time);
+	}
+
+	// restaura la acción, los eventos por defecto y el formato blob
+	setRespCodec(0);
+	Blob::LightActionClrRequest_t creq = {70, 3};
+	res = MQ::MQClient::publish("set/actclr/light", &creq, sizeof(Blob::LightActionClrRequest_t), &s_published_cb);
+	TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
+	setEvtFlagMask(71, Blob::LightOutOnEvt | Blob::LightOutOffEvt | Blob::LightOutLevelChangeEvt | Blob::LightLateActionEvt);
+	Heap::memFree(s_cache_resp);
+	s_cache_resp = NULL;
+}
+
+
 //------------------------------------------------------------------------------------
 //-- PREREQUISITES -------------------------------------------------------------------
 //------------------------------------------------------------------------------------
@@ -476,6 +2460,10 @@ static void subscriptionCb(const char* topic, void* msg, uint16_t msg_len){
 				}
 			}
 		}
+		else if(msg_len == sizeof(Blob::LightSlimResponse_t)){
+			Blob::LightSlimResponse_t* resp = (Blob::LightSlimResponse_t*)msg;
+			DEBUG_TRACE_I(_EXPR_, _MODULE_, "idTrans=%d, code=%d, outValue=%d", resp->idTrans, resp->code, resp->stat.outValue);
+		}
 		else{
 			DEBUG_TRACE_I(_EXPR_, _MODULE_, "Error procesando mensaje en topic %s", topic);
 			s_test_done = false;
@@ -495,13 +2483,13 @@ static void executePrerequisites(){
 		MQ::ErrorResult res = MQ::MQBroker::start(64);
 		TEST_ASSERT_EQUAL(res, MQ::SUCCESS);
 
-		// espera a que est disponible
+		// espera a que esté disponible
 		while(!MQ::MQBroker::ready()){
 			Thread::wait(100);
 		}
 		DEBUG_TRACE_I(_EXPR_, _MODULE_, "MQLib OK!");
 
-		// registra un manejador de publicaciones comn
+		// registra un manejador de publicaciones común
 		s_published_cb = callback(&publishedCb);
 
 		// inicia el subsistema NV